@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <iostream>
+#include "Aggregate.h"
+using namespace std;
+
+/*****************
+ * Aggregate
+ *****************/
+
+static const char *FUNCTION_NAMES[] = {"COUNT", "SUM", "MIN", "MAX", "AVG"};
+
+bool Aggregate::function_named(string name, Function &function) {
+    transform(name.begin(), name.end(), name.begin(), ::toupper);
+    for (auto f: {COUNT, SUM, MIN, MAX, AVG}) {
+        if (name == FUNCTION_NAMES[f]) {
+            function = f;
+            return true;
+        }
+    }
+    return false;
+}
+
+string Aggregate::function_name(Function function) {
+    return FUNCTION_NAMES[function];
+}
+
+/*****************
+ * GroupTable
+ *****************/
+
+static const size_t INITIAL_SLOTS = 64;
+
+GroupTable::GroupTable(const ColumnNames &group_by, const Aggregates &aggregates)
+        : group_by(group_by), aggregates(aggregates), slots(INITIAL_SLOTS, Slot{0, -1}), keys(), groups(), bytes(0) {
+}
+
+GroupTable::~GroupTable() {
+    clear();
+}
+
+int32_t GroupTable::find(const ValueDict &row, uint64_t hash) const {
+    size_t mask = this->slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot &slot = this->slots[i];
+        if (slot.group < 0)
+            return -1;
+        if (slot.hash != hash)
+            continue;
+        const ValueDict &key = *this->keys[slot.group];
+        bool same = true;
+        for (auto const& column: this->group_by)
+            if (row.at(column) != key.at(column)) {
+                same = false;
+                break;
+            }
+        if (same)
+            return slot.group;
+    }
+}
+
+// The group takes the first empty slot from its hash on.
+int32_t GroupTable::insert(const ValueDict &row, uint64_t hash) {
+    if (2 * (this->groups.size() + 1) > this->slots.size())
+        grow();
+    int32_t id = (int32_t) this->groups.size();
+    ValueDict *key = new ValueDict();
+    for (auto const& column: this->group_by)
+        (*key)[column] = row.at(column);
+    this->keys.push_back(key);
+    this->groups.push_back(vector<Running>(this->aggregates.size(), Running{0, 0, Value()}));
+    this->bytes += JoinHashTable::row_bytes(*key) + this->aggregates.size() * sizeof(Running);
+
+    size_t mask = this->slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Slot &slot = this->slots[i];
+        if (slot.group < 0) {
+            slot.hash = hash;
+            slot.group = id;
+            return id;
+        }
+    }
+}
+
+void GroupTable::add(int32_t group, const ValueDict &row) {
+    vector<Running> &running = this->groups[group];
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        const Aggregate &aggregate = this->aggregates[i];
+        Running &so_far = running[i];
+        so_far.count++;
+        if (aggregate.function == Aggregate::COUNT)
+            continue;
+        const Value &value = row.at(aggregate.column);
+        if (aggregate.function == Aggregate::SUM || aggregate.function == Aggregate::AVG)
+            so_far.sum += value.n;
+        else if (so_far.count == 1 || (aggregate.function == Aggregate::MIN ? value < so_far.extreme
+                                                                           : so_far.extreme < value))
+            so_far.extreme = value;
+    }
+}
+
+ValueDict *GroupTable::result(int32_t group) const {
+    ValueDict *row = new ValueDict(*this->keys[group]);
+    const vector<Running> &running = this->groups[group];
+    for (size_t i = 0; i < this->aggregates.size(); i++) {
+        const Running &so_far = running[i];
+        Value value;
+        switch (this->aggregates[i].function) {
+            case Aggregate::COUNT:
+                value = Value((int32_t) so_far.count);
+                break;
+            case Aggregate::SUM:
+                value = Value((int32_t) so_far.sum);
+                break;
+            case Aggregate::AVG:
+                value = Value((int32_t) (so_far.count == 0 ? 0 : so_far.sum / so_far.count));
+                break;
+            case Aggregate::MIN:
+            case Aggregate::MAX:
+                value = so_far.extreme;
+                break;
+        }
+        (*row)[this->aggregates[i].name] = value;
+    }
+    return row;
+}
+
+void GroupTable::clear() {
+    for (auto const key: this->keys)
+        delete key;
+    this->keys.clear();
+    this->groups.clear();
+    this->slots.assign(INITIAL_SLOTS, Slot{0, -1});
+    this->bytes = 0;
+}
+
+// Double the slots and put the groups back in by their hashes.
+void GroupTable::grow() {
+    vector<Slot> old;
+    old.swap(this->slots);
+    this->slots.assign(old.size() * 2, Slot{0, -1});
+    size_t mask = this->slots.size() - 1;
+    for (auto const& slot: old) {
+        if (slot.group < 0)
+            continue;
+        size_t i = slot.hash & mask;
+        while (this->slots[i].group >= 0)
+            i = (i + 1) & mask;
+        this->slots[i] = slot;
+    }
+}
+
+/*****************
+ * HashAggregateOperator
+ *****************/
+
+static uint temp_sequence = 0;  // to name each aggregation's partitions apart
+
+HashAggregateOperator::HashAggregateOperator(EvalOperator *input, const ColumnNames &group_by,
+                                             const Aggregates &aggregates, size_t memory_budget)
+        : input(input), group_by(group_by), aggregates(aggregates), memory_budget(memory_budget),
+          table(group_by, aggregates), partitions(), partition(0), position(0) {
+}
+
+HashAggregateOperator::~HashAggregateOperator() {
+    clear();
+    delete this->input;
+}
+
+// Aggregate the whole input, spilling the rows of groups not yet seen to partitions once the table
+// outgrows the budget.
+void HashAggregateOperator::open() {
+    clear();
+    ValueDict *row;
+    this->input->open();
+    while ((row = this->input->next()) != nullptr) {
+        aggregate(*row, true);
+        delete row;
+    }
+    this->input->close();
+    if (this->group_by.empty() && this->table.size() == 0)
+        this->table.insert(ValueDict(), JoinHashTable::hash(ValueDict(), this->group_by));
+}
+
+ValueDict *HashAggregateOperator::next() {
+    while (this->position >= this->table.size()) {
+        if (this->partition >= this->partitions.size())
+            return nullptr;
+        next_partition();
+    }
+    return this->table.result((int32_t) this->position++);
+}
+
+void HashAggregateOperator::close() {
+    clear();
+}
+
+void HashAggregateOperator::aggregate(const ValueDict &row, bool may_spill) {
+    uint64_t hash = JoinHashTable::hash(row, this->group_by);
+    int32_t group = this->table.find(row, hash);
+    if (group < 0) {
+        if (may_spill && is_partitioned()) {
+            this->partitions[partition_of(hash)]->add(row);
+            return;
+        }
+        group = this->table.insert(row, hash);
+        if (may_spill && this->table.get_bytes() > this->memory_budget)
+            spill();
+    }
+    this->table.add(group, row);
+}
+
+// From here on, the rows of groups not in the table go out to partitions.
+void HashAggregateOperator::spill() {
+    string name = "_group" + to_string(temp_sequence++) + "-";
+    for (uint i = 0; i < PARTITIONS; i++)
+        this->partitions.push_back(new JoinPartition(name + to_string(i)));
+}
+
+// Aggregate the next partition's rows in the table, in place of the groups handed over (dropping the
+// rows from disk).
+void HashAggregateOperator::next_partition() {
+    this->table.clear();
+    this->position = 0;
+    JoinPartition *partition = this->partitions[this->partition++];
+    ValueDicts *rows;
+    for (BlockID block_id = 1; (rows = partition->read(block_id)) != nullptr; block_id++) {
+        for (auto const row: *rows) {
+            aggregate(*row, false);
+            delete row;
+        }
+        delete rows;
+    }
+    partition->drop();
+}
+
+// Free the groups and any partitions.
+void HashAggregateOperator::clear() {
+    this->table.clear();
+    for (auto const partition: this->partitions)
+        delete partition;
+    this->partitions.clear();
+    this->partition = 0;
+    this->position = 0;
+}
+
+// test function -- returns true if all tests pass
+bool test_hash_aggregate() {
+    ColumnNames column_names = {"id", "status", "region"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("test_hash_aggregate", column_names, column_attributes);
+    table.create();
+
+    // status: one row in ten 'open', one in ten 'held', the rest 'done'; region 0 through 299
+    ValueDict row;
+    for (int i = 0; i < 3000; i++) {
+        row["id"] = Value(i);
+        row["status"] = Value(i % 10 == 0 ? "open" : i % 10 == 5 ? "held" : "done");
+        row["region"] = Value((i * 7) % 300);
+        table.insert(&row);
+    }
+    Aggregates aggregates = {Aggregate(Aggregate::COUNT, "", "n"), Aggregate(Aggregate::SUM, "id", "total"),
+                             Aggregate(Aggregate::MIN, "id", "low"), Aggregate(Aggregate::MAX, "status", "last"),
+                             Aggregate(Aggregate::AVG, "id", "mean")};
+    auto run = [&](HashAggregateOperator &op) {
+        map<Value, ValueDict> groups;  // by the first group-by column (or one group)
+        op.open();
+        ValueDict *result;
+        while ((result = op.next()) != nullptr) {
+            Value key = result->count("status") ? result->at("status")
+                        : result->count("region") ? result->at("region") : Value();
+            groups[key] = *result;
+            delete result;
+        }
+        op.close();
+        return groups;
+    };
+    auto expect = [&](const ValueDict &got, function<bool(int)> in_group) {
+        int64_t n = 0, total = 0;
+        int low = -1;
+        string last;
+        for (int i = 0; i < 3000; i++) {
+            if (!in_group(i))
+                continue;
+            string status = i % 10 == 0 ? "open" : i % 10 == 5 ? "held" : "done";
+            n++;
+            total += i;
+            low = low < 0 ? i : low;
+            last = max(last, status);
+        }
+        return n > 0 && got.at("n").n == n && got.at("total").n == total && got.at("low").n == low
+               && got.at("last").s == last && got.at("mean").n == total / n;
+    };
+
+    //t1 a few big groups
+    HashAggregateOperator by_status(new TableScanOperator(table), {"status"}, aggregates);
+    auto t1 = run(by_status);
+    bool result = t1.size() == 3 && !by_status.is_partitioned();
+    for (string status: {"open", "held", "done"})
+        result = result && t1.count(Value(status))
+                 && expect(t1[Value(status)], [status](int i) {
+                     return status == (i % 10 == 0 ? "open" : i % 10 == 5 ? "held" : "done");
+                 });
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 many groups past a small memory budget, and reopening
+    HashAggregateOperator by_region(new TableScanOperator(table), {"region"}, aggregates, 4000);
+    for (int pass = 0; pass < 2; pass++) {
+        auto t2 = run(by_region);
+        result = result && t2.size() == 300;
+        for (int region = 0; region < 300 && result; region++)
+            result = t2.count(Value(region))
+                     && expect(t2[Value(region)], [region](int i) { return (i * 7) % 300 == region; });
+    }
+    cout << (result ? "passed t2" : "failed t2") << endl;
+    HashAggregateOperator partitioned(new TableScanOperator(table), {"region"}, aggregates, 4000);
+    partitioned.open();
+    result = result && partitioned.is_partitioned();
+    partitioned.close();
+
+    //t3 no group-by columns: one row, even for no rows
+    HashAggregateOperator all(new TableScanOperator(table), ColumnNames(), aggregates);
+    auto t3 = run(all);
+    result = result && t3.size() == 1 && expect(t3.begin()->second, [](int i) { return true; });
+    ValueDict none;
+    none["status"] = Value("lost");
+    HashAggregateOperator empty(new SelectOperator(new TableScanOperator(table), none), ColumnNames(), aggregates);
+    t3 = run(empty);
+    result = result && t3.size() == 1 && t3.begin()->second.at("n").n == 0 && t3.begin()->second.at("total").n == 0;
+    cout << (result ? "passed t3" : "failed t3") << endl;
+
+    table.drop();
+    return result;
+}
@@ -0,0 +1,130 @@
+/**
+ * @file Aggregate.h - grouping rows and summarizing each group:
+ * Aggregate: an aggregate function of a column (COUNT, SUM, MIN, MAX or AVG) and the name of its result
+ * GroupTable: open-addressing table from group-by values to the group's running aggregates
+ * HashAggregateOperator: a row for each group of its input, with the group's values and aggregates
+ */
+#pragma once
+
+#include "heap_storage.h"
+#include "EvalOperator.h"
+#include "HashJoin.h"
+
+/**
+ * @class Aggregate - what to compute over a group's rows, and the column to put it in
+ *
+ * COUNT counts rows (there are no NULLs to skip, so COUNT(column) is COUNT(*)). SUM and AVG are of an
+ * INT column; AVG is rounded toward zero, there being no fractional values. MIN and MAX go by Value's
+ * operator<. Over no rows, all but COUNT come out as Value() (0), there being no NULLs either.
+ */
+class Aggregate {
+public:
+    enum Function {
+        COUNT,
+        SUM,
+        MIN,
+        MAX,
+        AVG
+    };
+
+    Aggregate(Function function, Identifier column, Identifier name)
+            : function(function), column(column), name(name) {}  // column is empty for COUNT(*)
+
+    Function function;
+    Identifier column;
+    Identifier name;
+
+    // the function called name (in any case), returning false if there is none
+    static bool function_named(std::string name, Function &function);
+    static std::string function_name(Function function);
+};
+
+typedef std::vector<Aggregate> Aggregates;
+
+/**
+ * @class GroupTable - the groups seen so far, looked up by the values of their group-by columns
+ *
+ * Each slot holds a group's hash and its index, so a lookup compares hashes in one contiguous array and
+ * only looks at a group's values once the hash matches. Linear probing, never more than half full.
+ */
+class GroupTable {
+public:
+    GroupTable(const ColumnNames &group_by, const Aggregates &aggregates);
+    virtual ~GroupTable();
+    GroupTable(const GroupTable& other) = delete;
+    GroupTable& operator=(const GroupTable& other) = delete;
+
+    int32_t find(const ValueDict &row, uint64_t hash) const;  // row's group, or -1 if it hasn't been seen
+    int32_t insert(const ValueDict &row, uint64_t hash);  // a new group for row's values (row isn't added)
+    void add(int32_t group, const ValueDict &row);  // fold row into the group's aggregates
+    ValueDict *result(int32_t group) const;  // the group's values and aggregates (freed by caller)
+    void clear();
+
+    size_t size() const { return this->groups.size(); }
+    size_t get_bytes() const { return this->bytes; }  // about how much memory the groups take
+
+protected:
+    struct Slot {
+        uint64_t hash;
+        int32_t group;  // -1 if the slot is empty
+    };
+    struct Running {  // an aggregate so far
+        int64_t count;
+        int64_t sum;
+        Value extreme;  // for MIN and MAX
+    };
+
+    ColumnNames group_by;
+    Aggregates aggregates;
+    std::vector<Slot> slots;  // a power of two of them
+    ValueDicts keys;  // each group's values of the group-by columns
+    std::vector<std::vector<Running>> groups;
+    size_t bytes;
+
+    void grow();
+};
+
+/**
+ * @class HashAggregateOperator - a row for each group of its input's rows with equal values in the
+ * group-by columns, holding those values and the aggregates of the group (a single row, even for no
+ * input, if there are no group-by columns)
+ *
+ * open() reads the whole input into a GroupTable. If the groups grow past memory_budget bytes, the
+ * groups already in the table go on being aggregated there, but the rows of any other group are split
+ * by hash into PARTITIONS partitions on disk, each aggregated on its own once the table's groups are
+ * handed over (a partition that is still too big is aggregated anyway). The groups come in no
+ * particular order.
+ */
+class HashAggregateOperator : public EvalOperator {
+public:
+    HashAggregateOperator(EvalOperator *input, const ColumnNames &group_by, const Aggregates &aggregates,
+                          size_t memory_budget=DEFAULT_MEMORY_BUDGET);
+    virtual ~HashAggregateOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+    bool is_partitioned() const { return !this->partitions.empty(); }
+
+    static const size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+    static const uint PARTITIONS = 16;
+
+protected:
+    EvalOperator *input;
+    ColumnNames group_by;
+    Aggregates aggregates;
+    size_t memory_budget;
+    GroupTable table;
+    JoinPartitions partitions;  // empty unless the groups didn't fit in memory
+    uint partition;  // the next partition to aggregate
+    size_t position;  // next group to hand over
+
+    void aggregate(const ValueDict &row, bool may_spill);
+    void spill();
+    void next_partition();
+    void clear();
+    static uint partition_of(uint64_t hash) { return (uint) (hash >> 60) % PARTITIONS; }
+};
+
+bool test_hash_aggregate();
@@ -0,0 +1,467 @@
+#include <algorithm>
+#include <cstring>
+#include "ArtTree.h"
+using namespace std;
+
+/************
+ * ArtInner *
+ ************/
+
+void ArtInner::copy_into(ArtInner* other) const {
+    other->prefix = this->prefix;
+    ArtChildren kids;
+    children(kids);
+    for (auto const& kid: kids)
+        other->add(kid.first, kid.second);
+}
+
+ArtNode* ArtInner::get(unsigned char byte) const {
+    ArtNode** found = const_cast<ArtInner*>(this)->find(byte);
+    return found == nullptr ? nullptr : *found;
+}
+
+
+/************
+ * ArtNode4 *
+ ************/
+
+ArtNode** ArtNode4::find(unsigned char byte) {
+    for (uint i = 0; i < this->count; i++)
+        if (this->keys[i] == byte)
+            return &this->child[i];
+    return nullptr;
+}
+
+// keys are kept sorted so children come out in byte order
+void ArtNode4::add(unsigned char byte, ArtNode* child) {
+    uint i = this->count;
+    for (; i > 0 && this->keys[i - 1] > byte; i--) {
+        this->keys[i] = this->keys[i - 1];
+        this->child[i] = this->child[i - 1];
+    }
+    this->keys[i] = byte;
+    this->child[i] = child;
+    this->count++;
+}
+
+void ArtNode4::remove(unsigned char byte) {
+    uint i = 0;
+    while (i < this->count && this->keys[i] != byte)
+        i++;
+    if (i == this->count)
+        return;
+    for (; i + 1 < this->count; i++) {
+        this->keys[i] = this->keys[i + 1];
+        this->child[i] = this->child[i + 1];
+    }
+    this->count--;
+}
+
+void ArtNode4::children(ArtChildren& out) const {
+    for (uint i = 0; i < this->count; i++)
+        out.push_back(ArtChild(this->keys[i], this->child[i]));
+}
+
+ArtInner* ArtNode4::grow() const {
+    ArtInner* bigger = new ArtNode16();
+    copy_into(bigger);
+    return bigger;
+}
+
+
+/*************
+ * ArtNode16 *
+ *************/
+
+ArtNode** ArtNode16::find(unsigned char byte) {
+    unsigned char* end = this->keys + this->count;
+    unsigned char* at = lower_bound(this->keys, end, byte);
+    if (at == end || *at != byte)
+        return nullptr;
+    return &this->child[at - this->keys];
+}
+
+void ArtNode16::add(unsigned char byte, ArtNode* child) {
+    uint i = this->count;
+    for (; i > 0 && this->keys[i - 1] > byte; i--) {
+        this->keys[i] = this->keys[i - 1];
+        this->child[i] = this->child[i - 1];
+    }
+    this->keys[i] = byte;
+    this->child[i] = child;
+    this->count++;
+}
+
+void ArtNode16::remove(unsigned char byte) {
+    uint i = 0;
+    while (i < this->count && this->keys[i] != byte)
+        i++;
+    if (i == this->count)
+        return;
+    for (; i + 1 < this->count; i++) {
+        this->keys[i] = this->keys[i + 1];
+        this->child[i] = this->child[i + 1];
+    }
+    this->count--;
+}
+
+void ArtNode16::children(ArtChildren& out) const {
+    for (uint i = 0; i < this->count; i++)
+        out.push_back(ArtChild(this->keys[i], this->child[i]));
+}
+
+ArtInner* ArtNode16::grow() const {
+    ArtInner* bigger = new ArtNode48();
+    copy_into(bigger);
+    return bigger;
+}
+
+ArtInner* ArtNode16::shrink() const {
+    if (this->count > 3)
+        return nullptr;
+    ArtInner* smaller = new ArtNode4();
+    copy_into(smaller);
+    return smaller;
+}
+
+
+/*************
+ * ArtNode48 *
+ *************/
+
+ArtNode48::ArtNode48() : ArtInner() {
+    memset(this->slot, 0, sizeof(this->slot));
+    for (uint i = 0; i < 48; i++)
+        this->child[i] = nullptr;
+}
+
+ArtNode** ArtNode48::find(unsigned char byte) {
+    if (this->slot[byte] == 0)
+        return nullptr;
+    return &this->child[this->slot[byte] - 1];
+}
+
+void ArtNode48::add(unsigned char byte, ArtNode* child) {
+    uint i = 0;
+    while (this->child[i] != nullptr)
+        i++;
+    this->child[i] = child;
+    this->slot[byte] = (unsigned char) (i + 1);
+    this->count++;
+}
+
+void ArtNode48::remove(unsigned char byte) {
+    if (this->slot[byte] == 0)
+        return;
+    this->child[this->slot[byte] - 1] = nullptr;
+    this->slot[byte] = 0;
+    this->count--;
+}
+
+void ArtNode48::children(ArtChildren& out) const {
+    for (uint byte = 0; byte < 256; byte++)
+        if (this->slot[byte] != 0)
+            out.push_back(ArtChild((unsigned char) byte, this->child[this->slot[byte] - 1]));
+}
+
+ArtInner* ArtNode48::grow() const {
+    ArtInner* bigger = new ArtNode256();
+    copy_into(bigger);
+    return bigger;
+}
+
+ArtInner* ArtNode48::shrink() const {
+    if (this->count > 12)
+        return nullptr;
+    ArtInner* smaller = new ArtNode16();
+    copy_into(smaller);
+    return smaller;
+}
+
+
+/**************
+ * ArtNode256 *
+ **************/
+
+ArtNode256::ArtNode256() : ArtInner() {
+    for (uint i = 0; i < 256; i++)
+        this->child[i] = nullptr;
+}
+
+ArtNode** ArtNode256::find(unsigned char byte) {
+    return this->child[byte] == nullptr ? nullptr : &this->child[byte];
+}
+
+void ArtNode256::add(unsigned char byte, ArtNode* child) {
+    this->child[byte] = child;
+    this->count++;
+}
+
+void ArtNode256::remove(unsigned char byte) {
+    if (this->child[byte] == nullptr)
+        return;
+    this->child[byte] = nullptr;
+    this->count--;
+}
+
+void ArtNode256::children(ArtChildren& out) const {
+    for (uint byte = 0; byte < 256; byte++)
+        if (this->child[byte] != nullptr)
+            out.push_back(ArtChild((unsigned char) byte, this->child[byte]));
+}
+
+ArtInner* ArtNode256::shrink() const {
+    if (this->count > 37)
+        return nullptr;
+    ArtInner* smaller = new ArtNode48();
+    copy_into(smaller);
+    return smaller;
+}
+
+
+/***********
+ * ArtTree *
+ ***********/
+
+ArtTree::~ArtTree() {
+    clear();
+}
+
+void ArtTree::clear() {
+    destroy(this->root);
+    this->root = nullptr;
+    this->size = 0;
+}
+
+void ArtTree::destroy(ArtNode* node) {
+    if (node == nullptr)
+        return;
+    if (!node->is_leaf()) {
+        ArtChildren kids;
+        ((ArtInner*) node)->children(kids);
+        for (auto const& kid: kids)
+            destroy(kid.second);
+    }
+    delete node;
+}
+
+void ArtTree::insert(const NormalizedKey& key, Handle handle) {
+    ArtNode** ref = &this->root;
+    size_t depth = 0;
+    while (true) {
+        ArtNode* node = *ref;
+        if (node == nullptr) {
+            *ref = new ArtLeaf(key, handle);
+            break;
+        }
+        if (node->is_leaf()) {
+            ArtLeaf* leaf = (ArtLeaf*) node;
+            if (leaf->key == key) {
+                if (this->unique)
+                    throw DbRelationError("Duplicate keys are not allowed in unique index");
+                leaf->handles.push_back(handle);
+                break;
+            }
+            // lazy expansion: only now does this leaf need an inner node above it
+            size_t shared = depth;
+            while (shared < key.size() && shared < leaf->key.size() && key[shared] == leaf->key[shared])
+                shared++;
+            if (shared == key.size() || shared == leaf->key.size())
+                throw DbRelationError("radix tree keys must be prefix free");
+            ArtInner* inner = new ArtNode4();
+            inner->prefix = key.substr(depth, shared - depth);
+            inner->add((unsigned char) leaf->key[shared], leaf);
+            inner->add((unsigned char) key[shared], new ArtLeaf(key, handle));
+            *ref = inner;
+            break;
+        }
+
+        ArtInner* inner = (ArtInner*) node;
+        size_t matched = 0;
+        while (matched < inner->prefix.size() && depth + matched < key.size() &&
+               inner->prefix[matched] == key[depth + matched])
+            matched++;
+        if (matched < inner->prefix.size()) {
+            // key leaves the compressed path part way: split the path there
+            if (depth + matched == key.size())
+                throw DbRelationError("radix tree keys must be prefix free");
+            ArtInner* parent = new ArtNode4();
+            parent->prefix = inner->prefix.substr(0, matched);
+            unsigned char old_byte = (unsigned char) inner->prefix[matched];
+            inner->prefix.erase(0, matched + 1);
+            parent->add(old_byte, inner);
+            parent->add((unsigned char) key[depth + matched], new ArtLeaf(key, handle));
+            *ref = parent;
+            break;
+        }
+        depth += matched;
+        if (depth == key.size())
+            throw DbRelationError("radix tree keys must be prefix free");
+        ArtNode** child = inner->find((unsigned char) key[depth]);
+        if (child != nullptr) {
+            ref = child;
+            depth++;
+            continue;
+        }
+        if (inner->full()) {
+            ArtInner* bigger = inner->grow();
+            delete inner;
+            *ref = bigger;
+            inner = bigger;
+        }
+        inner->add((unsigned char) key[depth], new ArtLeaf(key, handle));
+        break;
+    }
+    this->size++;
+}
+
+// Take out the handle; if that empties its leaf, take the leaf out of its parent, and then fold a parent
+// left with one child into that child, or shrink it if it has got small enough.
+bool ArtTree::remove(const NormalizedKey& key, Handle handle) {
+    ArtNode** parent_ref = nullptr;
+    ArtNode** ref = &this->root;
+    size_t depth = 0;
+    while (*ref != nullptr && !(*ref)->is_leaf()) {
+        ArtInner* inner = (ArtInner*) *ref;
+        if (key.compare(depth, inner->prefix.size(), inner->prefix) != 0)
+            return false;
+        depth += inner->prefix.size();
+        if (depth >= key.size())
+            return false;
+        ArtNode** child = inner->find((unsigned char) key[depth]);
+        if (child == nullptr)
+            return false;
+        parent_ref = ref;
+        ref = child;
+        depth++;
+    }
+    if (*ref == nullptr)
+        return false;
+    ArtLeaf* leaf = (ArtLeaf*) *ref;
+    if (leaf->key != key)
+        return false;
+    auto at = std::find(leaf->handles.begin(), leaf->handles.end(), handle);
+    if (at == leaf->handles.end())
+        return false;
+    leaf->handles.erase(at);
+    this->size--;
+    if (!leaf->handles.empty())
+        return true;
+
+    delete leaf;
+    if (parent_ref == nullptr) {
+        this->root = nullptr;
+        return true;
+    }
+    ArtInner* parent = (ArtInner*) *parent_ref;
+    parent->remove((unsigned char) key[depth - 1]);
+    if (parent->count == 1) {
+        ArtChildren kids;
+        parent->children(kids);
+        ArtNode* only = kids[0].second;
+        if (!only->is_leaf()) {
+            ArtInner* child = (ArtInner*) only;
+            child->prefix = parent->prefix + (char) kids[0].first + child->prefix;
+        }
+        *parent_ref = only;
+        delete parent;
+    } else {
+        ArtInner* smaller = parent->shrink();
+        if (smaller != nullptr) {
+            *parent_ref = smaller;
+            delete parent;
+        }
+    }
+    return true;
+}
+
+const Handles* ArtTree::find(const NormalizedKey& key) const {
+    const ArtNode* node = this->root;
+    size_t depth = 0;
+    while (node != nullptr && !node->is_leaf()) {
+        const ArtInner* inner = (const ArtInner*) node;
+        if (key.compare(depth, inner->prefix.size(), inner->prefix) != 0)
+            return nullptr;
+        depth += inner->prefix.size();
+        if (depth >= key.size())
+            return nullptr;
+        node = inner->get((unsigned char) key[depth]);
+        depth++;
+    }
+    if (node == nullptr || ((const ArtLeaf*) node)->key != key)
+        return nullptr;
+    return &((const ArtLeaf*) node)->handles;
+}
+
+void ArtTree::range(const NormalizedKey* min, const NormalizedKey* max, ArtEntries& out) const {
+    NormalizedKey path;
+    collect(this->root, path, min, max, out);
+}
+
+// In-order walk of the leaves under node, where path is the key bytes leading to it. A subtree whose
+// path is already past a bound is skipped, and a bound its path is already inside of is dropped.
+void ArtTree::collect(const ArtNode* node, NormalizedKey& path, const NormalizedKey* min, const NormalizedKey* max,
+                      ArtEntries& out) {
+    if (node == nullptr)
+        return;
+    if (node->is_leaf()) {
+        const ArtLeaf* leaf = (const ArtLeaf*) node;
+        if ((min != nullptr && leaf->key < *min) || (max != nullptr && leaf->key > *max))
+            return;
+        for (auto const& handle: leaf->handles)
+            out.push_back(ArtEntry(leaf->key, handle));
+        return;
+    }
+    const ArtInner* inner = (const ArtInner*) node;
+    size_t length = path.size();
+    path.append(inner->prefix);
+    if (min != nullptr) {
+        int compared = path.compare(0, path.size(), *min, 0, path.size());
+        if (compared < 0) {
+            path.resize(length);
+            return;
+        }
+        if (compared > 0)
+            min = nullptr;
+    }
+    if (max != nullptr) {
+        int compared = path.compare(0, path.size(), *max, 0, path.size());
+        if (compared > 0) {
+            path.resize(length);
+            return;
+        }
+        if (compared < 0)
+            max = nullptr;
+    }
+    ArtChildren kids;
+    inner->children(kids);
+    for (auto const& kid: kids) {
+        path.push_back((char) kid.first);
+        collect(kid.second, path, min, max, out);
+        path.pop_back();
+    }
+    path.resize(length);
+}
+
+// Walk down as far as the prefix goes, then take everything below.
+void ArtTree::prefixed(const NormalizedKey& prefix, ArtEntries& out) const {
+    const ArtNode* node = this->root;
+    size_t depth = 0;
+    while (node != nullptr && !node->is_leaf() && depth < prefix.size()) {
+        const ArtInner* inner = (const ArtInner*) node;
+        size_t n = min(inner->prefix.size(), prefix.size() - depth);
+        if (inner->prefix.compare(0, n, prefix, depth, n) != 0)
+            return;
+        if (depth + inner->prefix.size() >= prefix.size())
+            break;
+        depth += inner->prefix.size();
+        node = inner->get((unsigned char) prefix[depth]);
+        depth++;
+    }
+    if (node == nullptr)
+        return;
+    if (node->is_leaf() && ((const ArtLeaf*) node)->key.compare(0, prefix.size(), prefix) != 0)
+        return;
+    NormalizedKey path = prefix.substr(0, depth);
+    collect(node, path, nullptr, nullptr, out);
+}
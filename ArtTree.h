@@ -0,0 +1,165 @@
+/**
+ * @file ArtTree.h - adaptive radix tree over normalized keys, for ArtIndex:
+ * ArtNode: a node of the tree, either an ArtLeaf or one of the four sizes of inner node
+ * ArtTree: the tree itself, mapping each key to the handles of its rows
+ */
+#pragma once
+
+#include "KeyEncoding.h"
+
+typedef std::pair<NormalizedKey, Handle> ArtEntry;
+typedef std::vector<ArtEntry> ArtEntries;
+
+class ArtNode {
+public:
+    ArtNode(bool leaf) : leaf(leaf) {}
+    virtual ~ArtNode() {}
+    ArtNode(const ArtNode& other) = delete;
+    ArtNode& operator=(const ArtNode& other) = delete;
+
+    bool is_leaf() const { return this->leaf; }
+
+protected:
+    bool leaf;
+};
+
+/**
+ * @class ArtLeaf - a whole key and the handles of the rows that have it
+ */
+class ArtLeaf : public ArtNode {
+public:
+    ArtLeaf(const NormalizedKey& key, Handle handle) : ArtNode(true), key(key), handles(1, handle) {}
+    virtual ~ArtLeaf() {}
+
+    NormalizedKey key;
+    Handles handles;
+};
+
+typedef std::pair<unsigned char, ArtNode*> ArtChild;
+typedef std::vector<ArtChild> ArtChildren;
+
+/**
+ * @class ArtInner - inner node: the bytes its keys all share (path compression), then one child per next byte
+ *
+ * Subclasses hold up to 4, 16, 48 or 256 children, and a node grows into (or shrinks back to) the next
+ * size as children come and go. Destroying an inner node does not destroy its children.
+ */
+class ArtInner : public ArtNode {
+public:
+    ArtInner() : ArtNode(false), prefix(), count(0) {}
+    virtual ~ArtInner() {}
+
+    virtual ArtNode** find(unsigned char byte) = 0;  // nullptr if no child for byte
+    virtual void add(unsigned char byte, ArtNode* child) = 0;  // caller checks full() first
+    virtual void remove(unsigned char byte) = 0;
+    virtual void children(ArtChildren& out) const = 0;  // in byte order
+    virtual bool full() const = 0;
+    virtual ArtInner* grow() const = 0;  // copy into the next size up
+    virtual ArtInner* shrink() const = 0;  // copy into the next size down if few enough children, else nullptr
+    ArtNode* get(unsigned char byte) const;  // child for byte or nullptr
+
+    NormalizedKey prefix;
+    uint count;
+
+protected:
+    void copy_into(ArtInner* other) const;
+};
+
+class ArtNode4 : public ArtInner {
+public:
+    ArtNode4() : ArtInner() {}
+    virtual ArtNode** find(unsigned char byte);
+    virtual void add(unsigned char byte, ArtNode* child);
+    virtual void remove(unsigned char byte);
+    virtual void children(ArtChildren& out) const;
+    virtual bool full() const { return this->count == 4; }
+    virtual ArtInner* grow() const;
+    virtual ArtInner* shrink() const { return nullptr; }
+
+protected:
+    unsigned char keys[4];
+    ArtNode* child[4];
+};
+
+class ArtNode16 : public ArtInner {
+public:
+    ArtNode16() : ArtInner() {}
+    virtual ArtNode** find(unsigned char byte);
+    virtual void add(unsigned char byte, ArtNode* child);
+    virtual void remove(unsigned char byte);
+    virtual void children(ArtChildren& out) const;
+    virtual bool full() const { return this->count == 16; }
+    virtual ArtInner* grow() const;
+    virtual ArtInner* shrink() const;
+
+protected:
+    unsigned char keys[16];
+    ArtNode* child[16];
+};
+
+class ArtNode48 : public ArtInner {
+public:
+    ArtNode48();
+    virtual ArtNode** find(unsigned char byte);
+    virtual void add(unsigned char byte, ArtNode* child);
+    virtual void remove(unsigned char byte);
+    virtual void children(ArtChildren& out) const;
+    virtual bool full() const { return this->count == 48; }
+    virtual ArtInner* grow() const;
+    virtual ArtInner* shrink() const;
+
+protected:
+    unsigned char slot[256];  // 1 + index into child, or 0 if none
+    ArtNode* child[48];
+};
+
+class ArtNode256 : public ArtInner {
+public:
+    ArtNode256();
+    virtual ArtNode** find(unsigned char byte);
+    virtual void add(unsigned char byte, ArtNode* child);
+    virtual void remove(unsigned char byte);
+    virtual void children(ArtChildren& out) const;
+    virtual bool full() const { return false; }
+    virtual ArtInner* grow() const { return nullptr; }
+    virtual ArtInner* shrink() const;
+
+protected:
+    ArtNode* child[256];
+};
+
+/**
+ * @class ArtTree - adaptive radix tree (Leis et al.) mapping normalized keys to handles
+ *
+ * Leaves are only made where keys differ (lazy expansion) and inner nodes keep the bytes all their keys
+ * share (path compression), so a probe looks at each byte of the key at most once. Normalized keys of
+ * one key profile are prefix free: no key is the start of another, so every key ends at a leaf.
+ */
+class ArtTree {
+public:
+    ArtTree(bool unique) : root(nullptr), unique(unique), size(0) {}
+    virtual ~ArtTree();
+    ArtTree(const ArtTree& other) = delete;
+    ArtTree& operator=(const ArtTree& other) = delete;
+
+    void insert(const NormalizedKey& key, Handle handle);
+    bool remove(const NormalizedKey& key, Handle handle);  // false if not there
+    void clear();
+
+    const Handles* find(const NormalizedKey& key) const;  // nullptr if none
+    // entries with min <= key <= max (either may be nullptr for no bound), in key order
+    void range(const NormalizedKey* min, const NormalizedKey* max, ArtEntries& out) const;
+    // entries whose keys start with prefix, in key order
+    void prefixed(const NormalizedKey& prefix, ArtEntries& out) const;
+
+    size_t get_size() const { return this->size; }  // number of entries
+
+protected:
+    ArtNode* root;
+    bool unique;
+    size_t size;
+
+    static void destroy(ArtNode* node);
+    static void collect(const ArtNode* node, NormalizedKey& path, const NormalizedKey* min, const NormalizedKey* max,
+                        ArtEntries& out);
+};
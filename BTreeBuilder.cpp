@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cstring>
+#include "BTreeBuilder.h"
+using namespace std;
+
+// order entries by key only (handles never break ties in a unique index); normalized keys compare bytewise
+static bool entry_less(const BTreeEntry& a, const BTreeEntry& b) {
+    return a.first < b.first;
+}
+
+/***********
+ * SortRun *
+ ***********/
+
+SortRun::SortRun(string name, const KeyProfile& key_profile)
+        : file(name), key_profile(key_profile), page(nullptr), block_id(0), record_id(0), record_count(0),
+          dropped(false) {
+}
+
+SortRun::~SortRun() {
+    delete this->page;
+    drop();
+}
+
+// Each record is a marshaled handle, the payload's 2-byte length and bytes, then the bytes of the normalized key.
+void SortRun::write(const BTreeEntries& entries) {
+    this->file.create();
+    SlottedPage *block = this->file.get(this->file.get_last_block_id());
+    char bytes[DbBlock::BLOCK_SZ];
+    for (auto const& entry: entries) {
+        Dbt *handle = BTreeNode::marshal_handle(entry.second.first);
+        const Payload& payload = entry.second.second;
+        uint16_t payload_size = (uint16_t) payload.size();
+        uint size = handle->get_size();
+        memcpy(bytes, handle->get_data(), size);
+        memcpy(bytes + size, &payload_size, sizeof(uint16_t));
+        size += sizeof(uint16_t);
+        memcpy(bytes + size, payload.data(), payload.size());
+        size += payload.size();
+        memcpy(bytes + size, entry.first.data(), entry.first.size());
+        size += entry.first.size();
+        delete[] (char *) handle->get_data();
+        delete handle;
+
+        Dbt record(bytes, size);
+        try {
+            block->add(&record);
+        } catch (DbBlockNoRoomError& e) {
+            this->file.put(block);
+            delete block;
+            block = this->file.get_new();
+            block->add(&record);
+        }
+    }
+    this->file.put(block);
+    delete block;
+    this->block_id = 1;
+    this->record_id = 0;
+}
+
+bool SortRun::next(BTreeEntry& entry) {
+    while (true) {
+        if (this->page == nullptr) {
+            if (this->block_id > this->file.get_last_block_id())
+                return false;
+            this->page = this->file.get(this->block_id);
+            this->record_id = 0;
+            this->record_count = this->page->size();
+        }
+        Dbt *record = nullptr;
+        if (this->record_id < this->record_count)
+            record = this->page->get(++this->record_id);
+        if (record == nullptr) {
+            delete this->page;
+            this->page = nullptr;
+            this->block_id++;
+            continue;
+        }
+        const char *bytes = (const char *) record->get_data();
+        uint offset = BTreeNode::HANDLE_SZ;
+        uint16_t payload_size = *(uint16_t *) (bytes + offset);
+        offset += sizeof(uint16_t);
+        entry.second.first = BTreeNode::unmarshal_handle(bytes);
+        entry.second.second.assign(bytes + offset, payload_size);
+        offset += payload_size;
+        entry.first.assign(bytes + offset, record->get_size() - offset);
+        delete record;
+        return true;
+    }
+}
+
+void SortRun::drop() {
+    if (!this->dropped)
+        this->file.drop();
+    this->dropped = true;
+}
+
+
+/***************
+ * BTreeSorter *
+ ***************/
+
+BTreeSorter::BTreeSorter(string name, const KeyProfile& key_profile, uint run_size)
+        : name(name), key_profile(key_profile), run_size(run_size), buffer(), buffer_pos(0), runs(), heads() {
+    if (this->run_size == 0)
+        this->run_size = 1;
+}
+
+BTreeSorter::~BTreeSorter() {
+    for (auto run: this->runs)
+        delete run;
+}
+
+void BTreeSorter::add(const NormalizedKey& key, Handle handle, const Payload& payload) {
+    if (key.size() + payload.size() > BTreeNode::MAX_KEY_SIZE)
+        throw DbRelationError("index key too big to marshal");
+    this->buffer.push_back(BTreeEntry(key, LeafValue(handle, payload)));
+    if (this->buffer.size() >= this->run_size)
+        spill();
+}
+
+// Sort the in-memory entries and write them out as a new run.
+void BTreeSorter::spill() {
+    std::sort(this->buffer.begin(), this->buffer.end(), entry_less);
+    SortRun *run = new SortRun(this->name + "-run" + to_string(this->runs.size()), this->key_profile);
+    this->runs.push_back(run);
+    run->write(this->buffer);
+    this->buffer.clear();
+}
+
+void BTreeSorter::sort() {
+    std::sort(this->buffer.begin(), this->buffer.end(), entry_less);
+    this->buffer_pos = 0;
+    if (this->runs.empty())
+        return;  // everything fit in memory, so next() just walks the buffer
+
+    // prime the merge with the first entry from each run and from the in-memory remainder
+    BTreeEntry entry;
+    for (size_t source = 0; source <= this->runs.size(); source++)
+        if (pull(source, entry))
+            this->heads.push(MergeHead(entry, source));
+}
+
+// Get the next entry from a single source of the merge.
+bool BTreeSorter::pull(size_t source, BTreeEntry& entry) {
+    if (source < this->runs.size())
+        return this->runs[source]->next(entry);
+    if (this->buffer_pos >= this->buffer.size())
+        return false;
+    entry = this->buffer[this->buffer_pos++];
+    return true;
+}
+
+bool BTreeSorter::next(BTreeEntry& entry) {
+    if (this->runs.empty())
+        return pull(0, entry);
+    if (this->heads.empty())
+        return false;
+    MergeHead head = this->heads.top();
+    this->heads.pop();
+    entry = head.first;
+    BTreeEntry following;
+    if (pull(head.second, following))
+        this->heads.push(MergeHead(following, head.second));
+    return true;
+}
+
+
+/**************
+ * BTreeMerge *
+ **************/
+
+BTreeMerge::BTreeMerge(const vector<BTreeSorter*>& sorters) : sorters(sorters), heads() {
+    BTreeEntry entry;
+    for (size_t source = 0; source < this->sorters.size(); source++)
+        if (this->sorters[source]->next(entry))
+            this->heads.push(MergeHead(entry, source));
+}
+
+bool BTreeMerge::next(BTreeEntry& entry) {
+    if (this->heads.empty())
+        return false;
+    MergeHead head = this->heads.top();
+    this->heads.pop();
+    entry = head.first;
+    BTreeEntry following;
+    if (this->sorters[head.second]->next(following))
+        this->heads.push(MergeHead(following, head.second));
+    return true;
+}
+
+
+/****************
+ * BTreeBuilder *
+ ****************/
+
+BTreeBuilder::BTreeBuilder(HeapFile& file, const KeyProfile& key_profile, uint fill_percent)
+        : file(file), key_profile(key_profile), budget(0), leaf(nullptr), last_key(), has_last(false), leaves(),
+          entries(0), interior_pages(0), leaf_bytes(0), distinct(key_profile.size(), 0) {
+    uint target = DbBlock::BLOCK_SZ * std::min(std::max(fill_percent, 1U), 100U) / 100;
+    this->budget = std::min(BTreeNode::CAPACITY, target);
+}
+
+BTreeBuilder::~BTreeBuilder() {
+    delete this->leaf;
+}
+
+void BTreeBuilder::add(const NormalizedKey& key, Handle handle, const Payload& payload) {
+    if (this->has_last && !(this->last_key < key))
+        throw DbRelationError("Duplicate keys are not allowed in unique index");
+    if (key.size() + payload.size() > BTreeNode::MAX_KEY_SIZE)
+        throw DbRelationError("index key too big to marshal");
+
+    if (this->leaf != nullptr && this->leaf->size_with(key, payload.size()) > this->budget) {
+        // this leaf is full, so start its sister to the right
+        BTreeLeaf *next = new BTreeLeaf(this->file, 0, this->key_profile, true);
+        this->leaf->set_next_leaf(next->get_id());
+        this->leaf->save();
+        this->leaf_bytes += this->leaf->size();
+        delete this->leaf;
+        this->leaf = next;
+        this->leaves.push_back(make_pair(BTreeNode::shortest_separator(this->last_key, key), this->leaf->get_id()));
+    }
+    if (this->leaf == nullptr) {
+        this->leaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
+        this->leaves.push_back(make_pair(key, this->leaf->get_id()));
+    }
+    this->leaf->append(key, handle, payload);
+
+    // a key begins a new distinct value of every leading group of columns it doesn't share with the last key
+    vector<size_t> ends = KeyEncoding::column_ends(key, this->key_profile);
+    size_t prefix = this->has_last ? BTreeNode::common_prefix(this->last_key, key) : 0;
+    for (size_t i = 0; i < ends.size(); i++)
+        if (!this->has_last || ends[i] > prefix)
+            this->distinct[i]++;
+    this->entries++;
+    this->last_key = key;
+    this->has_last = true;
+}
+
+void BTreeBuilder::finish(BlockID& root_id, uint& height) {
+    if (this->leaf == nullptr) {
+        // empty relation: the tree is a single empty leaf
+        this->leaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
+        this->leaves.push_back(make_pair(NormalizedKey(), this->leaf->get_id()));
+    }
+    this->leaf->save();
+    this->leaf_bytes += this->leaf->size();
+    delete this->leaf;
+    this->leaf = nullptr;
+
+    height = 1;
+    LevelEntries level = this->leaves;
+    while (level.size() > 1) {
+        LevelEntries parents;
+        build_level(level, parents);
+        this->interior_pages += parents.size();
+        level.swap(parents);
+        height++;
+    }
+    root_id = level.front().second;
+}
+
+void BTreeBuilder::count(BTreeStat& stat) const {
+    stat.entries = this->entries;
+    stat.leaf_pages = this->leaves.size();
+    stat.interior_pages = this->interior_pages;
+    stat.leaf_bytes = this->leaf_bytes;
+    for (size_t i = 0; i < this->distinct.size(); i++)
+        stat.distinct[i] = this->distinct[i];
+}
+
+// Pack one interior level over the given children.
+void BTreeBuilder::build_level(const LevelEntries& children, LevelEntries& parents) {
+    // decide where each interior node starts; every node needs at least two children
+    vector<size_t> starts;
+    const uint first_bytes = sizeof(BlockID) + BTreeNode::SLOT_SZ;
+    uint bytes = 0;
+    for (size_t i = 0; i < children.size(); i++) {
+        uint child_bytes = (uint) (sizeof(BlockID) + children[i].first.size() + BTreeNode::SLOT_SZ);
+        if (starts.empty() || (i - starts.back() >= 2 && bytes + child_bytes > this->budget)) {
+            starts.push_back(i);
+            bytes = first_bytes;
+        } else {
+            bytes += child_bytes;
+        }
+    }
+    if (starts.size() > 1 && children.size() - starts.back() < 2) {
+        // don't leave a lone pointer: borrow a child from the left neighbor, or merge into it
+        if (starts.back() - starts[starts.size() - 2] > 2)
+            starts.back()--;
+        else
+            starts.pop_back();
+    }
+
+    for (size_t n = 0; n < starts.size(); n++) {
+        size_t end = n + 1 < starts.size() ? starts[n + 1] : children.size();
+        BTreeInterior *node = new BTreeInterior(this->file, 0, this->key_profile, true);
+        node->set_first(children[starts[n]].second);
+        for (size_t i = starts[n] + 1; i < end; i++)
+            node->append(children[i].first, children[i].second);
+        node->save();
+        parents.push_back(make_pair(children[starts[n]].first, node->get_id()));
+        delete node;
+    }
+}
@@ -0,0 +1,172 @@
+/**
+ * @file BTreeBuilder.h - Bottom-up bulk loading of a BTreeIndex:
+ * SortRun: a sorted run of index entries spilled to a HeapFile
+ * BTreeSorter: sorts (normalized key, handle and payload) entries, spilling runs when over its memory budget
+ * BTreeMerge: k-way merge of several sorters' outputs (one sorter per build worker)
+ * BTreeBuilder: packs sorted entries into leaves left to right, then builds the interior levels
+ */
+#pragma once
+
+#include <queue>
+#include "BTreeNode.h"
+
+typedef std::pair<NormalizedKey, LeafValue> BTreeEntry;
+typedef std::vector<BTreeEntry> BTreeEntries;
+
+/**
+ * @class SortRun - sorted sequence of index entries written to (and read back from) a temporary HeapFile
+ */
+class SortRun {
+public:
+    SortRun(std::string name, const KeyProfile& key_profile);
+    virtual ~SortRun();
+    SortRun(const SortRun& other) = delete;
+    SortRun& operator=(const SortRun& other) = delete;
+
+    /**
+     * Write out the given (already sorted) entries as this run's contents.
+     */
+    void write(const BTreeEntries& entries);
+
+    /**
+     * Read the next entry of the run.
+     * @returns  false if the run is exhausted
+     */
+    bool next(BTreeEntry& entry);
+
+    /**
+     * Remove the run's file.
+     */
+    void drop();
+
+protected:
+    HeapFile file;
+    const KeyProfile& key_profile;
+    SlottedPage *page;
+    BlockID block_id;
+    RecordID record_id;
+    RecordID record_count;
+    bool dropped;
+};
+
+/**
+ * @class BTreeSorter - external sort of index entries by key
+ *
+ * Entries are buffered in memory. Once run_size entries are buffered they are sorted and
+ * spilled as a SortRun. The sorted output is a k-way merge of the spilled runs and whatever
+ * is still in memory; if nothing was spilled this is just an in-memory sort.
+ */
+class BTreeSorter {
+public:
+    BTreeSorter(std::string name, const KeyProfile& key_profile, uint run_size);
+    virtual ~BTreeSorter();
+    BTreeSorter(const BTreeSorter& other) = delete;
+    BTreeSorter& operator=(const BTreeSorter& other) = delete;
+
+    void add(const NormalizedKey& key, Handle handle, const Payload& payload);
+
+    /**
+     * No more adds. Get ready to return the entries in key order with next().
+     */
+    void sort();
+
+    /**
+     * Get the next entry in key order.
+     * @returns  false if there are no more entries
+     */
+    bool next(BTreeEntry& entry);
+
+protected:
+    // one input to the merge: index into runs, or runs.size() for the in-memory buffer
+    typedef std::pair<BTreeEntry, size_t> MergeHead;
+    struct MergeOrder {
+        bool operator()(const MergeHead& a, const MergeHead& b) const { return b.first.first < a.first.first; }
+    };
+
+    std::string name;
+    const KeyProfile& key_profile;
+    uint run_size;
+    BTreeEntries buffer;
+    size_t buffer_pos;
+    std::vector<SortRun*> runs;
+    std::priority_queue<MergeHead, std::vector<MergeHead>, MergeOrder> heads;
+
+    void spill();
+    bool pull(size_t source, BTreeEntry& entry);
+};
+
+/**
+ * @class BTreeMerge - merges the sorted outputs of several BTreeSorters into one key-ordered stream
+ */
+class BTreeMerge {
+public:
+    BTreeMerge(const std::vector<BTreeSorter*>& sorters);
+    virtual ~BTreeMerge() {}
+
+    /**
+     * Get the next entry in key order across all the sorters.
+     * @returns  false if every sorter is exhausted
+     */
+    bool next(BTreeEntry& entry);
+
+protected:
+    typedef std::pair<BTreeEntry, size_t> MergeHead;
+    struct MergeOrder {
+        bool operator()(const MergeHead& a, const MergeHead& b) const { return b.first.first < a.first.first; }
+    };
+
+    std::vector<BTreeSorter*> sorters;
+    std::priority_queue<MergeHead, std::vector<MergeHead>, MergeOrder> heads;
+};
+
+/**
+ * @class BTreeBuilder - packs sorted entries into a fresh BTree index file
+ *
+ * Leaves are filled left to right up to fill_percent of a block and chained together. Once
+ * the leaves are done, each interior level is packed the same way from the (separator, block id)
+ * of the level below, until a single root remains. A leaf's separator is the shortest key
+ * between its left neighbor's last key and its own first key.
+ */
+class BTreeBuilder {
+public:
+    BTreeBuilder(HeapFile& file, const KeyProfile& key_profile, uint fill_percent);
+    virtual ~BTreeBuilder();
+    BTreeBuilder(const BTreeBuilder& other) = delete;
+    BTreeBuilder& operator=(const BTreeBuilder& other) = delete;
+
+    /**
+     * Add the next entry. Keys must arrive in strictly increasing order.
+     */
+    void add(const NormalizedKey& key, Handle handle, const Payload& payload);
+
+    /**
+     * Finish the leaves and build the interior levels.
+     * @param root_id  returned by reference: block id of the new root
+     * @param height   returned by reference: height of the new tree
+     */
+    void finish(BlockID& root_id, uint& height);
+
+    /**
+     * Set stat's counts of entries, pages, leaf bytes and distinct values to those of the tree just built,
+     * so it needn't be walked again to count them. The split counts are left alone.
+     */
+    void count(BTreeStat& stat) const;
+
+protected:
+    // (lowest key, block id) of each node on a level, used to build the level above it
+    typedef std::vector<std::pair<NormalizedKey, BlockID>> LevelEntries;
+
+    HeapFile& file;
+    const KeyProfile& key_profile;
+    uint budget;
+    BTreeLeaf *leaf;
+    NormalizedKey last_key;
+    bool has_last;
+    LevelEntries leaves;
+    uint64_t entries;
+    uint64_t interior_pages;
+    uint64_t leaf_bytes;
+    std::vector<uint64_t> distinct;  // of the first 1, 2, ... key columns, as analyze counts them
+
+    void build_level(const LevelEntries& children, LevelEntries& parents);
+};
@@ -0,0 +1,101 @@
+#include "BTreeLatch.h"
+using namespace std;
+
+/**************
+ * BTreeLatch *
+ **************/
+
+void BTreeLatch::lock() {
+    this->mutex.lock();
+    this->version++;  // now odd: readers in flight will fail to validate
+}
+
+void BTreeLatch::unlock() {
+    this->version++;
+    this->mutex.unlock();
+}
+
+bool BTreeLatch::read_version(uint64_t& version) const {
+    version = this->version.load();
+    return (version & 1) == 0;
+}
+
+bool BTreeLatch::upgrade(uint64_t version) {
+    lock();
+    if (this->version.load() == version + 1)
+        return true;
+    unlock();
+    return false;
+}
+
+
+/****************
+ * BTreeLatches *
+ ****************/
+
+BTreeLatches::BTreeLatches() : mutex() {
+    for (uint i = 0; i < MAX_DIRECTORIES; i++)
+        this->directories[i].store(nullptr);
+}
+
+BTreeLatches::~BTreeLatches() {
+    for (uint i = 0; i < MAX_DIRECTORIES; i++) {
+        ChunkPointer* directory = this->directories[i].load();
+        if (directory == nullptr)
+            continue;
+        for (uint j = 0; j < DIRECTORY_SZ; j++)
+            delete[] directory[j].load();
+        delete[] directory;
+    }
+}
+
+BTreeLatch& BTreeLatches::get(BlockID block_id) {
+    uint chunk_num = block_id / CHUNK_SZ;
+    ChunkPointer* directory = this->directories[chunk_num / DIRECTORY_SZ].load();
+    BTreeLatch* chunk = directory == nullptr ? nullptr : directory[chunk_num % DIRECTORY_SZ].load();
+    if (chunk == nullptr) {
+        lock_guard<std::mutex> guard(this->mutex);
+        directory = this->directories[chunk_num / DIRECTORY_SZ].load();
+        if (directory == nullptr) {
+            directory = new ChunkPointer[DIRECTORY_SZ];
+            for (uint j = 0; j < DIRECTORY_SZ; j++)
+                directory[j].store(nullptr);
+            this->directories[chunk_num / DIRECTORY_SZ].store(directory);
+        }
+        chunk = directory[chunk_num % DIRECTORY_SZ].load();
+        if (chunk == nullptr) {
+            chunk = new BTreeLatch[CHUNK_SZ];
+            directory[chunk_num % DIRECTORY_SZ].store(chunk);
+        }
+    }
+    return chunk[block_id % CHUNK_SZ];
+}
+
+
+/******************
+ * BTreeLatchPath *
+ ******************/
+
+BTreeLatchPath::~BTreeLatchPath() {
+    release_all();
+}
+
+void BTreeLatchPath::exclusive(BlockID block_id) {
+    BTreeLatch& latch = this->latches.get(block_id);
+    latch.lock();
+    this->held.push_back(&latch);
+}
+
+void BTreeLatchPath::release_above() {
+    if (this->held.size() < 2)
+        return;
+    for (size_t i = 0; i < this->held.size() - 1; i++)
+        this->held[i]->unlock();
+    this->held.erase(this->held.begin(), this->held.end() - 1);
+}
+
+void BTreeLatchPath::release_all() {
+    for (auto latch: this->held)
+        latch->unlock();
+    this->held.clear();
+}
@@ -0,0 +1,111 @@
+/**
+ * @file BTreeLatch.h - short-term latches that let several threads use one BTreeIndex:
+ * BTreeLatch: exclusive latch plus version counter on one node
+ * BTreeLatches: the latches of an index, one per block, made on first use
+ * BTreeLatchPath: the latches held by one index operation as it crabs down the tree
+ */
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "storage_engine.h"
+
+/**
+ * @class BTreeLatch - exclusive latch and version counter for one BTree node
+ *
+ * Only writers latch. The version is odd while a writer holds the latch and goes up again when it
+ * lets go, so a reader notes the version, reads the node without latching it, and then checks the
+ * version is unchanged. If it isn't, what the reader saw may be stale and it starts over.
+ */
+class BTreeLatch {
+public:
+    BTreeLatch() : mutex(), version(0) {}
+    virtual ~BTreeLatch() {}
+    BTreeLatch(const BTreeLatch& other) = delete;
+    BTreeLatch& operator=(const BTreeLatch& other) = delete;
+
+    void lock();
+    void unlock();
+
+    /**
+     * Start an optimistic read.
+     * @param version  returned by reference: the version to validate against afterwards
+     * @returns        false if a writer has the node latched (so the read should restart)
+     */
+    bool read_version(uint64_t& version) const;
+
+    /**
+     * Finish an optimistic read.
+     * @returns  true if nothing has changed the node since read_version
+     */
+    bool validate(uint64_t version) const { return this->version.load() == version; }
+
+    /**
+     * Latch a node that was read optimistically.
+     * @returns  false (not latched) if the node has changed since read_version
+     */
+    bool upgrade(uint64_t version);
+
+protected:
+    std::mutex mutex;
+    std::atomic<uint64_t> version;
+};
+
+/**
+ * @class BTreeLatches - latch table of an index, indexed by block id
+ *
+ * Latches are allocated a chunk of block ids at a time, and the chunks are found through directories
+ * made on first use too, so the table reaches every block id but only takes memory for the ones in use.
+ * Finding an existing latch takes no lock, so optimistic readers don't write to any shared memory at all.
+ */
+class BTreeLatches {
+public:
+    static const uint CHUNK_SZ = 1024;  // latches per chunk
+    static const uint DIRECTORY_SZ = 4096;  // chunks per directory
+    static const uint MAX_DIRECTORIES = (uint) ((1ULL << 32) / CHUNK_SZ / DIRECTORY_SZ);  // for any BlockID
+
+    BTreeLatches();
+    virtual ~BTreeLatches();
+    BTreeLatches(const BTreeLatches& other) = delete;
+    BTreeLatches& operator=(const BTreeLatches& other) = delete;
+
+    /**
+     * Get the latch for a block (making its chunk if need be). Latches live as long as the table.
+     */
+    BTreeLatch& get(BlockID block_id);
+
+protected:
+    typedef std::atomic<BTreeLatch*> ChunkPointer;
+
+    std::mutex mutex;  // only held to add a chunk or directory
+    std::atomic<ChunkPointer*> directories[MAX_DIRECTORIES];
+};
+
+/**
+ * @class BTreeLatchPath - exclusive latches held by one writer, always taken top down
+ *
+ * Crabbing: latch the child, then let go of the ancestors once they can no longer be
+ * affected. Whatever is still held is released by the destructor, so an exception part way
+ * down the tree can't leave a node latched.
+ */
+class BTreeLatchPath {
+public:
+    BTreeLatchPath(BTreeLatches& latches) : latches(latches), held() {}
+    virtual ~BTreeLatchPath();
+    BTreeLatchPath(const BTreeLatchPath& other) = delete;
+    BTreeLatchPath& operator=(const BTreeLatchPath& other) = delete;
+
+    void exclusive(BlockID block_id);
+
+    /**
+     * Release every latch except the one taken most recently.
+     */
+    void release_above();
+
+    void release_all();
+
+protected:
+    BTreeLatches& latches;
+    std::vector<BTreeLatch*> held;
+};
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <cstring>
 #include "BTreeNode.h"
 using namespace std;
@@ -14,6 +15,11 @@ BTreeNode::BTreeNode(HeapFile &file, BlockID block_id, const KeyProfile& key_pro
         this->id = this->block->get_block_id();
     } else {
         this->block = file.get(block_id);
+        if (!this->block->is_sound()) {
+            delete this->block;
+            this->block = nullptr;
+            throw BTreeNodeTorn(block_id);
+        }
     }
 }
 
@@ -28,51 +34,33 @@ void BTreeNode::save() {
 
 // Get the record and turn it into a block ID.
 BlockID BTreeNode::get_block_id(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
+    Dbt *dbt = get_record(record_id, sizeof(BlockID));
     BlockID block_id = *(BlockID *)dbt->get_data();
     delete dbt;
     return block_id;
 }
 
-// Get the record and turn it into a Handle.
-Handle BTreeNode::get_handle(RecordID record_id) const {
+// Get a record that has to be at least least bytes long (if it isn't, the node is torn).
+Dbt *BTreeNode::get_record(RecordID record_id, size_t least) const {
     Dbt *dbt = this->block->get(record_id);
-    BlockID handle_block_id = *(BlockID *)dbt->get_data();
-    RecordID handle_record_id = *(RecordID *)((char*)dbt->get_data() + sizeof(BlockID));
-    delete dbt;
-    return Handle(handle_block_id, handle_record_id);
+    if (dbt->get_size() < least) {
+        delete dbt;
+        throw BTreeNodeTorn(this->id);
+    }
+    return dbt;
 }
 
-// Get the record and turn it into a KeyValue.
-KeyValue *BTreeNode::get_key(RecordID record_id) const {
-    Dbt *dbt = this->block->get(record_id);
-    char *bytes = (char*)dbt->get_data();
-    KeyValue *key_value = new KeyValue();
-    Value value;
-    uint offset = 0;
-    for (auto const& data_type: this->key_profile) {
-        value.data_type = data_type;
-        if (data_type == ColumnAttribute::DataType::INT) {
-            value.n = *(int32_t*)(bytes + offset);
-            offset += sizeof(int32_t);
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            uint16_t size = *(uint16_t *)(bytes + offset);
-            offset += sizeof(uint16_t);
-            char buffer[DbBlock::BLOCK_SZ];
-            memcpy(buffer, bytes+offset, size);
-            buffer[size] = '\0';
-            value.s = std::string(buffer);  // assume ascii for now
-            offset += size;
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            value.n = *(uint8_t*)(bytes + offset);
-            offset += sizeof(uint8_t);
-        } else {
-            throw DbRelationError("Only know how to unmarshal INT, TEXT, or BOOLEAN");
-        }
-        key_value->push_back(value);
-    }
-    delete dbt;
-    return key_value;
+// Add a record built up in a string.
+void BTreeNode::add_record(const string& bytes) {
+    Dbt dbt((void *) bytes.data(), (u_int32_t) bytes.size());
+    this->block->add(&dbt);
+}
+
+// Turn bytes produced by marshal_handle back into a Handle.
+Handle BTreeNode::unmarshal_handle(const char *bytes) {
+    BlockID handle_block_id = *(BlockID *)bytes;
+    RecordID handle_record_id = *(RecordID *)(bytes + sizeof(BlockID));
+    return Handle(handle_block_id, handle_record_id);
 }
 
 // Convert block_id into bytes.
@@ -92,49 +80,59 @@ Dbt *BTreeNode::marshal_handle(Handle handle) {
     return dbt;
 }
 
-// Convert KeyValue into bytes.
-Dbt *BTreeNode::marshal_key(const KeyValue *key) {
-    char *bytes = new char[DbBlock::BLOCK_SZ]; // more than we need
-    uint offset = 0;
-    uint col_num = 0;
-    for (auto const& data_type: this->key_profile) {
-        Value value = (*key)[col_num];
-
-        if (data_type == ColumnAttribute::DataType::INT) {
-            if (offset + 4 > DbBlock::BLOCK_SZ - 4)
-                throw DbRelationError("index key too big to marshal");
-
-            *(int32_t*) (bytes + offset) = value.n;
-            offset += sizeof(int32_t);
-
-        } else if (data_type == ColumnAttribute::DataType::TEXT) {
-            u_long size = (uint16_t) value.s.length();
-            if (size > UINT16_MAX)
-                throw DbRelationError("text field too long to marshal");
-            if (offset + 2 + size > DbBlock::BLOCK_SZ)
-                throw DbRelationError("index key too big to marshal");
-
-            *(uint16_t*) (bytes + offset) = (uint16_t) size;
-            offset += sizeof(uint16_t);
-            memcpy(bytes+offset, value.s.c_str(), size); // assume ascii for now
-            offset += size;
-
-        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
-            if (offset + 1 > DbBlock::BLOCK_SZ - 1)
-                throw DbRelationError("index key too big to marshal");
+size_t BTreeNode::common_prefix(const NormalizedKey& a, const NormalizedKey& b) {
+    size_t n = min(a.size(), b.size());
+    size_t i = 0;
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
 
-            *(uint8_t*) (bytes + offset) = (uint8_t)value.n;
-            offset += sizeof(uint8_t);
+// Since right > left, right goes on past where they first differ, and its prefix through
+// that byte is already greater than left.
+NormalizedKey BTreeNode::shortest_separator(const NormalizedKey& left, const NormalizedKey& right) {
+    return right.substr(0, common_prefix(left, right) + 1);
+}
 
-        } else {
-            throw DbRelationError("only know how to marshal INT, TEXT, or BOOLEAN for BTree index");
+// Pick where to split a node of n entries, the first split going to the left and the rest to the right.
+// Only positions where both halves fit are considered. Of those within n/8 of the point that halves
+// the bytes, prefer the one whose separator is shortest so the parent gets the smallest possible
+// boundary; if none that close fit, take the one nearest that point.
+template<typename EntrySize, typename SeparatorLength, typename Fits>
+static size_t choose_split(size_t n, size_t lowest, EntrySize entry_size, SeparatorLength separator_length,
+                           Fits fits) {
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += entry_size(i);
+    size_t middle = 0;
+    for (size_t bytes = 0; middle < n - 1 && bytes * 2 < total; middle++)
+        bytes += entry_size(middle);
+    middle = max(middle, lowest);
+
+    size_t reach = n / 8;
+    size_t best = n;
+    size_t best_length = 0;
+    size_t best_distance = 0;
+    for (size_t i = max(middle > reach ? middle - reach : 0, lowest); i <= middle + reach && i < n; i++) {
+        if (!fits(i))
+            continue;
+        size_t length = separator_length(i);
+        size_t distance = i > middle ? i - middle : middle - i;
+        if (best == n || length < best_length || (length == best_length && distance < best_distance)) {
+            best = i;
+            best_length = length;
+            best_distance = distance;
         }
     }
-    char *right_size_bytes = new char[offset];
-    memcpy(right_size_bytes, bytes, offset);
-    delete[] bytes;
-    Dbt *data = new Dbt(right_size_bytes, offset);
-    return data;
+    for (size_t distance = reach + 1; best == n && distance < n; distance++) {
+        if (middle + distance < n && fits(middle + distance))
+            best = middle + distance;
+        else if (middle >= lowest + distance && fits(middle - distance))
+            best = middle - distance;
+    }
+    if (best == n)
+        throw DbRelationError("index entries too big to split");
+    return best;
 }
 
 
@@ -144,14 +142,43 @@ Dbt *BTreeNode::marshal_key(const KeyValue *key) {
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile& key_profile)
         : BTreeNode(file, stat_id, key_profile, false), root_id(new_root), height(1) {
+    clear_stats();
     save();
 }
 
 BTreeStat::BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile& key_profile)
         : BTreeNode(file, stat_id, key_profile, false), root_id(get_block_id(ROOT)), height(get_block_id(HEIGHT)) {
+    clear_stats();
+    if (this->block->size() < STATS)
+        return;  // from before statistics were kept: zero until an ANALYZE
+    Dbt *dbt = this->block->get(STATS);
+    const uint64_t *counts = (const uint64_t *) dbt->get_data();
+    size_t n = dbt->get_size() / sizeof(uint64_t);
+    std::atomic<uint64_t> *fields[] = {&this->entries, &this->leaf_pages, &this->interior_pages, &this->leaf_bytes,
+                                       &this->leaf_splits, &this->interior_splits};
+    size_t n_fields = sizeof(fields) / sizeof(fields[0]);
+    for (size_t i = 0; i < n && i < n_fields + DbIndex::MAX_COMPOSITE; i++) {
+        if (i < n_fields)
+            *fields[i] = counts[i];
+        else
+            this->distinct[i - n_fields] = counts[i];
+    }
+    delete dbt;
+}
+
+void BTreeStat::clear_stats() {
+    this->entries = 0;
+    this->leaf_pages = 0;
+    this->interior_pages = 0;
+    this->leaf_bytes = 0;
+    this->leaf_splits = 0;
+    this->interior_splits = 0;
+    for (auto& count: this->distinct)
+        count = 0;
 }
 
 void BTreeStat::save() {
+    lock_guard<mutex> guard(this->save_mutex);
     Dbt *dbt = marshal_block_id(this->root_id);
     bool is_new = (this->block->size() == 0);
     if (is_new)
@@ -169,6 +196,17 @@ void BTreeStat::save() {
     delete[] (char*)dbt->get_data();
     delete dbt;
 
+    // the counts, then a distinct count per key column
+    vector<uint64_t> counts = {this->entries, this->leaf_pages, this->interior_pages, this->leaf_bytes,
+                               this->leaf_splits, this->interior_splits};
+    for (size_t i = 0; i < this->key_profile.size(); i++)
+        counts.push_back(this->distinct[i]);
+    Dbt stats(counts.data(), (u_int32_t) (counts.size() * sizeof(uint64_t)));
+    if (this->block->size() < STATS)
+        this->block->add(&stats);
+    else
+        this->block->put(STATS, stats);
+
     BTreeNode::save();
 }
 
@@ -181,137 +219,136 @@ BTreeInterior::BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile&
         : BTreeNode(file, block_id, key_profile, create), first(0), pointers(), boundaries() {
     if (!create) {
         RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == 1) {
-                // first pointer
-                this->first = get_block_id(i);
-            } else if (i%2 != 0) {
-                // pointer
-                this->pointers.push_back(get_block_id(i));
-            } else {
-                // key
-                KeyValue *key_value = get_key(i);
-                this->boundaries.push_back(key_value);
+        try {  // a torn node throws part way
+            for (auto const& record_id: *record_id_list) {
+                if (record_id == 1) {
+                    // first pointer
+                    this->first = get_block_id(record_id);
+                } else {
+                    // pointer, then boundary
+                    Dbt *dbt = get_record(record_id, sizeof(BlockID));
+                    const char *bytes = (const char *) dbt->get_data();
+                    this->pointers.push_back(*(BlockID *) bytes);
+                    this->boundaries.push_back(NormalizedKey(bytes + sizeof(BlockID),
+                                                             dbt->get_size() - sizeof(BlockID)));
+                    delete dbt;
+                }
             }
-            i++;
+        } catch (...) {
+            delete record_id_list;
+            throw;
         }
         delete record_id_list;
     }
 }
 
 BTreeInterior::~BTreeInterior() {
-    for (auto key_value: this->boundaries)
-        delete key_value;
-    this->boundaries.clear();
 }
 
 // Get next block down in tree where key must be.
-BTreeNode *BTreeInterior::find(const KeyValue* key, uint depth) const {
-    BlockID down = this->pointers.back();  // last pointer is correct if we don't find an earlier boundary
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *boundary = this->boundaries[i];
-        if (*boundary > *key) {
-            if (i > 0)
-                down = this->pointers[i - 1];
-            else
-                down = this->first;
-            break;
-        }
+BlockID BTreeInterior::child(const NormalizedKey& key) const {
+    // normalized keys compare as plain bytes, so binary search for the first boundary above key
+    auto above = upper_bound(this->boundaries.begin(), this->boundaries.end(), key);
+    return above == this->boundaries.begin() ? this->first : this->pointers[above - this->boundaries.begin() - 1];
+}
+
+BlockID BTreeInterior::child(const NormalizedKey& key, NormalizedKey& high, bool& bounded) const {
+    auto above = upper_bound(this->boundaries.begin(), this->boundaries.end(), key);
+    if (above != this->boundaries.end()) {
+        high = *above;
+        bounded = true;
     }
-    if (depth == 2)
-        return new BTreeLeaf(this->file, down, this->key_profile, false);
-    else
-        return new BTreeInterior(this->file, down, this->key_profile, false);
+    return above == this->boundaries.begin() ? this->first : this->pointers[above - this->boundaries.begin() - 1];
+}
+
+bool BTreeInterior::has_room_for_boundary() const {
+    return size() + sizeof(BlockID) + MAX_KEY_SIZE + SLOT_SZ <= CAPACITY;
+}
+
+uint BTreeInterior::size() const {
+    uint size = sizeof(BlockID) + SLOT_SZ;
+    for (auto const& boundary: this->boundaries)
+        size += sizeof(BlockID) + boundary.size() + SLOT_SZ;
+    return size;
 }
 
 // Save the pointers and boundaries in the correct order
 void BTreeInterior::save() {
-    Dbt *dbt;
     this->block->clear();
-    dbt = marshal_block_id(this->first);
+    Dbt *dbt = marshal_block_id(this->first);
+    this->block->add(dbt);
     delete[] (char *) dbt->get_data();
     delete dbt;
     for (uint i = 0; i < this->boundaries.size(); i++) {
-        // key
-        dbt = marshal_key(this->boundaries[i]);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // boundary
-        dbt = marshal_block_id(this->pointers[i]);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+        string record((const char *) &this->pointers[i], sizeof(BlockID));
+        record += this->boundaries[i];
+        add_record(record);
     }
     BTreeNode::save();
 }
 
-// Insert boundary, block_id pair into block.
-Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
-    Dbt *dbt;
+// Add boundary, block_id pair after all the existing ones. Used when packing a sorted level.
+void BTreeInterior::append(const NormalizedKey& boundary, BlockID block_id) {
+    this->boundaries.push_back(boundary);
+    this->pointers.push_back(block_id);
+}
 
-    bool inserted = false;
-    for (uint i = 0; i < this->boundaries.size(); i++) {
-        KeyValue *check = this->boundaries[i];
-        if (*boundary == *check) {
-            this->boundaries.insert(this->boundaries.begin() + i, new KeyValue(*boundary));
-            this->pointers.insert(this->pointers.begin() + i, block_id);
-            inserted = true;
-            break;
-        }
-    }
-    if (!inserted) {
-        // must go at the end
-        this->boundaries.push_back(new KeyValue(*boundary));
-        this->pointers.push_back(block_id);
-    }
-    dbt = marshal_block_id(block_id);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(boundary);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+BlockPointers BTreeInterior::children() const {
+    BlockPointers children;
+    children.push_back(this->first);
+    children.insert(children.end(), this->pointers.begin(), this->pointers.end());
+    return children;
+}
 
-        // that worked, so no need to split
+// Insert boundary, block_id pair into block.
+Insertion BTreeInterior::insert(const NormalizedKey& boundary, BlockID block_id) {
+    if (boundary.size() > MAX_KEY_SIZE)
+        throw DbRelationError("index key too big to marshal");
+    auto above = upper_bound(this->boundaries.begin(), this->boundaries.end(), boundary);
+    this->pointers.insert(this->pointers.begin() + (above - this->boundaries.begin()), block_id);
+    this->boundaries.insert(above, boundary);
+
+    if (size() <= CAPACITY) {
+        // it fits, so no need to split
         save();
         return BTreeNode::insertion_none();
+    }
 
-    } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // too big, so split
-
-        // create the sister
-        BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
-
-        // only the pointer of the middle entry goes into the sister (as it's first pointer)
-        // the corresponding boundary is moved up to be inserted into the parent node
-        u_long split = this->boundaries.size() / 2;
-        nnode->first = this->pointers[split];
-        KeyValue *nboundary = this->boundaries[split];
-        Insertion ret(nnode->id, *nboundary);
-        delete nboundary;
-
-        // move half of the entries to the sister
-        for (u_long i = split + 1; i < this->boundaries.size(); i++) {
-            nnode->boundaries.push_back(this->boundaries[i]);
-            nnode->pointers.push_back(this->pointers[i]);
-        }
-        this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
-        this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
-
-        // save everything
-        nnode->save();
-        this->save();
-        return ret;
+    // too big, so split
+
+    // create the sister
+    BTreeInterior *nnode = new BTreeInterior(this->file, 0, this->key_profile, true);
+
+    // only the pointer of the split entry goes into the sister (as it's first pointer)
+    // the corresponding boundary is moved up to be inserted into the parent node
+    // the node keeps the boundaries before the split, the sister those after it
+    const NormalizedKeys& boundaries = this->boundaries;
+    vector<size_t> before(boundaries.size() + 1, 0);  // bytes of the boundaries before each one
+    for (size_t i = 0; i < boundaries.size(); i++)
+        before[i + 1] = before[i] + sizeof(BlockID) + boundaries[i].size() + SLOT_SZ;
+    auto entry_size = [&before](size_t i) { return before[i + 1] - before[i]; };
+    auto separator_length = [&boundaries](size_t i) { return boundaries[i].size(); };
+    auto fits = [&before](size_t i) {
+        size_t empty = sizeof(BlockID) + SLOT_SZ;
+        return empty + before[i] <= CAPACITY && empty + before.back() - before[i + 1] <= CAPACITY;
+    };
+    u_long split = choose_split(boundaries.size(), 0, entry_size, separator_length, fits);
+    nnode->first = this->pointers[split];
+    Insertion ret(nnode->id, this->boundaries[split]);
+
+    // move the entries after the split to the sister
+    for (u_long i = split + 1; i < this->boundaries.size(); i++) {
+        nnode->boundaries.push_back(this->boundaries[i]);
+        nnode->pointers.push_back(this->pointers[i]);
     }
+    this->boundaries.erase(this->boundaries.begin() + split, this->boundaries.end());
+    this->pointers.erase(this->pointers.begin() + split, this->pointers.end());
+
+    // save everything
+    nnode->save();
+    this->save();
+    delete nnode;
+    return ret;
 }
 
 
@@ -321,20 +358,43 @@ Insertion BTreeInterior::insert(const KeyValue* boundary, BlockID block_id) {
  *************/
 
 BTreeLeaf::BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create)
-        : BTreeNode(file, block_id, key_profile, create), next_leaf(0), key_map() {
+        : BTreeNode(file, block_id, key_profile, create), next_leaf(0), key_map(), key_bytes(0), payload_bytes(0) {
     if (!create) {
         RecordIDs *record_id_list = this->block->ids();
-        RecordID i = 1;
-        for (auto j = record_id_list->size(); j > 0; j--) {
-            if (i == record_id_list->size()) {
-                // next leaf block
-                this->next_leaf = get_block_id(i);
-            } else if (i%2 == 0) {
-                // record i-1: handle, record i: key
-                KeyValue *key_value = get_key(i);
-                this->key_map[*key_value] = get_handle(i-1);
+        NormalizedKey prefix;
+        bool has_payloads = false;
+        try {  // a torn node throws part way
+            for (auto const& record_id: *record_id_list) {
+                Dbt *dbt = get_record(record_id, record_id == 1 ? sizeof(BlockID) + 1
+                                                                : HANDLE_SZ + (has_payloads ? sizeof(uint16_t) : 0));
+                const char *bytes = (const char *) dbt->get_data();
+                if (record_id == 1) {
+                    // next leaf block, payload flag, then the common prefix
+                    this->next_leaf = *(BlockID *) bytes;
+                    has_payloads = bytes[sizeof(BlockID)] != 0;
+                    prefix.assign(bytes + sizeof(BlockID) + 1, dbt->get_size() - sizeof(BlockID) - 1);
+                } else {
+                    // handle, then the payload (if any), then the rest of the key
+                    uint offset = HANDLE_SZ;
+                    Payload payload;
+                    if (has_payloads) {
+                        uint16_t payload_size = *(uint16_t *) (bytes + offset);
+                        if (offset + sizeof(uint16_t) + payload_size > dbt->get_size()) {
+                            delete dbt;
+                            throw BTreeNodeTorn(this->id);
+                        }
+                        payload.assign(bytes + offset + sizeof(uint16_t), payload_size);
+                        offset += sizeof(uint16_t) + payload_size;
+                    }
+                    NormalizedKey key = prefix;
+                    key.append(bytes + offset, dbt->get_size() - offset);
+                    append(key, unmarshal_handle(bytes), payload);
+                }
+                delete dbt;
             }
-            i++;
+        } catch (...) {
+            delete record_id_list;
+            throw;
         }
         delete record_id_list;
     }
@@ -344,93 +404,152 @@ BTreeLeaf::~BTreeLeaf() {
 }
 
 // Find the handle for a given key
-Handle BTreeLeaf::find_eq(const KeyValue* key) const {
-    return this->key_map.at(*key);
+Handle BTreeLeaf::find_eq(const NormalizedKey& key) const {
+    return this->key_map.at(key).first;
+
+}
+
+// Find the handle and payload for a given key
+const LeafValue& BTreeLeaf::find_value(const NormalizedKey& key) const {
+    return this->key_map.at(key);
+}
 
+// Size of a leaf holding count keys of the given total length which share a prefix of the given length,
+// and payloads of the given total length (each with its own length if there are any).
+uint BTreeLeaf::compressed_size(size_t count, size_t total, size_t prefix, size_t payloads) const {
+    size_t size = sizeof(BlockID) + 1 + prefix + SLOT_SZ + count * (HANDLE_SZ + SLOT_SZ) + total - count * prefix;
+    if (payloads > 0)
+        size += payloads + count * sizeof(uint16_t);
+    return (uint) size;
 }
 
-// Save the key_map and next_leaf data in the correct order
+uint BTreeLeaf::size() const {
+    if (this->key_map.empty())
+        return compressed_size(0, 0, 0, 0);
+    size_t prefix = common_prefix(this->key_map.begin()->first, this->key_map.rbegin()->first);
+    return compressed_size(this->key_map.size(), this->key_bytes, prefix, this->payload_bytes);
+}
+
+uint BTreeLeaf::size_with(const NormalizedKey& key, size_t payload_size) const {
+    size_t prefix = key.size();
+    if (!this->key_map.empty()) {
+        // keys are sorted, so what the lowest and highest share every key shares
+        const NormalizedKey& low = min(key, this->key_map.begin()->first);
+        const NormalizedKey& high = max(key, this->key_map.rbegin()->first);
+        prefix = common_prefix(low, high);
+    }
+    return compressed_size(this->key_map.size() + 1, this->key_bytes + key.size(), prefix,
+                           this->payload_bytes + payload_size);
+}
+
+// Save the next_leaf, common prefix, and key_map data in the correct order
 void BTreeLeaf::save() {
-    Dbt *dbt;
     this->block->clear();
-    for (auto const& item: this->key_map) {
-        // handle
-        dbt = marshal_handle(item.second);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
+    size_t prefix = 0;
+    if (!this->key_map.empty())
+        prefix = common_prefix(this->key_map.begin()->first, this->key_map.rbegin()->first);
+    bool has_payloads = this->payload_bytes > 0;
 
-        // key
-        dbt = marshal_key(&item.first);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-    }
-    // next leaf pointer is final record
-    dbt = marshal_block_id(this->next_leaf);
-    this->block->add(dbt);
-    delete[] (char *) dbt->get_data();
-    delete dbt;
+    string record((const char *) &this->next_leaf, sizeof(BlockID));
+    record.push_back(has_payloads ? 1 : 0);
+    if (!this->key_map.empty())
+        record.append(this->key_map.begin()->first, 0, prefix);
+    add_record(record);
 
+    for (auto const& item: this->key_map) {
+        const Handle& handle = item.second.first;
+        const Payload& payload = item.second.second;
+        record.assign((const char *) &handle.first, sizeof(BlockID));
+        record.append((const char *) &handle.second, sizeof(RecordID));
+        if (has_payloads) {
+            uint16_t payload_size = (uint16_t) payload.size();
+            record.append((const char *) &payload_size, sizeof(uint16_t));
+            record.append(payload);
+        }
+        record.append(item.first, prefix, string::npos);
+        add_record(record);
+    }
     BTreeNode::save();
 }
 
+// Add key, handle pair without checking for room. Used when packing sorted leaves.
+void BTreeLeaf::append(const NormalizedKey& key, Handle handle, const Payload& payload) {
+    this->key_map.emplace_hint(this->key_map.end(), key, LeafValue(handle, payload));
+    this->key_bytes += key.size();
+    this->payload_bytes += payload.size();
+}
+
+void BTreeLeaf::neighbors(const NormalizedKey& key, const NormalizedKey*& before, const NormalizedKey*& after) const {
+    auto at = this->key_map.lower_bound(key);
+    before = at == this->key_map.begin() ? nullptr : &prev(at)->first;
+    if (at != this->key_map.end() && at->first == key)
+        at++;
+    after = at == this->key_map.end() ? nullptr : &at->first;
+}
+
 // Insert key, handle pair into block.
-Insertion BTreeLeaf::insert(const KeyValue* key, Handle handle) {
+Insertion BTreeLeaf::insert(const NormalizedKey& key, Handle handle, const Payload& payload) {
     // check unique
-    if (this->key_map.find(*key) != this->key_map.end())
+    if (this->key_map.find(key) != this->key_map.end())
         throw DbRelationError("Duplicate keys are not allowed in unique index");
-
-    Dbt *dbt;
-    dbt = marshal_handle(handle);
-    try {
-        // following is just a check for size (the save method will redo this in the right order)
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-        dbt = marshal_key(key);
-        this->block->add(dbt);
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // that worked, so no need to split
-        this->key_map[*key] = handle;
+    if (key.size() + payload.size() > MAX_KEY_SIZE)
+        throw DbRelationError("index key too big to marshal");
+
+    if (size_with(key, payload.size()) <= CAPACITY) {
+        // it fits, so no need to split
+        this->key_map[key] = LeafValue(handle, payload);
+        this->key_bytes += key.size();
+        this->payload_bytes += payload.size();
         save();
         return BTreeNode::insertion_none();
+    }
 
-    } catch (DbBlockNoRoomError &e) {
-        delete[] (char *) dbt->get_data();
-        delete dbt;
-
-        // too big, so split
-
-        // create the sister and put her to the right
-        BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
-        nleaf->next_leaf = this->next_leaf;
-        this->next_leaf = nleaf->id;
-
-        // move half of the entries to the sister
-        auto key_list = this->key_map;       // make a copy of my key_map
-        key_list[*key] = handle;             // add key/handle to it
-        u_long split = key_list.size() / 2;  // figure out how many to keep (the rest move to nleaf)
-        this->key_map.clear();               // empty my list
-        u_long i = 0;
-        KeyValue boundary;
-        for (auto const& item: key_list) {
-            if (i < split) {
-                this->key_map[item.first] = item.second;
-            } else if (i == split) {
-                boundary = item.first;
-                nleaf->key_map[boundary] = item.second;
-            } else {
-                nleaf->key_map[item.first] = item.second;
-            }
-            i++;
-        }
-
-        nleaf->save();
-        this->save();
-        return Insertion(nleaf->id, boundary);
+    // too big, so split
+
+    // create the sister and put her to the right
+    BTreeLeaf *nleaf = new BTreeLeaf(this->file, 0, this->key_profile, true);
+    nleaf->next_leaf = this->next_leaf;
+    this->next_leaf = nleaf->id;
+
+    // move the upper entries to the sister, near the middle where both halves fit and the separator is shortest
+    vector<pair<NormalizedKey, LeafValue>> entries(this->key_map.begin(), this->key_map.end());
+    auto entry = make_pair(key, LeafValue(handle, payload));
+    entries.insert(upper_bound(entries.begin(), entries.end(), entry), entry);
+    size_t n = entries.size();
+    vector<size_t> key_bytes(n + 1, 0), payload_bytes(n + 1, 0);  // totals before each entry
+    for (size_t i = 0; i < n; i++) {
+        key_bytes[i + 1] = key_bytes[i] + entries[i].first.size();
+        payload_bytes[i + 1] = payload_bytes[i] + entries[i].second.second.size();
+    }
+    auto entry_size = [&entries](size_t i) {
+        size_t payload = entries[i].second.second.size();
+        return HANDLE_SZ + SLOT_SZ + entries[i].first.size() + (payload > 0 ? payload + sizeof(uint16_t) : 0);
+    };
+    auto separator_length = [&entries](size_t i) { return common_prefix(entries[i - 1].first, entries[i].first) + 1; };
+    auto fits = [this, &entries, &key_bytes, &payload_bytes, n](size_t i) {
+        size_t left_prefix = common_prefix(entries[0].first, entries[i - 1].first);
+        size_t right_prefix = common_prefix(entries[i].first, entries[n - 1].first);
+        return compressed_size(i, key_bytes[i], left_prefix, payload_bytes[i]) <= CAPACITY
+               && compressed_size(n - i, key_bytes[n] - key_bytes[i], right_prefix,
+                                  payload_bytes[n] - payload_bytes[i]) <= CAPACITY;
+    };
+    u_long split = choose_split(n, 1, entry_size, separator_length, fits);
+    this->key_map.clear();
+    this->key_bytes = 0;
+    this->payload_bytes = 0;
+    for (u_long i = 0; i < entries.size(); i++) {
+        const LeafValue& value = entries[i].second;
+        if (i < split)
+            this->append(entries[i].first, value.first, value.second);
+        else
+            nleaf->append(entries[i].first, value.first, value.second);
     }
+    NormalizedKey boundary = shortest_separator(entries[split - 1].first, entries[split].first);
+
+    nleaf->save();
+    this->save();
+    BlockID nleaf_id = nleaf->id;
+    delete nleaf;
+    return Insertion(nleaf_id, boundary);
 }
 
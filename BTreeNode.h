@@ -1,13 +1,24 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include "storage_engine.h"
 #include "heap_storage.h"
+#include "KeyEncoding.h"
 
-typedef std::vector<ColumnAttribute::DataType> KeyProfile;
-typedef std::vector<Value> KeyValue;
-typedef std::vector<KeyValue*> KeyValues;
 typedef std::vector<BlockID> BlockPointers;
-typedef std::pair<BlockID,KeyValue> Insertion;
+typedef std::pair<BlockID,NormalizedKey> Insertion;
+typedef std::string Payload;  // INCLUDE column values a covering index keeps with each entry (encoded by BTreeIndex)
+typedef std::pair<Handle,Payload> LeafValue;
+
+/**
+ * @class BTreeNodeTorn - a node that doesn't parse, most likely because it was read without a latch
+ * while a writer was part way through it; an optimistic reader restarts as if it had failed to validate
+ */
+class BTreeNodeTorn : public DbRelationError {
+public:
+    explicit BTreeNodeTorn(BlockID block_id) : DbRelationError("btree node " + std::to_string(block_id) + " is torn") {}
+};
 
 class BTreeNode {
 public:
@@ -15,12 +26,28 @@ public:
     virtual ~BTreeNode();
 
     static bool insertion_is_none(Insertion insertion) { return insertion.first == 0; }
-    static Insertion insertion_none() { return Insertion(0, KeyValue()); }
+    static Insertion insertion_none() { return Insertion(0, NormalizedKey()); }
 
     virtual void save();
 
     BlockID get_id() const { return this->id; }
 
+    // largest normalized key we will put in a node, so a split always leaves room on both sides
+    static const uint MAX_KEY_SIZE = DbBlock::BLOCK_SZ / 4;
+    // bytes of records plus their 4-byte slot headers that fit in a SlottedPage
+    static const uint SLOT_SZ = 4;
+    static const uint CAPACITY = DbBlock::BLOCK_SZ - 5;
+    static const uint HANDLE_SZ = sizeof(BlockID) + sizeof(RecordID);
+
+    // record (de)serialization, also used for the sorted runs of a bulk build
+    static Dbt *marshal_handle(Handle handle);
+    static Handle unmarshal_handle(const char *bytes);
+
+    // length of the common prefix of a and b
+    static size_t common_prefix(const NormalizedKey& a, const NormalizedKey& b);
+    // shortest key s with left < s <= right (right must be greater than left)
+    static NormalizedKey shortest_separator(const NormalizedKey& left, const NormalizedKey& right);
+
 protected:
     SlottedPage *block;
     HeapFile &file;
@@ -28,18 +55,17 @@ protected:
     const KeyProfile& key_profile;
 
     static Dbt *marshal_block_id(BlockID block_id);
-    static Dbt *marshal_handle(Handle handle);
-    virtual Dbt *marshal_key(const KeyValue *key);
 
     virtual BlockID get_block_id(RecordID record_id) const;
-    virtual Handle get_handle(RecordID record_id) const;
-    virtual KeyValue* get_key(RecordID record_id) const;
+    Dbt *get_record(RecordID record_id, size_t least) const;
+    void add_record(const std::string& bytes);
 };
 
 class BTreeStat : public BTreeNode {
 public:
     static const RecordID ROOT = 1;  // where we store the root id in the stat block
     static const RecordID HEIGHT = ROOT + 1;  // where we store the height in the stat block
+    static const RecordID STATS = HEIGHT + 1;  // where we store the statistics (absent in older indices)
 
     BTreeStat(HeapFile &file, BlockID stat_id, BlockID new_root, const KeyProfile& key_profile);
     BTreeStat(HeapFile &file, BlockID stat_id, const KeyProfile& key_profile);
@@ -52,40 +78,95 @@ public:
     uint get_height() const { return this->height; }
     void set_height(uint height) { this->height = height; }
 
+    // statistics, set by the bulk load, counted up by inserts as they go and recounted by BTreeIndex::analyze
+    std::atomic<uint64_t> entries;
+    std::atomic<uint64_t> leaf_pages;
+    std::atomic<uint64_t> interior_pages;
+    std::atomic<uint64_t> leaf_bytes;  // bytes in use across all the leaves
+    std::atomic<uint64_t> leaf_splits;
+    std::atomic<uint64_t> interior_splits;
+    std::atomic<uint64_t> distinct[DbIndex::MAX_COMPOSITE];  // distinct values of the first 1, 2, ... key columns
+
 protected:
-    BlockID root_id;
-    uint height;
+    // atomic so optimistic readers can look at them while a root split is changing them
+    std::atomic<BlockID> root_id;
+    std::atomic<uint> height;
+    std::mutex save_mutex;  // inserts splitting different leaves may save at once
 
+    void clear_stats();
 };
 
+/**
+ * @class BTreeInterior - interior node of a BTree
+ *
+ * Records: the first pointer, then one record per boundary holding its pointer followed by the
+ * boundary key. Boundaries are separators (see BTreeNode::shortest_separator), not necessarily whole keys.
+ */
 class BTreeInterior : public BTreeNode {
 public:
     BTreeInterior(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create);
     virtual ~BTreeInterior();
 
-    BTreeNode *find(const KeyValue* key, uint depth) const;
-    Insertion insert(const KeyValue* boundary, BlockID block_id);
+    BlockID child(const NormalizedKey& key) const;  // block id of the child where key must be
+    // as child(key), also narrowing high to the boundary above key if there is one (every key under that
+    // child is below it), with bounded set; if there isn't, high and bounded are left as the caller had them
+    BlockID child(const NormalizedKey& key, NormalizedKey& high, bool& bounded) const;
+    Insertion insert(const NormalizedKey& boundary, BlockID block_id);
     virtual void save();
 
     void set_first(BlockID first) { this->first = first; }
 
+    // bytes the node occupies in its block (compare to CAPACITY)
+    uint size() const;
+    // true if any boundary can be inserted without splitting
+    bool has_room_for_boundary() const;
+
+    // bulk-load support: add boundary/pointer to the right end (no size check, caller saves)
+    void append(const NormalizedKey& boundary, BlockID block_id);
+
+    BlockPointers children() const;  // every child, left to right
+
 protected:
     BlockID first;
     BlockPointers pointers;
-    KeyValues boundaries;
+    NormalizedKeys boundaries;
 };
 
+/**
+ * @class BTreeLeaf - leaf node of a BTree
+ *
+ * Keys are prefix compressed: the first record holds the next-leaf pointer, a flag saying whether
+ * entries carry payloads, and the prefix common to every key in the leaf. Then each entry is one
+ * record of its handle, its payload (2-byte length and bytes, only if flagged) and the rest of its key.
+ */
 class BTreeLeaf : public BTreeNode {
 public:
     BTreeLeaf(HeapFile &file, BlockID block_id, const KeyProfile& key_profile, bool create);
     virtual ~BTreeLeaf();
 
-    Handle find_eq(const KeyValue* key) const;  // throws if not found
-    Insertion insert(const KeyValue* key, Handle handle);
+    Handle find_eq(const NormalizedKey& key) const;  // throws if not found
+    const LeafValue& find_value(const NormalizedKey& key) const;  // throws if not found
+    Insertion insert(const NormalizedKey& key, Handle handle, const Payload& payload=Payload());
     virtual void save();
 
+    // bulk-load support: add entry (no size check, caller saves) and chain leaves left to right
+    void append(const NormalizedKey& key, Handle handle, const Payload& payload=Payload());
+    void set_next_leaf(BlockID next_leaf) { this->next_leaf = next_leaf; }
+
+    // bytes the leaf occupies in its block, now or with key added (compare to CAPACITY)
+    uint size() const;
+    uint size_with(const NormalizedKey& key, size_t payload_size=0) const;
+
+    // the entries, in key order, and the keys next to where key is or would be (nullptr at either end)
+    const std::map<NormalizedKey,LeafValue>& get_entries() const { return this->key_map; }
+    void neighbors(const NormalizedKey& key, const NormalizedKey*& before, const NormalizedKey*& after) const;
+
 protected:
     BlockID next_leaf;
-    std::map<KeyValue,Handle> key_map;
+    std::map<NormalizedKey,LeafValue> key_map;
+    size_t key_bytes;  // total length of the (uncompressed) keys in key_map
+    size_t payload_bytes;  // total length of their payloads
+
+    uint compressed_size(size_t count, size_t total, size_t prefix, size_t payloads) const;
 };
 
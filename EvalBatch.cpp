@@ -0,0 +1,97 @@
+#include <algorithm>
+#include "EvalBatch.h"
+using namespace std;
+
+const size_t EvalBatch::CAPACITY;
+
+void EvalBatch::set_columns(const ColumnNames &column_names, const DataTypes &data_types) {
+    if (column_names == this->column_names && data_types == this->data_types)
+        return;
+    this->column_names = column_names;
+    this->data_types = data_types;
+    this->ints.assign(column_names.size(), vector<int32_t>());
+    this->texts.assign(column_names.size(), vector<string>());
+    this->selection.clear();
+    this->size = 0;
+}
+
+// Keep each column's array (and its allocation) but empty it.
+void EvalBatch::clear() {
+    for (auto& values: this->ints)
+        values.clear();
+    for (auto& values: this->texts)
+        values.clear();
+    this->selection.clear();
+    this->size = 0;
+}
+
+int EvalBatch::column(const Identifier &column_name) const {
+    for (size_t i = 0; i < this->column_names.size(); i++)
+        if (this->column_names[i] == column_name)
+            return (int) i;
+    return -1;
+}
+
+void EvalBatch::append(const ValueDict &row) {
+    if (this->size == 0) {
+        ColumnNames column_names;
+        DataTypes data_types;
+        for (auto const& column: row) {
+            column_names.push_back(column.first);
+            data_types.push_back(column.second.data_type);
+        }
+        set_columns(column_names, data_types);
+    }
+    for (size_t i = 0; i < this->column_names.size(); i++) {
+        auto value = row.find(this->column_names[i]);
+        if (value == row.end())
+            throw DbRelationError("row does not have column named '" + this->column_names[i] + "'");
+        if (this->data_types[i] == ColumnAttribute::TEXT)
+            this->texts[i].push_back(value->second.s);
+        else
+            this->ints[i].push_back(value->second.n);
+    }
+    this->selection.push_back((uint16_t) this->size++);
+}
+
+ValueDict *EvalBatch::row(uint16_t position) const {
+    ValueDict *row = new ValueDict();
+    for (size_t i = 0; i < this->column_names.size(); i++) {
+        Value value;
+        if (this->data_types[i] == ColumnAttribute::TEXT) {
+            value = Value(this->texts[i][position]);
+        } else {
+            value = Value(this->ints[i][position]);
+            value.data_type = this->data_types[i];
+        }
+        (*row)[this->column_names[i]] = value;
+    }
+    return row;
+}
+
+// The arrays are swapped over rather than copied (other is refilled before it is looked at again), but
+// a column asked for twice is copied the second time.
+void EvalBatch::take(EvalBatch &other, const ColumnNames &column_names) {
+    DataTypes data_types;
+    vector<int> from;
+    for (auto const& column_name: column_names) {
+        int i = other.column(column_name);
+        if (i < 0)
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        data_types.push_back(other.data_types[i]);
+        from.push_back(i);
+    }
+    set_columns(column_names, data_types);
+    for (size_t j = 0; j < from.size(); j++) {
+        size_t first = find(from.begin(), from.end(), from[j]) - from.begin();
+        if (first < j) {
+            this->ints[j] = this->ints[first];
+            this->texts[j] = this->texts[first];
+        } else {
+            this->ints[j].swap(other.ints[from[j]]);
+            this->texts[j].swap(other.texts[from[j]]);
+        }
+    }
+    this->selection.swap(other.selection);
+    this->size = other.size;
+}
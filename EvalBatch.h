@@ -0,0 +1,42 @@
+/**
+ * @file EvalBatch.h - rows handed between vectorized EvalOperators a batch at a time, column by column
+ */
+#pragma once
+
+#include <cstdint>
+#include "storage_engine.h"
+
+typedef std::vector<ColumnAttribute::DataType> DataTypes;
+typedef std::vector<uint16_t> Selection;  // positions of rows in a batch
+
+/**
+ * @class EvalBatch - up to CAPACITY rows stored as one array per column, plus a selection vector
+ *
+ * INT and BOOLEAN columns are held as int32_t, TEXT columns as strings, so a filter is a loop over one
+ * array of one type. Filters don't move the values, they just narrow the selection (the positions of the
+ * rows still in the batch, in order); a projection just drops columns.
+ */
+class EvalBatch {
+public:
+    static const size_t CAPACITY = 1024;
+
+    EvalBatch() : column_names(), data_types(), ints(), texts(), selection(), size(0) {}
+    virtual ~EvalBatch() {}
+
+    ColumnNames column_names;
+    DataTypes data_types;
+    std::vector<std::vector<int32_t>> ints;  // per column (empty for TEXT columns)
+    std::vector<std::vector<std::string>> texts;  // per column (empty for INT and BOOLEAN columns)
+    Selection selection;  // the rows in the batch
+    size_t size;  // rows stored, selected or not
+
+    // a producer sets its columns (a no-op if the batch has them already), then clears and fills
+    void set_columns(const ColumnNames &column_names, const DataTypes &data_types);
+    void clear();  // no rows (the columns and their allocations stay)
+    bool full() const { return this->size >= CAPACITY; }
+    int column(const Identifier &column_name) const;  // position of column_name, or -1 if there is none
+
+    void append(const ValueDict &row);  // a row appended to an empty batch sets the columns
+    ValueDict *row(uint16_t position) const;  // (freed by caller)
+    void take(EvalBatch &other, const ColumnNames &column_names);  // other's rows with just column_names
+};
@@ -0,0 +1,764 @@
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include "EvalOperator.h"
+using namespace std;
+
+/*****************
+ * ValueRange
+ *****************/
+
+// Keep the tighter of the old and new bounds.
+void ValueRange::above(const Value &bound, bool inclusive) {
+    if (this->has_min && (bound < this->min || (bound == this->min && inclusive)))
+        return;
+    this->min = bound;
+    this->min_inclusive = inclusive;
+    this->has_min = true;
+}
+
+void ValueRange::below(const Value &bound, bool inclusive) {
+    if (this->has_max && (this->max < bound || (bound == this->max && inclusive)))
+        return;
+    this->max = bound;
+    this->max_inclusive = inclusive;
+    this->has_max = true;
+}
+
+bool ValueRange::holds(const Value &value) const {
+    if (this->has_min && (value < this->min || (!this->min_inclusive && value == this->min)))
+        return false;
+    if (this->has_max && (this->max < value || (!this->max_inclusive && value == this->max)))
+        return false;
+    return true;
+}
+
+// By default a batch is filled from next(), a row at a time.
+bool EvalOperator::next_batch(EvalBatch &batch) {
+    batch.clear();
+    ValueDict *row;
+    while (!batch.full() && (row = next()) != nullptr) {
+        try {
+            batch.append(*row);
+        } catch (...) {
+            delete row;
+            throw;
+        }
+        delete row;
+    }
+    return batch.size > 0;
+}
+
+/*****************
+ * TableScanOperator
+ *****************/
+
+TableScanOperator::TableScanOperator(DbRelation &table)
+        : table(table), heap(dynamic_cast<HeapTable *>(&table)), data_types(), block_id(0), block_count(0),
+          rows(nullptr), handles(nullptr), position(0) {
+    for (auto attribute: table.get_column_attributes())
+        this->data_types.push_back(attribute.get_data_type());
+}
+
+TableScanOperator::~TableScanOperator() {
+    clear();
+}
+
+void TableScanOperator::open() {
+    clear();
+    this->block_id = 0;
+    if (this->heap != nullptr)
+        this->block_count = this->heap->get_block_count();
+    else
+        this->handles = this->table.select();
+}
+
+// Hand over the current block's rows, reading the next block each time they run out.
+ValueDict *TableScanOperator::next() {
+    if (this->heap == nullptr) {
+        if (this->handles == nullptr || this->position >= this->handles->size())
+            return nullptr;
+        return this->table.project(this->handles->at(this->position++));
+    }
+    while (this->rows == nullptr || this->position >= this->rows->size()) {
+        if (this->block_id >= this->block_count)
+            return nullptr;
+        delete this->rows;
+        this->block_id++;
+        ColumnNames all;  // empty: every column
+        Handles block_handles;
+        this->rows = this->heap->scan(this->block_id, this->block_id, &all, block_handles);
+        this->position = 0;
+    }
+    return this->rows->at(this->position++);
+}
+
+void TableScanOperator::close() {
+    clear();
+}
+
+// Decode whole blocks into the batch for as long as the next one fits (a block never holds more rows
+// than a batch does, so an empty batch always takes one).
+bool TableScanOperator::next_batch(EvalBatch &batch) {
+    if (this->heap == nullptr)
+        return EvalOperator::next_batch(batch);
+    batch.set_columns(this->table.get_column_names(), this->data_types);
+    batch.clear();
+    while (this->block_id < this->block_count) {
+        int rows = this->heap->scan_columns(this->block_id + 1, EvalBatch::CAPACITY - batch.size, batch.ints,
+                                            batch.texts);
+        if (rows < 0) {
+            if (batch.size == 0)
+                throw DbRelationError("block has more rows than a batch holds");
+            break;
+        }
+        this->block_id++;
+        for (int i = 0; i < rows; i++)
+            batch.selection.push_back((uint16_t) batch.size++);
+    }
+    return batch.size > 0;
+}
+
+// Free the rows not handed over.
+void TableScanOperator::clear() {
+    if (this->rows != nullptr)
+        for (size_t i = this->position; i < this->rows->size(); i++)
+            delete this->rows->at(i);
+    delete this->rows;
+    this->rows = nullptr;
+    delete this->handles;
+    this->handles = nullptr;
+    this->position = 0;
+}
+
+/*****************
+ * LookupOperator
+ *****************/
+
+LookupOperator::LookupOperator(DbRelation &table, function<Handles *()> lookup)
+        : table(table), lookup(lookup), handles(nullptr), position(0) {
+}
+
+LookupOperator::~LookupOperator() {
+    delete this->handles;
+}
+
+void LookupOperator::open() {
+    delete this->handles;
+    this->handles = this->lookup();
+    this->position = 0;
+}
+
+ValueDict *LookupOperator::next() {
+    if (this->handles == nullptr || this->position >= this->handles->size())
+        return nullptr;
+    return this->table.project(this->handles->at(this->position++));
+}
+
+void LookupOperator::close() {
+    delete this->handles;
+    this->handles = nullptr;
+}
+
+/*****************
+ * RowsOperator
+ *****************/
+
+RowsOperator::RowsOperator(function<ValueDicts *()> fetch) : fetch(fetch), rows(nullptr), position(0) {
+}
+
+RowsOperator::~RowsOperator() {
+    close();
+}
+
+void RowsOperator::open() {
+    close();
+    this->rows = this->fetch();
+    this->position = 0;
+}
+
+ValueDict *RowsOperator::next() {
+    if (this->rows == nullptr || this->position >= this->rows->size())
+        return nullptr;
+    return this->rows->at(this->position++);
+}
+
+void RowsOperator::close() {
+    if (this->rows != nullptr)
+        for (size_t i = this->position; i < this->rows->size(); i++)
+            delete this->rows->at(i);
+    delete this->rows;
+    this->rows = nullptr;
+}
+
+/*****************
+ * SelectOperator
+ *****************/
+
+SelectOperator::SelectOperator(EvalOperator *input, const ValueDict &conjunction)
+        : input(input), conjunction(conjunction) {
+}
+
+SelectOperator::~SelectOperator() {
+    delete this->input;
+}
+
+void SelectOperator::open() {
+    this->input->open();
+}
+
+ValueDict *SelectOperator::next() {
+    ValueDict *row;
+    while ((row = this->input->next()) != nullptr) {
+        bool selected = true;
+        for (auto const& column: this->conjunction) {
+            auto value = row->find(column.first);
+            if (value == row->end()) {
+                delete row;
+                throw DbRelationError("table does not have column named '" + column.first + "'");
+            }
+            if (value->second != column.second) {
+                selected = false;
+                break;
+            }
+        }
+        if (selected)
+            return row;
+        delete row;
+    }
+    return nullptr;
+}
+
+void SelectOperator::close() {
+    this->input->close();
+}
+
+/*****************
+ * SelectInOperator
+ *****************/
+
+SelectInOperator::SelectInOperator(EvalOperator *input, const ValueLists &value_lists)
+        : input(input), value_lists(value_lists) {
+}
+
+SelectInOperator::~SelectInOperator() {
+    delete this->input;
+}
+
+void SelectInOperator::open() {
+    this->input->open();
+}
+
+ValueDict *SelectInOperator::next() {
+    ValueDict *row;
+    while ((row = this->input->next()) != nullptr) {
+        bool selected = true;
+        for (auto const& list: this->value_lists) {
+            auto value = row->find(list.first);
+            if (value == row->end()) {
+                delete row;
+                throw DbRelationError("table does not have column named '" + list.first + "'");
+            }
+            if (!binary_search(list.second.begin(), list.second.end(), value->second)) {
+                selected = false;
+                break;
+            }
+        }
+        if (selected)
+            return row;
+        delete row;
+    }
+    return nullptr;
+}
+
+void SelectInOperator::close() {
+    this->input->close();
+}
+
+/*****************
+ * SelectRangeOperator
+ *****************/
+
+SelectRangeOperator::SelectRangeOperator(EvalOperator *input, const ValueRanges &value_ranges)
+        : input(input), value_ranges(value_ranges) {
+}
+
+SelectRangeOperator::~SelectRangeOperator() {
+    delete this->input;
+}
+
+void SelectRangeOperator::open() {
+    this->input->open();
+}
+
+ValueDict *SelectRangeOperator::next() {
+    ValueDict *row;
+    while ((row = this->input->next()) != nullptr) {
+        bool selected = true;
+        for (auto const& range: this->value_ranges) {
+            auto value = row->find(range.first);
+            if (value == row->end()) {
+                delete row;
+                throw DbRelationError("table does not have column named '" + range.first + "'");
+            }
+            if (!range.second.holds(value->second)) {
+                selected = false;
+                break;
+            }
+        }
+        if (selected)
+            return row;
+        delete row;
+    }
+    return nullptr;
+}
+
+void SelectRangeOperator::close() {
+    this->input->close();
+}
+
+/*****************
+ * ProjectOperator
+ *****************/
+
+ProjectOperator::ProjectOperator(EvalOperator *input, const ColumnNames &column_names)
+        : input(input), column_names(column_names) {
+}
+
+ProjectOperator::~ProjectOperator() {
+    delete this->input;
+}
+
+void ProjectOperator::open() {
+    this->input->open();
+}
+
+ValueDict *ProjectOperator::next() {
+    ValueDict *row = this->input->next();
+    if (row == nullptr)
+        return nullptr;
+    ValueDict *projected = new ValueDict();
+    for (auto const& column_name: this->column_names) {
+        auto value = row->find(column_name);
+        if (value == row->end()) {
+            delete row;
+            delete projected;
+            throw DbRelationError("table does not have column named '" + column_name + "'");
+        }
+        (*projected)[column_name] = value->second;
+    }
+    delete row;
+    return projected;
+}
+
+void ProjectOperator::close() {
+    this->input->close();
+}
+
+/*****************
+ * LimitOperator
+ *****************/
+
+LimitOperator::LimitOperator(EvalOperator *input, size_t limit, size_t offset)
+        : input(input), limit(limit), offset(offset), count(0) {
+}
+
+LimitOperator::~LimitOperator() {
+    delete this->input;
+}
+
+// A limit of 0 takes no rows, so its input is never opened.
+void LimitOperator::open() {
+    this->count = 0;
+    if (this->limit > 0)
+        this->input->open();
+}
+
+ValueDict *LimitOperator::next() {
+    while (this->limit > 0 && this->count < this->offset) {
+        ValueDict *row = this->input->next();
+        if (row == nullptr)
+            return nullptr;
+        delete row;
+        this->count++;
+    }
+    if (this->limit == 0 || this->count >= this->offset + this->limit)
+        return nullptr;
+    ValueDict *row = this->input->next();
+    if (row != nullptr)
+        this->count++;
+    return row;
+}
+
+void LimitOperator::close() {
+    if (this->limit > 0)
+        this->input->close();
+}
+
+/*****************
+ * VectorOperator
+ *****************/
+
+VectorOperator::VectorOperator(EvalOperator *input) : input(input), batch(), cursor(0) {
+}
+
+VectorOperator::~VectorOperator() {
+    delete this->input;
+}
+
+void VectorOperator::open() {
+    this->batch.clear();
+    this->cursor = 0;
+    this->input->open();
+}
+
+ValueDict *VectorOperator::next() {
+    while (this->cursor >= this->batch.selection.size()) {
+        if (!next_batch(this->batch))
+            return nullptr;
+        this->cursor = 0;
+    }
+    return this->batch.row(this->batch.selection[this->cursor++]);
+}
+
+void VectorOperator::close() {
+    this->input->close();
+}
+
+/*****************
+ * VectorSelectOperator
+ *****************/
+
+// Narrow selection (n positions) to those where keep is true, in place; returns how many are left.
+// Branch-free, so the compiler can vectorize it.
+template <typename T, typename Keep>
+static size_t narrow(const T *values, Keep keep, uint16_t *selection, size_t n) {
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint16_t position = selection[i];
+        selection[kept] = position;
+        kept += keep(values[position]) ? 1 : 0;
+    }
+    return kept;
+}
+
+// Position of column_name in batch (which must have it).
+static int batch_column(const EvalBatch &batch, const Identifier &column_name) {
+    int i = batch.column(column_name);
+    if (i < 0)
+        throw DbRelationError("table does not have column named '" + column_name + "'");
+    return i;
+}
+
+static bool batch_type_matches(const EvalBatch &batch, int i, const Value &value) {
+    return batch.data_types[i] == value.data_type;
+}
+
+VectorSelectOperator::VectorSelectOperator(EvalOperator *input, const ValueDict &conjunction)
+        : VectorOperator(input), conjunction(conjunction) {
+}
+
+bool VectorSelectOperator::next_batch(EvalBatch &batch) {
+    while (this->input->next_batch(batch)) {
+        for (auto const& column: this->conjunction) {
+            int i = batch_column(batch, column.first);
+            size_t n = batch.selection.size();
+            if (!batch_type_matches(batch, i, column.second)) {
+                n = 0;
+            } else if (batch.data_types[i] == ColumnAttribute::TEXT) {
+                const string &value = column.second.s;
+                n = narrow(batch.texts[i].data(), [&value](const string &s) { return s == value; },
+                           batch.selection.data(), n);
+            } else {
+                int32_t value = column.second.n;
+                n = narrow(batch.ints[i].data(), [value](int32_t v) { return v == value; },
+                           batch.selection.data(), n);
+            }
+            batch.selection.resize(n);
+            if (n == 0)
+                break;
+        }
+        if (!batch.selection.empty())
+            return true;
+    }
+    return false;
+}
+
+/*****************
+ * VectorSelectInOperator
+ *****************/
+
+VectorSelectInOperator::VectorSelectInOperator(EvalOperator *input, const ValueLists &value_lists)
+        : VectorOperator(input), value_lists(value_lists) {
+}
+
+bool VectorSelectInOperator::next_batch(EvalBatch &batch) {
+    while (this->input->next_batch(batch)) {
+        for (auto const& list: this->value_lists) {
+            int i = batch_column(batch, list.first);
+            // the listed values of the column's type, as that type (still sorted)
+            vector<int32_t> ints;
+            vector<string> texts;
+            for (auto const& value: list.second) {
+                if (!batch_type_matches(batch, i, value))
+                    continue;
+                if (value.data_type == ColumnAttribute::TEXT)
+                    texts.push_back(value.s);
+                else
+                    ints.push_back(value.n);
+            }
+            size_t n = batch.selection.size();
+            if (batch.data_types[i] == ColumnAttribute::TEXT)
+                n = narrow(batch.texts[i].data(),
+                           [&texts](const string &s) { return binary_search(texts.begin(), texts.end(), s); },
+                           batch.selection.data(), n);
+            else
+                n = narrow(batch.ints[i].data(),
+                           [&ints](int32_t v) { return binary_search(ints.begin(), ints.end(), v); },
+                           batch.selection.data(), n);
+            batch.selection.resize(n);
+            if (n == 0)
+                break;
+        }
+        if (!batch.selection.empty())
+            return true;
+    }
+    return false;
+}
+
+/*****************
+ * VectorSelectRangeOperator
+ *****************/
+
+VectorSelectRangeOperator::VectorSelectRangeOperator(EvalOperator *input, const ValueRanges &value_ranges)
+        : VectorOperator(input), value_ranges(value_ranges) {
+}
+
+// A bound of another type than the column is above or below every value in it (see Value::operator<), so
+// it is dropped if that means it lets everything through, and empties the selection otherwise.
+bool VectorSelectRangeOperator::next_batch(EvalBatch &batch) {
+    while (this->input->next_batch(batch)) {
+        for (auto const& column: this->value_ranges) {
+            int i = batch_column(batch, column.first);
+            ValueRange range = column.second;
+            Value sample;
+            sample.data_type = batch.data_types[i];
+            bool empty = false;
+            if (range.has_min && !batch_type_matches(batch, i, range.min)) {
+                empty = range.min < sample ? empty : true;
+                range.has_min = false;
+            }
+            if (range.has_max && !batch_type_matches(batch, i, range.max)) {
+                empty = sample < range.max ? empty : true;
+                range.has_max = false;
+            }
+            size_t n = batch.selection.size();
+            if (empty) {
+                n = 0;
+            } else if (batch.data_types[i] == ColumnAttribute::TEXT) {
+                n = narrow(batch.texts[i].data(), [&range](const string &s) {
+                    return (!range.has_min || s > range.min.s || (range.min_inclusive && s == range.min.s))
+                           && (!range.has_max || s < range.max.s || (range.max_inclusive && s == range.max.s));
+                }, batch.selection.data(), n);
+            } else {
+                // as [low, high] over 64 bits, so exclusive bounds are a step in and can't overflow
+                int64_t low = range.has_min ? (int64_t) range.min.n + (range.min_inclusive ? 0 : 1) : INT64_MIN;
+                int64_t high = range.has_max ? (int64_t) range.max.n - (range.max_inclusive ? 0 : 1) : INT64_MAX;
+                n = narrow(batch.ints[i].data(), [low, high](int32_t v) { return v >= low && v <= high; },
+                           batch.selection.data(), n);
+            }
+            batch.selection.resize(n);
+            if (n == 0)
+                break;
+        }
+        if (!batch.selection.empty())
+            return true;
+    }
+    return false;
+}
+
+/*****************
+ * VectorProjectOperator
+ *****************/
+
+VectorProjectOperator::VectorProjectOperator(EvalOperator *input, const ColumnNames &column_names)
+        : VectorOperator(input), column_names(column_names), input_batch() {
+}
+
+bool VectorProjectOperator::next_batch(EvalBatch &batch) {
+    if (!this->input->next_batch(this->input_batch))
+        return false;
+    batch.take(this->input_batch, this->column_names);
+    return true;
+}
+
+/*****************
+ * VectorLimitOperator
+ *****************/
+
+VectorLimitOperator::VectorLimitOperator(EvalOperator *input, size_t limit, size_t offset)
+        : VectorOperator(input), limit(limit), offset(offset), count(0) {
+}
+
+// As LimitOperator, a limit of 0 never opens its input.
+void VectorLimitOperator::open() {
+    this->count = 0;
+    if (this->limit > 0) {
+        VectorOperator::open();
+    } else {
+        this->batch.clear();
+        this->cursor = 0;
+    }
+}
+
+void VectorLimitOperator::close() {
+    if (this->limit > 0)
+        VectorOperator::close();
+}
+
+// Drop the selected rows still to be skipped and any past the limit, stopping once it is reached.
+bool VectorLimitOperator::next_batch(EvalBatch &batch) {
+    while (this->limit > 0 && this->count < this->offset + this->limit && this->input->next_batch(batch)) {
+        Selection &selection = batch.selection;
+        size_t skip = min(this->offset - min(this->count, this->offset), selection.size());
+        size_t keep = min(this->offset + this->limit - this->count - skip, selection.size() - skip);
+        selection.erase(selection.begin(), selection.begin() + skip);
+        selection.resize(keep);
+        this->count += skip + keep;
+        if (!selection.empty())
+            return true;
+    }
+    return false;
+}
+
+// Every row op hands over, in order (freed by caller).
+static ValueDicts drain(EvalOperator &op) {
+    ValueDicts rows;
+    ValueDict *row;
+    op.open();
+    while ((row = op.next()) != nullptr)
+        rows.push_back(row);
+    op.close();
+    return rows;
+}
+
+// Run both operators (deleting them), and check they hand over the same count rows.
+static bool same_rows(EvalOperator *rows_op, EvalOperator *vector_op, size_t count) {
+    ValueDicts expected = drain(*rows_op), got = drain(*vector_op);
+    bool same = expected.size() == count && got.size() == count;
+    for (size_t i = 0; i < count && same; i++)
+        same = *expected[i] == *got[i];
+    for (auto const row: expected)
+        delete row;
+    for (auto const row: got)
+        delete row;
+    delete rows_op;
+    delete vector_op;
+    return same;
+}
+
+// test function -- returns true if all tests pass
+bool test_eval() {
+    ColumnNames column_names = {"id", "grp", "name", "flag"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                          ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::BOOLEAN)};
+    HeapTable table("test_eval", column_names, column_attributes);
+    table.create();
+    // several batches' worth, over many blocks
+    const int ROWS = 5000;
+    ValueDict row;
+    for (int i = 0; i < ROWS; i++) {
+        row["id"] = Value(i);
+        row["grp"] = Value(i % 7);
+        row["name"] = Value("n" + to_string(i % 13));
+        row["flag"] = Value(i % 3 == 0);
+        row["flag"].data_type = ColumnAttribute::BOOLEAN;
+        table.insert(&row);
+    }
+
+    //t1 scans: a block at a time as rows, as batches, and the rows of every handle
+    auto fetch_all = [&table]() {
+        Handles *handles = table.select();
+        ValueDicts *rows = new ValueDicts();
+        for (auto const& handle: *handles)
+            rows->push_back(table.project(handle));
+        delete handles;
+        return rows;
+    };
+    bool result = same_rows(new TableScanOperator(table),
+                            new VectorProjectOperator(new TableScanOperator(table), column_names), ROWS)
+                  && same_rows(new RowsOperator(fetch_all), new TableScanOperator(table), ROWS);
+    EvalBatch batch;
+    TableScanOperator batches(table);
+    size_t batch_count = 0, batch_rows = 0;
+    batches.open();
+    while (batches.next_batch(batch)) {
+        result = result && batch.size <= EvalBatch::CAPACITY && batch.selection.size() == batch.size;
+        batch_count++;
+        batch_rows += batch.size;
+    }
+    batches.close();
+    result = result && batch_count > 1 && batch_rows == (size_t) ROWS;
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 selections, each narrowing a selection that an earlier one has already narrowed
+    ValueDict conjunction;
+    conjunction["grp"] = Value(3);
+    conjunction["name"] = Value("n5");  // id % 91 == 31
+    ValueLists value_lists;
+    value_lists["id"] = {Value(3), Value(31), Value(122), Value(1004), Value(1031), Value(4126), Value(7000)};
+    value_lists["name"] = {Value("n5"), Value("n6"), Value("n9")};  // 31, 122 and 4126
+    ValueRanges value_ranges;
+    value_ranges["id"].above(Value(1000), true);
+    value_ranges["id"].below(Value(4000), false);
+    value_ranges["name"].above(Value("n5"), false);  // n6 to n9
+    auto ranged = [&table, &value_ranges](bool vectorized) -> EvalOperator * {
+        if (vectorized)
+            return new VectorSelectRangeOperator(new TableScanOperator(table), value_ranges);
+        return new SelectRangeOperator(new TableScanOperator(table), value_ranges);
+    };
+    size_t in_range = 0, in_range_and_grp = 0;
+    for (int i = 1000; i < 4000; i++) {
+        if (i % 13 >= 6 && i % 13 <= 9) {
+            in_range++;
+            in_range_and_grp += i % 7 == 3;
+        }
+    }
+    ValueDict grp;
+    grp["grp"] = Value(3);
+    result = result && same_rows(new SelectOperator(new TableScanOperator(table), conjunction),
+                                 new VectorSelectOperator(new TableScanOperator(table), conjunction),
+                                 ROWS / 91 + (ROWS % 91 > 31))
+             && same_rows(new SelectInOperator(new TableScanOperator(table), value_lists),
+                          new VectorSelectInOperator(new TableScanOperator(table), value_lists), 3)
+             && same_rows(ranged(false), ranged(true), in_range)
+             && same_rows(new SelectOperator(ranged(false), grp), new VectorSelectOperator(ranged(true), grp),
+                          in_range_and_grp);
+    cout << (result ? "passed t2" : "failed t2") << endl;
+
+    //t3 projections, of the rows of a lookup too (batched a row at a time)
+    ColumnNames projected = {"name", "id", "name"};
+    ValueDict where;
+    where["grp"] = Value(5);
+    auto lookup = [&table, &where]() { return table.select(&where); };
+    result = result && same_rows(new ProjectOperator(new TableScanOperator(table), projected),
+                                 new VectorProjectOperator(new TableScanOperator(table), projected), ROWS)
+             && same_rows(new ProjectOperator(new LookupOperator(table, lookup), projected),
+                          new VectorProjectOperator(new LookupOperator(table, lookup), projected), ROWS / 7);
+    cout << (result ? "passed t3" : "failed t3") << endl;
+
+    //t4 limits: across batches, ending inside one, beginning past the input's end, and taking nothing
+    size_t limits[][3] = {{2000, 1500, 2000}, {10, 1020, 10}, {100, ROWS - 30, 30}, {10, ROWS + 5, 0}, {0, 0, 0}};
+    for (auto const& limit: limits)
+        result = result && same_rows(new LimitOperator(new TableScanOperator(table), limit[0], limit[1]),
+                                     new VectorLimitOperator(new TableScanOperator(table), limit[0], limit[1]),
+                                     limit[2]);
+    // and over a selection, whose batches are only partly selected
+    result = result && same_rows(new LimitOperator(ranged(false), 700, 3),
+                                 new VectorLimitOperator(ranged(true), 700, 3), min(in_range - 3, (size_t) 700));
+    cout << (result ? "passed t4" : "failed t4") << endl;
+
+    table.drop();
+    return result;
+}
@@ -0,0 +1,319 @@
+/**
+ * @file EvalOperator.h - the operators an EvalPlan is run with, each pulling its rows from the one below:
+ * EvalOperator: open/next/close, one row at a time
+ * TableScanOperator: every row of a table, reading one block at a time
+ * LookupOperator: the rows at the handles an index lookup finds
+ * RowsOperator: rows an index answers with directly (index-only scans)
+ * SelectOperator: the rows meeting an equality conjunction
+ * SelectInOperator: the rows with one of the listed values in each listed column
+ * SelectRangeOperator: the rows with a value in range in each column given a range
+ * ProjectOperator: each row cut down to some of its columns
+ * LimitOperator: the first rows of its input (after skipping some), reading no further
+ * VectorOperator: an operator that works a batch at a time (see EvalBatch)
+ * VectorSelectOperator, VectorSelectInOperator, VectorSelectRangeOperator, VectorProjectOperator,
+ *     VectorLimitOperator: the same as the row-at-a-time ones
+ */
+#pragma once
+
+#include <functional>
+#include "storage_engine.h"
+#include "heap_storage.h"
+#include "EvalBatch.h"
+
+typedef std::map<Identifier, std::vector<Value>> ValueLists;  // column -> values it may have (sorted), as for IN
+
+/**
+ * @class ValueRange - the values between two bounds, each inclusive or not (or no bound at all)
+ */
+class ValueRange {
+public:
+    ValueRange() : min(), max(), has_min(false), has_max(false), min_inclusive(false), max_inclusive(false) {}
+
+    Value min;
+    Value max;
+    bool has_min;
+    bool has_max;
+    bool min_inclusive;
+    bool max_inclusive;
+
+    void above(const Value &bound, bool inclusive);  // narrow to values > bound (>= if inclusive)
+    void below(const Value &bound, bool inclusive);  // narrow to values < bound (<= if inclusive)
+    bool holds(const Value &value) const;
+};
+
+typedef std::map<Identifier, ValueRange> ValueRanges;  // column -> range its values must be in, as for < or >
+
+/**
+ * @class EvalOperator - iterator over the rows of a (sub)query
+ *
+ * open() gets ready to produce the rows from the first, next() hands them over one at a time, and
+ * close() lets go of whatever the operator still holds. An operator holds at most a block's worth of
+ * rows (or the handles an index lookup found), so the memory a query needs doesn't grow with its result,
+ * and the first row is ready without reading the whole table. Operators with an input own it and pass
+ * open and close down to it. An operator can be opened again after it is closed to start over.
+ */
+class EvalOperator {
+public:
+    EvalOperator() {}
+    virtual ~EvalOperator() {}
+
+    virtual void open() = 0;
+    virtual ValueDict *next() = 0;  // the next row (freed by caller), or nullptr once there are no more
+    virtual void close() = 0;
+
+    // the next rows, as many as fit in batch (just its selected ones count); false once there are no more
+    virtual bool next_batch(EvalBatch &batch);
+};
+
+/**
+ * @class TableScanOperator - every row of a table, all columns
+ *
+ * A HeapTable is read a block at a time; any other relation is selected into handles first. A HeapTable's
+ * batches are decoded from its blocks straight into the column arrays, with no rows built on the way.
+ */
+class TableScanOperator : public EvalOperator {
+public:
+    TableScanOperator(DbRelation &table);
+    virtual ~TableScanOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+    virtual bool next_batch(EvalBatch &batch);
+
+protected:
+    DbRelation &table;
+    HeapTable *heap;  // table, if it can be scanned a block at a time
+    DataTypes data_types;  // of the table's columns, for its batches
+    BlockID block_id;  // the block rows holds
+    BlockID block_count;
+    ValueDicts *rows;  // the rest of the current block's rows
+    Handles *handles;  // every handle, if not a HeapTable
+    size_t position;  // next one to hand over from rows or handles
+
+    void clear();
+};
+
+/**
+ * @class LookupOperator - the rows at the handles lookup finds (looked up at open), all columns
+ */
+class LookupOperator : public EvalOperator {
+public:
+    LookupOperator(DbRelation &table, std::function<Handles *()> lookup);
+    virtual ~LookupOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+protected:
+    DbRelation &table;
+    std::function<Handles *()> lookup;
+    Handles *handles;
+    size_t position;
+};
+
+/**
+ * @class RowsOperator - the rows fetch gets (at open)
+ */
+class RowsOperator : public EvalOperator {
+public:
+    RowsOperator(std::function<ValueDicts *()> fetch);
+    virtual ~RowsOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+protected:
+    std::function<ValueDicts *()> fetch;
+    ValueDicts *rows;
+    size_t position;
+};
+
+/**
+ * @class SelectOperator - the input rows whose value in each column of conjunction is the one given
+ */
+class SelectOperator : public EvalOperator {
+public:
+    SelectOperator(EvalOperator *input, const ValueDict &conjunction);
+    virtual ~SelectOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+protected:
+    EvalOperator *input;
+    ValueDict conjunction;
+};
+
+/**
+ * @class SelectInOperator - the input rows whose value in each column of value_lists is one of its values
+ */
+class SelectInOperator : public EvalOperator {
+public:
+    SelectInOperator(EvalOperator *input, const ValueLists &value_lists);
+    virtual ~SelectInOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+protected:
+    EvalOperator *input;
+    ValueLists value_lists;
+};
+
+/**
+ * @class SelectRangeOperator - the input rows whose value in each column of value_ranges is in its range
+ */
+class SelectRangeOperator : public EvalOperator {
+public:
+    SelectRangeOperator(EvalOperator *input, const ValueRanges &value_ranges);
+    virtual ~SelectRangeOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+protected:
+    EvalOperator *input;
+    ValueRanges value_ranges;
+};
+
+/**
+ * @class ProjectOperator - each input row with just column_names
+ */
+class ProjectOperator : public EvalOperator {
+public:
+    ProjectOperator(EvalOperator *input, const ColumnNames &column_names);
+    virtual ~ProjectOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+protected:
+    EvalOperator *input;
+    ColumnNames column_names;
+};
+
+/**
+ * @class LimitOperator - the limit input rows after the first offset, asking its input for no more
+ */
+class LimitOperator : public EvalOperator {
+public:
+    LimitOperator(EvalOperator *input, size_t limit, size_t offset=0);
+    virtual ~LimitOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+protected:
+    EvalOperator *input;
+    size_t limit;
+    size_t offset;
+    size_t count;  // rows handed over (or skipped) so far
+};
+
+/**
+ * @class VectorOperator - operator whose work is done in next_batch
+ *
+ * Filters and projections over a batch are typed loops over its column arrays, with no per-row virtual
+ * calls, map lookups or Value copies. next() is only for the operator at the top: it hands over the
+ * rows of its own batches one at a time.
+ */
+class VectorOperator : public EvalOperator {
+public:
+    VectorOperator(EvalOperator *input);
+    virtual ~VectorOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+    virtual bool next_batch(EvalBatch &batch) = 0;
+
+protected:
+    EvalOperator *input;
+    EvalBatch batch;  // for next()
+    size_t cursor;  // next one of batch's selection for next() to hand over
+};
+
+/**
+ * @class VectorSelectOperator - SelectOperator a batch at a time
+ */
+class VectorSelectOperator : public VectorOperator {
+public:
+    VectorSelectOperator(EvalOperator *input, const ValueDict &conjunction);
+    virtual ~VectorSelectOperator() {}
+
+    virtual bool next_batch(EvalBatch &batch);
+
+protected:
+    ValueDict conjunction;
+};
+
+/**
+ * @class VectorSelectInOperator - SelectInOperator a batch at a time
+ */
+class VectorSelectInOperator : public VectorOperator {
+public:
+    VectorSelectInOperator(EvalOperator *input, const ValueLists &value_lists);
+    virtual ~VectorSelectInOperator() {}
+
+    virtual bool next_batch(EvalBatch &batch);
+
+protected:
+    ValueLists value_lists;
+};
+
+/**
+ * @class VectorSelectRangeOperator - SelectRangeOperator a batch at a time
+ */
+class VectorSelectRangeOperator : public VectorOperator {
+public:
+    VectorSelectRangeOperator(EvalOperator *input, const ValueRanges &value_ranges);
+    virtual ~VectorSelectRangeOperator() {}
+
+    virtual bool next_batch(EvalBatch &batch);
+
+protected:
+    ValueRanges value_ranges;
+};
+
+/**
+ * @class VectorProjectOperator - ProjectOperator a batch at a time
+ */
+class VectorProjectOperator : public VectorOperator {
+public:
+    VectorProjectOperator(EvalOperator *input, const ColumnNames &column_names);
+    virtual ~VectorProjectOperator() {}
+
+    virtual bool next_batch(EvalBatch &batch);
+
+protected:
+    ColumnNames column_names;
+    EvalBatch input_batch;
+};
+
+/**
+ * @class VectorLimitOperator - LimitOperator a batch at a time (the last batch read can go past the limit)
+ */
+class VectorLimitOperator : public VectorOperator {
+public:
+    VectorLimitOperator(EvalOperator *input, size_t limit, size_t offset=0);
+    virtual ~VectorLimitOperator() {}
+
+    virtual void open();
+    virtual bool next_batch(EvalBatch &batch);
+    virtual void close();
+
+protected:
+    size_t limit;
+    size_t offset;
+    size_t count;  // rows handed over (or skipped) so far
+};
+
+bool test_eval();
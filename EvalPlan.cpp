@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cmath>
+#include <memory>
 #include "EvalPlan.h"
+using namespace std;
 
 
 class Dummy : public DbRelation {
@@ -21,27 +25,141 @@ public:
 };
 
 EvalPlan::EvalPlan(PlanType type, EvalPlan *relation)
-        : type(type), relation(relation), projection(nullptr), select_conjunction(nullptr), table(Dummy::one()) {
+        : type(type), relation(relation), projection(nullptr), select_conjunction(nullptr), value_lists(nullptr),
+          value_ranges(nullptr), table(Dummy::one()), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
 }
 
 EvalPlan::EvalPlan(ColumnNames *projection, EvalPlan *relation)
-        : type(Project), relation(relation), projection(projection), select_conjunction(nullptr), table(Dummy::one()) {
+        : type(Project), relation(relation), projection(projection), select_conjunction(nullptr), value_lists(nullptr),
+          value_ranges(nullptr), table(Dummy::one()), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
 }
 
 EvalPlan::EvalPlan(ValueDict* conjunction, EvalPlan *relation)
-        : type(Select), relation(relation), projection(nullptr), select_conjunction(conjunction), table(Dummy::one()) {
+        : type(Select), relation(relation), projection(nullptr), select_conjunction(conjunction), value_lists(nullptr),
+          value_ranges(nullptr), table(Dummy::one()), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
 }
 
-EvalPlan::EvalPlan(DbRelation &table)
-        : type(TableScan), relation(nullptr), projection(nullptr), select_conjunction(nullptr), table(table) {
+EvalPlan::EvalPlan(ValueLists* value_lists, EvalPlan *relation)
+        : type(SelectIn), relation(relation), projection(nullptr), select_conjunction(nullptr), value_lists(value_lists),
+          value_ranges(nullptr), table(Dummy::one()), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(ValueRanges* value_ranges, EvalPlan *relation)
+        : type(SelectRange), relation(relation), projection(nullptr), select_conjunction(nullptr), value_lists(nullptr),
+          value_ranges(value_ranges), table(Dummy::one()), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table, DbIndexes indexes, TableStats stats)
+        : type(TableScan), relation(nullptr), projection(nullptr), select_conjunction(nullptr), value_lists(nullptr),
+          value_ranges(nullptr), table(table), indexes(indexes), stats(stats), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(PlanType type, DbRelation &table, DbIndex *index, ValueDict *key, ValueDict *residual)
+        : type(type), relation(nullptr), projection(nullptr), select_conjunction(residual), value_lists(nullptr),
+          value_ranges(nullptr), table(table), indexes(), stats(), index(index), index_key(key),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table, DbIndex *index, ValueDict *min, ValueDict *max, ValueDict *residual)
+        : type(IndexRangeScan), relation(nullptr), projection(nullptr), select_conjunction(residual), value_lists(nullptr),
+          value_ranges(nullptr), table(table), indexes(), stats(), index(index), index_key(nullptr),
+          index_min(min), index_max(max), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table, DbIndex *index, ValueDicts *keys, ValueDict *residual)
+        : type(IndexProbes), relation(nullptr), projection(nullptr), select_conjunction(residual), value_lists(nullptr),
+          value_ranges(nullptr), table(table), indexes(), stats(), index(index), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(keys), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table, BitmapProbes probes, ValueDict *residual)
+        : type(BitmapScan), relation(nullptr), projection(nullptr), select_conjunction(residual), value_lists(nullptr),
+          value_ranges(nullptr), table(table), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(probes), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(DbRelation &table, IndexProbeKeys probes, ValueDict *residual)
+        : type(IndexIntersection), relation(nullptr), projection(nullptr), select_conjunction(residual), value_lists(nullptr),
+          value_ranges(nullptr), table(table), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(probes),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true),
+          merge(false), sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(EvalPlan *left, EvalPlan *right, ColumnNames left_keys, ColumnNames right_keys,
+                   Identifier left_prefix, Identifier right_prefix)
+        : type(Join), relation(left), projection(nullptr), select_conjunction(nullptr), value_lists(nullptr),
+          value_ranges(nullptr), table(Dummy::one()), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(right), left_keys(left_keys), right_keys(right_keys), left_prefix(left_prefix),
+          right_prefix(right_prefix), build_right(true), merge(false),
+          sort_keys(), group_by(), aggregates(), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(SortKeys sort_keys, EvalPlan *relation, size_t limit)
+        : type(Sort), relation(relation), projection(nullptr), select_conjunction(nullptr), value_lists(nullptr),
+          value_ranges(nullptr), table(Dummy::one()), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true), merge(false),
+          sort_keys(sort_keys), group_by(), aggregates(), limit(limit), offset(0) {
+}
+
+EvalPlan::EvalPlan(ColumnNames group_by, Aggregates aggregates, EvalPlan *relation)
+        : type(Group), relation(relation), projection(nullptr), select_conjunction(nullptr), value_lists(nullptr),
+          value_ranges(nullptr), table(Dummy::one()), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true), merge(false),
+          sort_keys(), group_by(group_by), aggregates(aggregates), limit(0), offset(0) {
+}
+
+EvalPlan::EvalPlan(size_t limit, size_t offset, EvalPlan *relation)
+        : type(Limit), relation(relation), projection(nullptr), select_conjunction(nullptr), value_lists(nullptr),
+          value_ranges(nullptr), table(Dummy::one()), indexes(), stats(), index(nullptr), index_key(nullptr),
+          index_min(nullptr), index_max(nullptr), index_keys(nullptr), bitmap_probes(), intersect_probes(),
+          right(nullptr), left_keys(), right_keys(), left_prefix(), right_prefix(), build_right(true), merge(false),
+          sort_keys(), group_by(), aggregates(), limit(limit), offset(offset) {
 }
 
 EvalPlan::EvalPlan(const EvalPlan *other)
-        : type(other->type), table(other->table) {
+        : type(other->type), table(other->table), indexes(other->indexes), stats(other->stats), index(other->index),
+          left_keys(other->left_keys), right_keys(other->right_keys), left_prefix(other->left_prefix),
+          right_prefix(other->right_prefix), build_right(other->build_right), merge(other->merge),
+          sort_keys(other->sort_keys), group_by(other->group_by), aggregates(other->aggregates), limit(other->limit),
+          offset(other->offset) {
     if (other->relation != nullptr)
         relation = new EvalPlan(other->relation);
     else
         relation = nullptr;
+    if (other->right != nullptr)
+        right = new EvalPlan(other->right);
+    else
+        right = nullptr;
     if (other->projection != nullptr)
         projection = new ColumnNames(*other->projection);
     else
@@ -50,39 +168,1164 @@ EvalPlan::EvalPlan(const EvalPlan *other)
         select_conjunction = new ValueDict(*other->select_conjunction);
     else
         select_conjunction = nullptr;
+    if (other->value_lists != nullptr)
+        value_lists = new ValueLists(*other->value_lists);
+    else
+        value_lists = nullptr;
+    if (other->value_ranges != nullptr)
+        value_ranges = new ValueRanges(*other->value_ranges);
+    else
+        value_ranges = nullptr;
+    if (other->index_key != nullptr)
+        index_key = new ValueDict(*other->index_key);
+    else
+        index_key = nullptr;
+    if (other->index_min != nullptr)
+        index_min = new ValueDict(*other->index_min);
+    else
+        index_min = nullptr;
+    if (other->index_max != nullptr)
+        index_max = new ValueDict(*other->index_max);
+    else
+        index_max = nullptr;
+    if (other->index_keys != nullptr) {
+        index_keys = new ValueDicts();
+        for (auto const key: *other->index_keys)
+            index_keys->push_back(new ValueDict(*key));
+    } else {
+        index_keys = nullptr;
+    }
+    for (auto const& probe: other->bitmap_probes)
+        bitmap_probes.push_back(BitmapProbes::value_type(probe.first, new ValueDict(*probe.second)));
+    for (auto const& probe: other->intersect_probes)
+        intersect_probes.push_back(IndexProbeKeys::value_type(probe.first, new ValueDict(*probe.second)));
 }
 
 EvalPlan::~EvalPlan() {
     delete relation;
+    delete right;
     delete projection;
     delete select_conjunction;
+    delete value_lists;
+    delete value_ranges;
+    delete index_key;
+    delete index_min;
+    delete index_max;
+    if (index_keys != nullptr)
+        for (auto const key: *index_keys)
+            delete key;
+    delete index_keys;
+    for (auto const& probe: bitmap_probes)
+        delete probe.second;
+    for (auto const& probe: intersect_probes)
+        delete probe.second;
 }
 
 
+// Cost model, in units of one sequential page read (the ratios are the usual ones)
+static const double RANDOM_PAGE_COST = 4.0;  // a page read out of order, as for a row an index found
+static const double CPU_ROW_COST = 0.01;  // unmarshalling a row
+static const double CPU_ENTRY_COST = 0.005;  // reading an index entry
+static const double CPU_OPERATOR_COST = 0.0025;  // testing a row against a selection, or a handle against another
+static const double DEFAULT_PROBE_PAGES = 2.0;  // pages read to find a key in an index that keeps no statistics
+
+// Answer a selection on a table from the table's indices where we can: with an index-only scan if
+// the query is a projection and an index covers it, otherwise by combining bitmap indices, otherwise
+// by probing an index once for each key an IN selection allows, otherwise by looking up one key or one
+// range of keys in an index. A range selection stays on top of whichever scan answers the rest.
+// Once the table has been analyzed, every one of these that applies is costed instead, along with the
+// full scan and intersecting the handles of several indices, and the cheapest is taken. The inputs of
+// a join, and of a grouping, are each optimized on their own, as is what a sort or a limit is of.
 EvalPlan *EvalPlan::optimize() {
-    return new EvalPlan(this);  // For now, we don't know how to do anything better
+    if (this->type == Limit)
+        return new EvalPlan(this->limit, this->offset, this->relation->optimize());
+    if (this->type == Join || ((this->type == ProjectAll || this->type == Project) && this->relation->type == Join))
+        return optimize_join();
+    if (this->type == Sort || ((this->type == ProjectAll || this->type == Project) && this->relation->type == Sort))
+        return optimize_sort();
+    if (this->type == Group || ((this->type == ProjectAll || this->type == Project) && this->relation->type == Group)) {
+        EvalPlan *optimized = new EvalPlan(this);
+        EvalPlan *group = optimized->type == Group ? optimized : optimized->relation;
+        EvalPlan *input = group->relation->optimize();
+        delete group->relation;
+        group->relation = input;
+        return optimized;
+    }
+    const EvalPlan *scan = table_scan();
+    const TableStats *stats = scan != nullptr && scan->stats.known ? &scan->stats : nullptr;
+    EvalPlan *best = nullptr;
+    double best_cost = 0.0, rows;
+    if (stats != nullptr) {
+        best = new EvalPlan(this);
+        best_cost = best->estimate(*stats, rows);
+    }
+    for (Rule rule: {IndexOnlyRule, BitmapRule, ProbesRule, IndexRule, IntersectionRule}) {
+        EvalPlan *candidate = rewrite(rule);
+        if (candidate == nullptr)
+            continue;
+        if (stats == nullptr)
+            return candidate;
+        double cost = candidate->estimate(*stats, rows);
+        if (cost < best_cost) {
+            delete best;
+            best = candidate;
+            best_cost = cost;
+        } else {
+            delete candidate;
+        }
+    }
+    return best != nullptr ? best : new EvalPlan(this);
 }
 
+// A copy of the sort (or of the projection of it) with its input optimized on its own. If every key is
+// ascending, the sort is dropped when the input comes in that order anyway, and otherwise costed
+// against reading the input in order from an index.
+EvalPlan *EvalPlan::optimize_sort() const {
+    EvalPlan *optimized = new EvalPlan(this);
+    EvalPlan *&sort = optimized->type == Sort ? optimized : optimized->relation;
+    EvalPlan *input = sort->relation->optimize();
+    ColumnNames keys;
+    for (auto const& key: sort->sort_keys)
+        if (!key.descending)
+            keys.push_back(key.column);
+    if (keys.size() < sort->sort_keys.size()) {
+        delete sort->relation;
+        sort->relation = input;
+        return optimized;
+    }
+    double cost, rows;
+    EvalPlan *ordered = ordered_input(sort->relation, input, keys, cost, rows);
+    if (ordered->type == Sort)
+        ordered->limit = sort->limit;
+    delete input;
+    delete sort;
+    sort = ordered;
+    return optimized;
+}
+
+// The TableScan at the bottom of a chain of projections and selections, or nullptr if there is none.
+const EvalPlan *EvalPlan::table_scan() const {
+    const EvalPlan *plan = this;
+    while (plan->type == ProjectAll || plan->type == Project || plan->type == Select || plan->type == SelectIn
+           || plan->type == SelectRange)
+        plan = plan->relation;
+    return plan->type == TableScan ? plan : nullptr;
+}
+
+// A copy of the plan with the scan the rule makes in place of the selection it answers (under any
+// range selection, except for IndexRule, which answers that too), or nullptr if the rule doesn't apply.
+EvalPlan *EvalPlan::rewrite(Rule rule) const {
+    EvalPlan *rewritten = new EvalPlan(this);
+    bool projected = rewritten->type == Project || rewritten->type == ProjectAll;
+    EvalPlan *&selection = projected ? rewritten->relation : rewritten;
+    EvalPlan *&filtered = selection->type == SelectRange ? selection->relation : selection;
+    EvalPlan *&replaced = rule == IndexRule ? selection : filtered;
+    EvalPlan *scan = nullptr;
+    switch (rule) {
+        case IndexOnlyRule:
+            if (projected && filtered->type == Select && &filtered == &selection)
+                scan = rewritten->index_only_scan();
+            break;
+        case BitmapRule:
+            if (filtered->type == Select)
+                scan = filtered->bitmap_scan();
+            break;
+        case ProbesRule:
+            if (filtered->type == Select || filtered->type == SelectIn)
+                scan = filtered->index_probes();
+            break;
+        case IndexRule:
+            if (selection->type == Select || selection->type == SelectIn || selection->type == SelectRange)
+                scan = selection->index_scan();
+            break;
+        case IntersectionRule:
+            if (filtered->type == Select)
+                scan = filtered->index_intersection();
+            break;
+    }
+    if (scan == nullptr) {
+        delete rewritten;
+        return nullptr;
+    }
+    // the scan keeps the table's statistics, for estimating it as the input of a join
+    EvalPlan *leaf = scan;
+    while (leaf->relation != nullptr)
+        leaf = leaf->relation;
+    leaf->stats = table_scan()->stats;
+    delete replaced;
+    replaced = scan;
+    return rewritten;
+}
+
+// For a projection of an equality selection on a table: an IndexOnlyScan of an index that has its whole
+// key in the selection and holds every column the query needs (and, if it is a partial index, every
+// row the selection can match). Returns nullptr if there is none.
+EvalPlan *EvalPlan::index_only_scan() const {
+    if (this->relation->relation->type != TableScan)
+        return nullptr;
+    EvalPlan *scan = this->relation->relation;
+    ValueDict *conjunction = this->relation->select_conjunction;
+    ColumnNames needed = this->type == Project ? *this->projection : scan->table.get_column_names();
+    for (auto const& column: *conjunction)
+        if (find(needed.begin(), needed.end(), column.first) == needed.end())
+            needed.push_back(column.first);
+
+    for (auto const index: scan->indexes) {
+        const ColumnNames& key_columns = index->get_key_columns();
+        bool keyed = true;
+        for (auto const& column: key_columns)
+            if (conjunction->find(column) == conjunction->end())
+                keyed = false;
+        if (!keyed || !index->covers(needed) || !index->implied_by(*conjunction))
+            continue;
+
+        ValueDict *key = new ValueDict();
+        ValueDict *residual = new ValueDict(*conjunction);
+        for (auto const& column: key_columns) {
+            (*key)[column] = conjunction->at(column);
+            residual->erase(column);
+        }
+        if (residual->empty()) {
+            delete residual;
+            residual = nullptr;
+        }
+        return new EvalPlan(IndexOnlyScan, scan->table, index, key, residual);
+    }
+    return nullptr;
+}
+
+// For an equality selection on a table: a BitmapScan ANDing the bitmaps of every bitmap index that has
+// its whole key in the selection, leaving the rest of the selection as a residual. Returns nullptr if
+// there are no such indices.
+EvalPlan *EvalPlan::bitmap_scan() const {
+    if (this->relation->type != TableScan)
+        return nullptr;
+    EvalPlan *scan = this->relation;
+    BitmapProbes probes;
+    ValueDict *residual = new ValueDict(*this->select_conjunction);
+    for (auto const index: scan->indexes) {
+        const BitmapIndex *bitmap_index = dynamic_cast<const BitmapIndex *>(index);
+        if (bitmap_index == nullptr)
+            continue;
+        const ColumnNames& key_columns = bitmap_index->get_key_columns();
+        bool keyed = true;
+        for (auto const& column: key_columns)
+            if (this->select_conjunction->find(column) == this->select_conjunction->end())
+                keyed = false;
+        if (!keyed)
+            continue;
+        ValueDict *key = new ValueDict();
+        for (auto const& column: key_columns) {
+            (*key)[column] = this->select_conjunction->at(column);
+            residual->erase(column);
+        }
+        probes.push_back(BitmapProbes::value_type(bitmap_index, key));
+    }
+    if (probes.empty()) {
+        delete residual;
+        return nullptr;
+    }
+    if (residual->empty()) {
+        delete residual;
+        residual = nullptr;
+    }
+    return new EvalPlan(scan->table, probes, residual);
+}
+
+// For an IN selection (with or without an equality selection above it) on a table: an IndexProbes of
+// an index whose key columns each have an IN list or an equality, at least one of them an IN list, with
+// a key for every combination of their values. What the keys don't cover is left as a residual and, for
+// other IN lists, a SelectIn above the probes. Returns nullptr if there is no such index or it would take
+// more than MAX_PROBES keys.
+EvalPlan *EvalPlan::index_probes() const {
+    const EvalPlan *select_in = this->type == Select ? this->relation : this;
+    if (select_in->type != SelectIn || select_in->relation->type != TableScan)
+        return nullptr;
+    EvalPlan *scan = select_in->relation;
+    ValueDict conjunction;
+    if (this->type == Select)
+        conjunction = *this->select_conjunction;
+    const ValueLists &lists = *select_in->value_lists;
+    ValueDict implied = conjunction;  // a one-value IN list is an equality, too
+    for (auto const& list: lists)
+        if (list.second.size() == 1)
+            implied[list.first] = list.second.front();
+
+    for (auto const index: scan->indexes) {
+        const ColumnNames& key_columns = index->get_key_columns();
+        bool keyed = true, listed = false;
+        size_t probes = 1;
+        for (auto const& column: key_columns) {
+            if (lists.find(column) != lists.end()) {
+                listed = true;
+                probes *= lists.at(column).size();
+                if (probes > MAX_PROBES)
+                    keyed = false;
+            } else if (conjunction.find(column) == conjunction.end()) {
+                keyed = false;
+            }
+            if (!keyed)
+                break;
+        }
+        if (!keyed || !listed || !index->implied_by(implied))
+            continue;
+
+        // every combination of the key columns' values, the last column varying fastest
+        ValueDicts *keys = new ValueDicts();
+        keys->push_back(new ValueDict());
+        ValueDict *residual = new ValueDict(conjunction);
+        ValueLists *rest = new ValueLists(lists);
+        for (auto const& column: key_columns) {
+            if (lists.find(column) == lists.end()) {
+                for (auto const key: *keys)
+                    (*key)[column] = conjunction.at(column);
+                residual->erase(column);
+                continue;
+            }
+            ValueDicts *expanded = new ValueDicts();
+            for (auto const key: *keys) {
+                for (auto const& value: lists.at(column)) {
+                    ValueDict *longer = new ValueDict(*key);
+                    (*longer)[column] = value;
+                    expanded->push_back(longer);
+                }
+                delete key;
+            }
+            delete keys;
+            keys = expanded;
+            rest->erase(column);
+        }
+        if (residual->empty()) {
+            delete residual;
+            residual = nullptr;
+        }
+        EvalPlan *plan = new EvalPlan(scan->table, index, keys, residual);
+        if (rest->empty())
+            delete rest;
+        else
+            plan = new EvalPlan(rest, plan);
+        return plan;
+    }
+    return nullptr;
+}
+
+// For a stack of Select, SelectIn and SelectRange over a table: an IndexScan of an index that has its
+// whole key in the equalities (a one-value IN list counts), or failing that an IndexRangeScan of an
+// ordered single-column index on a column with a range. The handles the index finds are narrowed by the
+// rest of the equalities as a residual, and by SelectIn and SelectRange above the scan for the rest of
+// the IN lists and (always, since the index's bounds are inclusive) the ranges. A partial index is only
+// used if the equalities imply its condition. Returns nullptr if there is no such index.
+EvalPlan *EvalPlan::index_scan() const {
+    ValueDict conjunction;
+    ValueLists lists;
+    ValueRanges ranges;
+    const EvalPlan *scan = selections(conjunction, lists, ranges);
+    if (scan == nullptr)
+        return nullptr;
+    ValueDict implied = conjunction;
+    for (auto const& list: lists)
+        if (list.second.size() == 1 && implied.find(list.first) == implied.end())
+            implied[list.first] = list.second.front();
+
+    EvalPlan *found = nullptr;
+    for (auto const index: scan->indexes) {
+        const ColumnNames& key_columns = index->get_key_columns();
+        bool keyed = true;
+        for (auto const& column: key_columns)
+            if (implied.find(column) == implied.end())
+                keyed = false;
+        if (!keyed || !index->implied_by(implied))
+            continue;
+        ValueDict *key = new ValueDict();
+        for (auto const& column: key_columns) {
+            (*key)[column] = implied.at(column);
+            if (conjunction.find(column) == conjunction.end())
+                lists.erase(column);
+            else
+                conjunction.erase(column);
+        }
+        found = new EvalPlan(IndexScan, scan->table, index, key, nullptr);
+        break;
+    }
+    for (auto const index: scan->indexes) {
+        if (found != nullptr)
+            break;
+        const ColumnNames& key_columns = index->get_key_columns();
+        if (!index->has_range() || key_columns.size() != 1 || ranges.find(key_columns.front()) == ranges.end()
+            || !index->implied_by(implied))
+            continue;
+        found = range_scan(scan, index, ranges);
+    }
+    if (found == nullptr)
+        return nullptr;
+    return above(found, conjunction, lists, ranges);
+}
+
+// For a stack of Select, SelectIn and SelectRange over a table: an IndexRangeScan of an index whose range
+// comes back in key order and whose key starts with keys, so that the rows come sorted on keys. It is
+// bounded by the range selection on the key if there is one and the index has a single column, and
+// otherwise reads the whole index; the selections all stay above it. A partial index is only used if
+// the equalities imply its condition. Returns nullptr if there is no such index.
+EvalPlan *EvalPlan::ordered_scan(const ColumnNames &keys) const {
+    ValueDict conjunction;
+    ValueLists lists;
+    ValueRanges ranges;
+    const EvalPlan *scan = selections(conjunction, lists, ranges);
+    if (scan == nullptr || keys.empty())
+        return nullptr;
+    for (auto const index: scan->indexes) {
+        const ColumnNames& key_columns = index->get_key_columns();
+        if (!index->has_range() || !index->range_in_order() || key_columns.size() < keys.size()
+            || !equal(keys.begin(), keys.end(), key_columns.begin()) || !index->implied_by(conjunction))
+            continue;
+        EvalPlan *found = range_scan(scan, index, key_columns.size() == 1 ? ranges : ValueRanges());
+        found->stats = scan->stats;
+        return above(found, conjunction, lists, ranges);
+    }
+    return nullptr;
+}
+
+// Gather the selections in a stack of Select, SelectIn and SelectRange, returning the TableScan under
+// them (nullptr if something else is).
+const EvalPlan *EvalPlan::selections(ValueDict &conjunction, ValueLists &lists, ValueRanges &ranges) const {
+    const EvalPlan *plan = this;
+    for (; plan->type != TableScan; plan = plan->relation) {
+        if (plan->type == Select)
+            conjunction.insert(plan->select_conjunction->begin(), plan->select_conjunction->end());
+        else if (plan->type == SelectIn)
+            lists.insert(plan->value_lists->begin(), plan->value_lists->end());
+        else if (plan->type == SelectRange)
+            ranges.insert(plan->value_ranges->begin(), plan->value_ranges->end());
+        else
+            return nullptr;
+    }
+    return plan;
+}
+
+// An IndexRangeScan of scan's table, bounded by the range on the index's first key column, if ranges has
+// one.
+EvalPlan *EvalPlan::range_scan(const EvalPlan *scan, DbIndex *index, const ValueRanges &ranges) {
+    const Identifier& column = index->get_key_columns().front();
+    ValueDict *min = nullptr, *max = nullptr;
+    if (ranges.find(column) != ranges.end()) {
+        // bounds of another type than the column's can't be keys (SelectRange sorts them out)
+        const ValueRange& range = ranges.at(column);
+        ColumnNames column_names(1, column);
+        ColumnAttributes *attributes = scan->table.get_column_attributes(column_names);
+        ColumnAttribute::DataType data_type = attributes->front().get_data_type();
+        delete attributes;
+        if (range.has_min && range.min.data_type == data_type)
+            min = new ValueDict({{column, range.min}});
+        if (range.has_max && range.max.data_type == data_type)
+            max = new ValueDict({{column, range.max}});
+    }
+    return new EvalPlan(scan->table, index, min, max, nullptr);
+}
+
+// The rest of a selection over an index scan: the equalities as its residual, and SelectIn and
+// SelectRange above it for the IN lists and (always, since the index's bounds are inclusive) the ranges.
+EvalPlan *EvalPlan::above(EvalPlan *scan, const ValueDict &conjunction, const ValueLists &lists,
+                          const ValueRanges &ranges) {
+    if (!conjunction.empty())
+        scan->select_conjunction = new ValueDict(conjunction);
+    if (!lists.empty())
+        scan = new EvalPlan(new ValueLists(lists), scan);
+    if (!ranges.empty())
+        scan = new EvalPlan(new ValueRanges(ranges), scan);
+    return scan;
+}
+
+// For an equality selection on a table: an IndexIntersection of every index (but one per set of key
+// columns) that has its whole key in the selection, when there are two or more, leaving the rest of the
+// selection as a residual. Returns nullptr otherwise.
+EvalPlan *EvalPlan::index_intersection() const {
+    if (this->relation->type != TableScan)
+        return nullptr;
+    EvalPlan *scan = this->relation;
+    IndexProbeKeys probes;
+    vector<ColumnNames> keys_used;
+    ValueDict *residual = new ValueDict(*this->select_conjunction);
+    for (auto const index: scan->indexes) {
+        const ColumnNames& key_columns = index->get_key_columns();
+        bool keyed = true;
+        for (auto const& column: key_columns)
+            if (this->select_conjunction->find(column) == this->select_conjunction->end())
+                keyed = false;
+        if (!keyed || !index->implied_by(*this->select_conjunction)
+            || find(keys_used.begin(), keys_used.end(), key_columns) != keys_used.end())
+            continue;
+        keys_used.push_back(key_columns);
+        ValueDict *key = new ValueDict();
+        for (auto const& column: key_columns) {
+            (*key)[column] = this->select_conjunction->at(column);
+            residual->erase(column);
+        }
+        probes.push_back(IndexProbeKeys::value_type(index, key));
+    }
+    if (probes.size() < 2) {
+        for (auto const& probe: probes)
+            delete probe.second;
+        delete residual;
+        return nullptr;
+    }
+    if (residual->empty()) {
+        delete residual;
+        residual = nullptr;
+    }
+    return new EvalPlan(scan->table, probes, residual);
+}
+
+// A copy of the join (or of the projection of it), costed three ways: hashing whichever input is
+// estimated to have fewer rows; looking up the rows of one input in an index on the other input's join
+// columns; or merging the inputs in order of the keys, each input either already coming in that order,
+// read in order from an index, or sorted. The cheapest is taken. Each input is optimized on its own,
+// except the inner input of an index join, which is only ever read through the index.
+EvalPlan *EvalPlan::optimize_join() const {
+    EvalPlan *optimized = new EvalPlan(this);
+    EvalPlan *join = optimized->type == Join ? optimized : optimized->relation;
+    EvalPlan *left = join->relation, *right = join->right;  // as given, for index lookups and ordered scans
+    join->relation = left->optimize();
+    join->right = right->optimize();
+    double left_rows, right_rows, rows;
+    double left_cost = input_estimate(join->relation, left_rows);
+    double right_cost = input_estimate(join->right, right_rows);
+    join->build_right = right_rows <= left_rows;
+    join->index = nullptr;
+    join->merge = false;
+    double best_cost = join->estimate(TableStats(), rows);
+
+    DbIndex *best_index = nullptr;
+    bool inner_right = true;
+    for (bool candidate_right: {true, false}) {
+        EvalPlan *inner = candidate_right ? right : left;
+        DbIndex *index = join_index(inner, candidate_right ? join->right_keys : join->left_keys);
+        if (index == nullptr)
+            continue;
+        double cost = (candidate_right ? left_cost : right_cost)
+                      + index_join_cost(inner, index, candidate_right ? left_rows : right_rows, rows);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_index = index;
+            inner_right = candidate_right;
+        }
+    }
+
+    // merging, with the key pairs in the order either input already comes in, if it does
+    EvalPlan *best_left = nullptr, *best_right = nullptr;
+    ColumnNames best_left_keys, best_right_keys;
+    vector<pair<ColumnNames, ColumnNames>> key_orders;
+    if (!join->left_keys.empty())
+        key_orders.push_back(make_pair(join->left_keys, join->right_keys));
+    for (bool by_left: {true, false}) {
+        if (join->left_keys.empty())
+            break;
+        ColumnNames order = (by_left ? join->relation : join->right)->order();
+        const ColumnNames &keys = by_left ? join->left_keys : join->right_keys;
+        if (order.size() < keys.size() || !is_permutation(keys.begin(), keys.end(), order.begin()))
+            continue;
+        ColumnNames left_keys, right_keys;
+        for (size_t i = 0; i < keys.size(); i++) {
+            size_t pair = find(keys.begin(), keys.end(), order[i]) - keys.begin();
+            left_keys.push_back(join->left_keys[pair]);
+            right_keys.push_back(join->right_keys[pair]);
+        }
+        key_orders.push_back(make_pair(left_keys, right_keys));
+    }
+    for (auto const& keys: key_orders) {
+        double left_sorted_rows, right_sorted_rows;
+        double left_sorted_cost, right_sorted_cost;
+        EvalPlan *left_sorted = ordered_input(left, join->relation, keys.first, left_sorted_cost, left_sorted_rows);
+        EvalPlan *right_sorted = ordered_input(right, join->right, keys.second, right_sorted_cost,
+                                               right_sorted_rows);
+        rows = max(left_sorted_rows, right_sorted_rows);
+        double cost = left_sorted_cost + right_sorted_cost
+                      + (left_sorted_rows + right_sorted_rows) * CPU_OPERATOR_COST + rows * CPU_OPERATOR_COST;
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_index = nullptr;
+            delete best_left;
+            delete best_right;
+            best_left = left_sorted;
+            best_right = right_sorted;
+            best_left_keys = keys.first;
+            best_right_keys = keys.second;
+        } else {
+            delete left_sorted;
+            delete right_sorted;
+        }
+    }
+
+    if (best_left != nullptr) {
+        join->merge = true;
+        join->left_keys = best_left_keys;
+        join->right_keys = best_right_keys;
+        swap(join->relation, best_left);
+        swap(join->right, best_right);
+        delete best_left;
+        delete best_right;
+    } else if (best_index != nullptr) {
+        join->index = best_index;
+        join->build_right = inner_right;
+        swap(inner_right ? join->right : join->relation, inner_right ? right : left);
+    }
+    delete left;
+    delete right;
+    return optimized;
+}
+
+// An input of a join in order of keys: as optimized, if it already comes in that order, otherwise the
+// cheaper of reading the input as given in order from an index and sorting it as optimized.
+EvalPlan *EvalPlan::ordered_input(const EvalPlan *input, const EvalPlan *optimized, const ColumnNames &keys,
+                                  double &cost, double &rows) {
+    ColumnNames order = optimized->order();
+    if (order.size() >= keys.size() && equal(keys.begin(), keys.end(), order.begin())) {
+        cost = input_estimate(optimized, rows);
+        return new EvalPlan(optimized);
+    }
+    SortKeys sort_keys;
+    for (auto const& key: keys)
+        sort_keys.push_back(SortKey(key));
+    EvalPlan *best = new EvalPlan(sort_keys, new EvalPlan(optimized));
+    cost = input_estimate(best, rows);
+    EvalPlan *scan = input->ordered_scan(keys);
+    if (scan != nullptr) {
+        double scan_rows, scan_cost = input_estimate(scan, scan_rows);
+        if (scan_cost < cost) {
+            delete best;
+            best = scan;
+            cost = scan_cost;
+            rows = scan_rows;
+        } else {
+            delete scan;
+        }
+    }
+    return best;
+}
+
+// The statistics of the table under an input of a join (kept by whichever scan reads it), or if the
+// table has never been analyzed a guess at its size from its page count.
+TableStats EvalPlan::input_stats(const EvalPlan *input) {
+    const EvalPlan *scan = input;
+    while (scan->type == ProjectAll || scan->type == Project || scan->type == Select || scan->type == SelectIn
+           || scan->type == SelectRange || scan->type == Sort || scan->type == Group)
+        scan = scan->relation;
+    if (scan->type == Join)
+        return TableStats();
+    TableStats stats = scan->stats;
+    if (!stats.known) {
+        HeapTable *heap = dynamic_cast<HeapTable *>(&scan->table);
+        stats.pages = heap != nullptr ? heap->get_block_count() : 1;
+        stats.rows = stats.pages * GUESSED_ROWS_PER_PAGE;
+    }
+    return stats;
+}
+
+// Estimate an input of a join by its own table's statistics.
+double EvalPlan::input_estimate(const EvalPlan *input, double &rows) {
+    return input->estimate(input_stats(input), rows);
+}
+
+// The pages rows of an input of a join take up, by its table's average row size.
+double EvalPlan::input_pages(const EvalPlan *input, double rows) {
+    TableStats stats = input_stats(input);
+    return stats.rows == 0 ? 0.0 : rows * stats.pages / stats.rows;
+}
+
+// Whether the rows a Top-N sort keeps, by its input's average row size, fit in a sort's memory budget.
+bool EvalPlan::top_n_fits() const {
+    return input_pages(this->relation, (double) this->limit) * DbBlock::BLOCK_SZ
+           <= SortOperator::DEFAULT_MEMORY_BUDGET;
+}
+
+// An index on the inner input of a join that can look up the outer rows' keys: the input has to be a
+// table (or an equality selection on one) and the index's key columns all join columns. Returns nullptr
+// if there is none.
+DbIndex *EvalPlan::join_index(const EvalPlan *inner, const ColumnNames &inner_keys) {
+    const EvalPlan *scan = inner->type == Select ? inner->relation : inner;
+    if (scan->type != TableScan)
+        return nullptr;
+    ValueDict conjunction;
+    if (inner->type == Select)
+        conjunction = *inner->select_conjunction;
+    for (auto const index: scan->indexes) {
+        const ColumnNames &key_columns = index->get_key_columns();
+        bool keyed = !key_columns.empty();
+        for (auto const& column: key_columns)
+            if (find(inner_keys.begin(), inner_keys.end(), column) == inner_keys.end())
+                keyed = false;
+        if (keyed && index->implied_by(conjunction))
+            return index;
+    }
+    return nullptr;
+}
+
+// Pages read (at random) to find entries in index, and the work of reading them.
+static double probe_cost(const DbIndex *index, double entries) {
+    IndexStats index_stats = index->get_stats();
+    double pages = DEFAULT_PROBE_PAGES;
+    if (index_stats.known && index_stats.entries > 0)
+        pages = 1.0 + entries * index_stats.leaf_pages / index_stats.entries;
+    return pages * RANDOM_PAGE_COST + entries * CPU_ENTRY_COST;
+}
+
+// Reading rows an index found: a page for each (out of order), but no more pages than the table has.
+static double fetch_cost(const TableStats &stats, double rows) {
+    return min(rows, (double) stats.pages) * RANDOM_PAGE_COST + rows * CPU_ROW_COST;
+}
+
+// Looking up outer_rows keys in the index on the inner input of a join, fetching the rows found and
+// testing them against the inner input's selection. Without statistics on the key columns, each key is
+// taken to find one row, as for a unique key.
+double EvalPlan::index_join_cost(const EvalPlan *inner, const DbIndex *index, double outer_rows, double &rows) {
+    TableStats stats = input_stats(inner);
+    double per_key = 0.0;  // by the most selective of the key columns
+    for (auto const& column: index->get_key_columns()) {
+        auto column_stats = stats.columns.find(column);
+        if (column_stats == stats.columns.end() || column_stats->second.distinct == 0)
+            continue;
+        double column_per_key = (double) stats.rows / column_stats->second.distinct;
+        per_key = per_key == 0.0 ? column_per_key : min(per_key, column_per_key);
+    }
+    per_key = max(per_key, 1.0);
+    rows = outer_rows * per_key;
+    double cost = outer_rows * probe_cost(index, per_key) + fetch_cost(stats, rows);
+    if (inner->type == Select) {
+        cost += rows * CPU_OPERATOR_COST;
+        rows *= stats.selectivity(*inner->select_conjunction);
+    }
+    return cost;
+}
+
+// Each node's cost is what it adds to its input's; an index scan's residual selection is tested against
+// each row it fetches. A join's inputs go by their own statistics (stats is for a single table), and each
+// row of the bigger input is taken to match one row of the other, as for a foreign key. A hash join
+// copies each row it builds on into its table, and if they won't fit in its memory budget writes both
+// inputs out in partitions and reads them back; a merge join only compares the rows as they pass.
+double EvalPlan::estimate(const TableStats &stats, double &rows) const {
+    double cost = 0.0, found = 0.0;
+    switch (this->type) {
+        case Join: {
+            double left_rows, right_rows;
+            if (this->index != nullptr) {
+                const EvalPlan *outer = this->build_right ? this->relation : this->right;
+                cost = input_estimate(outer, left_rows);
+                return cost + index_join_cost(this->build_right ? this->right : this->relation, this->index,
+                                              left_rows, rows);
+            }
+            cost = input_estimate(this->relation, left_rows) + input_estimate(this->right, right_rows);
+            rows = this->left_keys.empty() ? left_rows * right_rows : max(left_rows, right_rows);
+            cost += (left_rows + right_rows) * CPU_OPERATOR_COST + rows * CPU_OPERATOR_COST;
+            if (!this->merge) {
+                double build_rows = this->build_right ? right_rows : left_rows;
+                cost += build_rows * CPU_ROW_COST;
+                if (input_pages(this->build_right ? this->right : this->relation, build_rows) * DbBlock::BLOCK_SZ
+                    > HashJoinOperator::DEFAULT_MEMORY_BUDGET)
+                    cost += 2 * (input_pages(this->relation, left_rows) + input_pages(this->right, right_rows));
+            }
+            return cost;
+        }
+        case Sort:
+            cost = this->relation->estimate(stats, rows);
+            if (this->limit > 0 && top_n_fits()) {
+                // each row against the heap of the rows kept
+                cost += rows * log2(max(min(rows, (double) this->limit), 2.0)) * CPU_OPERATOR_COST;
+                rows = min(rows, (double) this->limit);
+                return cost;
+            }
+            cost += rows * log2(max(rows, 2.0)) * CPU_OPERATOR_COST;
+            if (input_pages(this->relation, rows) * DbBlock::BLOCK_SZ > SortOperator::DEFAULT_MEMORY_BUDGET)
+                cost += 2 * input_pages(this->relation, rows);
+            if (this->limit > 0)
+                rows = min(rows, (double) this->limit);
+            return cost;
+        case Limit:
+            cost = this->relation->estimate(stats, rows);
+            rows = min(rows, (double) this->limit);
+            return cost;
+        case Group: {
+            // a group for each combination of the group-by columns' values, as far as there are rows
+            cost = this->relation->estimate(stats, rows);
+            cost += rows * (this->aggregates.size() + 1) * CPU_OPERATOR_COST;
+            double groups = 1.0;
+            for (auto const& column: this->group_by) {
+                auto column_stats = stats.columns.find(column);
+                groups *= column_stats == stats.columns.end() || column_stats->second.distinct == 0
+                          ? rows : column_stats->second.distinct;
+            }
+            rows = min(rows, groups);
+            return cost;
+        }
+        case ProjectAll:
+        case Project:
+            return this->relation->estimate(stats, rows);
+        case Select:
+            cost = this->relation->estimate(stats, rows) + rows * CPU_OPERATOR_COST;
+            rows *= stats.selectivity(*this->select_conjunction);
+            return cost;
+        case SelectIn:
+            cost = this->relation->estimate(stats, rows) + rows * CPU_OPERATOR_COST;
+            rows *= stats.selectivity(*this->value_lists);
+            return cost;
+        case SelectRange:
+            cost = this->relation->estimate(stats, rows) + rows * CPU_OPERATOR_COST;
+            rows *= stats.selectivity(*this->value_ranges);
+            return cost;
+        case TableScan:
+            rows = stats.rows;
+            return stats.pages + rows * CPU_ROW_COST;
+        case IndexScan:
+        case IndexOnlyScan:
+            found = stats.rows * stats.selectivity(*this->index_key);
+            cost = probe_cost(this->index, found);
+            if (this->type == IndexScan)
+                cost += fetch_cost(stats, found);
+            break;
+        case IndexRangeScan: {
+            ValueRanges ranges;  // none if the scan reads the whole index
+            if (this->index_min != nullptr)
+                ranges[this->index->get_key_columns().front()].above(this->index_min->begin()->second, true);
+            if (this->index_max != nullptr)
+                ranges[this->index->get_key_columns().front()].below(this->index_max->begin()->second, true);
+            found = stats.rows * stats.selectivity(ranges);
+            cost = probe_cost(this->index, found) + fetch_cost(stats, found);
+            break;
+        }
+        case IndexProbes:
+            for (auto const key: *this->index_keys) {
+                double key_found = stats.rows * stats.selectivity(*key);
+                cost += probe_cost(this->index, key_found);
+                found += key_found;
+            }
+            cost += fetch_cost(stats, found);
+            break;
+        case BitmapScan:
+        case IndexIntersection: {
+            // each index finds its own handles, then they are matched up
+            ValueDict combined;
+            IndexProbeKeys probes = this->intersect_probes;
+            for (auto const& probe: this->bitmap_probes)
+                probes.push_back(IndexProbeKeys::value_type(const_cast<BitmapIndex *>(probe.first), probe.second));
+            for (auto const& probe: probes) {
+                double probe_found = stats.rows * stats.selectivity(*probe.second);
+                cost += probe_cost(probe.first, probe_found) + probe_found * CPU_OPERATOR_COST;
+                combined.insert(probe.second->begin(), probe.second->end());
+            }
+            found = stats.rows * stats.selectivity(combined);
+            cost += fetch_cost(stats, found);
+            break;
+        }
+    }
+    rows = found;
+    if (this->select_conjunction != nullptr) {
+        cost += found * CPU_OPERATOR_COST;
+        rows *= stats.selectivity(*this->select_conjunction);
+    }
+    return cost;
+}
+
+// The handles every one of the indices finds for its key, in order.
+static Handles *lookup_intersection(const IndexProbeKeys &probes) {
+    Handles *ret = nullptr;
+    for (auto const& probe: probes) {
+        Handles *found = probe.first->lookup(probe.second);
+        sort(found->begin(), found->end());
+        if (ret != nullptr) {
+            Handles *both = new Handles();
+            set_intersection(ret->begin(), ret->end(), found->begin(), found->end(), back_inserter(*both));
+            delete ret;
+            delete found;
+            found = both;
+        }
+        ret = found;
+        if (ret->empty())
+            break;
+    }
+    return ret != nullptr ? ret : new Handles();
+}
+
+// Run the plan's operators to the end.
 ValueDicts *EvalPlan::evaluate() {
-    ValueDicts *ret = nullptr;
     if (this->type != ProjectAll && this->type != Project)
         throw DbRelationError("Invalid evaluation plan--not ending with a projection");
+    EvalOperator *op = stream();
+    ValueDicts *ret = new ValueDicts();
+    try {
+        op->open();
+        ValueDict *row;
+        while ((row = op->next()) != nullptr)
+            ret->push_back(row);
+        op->close();
+    } catch (...) {
+        for (auto row: *ret)
+            delete row;
+        delete ret;
+        delete op;
+        throw;
+    }
+    delete op;
+    return ret;
+}
+
+// The plan as operators: scans at the bottom (rows from the table or from an index), then the selections
+// and projection above them in the same order as in the plan. Vectorized, the selections and projection
+// work a batch at a time; the scans fill the batches a row at a time either way. A join hashes the input
+// optimize picked and probes with the other, looks the other's rows up in the index it picked, or merges
+// the two inputs in order.
+EvalOperator *EvalPlan::stream(bool vectorized) const {
+    switch (this->type) {
+        case ProjectAll:
+        case Project: {
+            if (this->relation->type == IndexOnlyScan)
+                return stream_index_only();
+            EvalOperator *input = this->relation->stream(vectorized);
+            if (this->type == ProjectAll)
+                return input;
+            if (vectorized)
+                return new VectorProjectOperator(input, *this->projection);
+            return new ProjectOperator(input, *this->projection);
+        }
+        case Select:
+            if (vectorized)
+                return new VectorSelectOperator(this->relation->stream(vectorized), *this->select_conjunction);
+            return new SelectOperator(this->relation->stream(vectorized), *this->select_conjunction);
+        case SelectIn:
+            if (vectorized)
+                return new VectorSelectInOperator(this->relation->stream(vectorized), *this->value_lists);
+            return new SelectInOperator(this->relation->stream(vectorized), *this->value_lists);
+        case SelectRange:
+            if (vectorized)
+                return new VectorSelectRangeOperator(this->relation->stream(vectorized), *this->value_ranges);
+            return new SelectRangeOperator(this->relation->stream(vectorized), *this->value_ranges);
+        case TableScan:
+            return new TableScanOperator(this->table);
+        case Sort:
+            if (this->limit > 0 && top_n_fits())
+                return new TopNOperator(this->relation->stream(vectorized), this->sort_keys, this->limit);
+            if (this->limit > 0)  // too many rows kept to hold: sort them all (on disk if need be) and take the first
+                return new LimitOperator(new SortOperator(this->relation->stream(vectorized), this->sort_keys),
+                                         this->limit);
+            return new SortOperator(this->relation->stream(vectorized), this->sort_keys);
+        case Limit: {
+            // a limit smaller than a batch has its input streamed a row at a time, so that no more rows
+            // are read than it needs
+            if (vectorized && this->limit + this->offset >= EvalBatch::CAPACITY)
+                return new VectorLimitOperator(this->relation->stream(vectorized), this->limit, this->offset);
+            return new LimitOperator(this->relation->stream(false), this->limit, this->offset);
+        }
+        case Group:
+            return new HashAggregateOperator(this->relation->stream(vectorized), this->group_by, this->aggregates);
+        case Join:
+            if (this->index != nullptr)
+                return stream_index_join(vectorized);
+            if (this->merge)
+                return new MergeJoinOperator(this->relation->stream(vectorized), this->right->stream(vectorized),
+                                             this->left_keys, this->right_keys, this->left_prefix, this->right_prefix);
+            if (this->build_right)
+                return new HashJoinOperator(this->right->stream(vectorized), this->relation->stream(vectorized),
+                                            this->right_keys, this->left_keys, this->right_prefix, this->left_prefix);
+            return new HashJoinOperator(this->relation->stream(vectorized), this->right->stream(vectorized),
+                                        this->left_keys, this->right_keys, this->left_prefix, this->right_prefix);
+        default:
+            break;
+    }
 
-    EvalPipeline pipeline = this->relation->pipeline();
-    DbRelation *temp_table = pipeline.first;
-    Handles *handles = pipeline.second;
-    if (this->type == ProjectAll)
-        ret = temp_table->project(handles);
-    else if (this->type == Project)
-        ret = temp_table->project(handles, this->projection);
-    delete handles;
+    // index scans: handles from the index, then any residual selection (the lookups keep their own
+    // copies of the keys)
+    DbIndex *index = this->index;
+    function<Handles *()> lookup;
+    if (this->type == IndexScan || this->type == IndexOnlyScan) {
+        ValueDict key = *this->index_key;
+        lookup = [index, key]() { ValueDict probe = key; return index->lookup(&probe); };
+    } else if (this->type == IndexRangeScan) {
+        shared_ptr<ValueDict> min(this->index_min == nullptr ? nullptr : new ValueDict(*this->index_min));
+        shared_ptr<ValueDict> max(this->index_max == nullptr ? nullptr : new ValueDict(*this->index_max));
+        lookup = [index, min, max]() { return index->range(min.get(), max.get()); };
+    } else if (this->type == BitmapScan) {
+        shared_ptr<BitmapProbes> probes(new BitmapProbes(), [](BitmapProbes *probes) {
+            for (auto const& probe: *probes)
+                delete probe.second;
+            delete probes;
+        });
+        for (auto const& probe: this->bitmap_probes)
+            probes->push_back(BitmapProbes::value_type(probe.first, new ValueDict(*probe.second)));
+        lookup = [probes]() { return BitmapIndex::lookup_and(*probes); };
+    } else if (this->type == IndexIntersection) {
+        shared_ptr<IndexProbeKeys> probes(new IndexProbeKeys(), [](IndexProbeKeys *probes) {
+            for (auto const& probe: *probes)
+                delete probe.second;
+            delete probes;
+        });
+        for (auto const& probe: this->intersect_probes)
+            probes->push_back(IndexProbeKeys::value_type(probe.first, new ValueDict(*probe.second)));
+        lookup = [probes]() { return lookup_intersection(*probes); };
+    } else if (this->type == IndexProbes) {
+        shared_ptr<ValueDicts> keys(new ValueDicts(), [](ValueDicts *keys) {
+            for (auto const key: *keys)
+                delete key;
+            delete keys;
+        });
+        for (auto const key: *this->index_keys)
+            keys->push_back(new ValueDict(*key));
+        lookup = [index, keys]() {
+            HandlesList *found = index->lookup_many(*keys);
+            Handles *handles = new Handles();
+            for (auto const key_handles: *found) {
+                handles->insert(handles->end(), key_handles->begin(), key_handles->end());
+                delete key_handles;
+            }
+            delete found;
+            return handles;
+        };
+    } else {
+        throw DbRelationError("Not implemented: stream of this plan");
+    }
+    EvalOperator *op = new LookupOperator(this->table, lookup);
+    if (this->select_conjunction != nullptr)
+        op = new SelectOperator(op, *this->select_conjunction);
+    return op;
+}
+
+// Selections keep their input's order, a projection as much of it as it keeps the columns of, and a
+// merge join its left input's order on the keys. A range scan comes in key order if the index hands
+// back its range that way. Nothing else is sure to come in any order.
+ColumnNames EvalPlan::order() const {
+    ColumnNames ret;
+    switch (this->type) {
+        case ProjectAll:
+        case Select:
+        case SelectIn:
+        case SelectRange:
+        case Limit:
+            return this->relation->order();
+        case Project:
+            for (auto const& column: this->relation->order()) {
+                if (find(this->projection->begin(), this->projection->end(), column) == this->projection->end())
+                    break;
+                ret.push_back(column);
+            }
+            break;
+        case IndexRangeScan:
+            if (this->index->range_in_order())
+                ret = this->index->get_key_columns();
+            break;
+        case Sort:
+            for (auto const& key: this->sort_keys) {
+                if (key.descending)
+                    break;
+                ret.push_back(key.column);
+            }
+            break;
+        case Join:
+            if (this->merge)
+                for (auto const& column: this->left_keys)
+                    ret.push_back(this->left_prefix.empty() ? column : this->left_prefix + "." + column);
+            break;
+        default:
+            break;
+    }
     return ret;
 }
 
+// Projection straight from a covering index: the relation itself is never read.
+EvalOperator *EvalPlan::stream_index_only() const {
+    EvalPlan *scan = this->relation;
+    ColumnNames columns = this->type == Project ? *this->projection : scan->table.get_column_names();
+    ColumnNames needed = columns;
+    if (scan->select_conjunction != nullptr)
+        for (auto const& column: *scan->select_conjunction)
+            if (find(needed.begin(), needed.end(), column.first) == needed.end())
+                needed.push_back(column.first);
+
+    DbIndex *index = scan->index;
+    ValueDict key = *scan->index_key;
+    EvalOperator *op = new RowsOperator([index, key, needed]() {
+        ValueDict probe = key;
+        return index->lookup_values(&probe, &needed);
+    });
+    if (scan->select_conjunction != nullptr)
+        op = new SelectOperator(op, *scan->select_conjunction);
+    return new ProjectOperator(op, columns);
+}
+
+// Index nested-loop join: the outer input's rows looked up in the index on the inner input's table.
+EvalOperator *EvalPlan::stream_index_join(bool vectorized) const {
+    const EvalPlan *outer = this->build_right ? this->relation : this->right;
+    const EvalPlan *inner = this->build_right ? this->right : this->relation;
+    ValueDict selection;
+    if (inner->type == Select)
+        selection = *inner->select_conjunction;
+    if (this->build_right)
+        return new IndexJoinOperator(outer->stream(vectorized), inner->table_scan()->table, this->index,
+                                     this->left_keys, this->right_keys, selection, this->left_prefix,
+                                     this->right_prefix);
+    return new IndexJoinOperator(outer->stream(vectorized), inner->table_scan()->table, this->index,
+                                 this->right_keys, this->left_keys, selection, this->right_prefix, this->left_prefix);
+}
+
 EvalPipeline EvalPlan::pipeline() {
+    // a limit stops a table's scan as soon as it has found the rows wanted
+    if (this->type == Limit) {
+        EvalPipeline ret;
+        size_t wanted = this->limit + this->offset;
+        if (this->relation->type == TableScan)
+            ret = EvalPipeline(&this->relation->table, this->relation->table.select(nullptr, wanted));
+        else if (this->relation->type == Select && this->relation->relation->type == TableScan)
+            ret = EvalPipeline(&this->relation->relation->table,
+                               this->relation->relation->table.select(this->relation->select_conjunction, wanted));
+        else
+            ret = this->relation->pipeline();
+        Handles *handles = ret.second;
+        if (handles->size() > wanted)
+            handles->resize(wanted);
+        handles->erase(handles->begin(), handles->begin() + min(this->offset, handles->size()));
+        return ret;
+    }
+
     // base cases
     if (this->type == TableScan)
         return EvalPipeline(&this->table, this->table.select());
+    if (this->type == IndexScan || this->type == IndexOnlyScan || this->type == IndexRangeScan) {
+        Handles *handles;
+        if (this->type == IndexRangeScan)
+            handles = this->index->range(this->index_min, this->index_max);
+        else
+            handles = this->index->lookup(this->index_key);
+        if (this->select_conjunction == nullptr)
+            return EvalPipeline(&this->table, handles);
+        EvalPipeline ret(&this->table, this->table.select(handles, this->select_conjunction));
+        delete handles;
+        return ret;
+    }
+    if (this->type == BitmapScan) {
+        Handles *handles = BitmapIndex::lookup_and(this->bitmap_probes);
+        if (this->select_conjunction == nullptr)
+            return EvalPipeline(&this->table, handles);
+        EvalPipeline ret(&this->table, this->table.select(handles, this->select_conjunction));
+        delete handles;
+        return ret;
+    }
+    if (this->type == IndexIntersection) {
+        Handles *handles = lookup_intersection(this->intersect_probes);
+        if (this->select_conjunction == nullptr)
+            return EvalPipeline(&this->table, handles);
+        EvalPipeline ret(&this->table, this->table.select(handles, this->select_conjunction));
+        delete handles;
+        return ret;
+    }
+    if (this->type == IndexProbes) {
+        HandlesList *found = this->index->lookup_many(*this->index_keys);
+        Handles *handles = new Handles();
+        for (auto const key_handles: *found) {
+            handles->insert(handles->end(), key_handles->begin(), key_handles->end());
+            delete key_handles;
+        }
+        delete found;
+        if (this->select_conjunction == nullptr)
+            return EvalPipeline(&this->table, handles);
+        EvalPipeline ret(&this->table, this->table.select(handles, this->select_conjunction));
+        delete handles;
+        return ret;
+    }
     if (this->type == Select && this->relation->type == TableScan)
         return EvalPipeline(&this->relation->table, this->relation->table.select(this->select_conjunction));
 
@@ -96,6 +1339,62 @@ EvalPipeline EvalPlan::pipeline() {
         return ret;
     }
 
+    if (this->type == SelectIn) {
+        EvalPipeline pipeline = this->relation->pipeline();
+        DbRelation *temp_table = pipeline.first;
+        Handles *handles = pipeline.second;
+        EvalPipeline ret(temp_table, select_in(temp_table, handles));
+        delete handles;
+        return ret;
+    }
+
+    if (this->type == SelectRange) {
+        EvalPipeline pipeline = this->relation->pipeline();
+        DbRelation *temp_table = pipeline.first;
+        Handles *handles = pipeline.second;
+        EvalPipeline ret(temp_table, select_range(temp_table, handles));
+        delete handles;
+        return ret;
+    }
+
     throw DbRelationError("Not implemented: pipeline other than Select or TableScan");
 }
 
+// The handles whose rows have, for each column of value_lists, one of its values.
+Handles *EvalPlan::select_in(DbRelation *table, Handles *handles) const {
+    ColumnNames column_names;
+    for (auto const& list: *this->value_lists)
+        column_names.push_back(list.first);
+    Handles *ret = new Handles();
+    for (auto const& handle: *handles) {
+        ValueDict *row = table->project(handle, &column_names);
+        bool selected = true;
+        for (auto const& list: *this->value_lists)
+            if (!binary_search(list.second.begin(), list.second.end(), row->at(list.first)))
+                selected = false;
+        if (selected)
+            ret->push_back(handle);
+        delete row;
+    }
+    return ret;
+}
+
+
+// The handles whose rows have, for each column of value_ranges, a value in its range.
+Handles *EvalPlan::select_range(DbRelation *table, Handles *handles) const {
+    ColumnNames column_names;
+    for (auto const& range: *this->value_ranges)
+        column_names.push_back(range.first);
+    Handles *ret = new Handles();
+    for (auto const& handle: *handles) {
+        ValueDict *row = table->project(handle, &column_names);
+        bool selected = true;
+        for (auto const& range: *this->value_ranges)
+            if (!range.second.holds(row->at(range.first)))
+                selected = false;
+        if (selected)
+            ret->push_back(handle);
+        delete row;
+    }
+    return ret;
+}
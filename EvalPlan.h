@@ -1,9 +1,19 @@
 #pragma once
 
 #include "storage_engine.h"
+#include "bitmap_index.h"
+#include "EvalOperator.h"
+#include "TableStats.h"
+#include "HashJoin.h"
+#include "IndexJoin.h"
+#include "Sort.h"
+#include "MergeJoin.h"
+#include "Aggregate.h"
 
 
 typedef std::pair<DbRelation*,Handles*> EvalPipeline;
+typedef std::vector<DbIndex*> DbIndexes;
+typedef std::vector<std::pair<DbIndex*, ValueDict*>> IndexProbeKeys;  // each index with the key to look up in it
 
 class EvalPlan {
 public:
@@ -11,29 +21,124 @@ public:
         ProjectAll,
         Project,
         Select,
-        TableScan
+        SelectIn,
+        SelectRange,
+        TableScan,
+        IndexScan,
+        IndexOnlyScan,
+        IndexRangeScan,
+        IndexProbes,
+        BitmapScan,
+        IndexIntersection,
+        Join,
+        Sort,
+        Group,
+        Limit
     };
 
     EvalPlan(PlanType type, EvalPlan *relation);  // use for ProjectAll, e.g., EvalPlan(EvalPlan::ProjectAll, table);
     EvalPlan(ColumnNames *projection, EvalPlan *relation); // use for Project
     EvalPlan(ValueDict* conjunction, EvalPlan *relation);  // use for Select
-    EvalPlan(DbRelation &table);  // use for TableScan
+    EvalPlan(ValueLists* value_lists, EvalPlan *relation);  // use for SelectIn
+    EvalPlan(ValueRanges* value_ranges, EvalPlan *relation);  // use for SelectRange
+    EvalPlan(DbRelation &table, DbIndexes indexes=DbIndexes(), TableStats stats=TableStats());  // use for TableScan (indexes the optimizer may use, statistics it costs plans by)
+    EvalPlan(PlanType type, DbRelation &table, DbIndex *index, ValueDict *key, ValueDict *residual);  // use for IndexScan or IndexOnlyScan
+    EvalPlan(DbRelation &table, DbIndex *index, ValueDict *min, ValueDict *max, ValueDict *residual);  // use for IndexRangeScan
+    EvalPlan(DbRelation &table, DbIndex *index, ValueDicts *keys, ValueDict *residual);  // use for IndexProbes
+    EvalPlan(DbRelation &table, BitmapProbes probes, ValueDict *residual);  // use for BitmapScan
+    EvalPlan(DbRelation &table, IndexProbeKeys probes, ValueDict *residual);  // use for IndexIntersection
+    EvalPlan(EvalPlan *left, EvalPlan *right, ColumnNames left_keys, ColumnNames right_keys, Identifier left_prefix,
+             Identifier right_prefix);  // use for Join (an equi-join on the key columns, paired up in order)
+    EvalPlan(SortKeys sort_keys, EvalPlan *relation, size_t limit=0);  // use for Sort (of which only the first limit rows are wanted, unless limit is 0)
+    EvalPlan(ColumnNames group_by, Aggregates aggregates, EvalPlan *relation);  // use for Group
+    EvalPlan(size_t limit, size_t offset, EvalPlan *relation);  // use for Limit (the limit rows after the first offset)
     EvalPlan(const EvalPlan *other);  // use for copying
     virtual ~EvalPlan();
 
     // Attempt to get the best equivalent evaluation plan
     EvalPlan *optimize();
 
-    // Evaluate the plan: evaluate gets values, pipeline gets handles
+    // Estimated cost of evaluating the plan (in sequential page reads) and the rows it will produce
+    double estimate(const TableStats &stats, double &rows) const;
+
+    // Evaluate the plan: evaluate gets values, pipeline gets handles, stream gets the operators that
+    // produce the values a row at a time or, vectorized, a batch at a time (freed by caller; they don't
+    // refer back to the plan)
     ValueDicts *evaluate();
     EvalPipeline pipeline();
+    EvalOperator *stream(bool vectorized=false) const;
+
+    // The columns the plan's rows are sure to come sorted on (ascending, the first column first), if any
+    ColumnNames order() const;
 
 protected:
 
     PlanType type;
-    EvalPlan *relation;  // for everything except TableScan
+    EvalPlan *relation;  // for everything except TableScan (the left input for Join)
     ColumnNames *projection;  // for Project
     ValueDict *select_conjunction;  // for Select
-    DbRelation &table;  // for TableScan
+    ValueLists *value_lists;  // for SelectIn
+    ValueRanges *value_ranges;  // for SelectRange
+    DbRelation &table;  // for TableScan and the index scans
+    DbIndexes indexes;  // for TableScan
+    TableStats stats;  // for TableScan
+    DbIndex *index;  // for IndexScan, IndexOnlyScan, IndexRangeScan, IndexProbes and, as an index nested-loop join, Join
+    ValueDict *index_key;  // for IndexScan and IndexOnlyScan (select_conjunction holds the rest of the selection, if any)
+    ValueDict *index_min;  // for IndexRangeScan, nullptr if there is no lower bound (likewise)
+    ValueDict *index_max;  // for IndexRangeScan, nullptr if there is no upper bound
+    ValueDicts *index_keys;  // for IndexProbes (likewise)
+    BitmapProbes bitmap_probes;  // for BitmapScan (likewise)
+    IndexProbeKeys intersect_probes;  // for IndexIntersection (likewise)
+    EvalPlan *right;  // for Join
+    ColumnNames left_keys;  // for Join: columns of the left input equal to the right_keys of the right input
+    ColumnNames right_keys;
+    Identifier left_prefix;  // for Join: what the left input's columns are qualified with, if anything
+    Identifier right_prefix;
+    bool build_right;  // for Join: whether the right input is the one hashed, or looked up in index (set by optimize)
+    bool merge;  // for Join: whether the inputs come sorted on the keys and are merged (set by optimize)
+    SortKeys sort_keys;  // for Sort
+    ColumnNames group_by;  // for Group: the columns whose values make up a group (none for just one group)
+    Aggregates aggregates;  // for Group
+    size_t limit;  // for Limit, and for Sort: how many rows are wanted (for Sort, 0 for all of them)
+    size_t offset;  // for Limit: how many rows to skip first
+
+    // the rewrites optimize() tries, in the order it prefers them when there are no statistics
+    enum Rule {
+        IndexOnlyRule,
+        BitmapRule,
+        ProbesRule,
+        IndexRule,
+        IntersectionRule
+    };
+
+    EvalPlan *rewrite(Rule rule) const;
+    const EvalPlan *table_scan() const;
+    EvalPlan *index_only_scan() const;
+    EvalPlan *bitmap_scan() const;
+    EvalPlan *index_probes() const;
+    EvalPlan *index_scan() const;
+    EvalPlan *index_intersection() const;
+    EvalPlan *ordered_scan(const ColumnNames &keys) const;
+    const EvalPlan *selections(ValueDict &conjunction, ValueLists &lists, ValueRanges &ranges) const;
+    static EvalPlan *range_scan(const EvalPlan *scan, DbIndex *index, const ValueRanges &ranges);
+    static EvalPlan *above(EvalPlan *scan, const ValueDict &conjunction, const ValueLists &lists,
+                           const ValueRanges &ranges);
+    EvalPlan *optimize_join() const;
+    EvalPlan *optimize_sort() const;
+    bool top_n_fits() const;
+    static TableStats input_stats(const EvalPlan *input);
+    static double input_estimate(const EvalPlan *input, double &rows);
+    static double input_pages(const EvalPlan *input, double rows);
+    static DbIndex *join_index(const EvalPlan *inner, const ColumnNames &inner_keys);
+    static double index_join_cost(const EvalPlan *inner, const DbIndex *index, double outer_rows, double &rows);
+    static EvalPlan *ordered_input(const EvalPlan *input, const EvalPlan *optimized, const ColumnNames &keys,
+                                   double &cost, double &rows);
+    Handles *select_in(DbRelation *table, Handles *handles) const;
+    Handles *select_range(DbRelation *table, Handles *handles) const;
+    EvalOperator *stream_index_only() const;
+    EvalOperator *stream_index_join(bool vectorized) const;
+
+    static const size_t MAX_PROBES = 10000;  // most index keys an IN selection is turned into
+    static const uint GUESSED_ROWS_PER_PAGE = 50;  // for sizing up a join input never analyzed
 };
 
@@ -0,0 +1,122 @@
+#include <cstring>
+#include "HashBucket.h"
+using namespace std;
+
+/*************
+ * HashEntry *
+ *************/
+
+uint HashEntry::size() const {
+    return sizeof(HashCode) + HashBucket::HANDLE_SZ + this->key.size() + HashBucket::SLOT_SZ;
+}
+
+
+/************
+ * HashStat *
+ ************/
+
+HashStat::HashStat(HeapFile &file, BlockID stat_id, bool create)
+        : block(file.get(stat_id)), file(file), level(0), next_split(0), bytes(0), free_overflow(0) {
+    if (create) {
+        save();
+    } else {
+        // level, next split, bytes and free overflow list head, in one record
+        Dbt *dbt = this->block->get(1);
+        const uint32_t *fields = (const uint32_t *) dbt->get_data();
+        this->level = fields[0];
+        this->next_split = fields[1];
+        this->bytes = fields[2];
+        this->free_overflow = fields[3];
+        delete dbt;
+    }
+}
+
+HashStat::~HashStat() {
+    delete this->block;
+}
+
+void HashStat::save() {
+    uint32_t fields[4] = {this->level, this->next_split, this->bytes, this->free_overflow};
+    Dbt dbt(fields, sizeof(fields));
+    if (this->block->size() == 0)
+        this->block->add(&dbt);
+    else
+        this->block->put(1, dbt);
+    this->file.put(this->block);
+}
+
+
+/**************
+ * HashBucket *
+ **************/
+
+HashBucket::HashBucket(HeapFile &file, BlockID block_id, bool create)
+        : block(nullptr), file(file), id(block_id), next(0), entries(), entry_bytes(0) {
+    if (create) {
+        this->block = file.get_new();
+        this->id = this->block->get_block_id();
+        return;
+    }
+    this->block = file.get(block_id);
+    RecordIDs *record_id_list = this->block->ids();
+    for (auto const& record_id: *record_id_list) {
+        Dbt *dbt = this->block->get(record_id);
+        const char *bytes = (const char *) dbt->get_data();
+        if (record_id == 1) {
+            this->next = *(BlockID *) bytes;
+        } else {
+            HashCode hash = *(HashCode *) bytes;
+            bytes += sizeof(HashCode);
+            Handle handle(*(BlockID *) bytes, *(RecordID *) (bytes + sizeof(BlockID)));
+            bytes += HANDLE_SZ;
+            add(HashEntry(hash, handle, NormalizedKey(bytes, dbt->get_size() - sizeof(HashCode) - HANDLE_SZ)));
+        }
+        delete dbt;
+    }
+    delete record_id_list;
+}
+
+HashBucket::~HashBucket() {
+    delete this->block;
+}
+
+void HashBucket::save() {
+    this->block->clear();
+    Dbt next_dbt(&this->next, sizeof(BlockID));
+    this->block->add(&next_dbt);
+    string record;
+    for (auto const& entry: this->entries) {
+        record.assign((const char *) &entry.hash, sizeof(HashCode));
+        record.append((const char *) &entry.handle.first, sizeof(BlockID));
+        record.append((const char *) &entry.handle.second, sizeof(RecordID));
+        record.append(entry.key);
+        Dbt dbt((void *) record.data(), (u_int32_t) record.size());
+        this->block->add(&dbt);
+    }
+    this->file.put(this->block);
+}
+
+void HashBucket::add(const HashEntry& entry) {
+    this->entries.push_back(entry);
+    this->entry_bytes += entry.size();
+}
+
+bool HashBucket::remove(const NormalizedKey& key, Handle handle) {
+    for (auto it = this->entries.begin(); it != this->entries.end(); it++) {
+        if (it->handle == handle && it->key == key) {
+            this->entry_bytes -= it->size();
+            this->entries.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void HashBucket::clear() {
+    this->entries.clear();
+    this->entry_bytes = 0;
+}
+
+uint HashBucket::size() const {
+    return sizeof(BlockID) + SLOT_SZ + this->entry_bytes;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file HashBucket.h - pages of a HashIndex:
+ * HashEntry: one index entry (hash code, row handle and normalized key)
+ * HashStat: the linear hashing state of an index, kept in its first block
+ * HashBucket: one page of a bucket, either the bucket's primary page or one of its overflow pages
+ */
+#pragma once
+
+#include "heap_storage.h"
+#include "KeyEncoding.h"
+
+typedef uint32_t HashCode;
+
+/**
+ * @class HashEntry - an index entry as stored in a HashBucket
+ *
+ * The hash code is kept with the entry so a split can redistribute a bucket and a probe can skip
+ * most non-matching entries without comparing keys.
+ */
+class HashEntry {
+public:
+    HashEntry() : hash(0), handle(), key() {}
+    HashEntry(HashCode hash, Handle handle, const NormalizedKey& key) : hash(hash), handle(handle), key(key) {}
+
+    // bytes the entry takes in a page, slot included
+    uint size() const;
+
+    HashCode hash;
+    Handle handle;
+    NormalizedKey key;
+};
+
+typedef std::vector<HashEntry> HashEntries;
+
+/**
+ * @class HashStat - linear hashing state of a HashIndex
+ *
+ * The buckets below next_split have been split in the current round and are addressed with one more
+ * bit of the hash than the rest. The byte count is the size of every entry, used to decide when to
+ * split the next bucket. Overflow pages that are no longer needed are chained from free_overflow.
+ */
+class HashStat {
+public:
+    HashStat(HeapFile &file, BlockID stat_id, bool create);
+    virtual ~HashStat();
+    HashStat(const HashStat& other) = delete;
+    HashStat& operator=(const HashStat& other) = delete;
+
+    void save();
+
+    uint get_level() const { return this->level; }
+    void set_level(uint level) { this->level = level; }
+    uint get_next_split() const { return this->next_split; }
+    void set_next_split(uint next_split) { this->next_split = next_split; }
+    uint get_bytes() const { return this->bytes; }
+    void set_bytes(uint bytes) { this->bytes = bytes; }
+    BlockID get_free_overflow() const { return this->free_overflow; }
+    void set_free_overflow(BlockID free_overflow) { this->free_overflow = free_overflow; }
+
+protected:
+    SlottedPage *block;
+    HeapFile &file;
+    uint level;
+    uint next_split;
+    uint bytes;
+    BlockID free_overflow;
+};
+
+/**
+ * @class HashBucket - one page of a hash bucket
+ *
+ * Records: the block id of the next overflow page of the bucket (0 for none), then one record per
+ * entry holding its hash code, handle and key. Entries are kept in the order they were added.
+ */
+class HashBucket {
+public:
+    // bytes of records plus their 4-byte slot headers that fit in a SlottedPage
+    static const uint SLOT_SZ = 4;
+    static const uint CAPACITY = DbBlock::BLOCK_SZ - 5;
+    static const uint HANDLE_SZ = sizeof(BlockID) + sizeof(RecordID);
+    // largest normalized key we will index, so any page has room for at least one entry
+    static const uint MAX_KEY_SIZE = DbBlock::BLOCK_SZ / 4;
+
+    HashBucket(HeapFile &file, BlockID block_id, bool create);
+    virtual ~HashBucket();
+    HashBucket(const HashBucket& other) = delete;
+    HashBucket& operator=(const HashBucket& other) = delete;
+
+    void save();
+
+    BlockID get_id() const { return this->id; }
+    BlockID get_next() const { return this->next; }
+    void set_next(BlockID next) { this->next = next; }
+
+    const HashEntries& get_entries() const { return this->entries; }
+    void add(const HashEntry& entry);  // no room check, see has_room_for
+    bool remove(const NormalizedKey& key, Handle handle);  // false if not here
+    void clear();
+
+    // bytes the page occupies in its block (compare to CAPACITY)
+    uint size() const;
+    bool has_room_for(const HashEntry& entry) const { return size() + entry.size() <= CAPACITY; }
+
+protected:
+    SlottedPage *block;
+    HeapFile &file;
+    BlockID id;
+    BlockID next;
+    HashEntries entries;
+    uint entry_bytes;  // sum of the entries' sizes
+};
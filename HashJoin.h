@@ -0,0 +1,132 @@
+/**
+ * @file HashJoin.h - equi-join of two inputs by hashing one of them:
+ * JoinHashTable: open-addressing table from join key values to the build rows that have them
+ * JoinPartition: rows spilled to a temporary HeapTable, for a grace hash join
+ * HashJoinOperator: the joined rows of a build input and a probe input
+ */
+#pragma once
+
+#include "heap_storage.h"
+#include "EvalOperator.h"
+
+/**
+ * @class JoinHashTable - build rows (owned) looked up by the values of their key columns
+ *
+ * Each slot holds a key's hash and the first of its rows, and rows with the same key are chained
+ * from there, so a probe compares hashes in one contiguous array and only looks at a row's values
+ * once the hash matches, however many rows share a key. Linear probing, never more than half full.
+ */
+class JoinHashTable {
+public:
+    JoinHashTable(const ColumnNames &key_columns);
+    virtual ~JoinHashTable();
+    JoinHashTable(const JoinHashTable& other) = delete;
+    JoinHashTable& operator=(const JoinHashTable& other) = delete;
+
+    void insert(ValueDict *row, uint64_t hash);  // row is the table's now
+    void clear();  // frees the rows
+
+    // the first row whose key is probe's values in probe_columns (hashed to hash), or -1 if there is none
+    int32_t find(const ValueDict &probe, const ColumnNames &probe_columns, uint64_t hash) const;
+    int32_t next(int32_t row) const { return this->chain[row]; }  // the next row with the same key, or -1
+    const ValueDict *row(int32_t row) const { return this->rows[row]; }
+
+    size_t size() const { return this->rows.size(); }
+    size_t get_bytes() const { return this->bytes; }  // about how much memory the rows take
+
+    static uint64_t hash(const ValueDict &row, const ColumnNames &columns);
+    static size_t row_bytes(const ValueDict &row);
+
+protected:
+    struct Slot {
+        uint64_t hash;
+        int32_t first;  // -1 if the slot is empty
+    };
+
+    ColumnNames key_columns;
+    std::vector<Slot> slots;  // a power of two of them
+    std::vector<ValueDict *> rows;
+    std::vector<int32_t> chain;  // for each row, the next one with the same key
+    size_t keys;  // slots in use
+    size_t bytes;
+
+    bool same_key(const ValueDict &probe, const ColumnNames &probe_columns, const ValueDict &row) const;
+    void grow();
+};
+
+/**
+ * @class JoinPartition - rows written to a temporary HeapTable and read back a block at a time
+ *
+ * The table's columns are taken from the first row added; it is dropped along with the partition.
+ */
+class JoinPartition {
+public:
+    JoinPartition(std::string name);
+    virtual ~JoinPartition();
+    JoinPartition(const JoinPartition& other) = delete;
+    JoinPartition& operator=(const JoinPartition& other) = delete;
+
+    void add(const ValueDict &row);
+    ValueDicts *read(BlockID block_id);  // the rows in a block (freed by caller), or nullptr past the last
+    void drop();
+
+protected:
+    std::string name;
+    HeapTable *table;
+};
+
+typedef std::vector<JoinPartition *> JoinPartitions;
+
+/**
+ * @class HashJoinOperator - each pair of a build row and a probe row with equal keys, as one row
+ *
+ * open() reads the whole build input into a JoinHashTable, then next() streams the probe input
+ * through it. If the build rows grow past memory_budget bytes, both inputs are split by key hash into
+ * PARTITIONS partitions on disk (grace hash join) and joined a partition at a time, so only one
+ * partition of build rows is in memory at once (a partition that is still too big is joined anyway).
+ * Each input's columns are renamed prefix.column in the joined rows, unless its prefix is empty.
+ */
+class HashJoinOperator : public EvalOperator {
+public:
+    HashJoinOperator(EvalOperator *build, EvalOperator *probe, const ColumnNames &build_keys,
+                     const ColumnNames &probe_keys, const Identifier &build_prefix, const Identifier &probe_prefix,
+                     size_t memory_budget=DEFAULT_MEMORY_BUDGET);
+    virtual ~HashJoinOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+    bool is_partitioned() const { return !this->build_partitions.empty(); }
+
+    static const size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+    static const uint PARTITIONS = 16;
+
+protected:
+    EvalOperator *build;
+    EvalOperator *probe;
+    ColumnNames build_keys;
+    ColumnNames probe_keys;
+    Identifier build_prefix;
+    Identifier probe_prefix;
+    size_t memory_budget;
+    JoinHashTable table;
+    ValueDict *probe_row;
+    uint64_t probe_hash;
+    int32_t match;  // next build row to join probe_row with, or -1
+    JoinPartitions build_partitions;  // empty unless the build rows didn't fit in memory
+    JoinPartitions probe_partitions;
+    uint partition;  // the partition being joined
+    BlockID block_id;  // the block of the probe partition probe_rows came from
+    ValueDicts *probe_rows;  // the rest of that block
+    size_t position;
+
+    void spill();
+    ValueDict *next_probe();
+    bool next_partition();
+    ValueDict *joined(const ValueDict &build_row, const ValueDict &probe_row) const;
+    void clear();
+    static uint partition_of(uint64_t hash) { return (uint) (hash >> 60) % PARTITIONS; }
+};
+
+bool test_hash_join();
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <iostream>
+#include "IndexJoin.h"
+#include "btree.h"
+#include "hash_index.h"
+using namespace std;
+
+IndexJoinOperator::IndexJoinOperator(EvalOperator *outer, DbRelation &inner, DbIndex *index,
+                                     const ColumnNames &outer_keys, const ColumnNames &inner_keys,
+                                     const ValueDict &inner_selection, const Identifier &outer_prefix,
+                                     const Identifier &inner_prefix, size_t batch_size)
+        : outer(outer), inner(inner), index(index), outer_keys(outer_keys), inner_keys(inner_keys), lookup_columns(),
+          inner_selection(inner_selection), outer_prefix(outer_prefix), inner_prefix(inner_prefix),
+          batch_size(max(batch_size, (size_t) 1)), outer_done(false), joined(), position(0) {
+    for (auto const& column: index->get_key_columns()) {
+        auto pair = find(inner_keys.begin(), inner_keys.end(), column);
+        if (pair == inner_keys.end())
+            throw DbRelationError("index is not on the join columns");
+        this->lookup_columns.push_back(outer_keys[pair - inner_keys.begin()]);
+    }
+}
+
+IndexJoinOperator::~IndexJoinOperator() {
+    clear();
+    delete this->outer;
+}
+
+void IndexJoinOperator::open() {
+    clear();
+    this->outer_done = false;
+    this->outer->open();
+}
+
+ValueDict *IndexJoinOperator::next() {
+    while (this->position >= this->joined.size()) {
+        if (this->outer_done)
+            return nullptr;
+        clear();
+        join_batch();
+    }
+    return this->joined[this->position++];
+}
+
+void IndexJoinOperator::close() {
+    clear();
+    this->outer->close();
+}
+
+// Look up the next batch of outer rows, then fetch what they found in handle order.
+void IndexJoinOperator::join_batch() {
+    ValueDicts outer_rows, keys;
+    while (outer_rows.size() < this->batch_size) {
+        ValueDict *row = this->outer->next();
+        if (row == nullptr) {
+            this->outer_done = true;
+            break;
+        }
+        ValueDict *key = new ValueDict();
+        const ColumnNames &key_columns = this->index->get_key_columns();
+        for (size_t i = 0; i < key_columns.size(); i++)
+            (*key)[key_columns[i]] = row->at(this->lookup_columns[i]);
+        outer_rows.push_back(row);
+        keys.push_back(key);
+    }
+    if (outer_rows.empty())
+        return;
+
+    // each handle found, with the outer row it was found for, in handle order
+    HandlesList *found = this->index->lookup_many(keys);
+    vector<pair<Handle, size_t>> matches;
+    for (size_t i = 0; i < found->size(); i++) {
+        for (auto const& handle: *found->at(i))
+            matches.push_back(make_pair(handle, i));
+        delete found->at(i);
+    }
+    delete found;
+    sort(matches.begin(), matches.end());
+    Handles handles;
+    for (auto const& match: matches)
+        if (handles.empty() || handles.back() != match.first)
+            handles.push_back(match.first);
+    ColumnNames all;  // empty: every column
+    ValueDicts *inner_rows = this->inner.project(&handles, &all);
+
+    size_t fetched = 0;
+    for (auto const& match: matches) {
+        while (handles[fetched] != match.first)
+            fetched++;
+        const ValueDict &inner_row = *inner_rows->at(fetched), &outer_row = *outer_rows[match.second];
+        bool keep = true;
+        for (size_t i = 0; i < this->outer_keys.size() && keep; i++)
+            keep = outer_row.at(this->outer_keys[i]) == inner_row.at(this->inner_keys[i]);
+        for (auto const& column: this->inner_selection)
+            keep = keep && inner_row.at(column.first) == column.second;
+        if (!keep)
+            continue;
+        ValueDict *row = new ValueDict();
+        for (auto const& column: outer_row)
+            (*row)[this->outer_prefix.empty() ? column.first : this->outer_prefix + "." + column.first] = column.second;
+        for (auto const& column: inner_row)
+            (*row)[this->inner_prefix.empty() ? column.first : this->inner_prefix + "." + column.first] = column.second;
+        this->joined.push_back(row);
+    }
+
+    for (auto const row: *inner_rows)
+        delete row;
+    delete inner_rows;
+    for (auto const row: outer_rows)
+        delete row;
+    for (auto const key: keys)
+        delete key;
+}
+
+// Free the joined rows not handed over.
+void IndexJoinOperator::clear() {
+    for (size_t i = this->position; i < this->joined.size(); i++)
+        delete this->joined[i];
+    this->joined.clear();
+    this->position = 0;
+}
+
+// test function -- returns true if all tests pass
+bool test_index_join() {
+    ColumnNames inner_columns = {"id", "grp", "tag"};
+    ColumnAttributes inner_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                         ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable inner("test_index_join_i", inner_columns, inner_attributes);
+    inner.create();
+    ColumnNames outer_columns = {"k", "g", "t"};
+    ColumnAttributes outer_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::INT),
+                                         ColumnAttribute(ColumnAttribute::TEXT)};
+    HeapTable outer("test_index_join_o", outer_columns, outer_attributes);
+    outer.create();
+
+    // inner rows 0..1999 in groups of i % 100, tagged i % 3; outer rows 0..59, k going past the last id
+    ValueDict row;
+    for (int i = 0; i < 2000; i++) {
+        row["id"] = Value(i);
+        row["grp"] = Value(i % 100);
+        row["tag"] = Value("t" + to_string(i % 3));
+        inner.insert(&row);
+    }
+    row.clear();
+    for (int i = 0; i < 60; i++) {
+        row["k"] = Value((i * 97) % 2100);
+        row["g"] = Value((i * 3) % 120);
+        row["t"] = Value("t" + to_string(i % 3));
+        outer.insert(&row);
+    }
+    BTreeIndex ids(inner, "test_index_join_ix", ColumnNames(1, "id"), true);
+    ids.create();
+    HashIndex groups(inner, "test_index_join_gx", ColumnNames(1, "grp"), false);
+    groups.create();
+
+    auto join = [&](DbIndex &index, const ColumnNames &outer_keys, const ColumnNames &inner_keys,
+                    const ValueDict &selection, size_t batch_size) {
+        IndexJoinOperator op(new TableScanOperator(outer), inner, &index, outer_keys, inner_keys, selection, "o", "i",
+                             batch_size);
+        vector<pair<int32_t, int32_t>> pairs;
+        op.open();
+        ValueDict *joined;
+        while ((joined = op.next()) != nullptr) {
+            if (joined->size() == 6)
+                pairs.push_back(make_pair(joined->at("o.k").n, joined->at("i.id").n));
+            delete joined;
+        }
+        op.close();
+        sort(pairs.begin(), pairs.end());
+        return pairs;
+    };
+    auto expected = [&](function<bool(int, int, int)> matches) {  // outer i, k and inner id
+        vector<pair<int32_t, int32_t>> pairs;
+        for (int i = 0; i < 60; i++)
+            for (int id = 0; id < 2000; id++)
+                if (matches(i, (i * 97) % 2100, id))
+                    pairs.push_back(make_pair((i * 97) % 2100, id));
+        sort(pairs.begin(), pairs.end());
+        return pairs;
+    };
+
+    //t1 unique index, batches of several sizes
+    auto t1 = expected([](int i, int k, int id) { return k == id; });
+    bool result = !t1.empty() && join(ids, {"k"}, {"id"}, ValueDict(), 7) == t1
+                  && join(ids, {"k"}, {"id"}, ValueDict(), 1) == t1
+                  && join(ids, {"k"}, {"id"}, ValueDict(), IndexJoinOperator::DEFAULT_BATCH_SIZE) == t1;
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 a hash index with many rows per key, and a key pair the index doesn't cover
+    auto t2 = expected([](int i, int k, int id) { return (i * 3) % 120 == id % 100 && i % 3 == id % 3; });
+    result = result && !t2.empty() && join(groups, {"g", "t"}, {"grp", "tag"}, ValueDict(), 16) == t2;
+    cout << (result ? "passed t2" : "failed t2") << endl;
+
+    //t3 a selection on the inner rows
+    ValueDict selection;
+    selection["tag"] = Value("t1");
+    auto t3 = expected([](int i, int k, int id) { return (i * 3) % 120 == id % 100 && id % 3 == 1; });
+    result = result && !t3.empty() && join(groups, {"g"}, {"grp"}, selection, 16) == t3;
+    cout << (result ? "passed t3" : "failed t3") << endl;
+
+    ids.drop();
+    groups.drop();
+    inner.drop();
+    outer.drop();
+    return result;
+}
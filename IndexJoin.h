@@ -0,0 +1,63 @@
+/**
+ * @file IndexJoin.h - index nested-loop join:
+ * IndexJoinOperator: each outer row joined with the inner rows an index on the inner table finds for it
+ */
+#pragma once
+
+#include "storage_engine.h"
+#include "EvalOperator.h"
+
+/**
+ * @class IndexJoinOperator - each pair of an outer row and an inner table row with equal keys, as one row
+ *
+ * The outer rows are taken a batch at a time and their keys looked up in the inner table's index all at
+ * once (lookup_many, so a B-tree shares the descents of nearby keys). The handles found are sorted and
+ * each distinct one fetched once, in order, so the inner table is read a block at a time rather than a
+ * row at a time; the inner table is never scanned. Rows come out in the inner table's order within a
+ * batch. Key pairs the index doesn't cover, and the inner selection, are checked against each row
+ * fetched. Each input's columns are renamed prefix.column in the joined rows, unless its prefix is empty.
+ */
+class IndexJoinOperator : public EvalOperator {
+public:
+    /**
+     * @param outer             the outer input
+     * @param inner             the inner table
+     * @param index             index on the inner table, its key columns all among inner_keys
+     * @param outer_keys        columns of the outer rows equal to the inner_keys of the inner rows, in pairs
+     * @param inner_keys
+     * @param inner_selection   column = value the inner rows must also meet
+     * @param outer_prefix      what the outer input's columns are qualified with, if anything
+     * @param inner_prefix      likewise for the inner table's
+     * @param batch_size        outer rows looked up at once
+     */
+    IndexJoinOperator(EvalOperator *outer, DbRelation &inner, DbIndex *index, const ColumnNames &outer_keys,
+                      const ColumnNames &inner_keys, const ValueDict &inner_selection, const Identifier &outer_prefix,
+                      const Identifier &inner_prefix, size_t batch_size=DEFAULT_BATCH_SIZE);
+    virtual ~IndexJoinOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+    static const size_t DEFAULT_BATCH_SIZE = 512;
+
+protected:
+    EvalOperator *outer;
+    DbRelation &inner;
+    DbIndex *index;
+    ColumnNames outer_keys;
+    ColumnNames inner_keys;
+    ColumnNames lookup_columns;  // of the outer rows, for each of the index's key columns
+    ValueDict inner_selection;
+    Identifier outer_prefix;
+    Identifier inner_prefix;
+    size_t batch_size;
+    bool outer_done;
+    ValueDicts joined;  // the current batch's joined rows
+    size_t position;  // next one to hand over
+
+    void join_batch();
+    void clear();
+};
+
+bool test_index_join();
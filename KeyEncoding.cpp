@@ -0,0 +1,90 @@
+#include "KeyEncoding.h"
+using namespace std;
+
+static const unsigned char TEXT_ESCAPE = 0x00;
+static const unsigned char TEXT_ESCAPED_ZERO = 0xFF;
+static const unsigned char TEXT_END = 0x00;
+
+void KeyEncoding::encode_value(const Value& value, ColumnAttribute::DataType data_type, NormalizedKey& out) {
+    if (data_type == ColumnAttribute::DataType::INT) {
+        uint32_t bits = (uint32_t) value.n ^ 0x80000000U;
+        out.push_back((char) (bits >> 24));
+        out.push_back((char) (bits >> 16));
+        out.push_back((char) (bits >> 8));
+        out.push_back((char) bits);
+    } else if (data_type == ColumnAttribute::DataType::TEXT) {
+        for (auto const& c: value.s) {
+            out.push_back(c);
+            if ((unsigned char) c == TEXT_ESCAPE)
+                out.push_back((char) TEXT_ESCAPED_ZERO);
+        }
+        out.push_back((char) TEXT_ESCAPE);
+        out.push_back((char) TEXT_END);
+    } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+        out.push_back((char) (value.n != 0 ? 1 : 0));
+    } else {
+        throw DbRelationError("only know how to encode INT, TEXT, or BOOLEAN index keys");
+    }
+}
+
+NormalizedKey KeyEncoding::encode(const KeyValue& key, const KeyProfile& key_profile) {
+    if (key.size() < key_profile.size())
+        throw DbRelationError("index key is missing columns");
+    NormalizedKey out;
+    for (uint col_num = 0; col_num < key_profile.size(); col_num++)
+        encode_value(key[col_num], key_profile[col_num], out);
+    return out;
+}
+
+KeyValue *KeyEncoding::decode(const char *bytes, size_t size, const KeyProfile& key_profile, size_t *consumed) {
+    const unsigned char *ubytes = (const unsigned char *) bytes;
+    KeyValue *key = new KeyValue();
+    size_t offset = 0;
+    for (auto const& data_type: key_profile) {
+        Value value;
+        value.data_type = data_type;
+        if (data_type == ColumnAttribute::DataType::INT) {
+            if (offset + 4 > size)
+                break;
+            uint32_t bits = ((uint32_t) ubytes[offset] << 24) | ((uint32_t) ubytes[offset + 1] << 16)
+                            | ((uint32_t) ubytes[offset + 2] << 8) | (uint32_t) ubytes[offset + 3];
+            value.n = (int32_t) (bits ^ 0x80000000U);
+            offset += 4;
+        } else if (data_type == ColumnAttribute::DataType::TEXT) {
+            while (offset + 1 < size && !(ubytes[offset] == TEXT_ESCAPE && ubytes[offset + 1] == TEXT_END)) {
+                value.s.push_back(bytes[offset]);
+                offset += ubytes[offset] == TEXT_ESCAPE ? 2 : 1;
+            }
+            if (offset + 1 >= size)
+                break;  // no terminator
+            offset += 2;
+        } else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+            if (offset + 1 > size)
+                break;
+            value.n = ubytes[offset++];
+        } else {
+            delete key;
+            throw DbRelationError("only know how to decode INT, TEXT, or BOOLEAN index keys");
+        }
+        key->push_back(value);
+    }
+    if (key->size() != key_profile.size()) {
+        delete key;
+        throw DbRelationError("truncated index key");
+    }
+    if (consumed != nullptr)
+        *consumed = offset;
+    return key;
+}
+
+std::vector<size_t> KeyEncoding::column_ends(const NormalizedKey& key, const KeyProfile& key_profile) {
+    vector<size_t> ends;
+    KeyProfile leading;
+    for (auto const& data_type: key_profile) {
+        leading.push_back(data_type);
+        size_t consumed;
+        delete decode(key.data(), key.size(), leading, &consumed);
+        ends.push_back(consumed);
+    }
+    return ends;
+}
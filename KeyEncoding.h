@@ -0,0 +1,66 @@
+/**
+ * @file KeyEncoding.h - order-preserving binary encoding of index keys
+ * KeyEncoding
+ */
+#pragma once
+
+#include <string>
+#include "storage_engine.h"
+
+typedef std::vector<ColumnAttribute::DataType> KeyProfile;
+typedef std::vector<Value> KeyValue;
+
+/**
+ * A KeyValue encoded so that comparing two encoded keys bytewise (memcmp, or std::string's <)
+ * gives the same order as comparing the KeyValues column by column.
+ */
+typedef std::string NormalizedKey;
+typedef std::vector<NormalizedKey> NormalizedKeys;
+
+/**
+ * @class KeyEncoding - builds and takes apart NormalizedKeys according to a KeyProfile
+ *
+ * Each column is encoded in turn:
+ *      INT:      4 bytes, big-endian, with the sign bit flipped so negatives sort first
+ *      BOOLEAN:  1 byte, 0 or 1
+ *      TEXT:     the bytes of the string with each 0x00 escaped as 0x00 0xFF, then 0x00 0x00
+ * The TEXT terminator sorts below any escaped or ordinary byte, so a string sorts before every
+ * longer string it is a prefix of, and no encoded column is a prefix of a different one.
+ */
+class KeyEncoding {
+public:
+    /**
+     * Encode a key.
+     * @param key          one value per key column
+     * @param key_profile  data type of each key column
+     * @returns            the normalized key
+     */
+    static NormalizedKey encode(const KeyValue& key, const KeyProfile& key_profile);
+
+    /**
+     * Decode a normalized key.
+     * @param bytes        start of the encoded key
+     * @param size         bytes available
+     * @param key_profile  data type of each key column
+     * @param consumed     if not null, returned by reference: number of bytes decoded
+     * @returns            the key values (freed by caller)
+     */
+    static KeyValue *decode(const char *bytes, size_t size, const KeyProfile& key_profile, size_t *consumed=nullptr);
+    static KeyValue *decode(const NormalizedKey& key, const KeyProfile& key_profile) {
+        return decode(key.data(), key.size(), key_profile);
+    }
+
+    /**
+     * Append the encoding of a single column value.
+     */
+    static void encode_value(const Value& value, ColumnAttribute::DataType data_type, NormalizedKey& out);
+
+    /**
+     * Where each column of a normalized key ends, so that key.substr(0, ends[i]) is the encoding of
+     * its first i + 1 columns.
+     * @param key          the normalized key
+     * @param key_profile  data type of each key column
+     * @returns            one byte count per key column
+     */
+    static std::vector<size_t> column_ends(const NormalizedKey& key, const KeyProfile& key_profile);
+};
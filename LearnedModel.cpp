@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "LearnedModel.h"
+using namespace std;
+
+const uint LearnedModel::DEFAULT_ERROR;
+
+LearnedModel::LearnedModel(uint error)
+        : segments(), error(error), entries(0), open(false), last_key(0), low(0.0), high(0.0) {
+}
+
+void LearnedModel::clear() {
+    this->segments.clear();
+    this->entries = 0;
+    this->open = false;
+}
+
+// Narrow the open segment's slopes to those that put key within error of position, or if none would,
+// close it and start a new one at key.
+void LearnedModel::add(int32_t key, uint32_t position) {
+    if (this->open && key == this->last_key)
+        return;
+    this->last_key = key;
+    if (this->open) {
+        const LearnedSegment& segment = this->segments.back();
+        double dx = (double) ((int64_t) key - segment.key);
+        double low = ((double) position - this->error - segment.position) / dx;
+        double high = ((double) position + this->error - segment.position) / dx;
+        if (max(this->low, low) <= min(this->high, high)) {
+            this->low = max(this->low, low);
+            this->high = min(this->high, high);
+            return;
+        }
+        close_segment();
+    }
+    this->segments.push_back(LearnedSegment(key, position, 0.0));
+    this->low = 0.0;
+    this->high = numeric_limits<double>::infinity();
+    this->open = true;
+}
+
+void LearnedModel::finish(uint32_t entries) {
+    if (this->open)
+        close_segment();
+    this->entries = entries;
+}
+
+// Any slope left in the cone will do; the middle one keeps clear of both edges.
+void LearnedModel::close_segment() {
+    LearnedSegment& segment = this->segments.back();
+    segment.slope = isinf(this->high) ? 0.0 : (this->low + this->high) / 2;
+    this->open = false;
+}
+
+// The segment for key is the last one starting at or before it; its prediction is kept between its
+// own first position and the next segment's.
+size_t LearnedModel::predict(int32_t key) const {
+    if (this->segments.empty())
+        return 0;
+    auto after = upper_bound(this->segments.begin(), this->segments.end(), key,
+                             [](int32_t key, const LearnedSegment& segment) { return key < segment.key; });
+    if (after == this->segments.begin())
+        return 0;
+    const LearnedSegment& segment = *(after - 1);
+    double limit = after == this->segments.end() ? (double) this->entries : (double) after->position;
+    double position = segment.position + segment.slope * (double) ((int64_t) key - segment.key);
+    position = min(max(position, (double) segment.position), limit);
+    return (size_t) llround(position);
+}
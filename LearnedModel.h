@@ -0,0 +1,66 @@
+/**
+ * @file LearnedModel.h - piecewise linear model of where INT keys are in a sorted array, for LearnedIndex:
+ * LearnedSegment: one line of the model, good from its first key up to the next segment's
+ * LearnedModel: the segments, fitted to the keys in one pass, and the predictions made from them
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "storage_engine.h"
+
+typedef std::pair<int32_t, Handle> LearnedEntry;
+typedef std::vector<LearnedEntry> LearnedEntries;
+
+/**
+ * @class LearnedSegment - predicts position + slope * (key - this key) for keys from this key on
+ */
+class LearnedSegment {
+public:
+    LearnedSegment() : key(0), position(0), slope(0.0) {}
+    LearnedSegment(int32_t key, uint32_t position, double slope) : key(key), position(position), slope(slope) {}
+
+    int32_t key;
+    uint32_t position;
+    double slope;
+};
+
+typedef std::vector<LearnedSegment> LearnedSegments;
+
+/**
+ * @class LearnedModel - maps each key to within error of the position of its first entry
+ *
+ * Fitted with a shrinking cone: each segment keeps the range of slopes that would still put every key
+ * it has taken within error of its position, and a key that would leave no slope at all starts the next
+ * segment. So the segment count depends only on how far the keys are from evenly spaced--ids or
+ * timestamps that grow steadily take a handful, however many rows there are. A key that is not in the
+ * data gets a prediction too, but with no bound on its error.
+ */
+class LearnedModel {
+public:
+    LearnedModel(uint error=DEFAULT_ERROR);
+    virtual ~LearnedModel() {}
+
+    // fitting: keys in order, each with the position of its entry (repeats of the last key are skipped)
+    void clear();
+    void add(int32_t key, uint32_t position);
+    void finish(uint32_t entries);
+
+    size_t predict(int32_t key) const;  // within error of key's first position, if key is in the data
+    uint get_error() const { return this->error; }
+    uint32_t get_entries() const { return this->entries; }
+
+    LearnedSegments segments;
+
+    static const uint DEFAULT_ERROR = 32;
+
+protected:
+    uint error;
+    uint32_t entries;
+    bool open;  // the last segment is still taking keys
+    int32_t last_key;
+    double low;  // the slopes the open segment can still have
+    double high;
+
+    void close_segment();
+};
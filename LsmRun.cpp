@@ -0,0 +1,166 @@
+#include <algorithm>
+#include "LsmRun.h"
+using namespace std;
+
+const uint LsmEntry::HANDLE_SZ;
+
+/************
+ * LsmEntry *
+ ************/
+
+LsmEntryKey LsmEntry::make(const NormalizedKey& key, Handle handle) {
+    LsmEntryKey entry(key);
+    for (int shift = 24; shift >= 0; shift -= 8)
+        entry.push_back((char) ((handle.first >> shift) & 0xFF));
+    entry.push_back((char) ((handle.second >> 8) & 0xFF));
+    entry.push_back((char) (handle.second & 0xFF));
+    return entry;
+}
+
+NormalizedKey LsmEntry::key(const LsmEntryKey& entry) {
+    return entry.substr(0, entry.size() - HANDLE_SZ);
+}
+
+Handle LsmEntry::handle(const LsmEntryKey& entry) {
+    const unsigned char* bytes = (const unsigned char*) entry.data() + entry.size() - HANDLE_SZ;
+    BlockID block_id = ((BlockID) bytes[0] << 24) | ((BlockID) bytes[1] << 16) | ((BlockID) bytes[2] << 8) | bytes[3];
+    RecordID record_id = (RecordID) ((bytes[4] << 8) | bytes[5]);
+    return Handle(block_id, record_id);
+}
+
+
+/**********
+ * LsmRun *
+ **********/
+
+// The last page whose fence is not past min: any earlier page ends before min.
+size_t LsmRun::first_page(const NormalizedKey& min) const {
+    auto after = upper_bound(this->fences.begin(), this->fences.end(), min);
+    return after == this->fences.begin() ? 0 : (after - this->fences.begin()) - 1;
+}
+
+LsmRun LsmRun::load(HeapFile& file, BlockID first_page_id, uint32_t entries) {
+    LsmRun run;
+    run.entries = entries;
+    BlockID page_id = first_page_id;
+    while (page_id != 0) {
+        SlottedPage* page = file.get(page_id);
+        Dbt* dbt = page->get(1);
+        BlockID next = *(BlockID*) dbt->get_data();
+        delete dbt;
+        RecordIDs* record_ids = page->ids();
+        if (record_ids->size() > 1) {
+            dbt = page->get(2);
+            run.fences.push_back(LsmEntryKey((const char*) dbt->get_data() + 1, dbt->get_size() - 1));
+            delete dbt;
+        } else {
+            run.fences.push_back(LsmEntryKey());
+        }
+        delete record_ids;
+        delete page;
+        run.pages.push_back(page_id);
+        page_id = next;
+    }
+    return run;
+}
+
+
+/****************
+ * LsmRunWriter *
+ ****************/
+
+LsmRunWriter::LsmRunWriter(HeapFile& file, LsmAllocator allocate)
+        : file(file), allocate(allocate), page(nullptr), used(0), run() {
+}
+
+LsmRunWriter::~LsmRunWriter() {
+    delete this->page;
+}
+
+void LsmRunWriter::add(const LsmEntryKey& entry, bool live) {
+    uint size = 1 + (uint) entry.size();
+    if (this->page == nullptr || this->used + size + SLOT_SZ > CAPACITY) {
+        next_page();
+        this->run.fences.push_back(entry);
+    }
+    string record(1, live ? '\1' : '\0');
+    record.append(entry);
+    Dbt dbt((void*) record.data(), (u_int32_t) record.size());
+    this->page->add(&dbt);
+    this->used += size + SLOT_SZ;
+    this->run.entries++;
+}
+
+// Start a new page, pointing the current one at it before writing it out.
+void LsmRunWriter::next_page() {
+    SlottedPage* next = this->allocate();
+    next->clear();
+    BlockID none = 0;
+    Dbt next_dbt(&none, sizeof(BlockID));
+    next->add(&next_dbt);
+    if (this->page != nullptr) {
+        BlockID next_id = next->get_block_id();
+        Dbt dbt(&next_id, sizeof(BlockID));
+        this->page->put(1, dbt);
+        this->file.put(this->page);
+        delete this->page;
+    }
+    this->page = next;
+    this->used = sizeof(BlockID) + SLOT_SZ;
+    this->run.pages.push_back(next->get_block_id());
+}
+
+LsmRun LsmRunWriter::finish() {
+    if (this->page == nullptr) {
+        next_page();
+        this->run.fences.push_back(LsmEntryKey());
+    }
+    this->file.put(this->page);
+    delete this->page;
+    this->page = nullptr;
+    return this->run;
+}
+
+
+/****************
+ * LsmRunReader *
+ ****************/
+
+LsmRunReader::LsmRunReader(HeapFile& file, const LsmRun& run, size_t page_index)
+        : file(file), run(run), page_index(page_index), buffer(), at(0) {
+}
+
+bool LsmRunReader::next(LsmEntryKey& entry, bool& live) {
+    while (this->at == this->buffer.size()) {
+        if (this->page_index >= this->run.pages.size())
+            return false;
+        this->buffer.clear();
+        this->at = 0;
+        SlottedPage* page = this->file.get(this->run.pages[this->page_index++]);
+        RecordIDs* record_ids = page->ids();
+        for (auto const& record_id: *record_ids) {
+            if (record_id == 1)
+                continue;
+            Dbt* dbt = page->get(record_id);
+            const char* data = (const char*) dbt->get_data();
+            this->buffer.push_back(make_pair(LsmEntryKey(data + 1, dbt->get_size() - 1), data[0] != 0));
+            delete dbt;
+        }
+        delete record_ids;
+        delete page;
+    }
+    entry = this->buffer[this->at].first;
+    live = this->buffer[this->at].second;
+    this->at++;
+    return true;
+}
+
+// page_index is the next page to read, so the page being read is the one before it.
+bool LsmRunReader::skip_to(size_t page_index) {
+    if (page_index < this->page_index)
+        return false;
+    this->page_index = page_index;
+    this->buffer.clear();
+    this->at = 0;
+    return true;
+}
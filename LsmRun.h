@@ -0,0 +1,100 @@
+/**
+ * @file LsmRun.h - sorted runs of index entries, for LsmIndex:
+ * LsmEntry: builds and takes apart the entry keys runs are sorted on
+ * LsmRun: where a run's pages are and the first entry on each
+ * LsmRunWriter: writes entries, in order, as a new run
+ * LsmRunReader: reads a run's entries back, in order
+ */
+#pragma once
+
+#include <functional>
+#include <map>
+#include "KeyEncoding.h"
+#include "heap_storage.h"
+
+/**
+ * An entry key is the row's normalized key followed by its handle (big-endian), so entries sort by key
+ * and then by handle, and since normalized keys are prefix free, a key's entries are exactly the entry
+ * keys that start with it.
+ */
+typedef std::string LsmEntryKey;
+typedef std::vector<LsmEntryKey> LsmEntryKeys;
+
+// entry key -> true for an insert, false for a delete (a tombstone hiding the entry in older runs)
+typedef std::map<LsmEntryKey, bool> LsmMemtable;
+
+class LsmEntry {
+public:
+    static const uint HANDLE_SZ = sizeof(BlockID) + sizeof(RecordID);
+    static LsmEntryKey make(const NormalizedKey& key, Handle handle);
+    static NormalizedKey key(const LsmEntryKey& entry);
+    static Handle handle(const LsmEntryKey& entry);
+};
+
+/**
+ * @class LsmRun - an immutable sorted run of entries on a chain of pages
+ *
+ * Each page holds the next page's id as record 1, then a record per entry: a live/tombstone byte and
+ * the entry key. The first entry key of each page is kept in memory as its fence, so a probe reads only
+ * the pages that can hold what it wants.
+ */
+class LsmRun {
+public:
+    LsmRun() : pages(), fences(), entries(0) {}
+
+    BlockIDs pages;
+    LsmEntryKeys fences;
+    uint32_t entries;
+
+    size_t first_page(const NormalizedKey& min) const;  // the page to start at for keys >= min
+
+    // walk the chain from first_page_id to fill in pages and fences
+    static LsmRun load(HeapFile& file, BlockID first_page_id, uint32_t entries);
+};
+
+typedef std::function<SlottedPage*()> LsmAllocator;
+
+/**
+ * @class LsmRunWriter - packs entries (given in order) onto pages from allocate, chaining them together
+ */
+class LsmRunWriter {
+public:
+    LsmRunWriter(HeapFile& file, LsmAllocator allocate);
+    virtual ~LsmRunWriter();
+    LsmRunWriter(const LsmRunWriter& other) = delete;
+    LsmRunWriter& operator=(const LsmRunWriter& other) = delete;
+
+    void add(const LsmEntryKey& entry, bool live);
+    LsmRun finish();  // write out the last page; a run always has at least one page
+
+protected:
+    static const uint SLOT_SZ = 4;
+    static const uint CAPACITY = DbBlock::BLOCK_SZ - 5;
+
+    HeapFile& file;
+    LsmAllocator allocate;
+    SlottedPage* page;
+    uint used;
+    LsmRun run;
+
+    void next_page();
+};
+
+/**
+ * @class LsmRunReader - reads a run a page at a time from a given page on
+ */
+class LsmRunReader {
+public:
+    LsmRunReader(HeapFile& file, const LsmRun& run, size_t page_index=0);
+    virtual ~LsmRunReader() {}
+
+    bool next(LsmEntryKey& entry, bool& live);  // false at end of run
+    bool skip_to(size_t page_index);  // jump ahead to a later page; false (staying put) if it isn't later
+
+protected:
+    HeapFile& file;
+    const LsmRun& run;
+    size_t page_index;
+    std::vector<std::pair<LsmEntryKey, bool>> buffer;
+    size_t at;
+};
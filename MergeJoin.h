@@ -0,0 +1,50 @@
+/**
+ * @file MergeJoin.h - sort-merge join:
+ * MergeJoinOperator: the joined rows of two inputs that both come sorted on their join keys
+ */
+#pragma once
+
+#include "storage_engine.h"
+#include "EvalOperator.h"
+
+/**
+ * @class MergeJoinOperator - each pair of a left row and a right row with equal keys, as one row
+ *
+ * Both inputs must come in ascending order of their keys (as Value's operator< orders them). They are
+ * read in step, and only the right rows with the current key are held, so the memory needed is that of
+ * the largest group of right rows sharing a key, however big the inputs are. The rows come out in order
+ * of the keys. Each input's columns are renamed prefix.column in the joined rows, unless its prefix is
+ * empty.
+ */
+class MergeJoinOperator : public EvalOperator {
+public:
+    MergeJoinOperator(EvalOperator *left, EvalOperator *right, const ColumnNames &left_keys,
+                      const ColumnNames &right_keys, const Identifier &left_prefix, const Identifier &right_prefix);
+    virtual ~MergeJoinOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+    // compare the values of a's columns a_keys with those of b's columns b_keys, as compare_rows does
+    static int compare_keys(const ValueDict &a, const ColumnNames &a_keys, const ValueDict &b,
+                            const ColumnNames &b_keys);
+
+protected:
+    EvalOperator *left;
+    EvalOperator *right;
+    ColumnNames left_keys;
+    ColumnNames right_keys;
+    Identifier left_prefix;
+    Identifier right_prefix;
+    ValueDict *left_row;  // the left row being joined
+    ValueDict *right_row;  // the first right row past the group
+    ValueDicts group;  // the right rows with the current key
+    size_t group_position;  // next one to join left_row with
+    bool matching;  // whether left_row has the group's key
+
+    ValueDict *joined(const ValueDict &left_row, const ValueDict &right_row) const;
+    void clear();
+};
+
+bool test_merge_join();
@@ -103,7 +103,13 @@ string ParseTreeToString::expression(const Expr *expr) {
             ret += to_string(expr->ival);
             break;
         case kExprFunctionRef:
-            ret += string(expr->name) + "?" + expr->expr->name;
+            ret += string(expr->name) + "(" + (expr->distinct ? "DISTINCT " : "");
+            if (expr->expr != NULL)
+                ret += expression(expr->expr);
+            else if (expr->exprList != NULL)
+                for (size_t i = 0; i < expr->exprList->size(); i++)
+                    ret += (i == 0 ? "" : ", ") + expression(expr->exprList->at(i));
+            ret += ")";
             break;
         case kExprOperator:
             ret += operator_expression(expr);
@@ -196,6 +202,22 @@ string ParseTreeToString::select(const SelectStatement *stmt) {
     ret += " FROM " + table_ref(stmt->fromTable);
     if (stmt->whereClause != NULL)
         ret += " WHERE " + expression(stmt->whereClause);
+    if (stmt->order != NULL) {
+        ret += " ORDER BY ";
+        doComma = false;
+        for (OrderDescription *order : *stmt->order) {
+            if (doComma)
+                ret += ", ";
+            ret += expression(order->expr);
+            if (order->type == kOrderDesc)
+                ret += " DESC";
+            doComma = true;
+        }
+    }
+    if (stmt->limit != NULL && stmt->limit->limit >= 0)
+        ret += " LIMIT " + to_string(stmt->limit->limit);
+    if (stmt->limit != NULL && stmt->limit->offset > 0)
+        ret += " OFFSET " + to_string(stmt->limit->offset);
     return ret;
 }
 
@@ -3,6 +3,10 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
  */
+#include <algorithm>
+#include <functional>
+#include <regex>
+#include <sstream>
 #include "SQLExec.h"
 #include "EvalPlan.h"
 #include "btree.h"
@@ -13,6 +17,29 @@ using namespace hsql;
 
 Tables* SQLExec::tables = nullptr;
 Indices* SQLExec::indices = nullptr;
+Statistics* SQLExec::statistics = nullptr;
+
+// Prints one row of query results
+static void print_row(ostream &out, const ColumnNames &column_names, const ValueDict *row) {
+    for (auto const &column_name: column_names) {
+        Value value = row->at(column_name);
+        switch (value.data_type) {
+            case ColumnAttribute::INT:
+                out << value.n;
+                break;
+            case ColumnAttribute::TEXT:
+                out << "\"" << value.s << "\"";
+                break;
+			case ColumnAttribute::BOOLEAN:
+				out << (value.n == 0 ? "false" : "true");
+				break;
+            default:
+                out << "???";
+        }
+        out << " ";
+    }
+    out << endl;
+}
 
 // Prints query results
 ostream &operator<<(ostream &out, const QueryResult &qres) {
@@ -23,32 +50,32 @@ ostream &operator<<(ostream &out, const QueryResult &qres) {
         for (unsigned int i = 0; i < qres.column_names->size(); i++)
             out << "----------+";
         out << endl;
-        for (auto const &row: *qres.rows) {
-            for (auto const &column_name: *qres.column_names) {
-                Value value = row->at(column_name);
-                switch (value.data_type) {
-                    case ColumnAttribute::INT:
-                        out << value.n;
-                        break;
-                    case ColumnAttribute::TEXT:
-                        out << "\"" << value.s << "\"";
-                        break;
-					case ColumnAttribute::BOOLEAN:
-						out << (value.n == 0 ? "false" : "true");
-						break;
-                    default:
-                        out << "???";
-                }
-                out << " ";
+        if (qres.rows != nullptr)
+            for (auto const &row: *qres.rows)
+                print_row(out, *qres.column_names, row);
+    }
+    if (qres.stream != nullptr) {
+        // run the query, printing each row as it is produced
+        u_long n = 0;
+        try {
+            qres.stream->open();
+            ValueDict *row;
+            while ((row = qres.stream->next()) != nullptr) {
+                print_row(out, *qres.column_names, row);
+                delete row;
+                n++;
             }
-            out << endl;
+            qres.stream->close();
+        } catch (DbRelationError& e) {
+            qres.stream->close();
+            throw SQLExecError(string("DbRelationError: ") + e.what());
         }
+        out << "successfully returned " << n << " rows";
     }
     out << qres.message;
     return out;
 }
 
-//Deconstructor
 QueryResult::~QueryResult() {
     if (column_names != nullptr)
         delete column_names;
@@ -59,20 +86,24 @@ QueryResult::~QueryResult() {
             delete row;
         delete rows;
     }
+    delete stream;
 }
 
 // Executes query statement
-QueryResult *SQLExec::execute(const SQLStatement *statement) throw(SQLExecError) {
+QueryResult *SQLExec::execute(const SQLStatement *statement, const IndexOptions *index_options) throw(SQLExecError) {
     // initialize _tables table, if not yet present
     if (SQLExec::tables == nullptr)
         SQLExec::tables = new Tables();
     if (SQLExec::indices == nullptr)
         SQLExec::indices = new Indices();
+    if (SQLExec::statistics == nullptr)
+        SQLExec::statistics = new Statistics();
 
     try {
         switch (statement->type()) {
             case kStmtCreate:
-                return create((const CreateStatement *) statement);
+                return create((const CreateStatement *) statement,
+                              index_options != nullptr ? *index_options : IndexOptions());
             case kStmtDrop:
                 return drop((const DropStatement *) statement);
             case kStmtShow:
@@ -90,14 +121,57 @@ QueryResult *SQLExec::execute(const SQLStatement *statement) throw(SQLExecError)
         throw SQLExecError(string("DbRelationError: ") + e.what());
     }
 }
-ValueDict* SQLExec::get_where_conjunction(const Expr *expr){
+
+// Pulls USING for the index types the parser lacks, INCLUDE (col, ...) and a trailing WHERE predicate
+// out of a CREATE INDEX query
+string SQLExec::parse_index_options(const string &query, IndexOptions &options) {
+    static const regex create_index("^\\s*create\\s+index\\b");
+    static const regex index_type("\\s+using\\s+(bitmap|art|lsm|learned)\\b");  // the parser knows btree and hash
+    static const regex include("\\s+include\\s*\\(([^)]*)\\)");
+    static const regex where("\\)\\s*where\\s+(.*?)\\s*;?\\s*$");
+    static const regex column("[a-z_][a-z0-9_]*");
+
+    options = IndexOptions();
+    if (!regex_search(query, create_index))
+        return query;
+    string rest = query;
+    smatch match;
+    if (regex_search(rest, match, index_type)) {
+        options.index_type = match[1].str();
+        transform(options.index_type.begin(), options.index_type.end(), options.index_type.begin(), ::toupper);
+        rest = match.prefix().str() + match.suffix().str();
+    }
+    if (regex_search(rest, match, where)) {
+        options.filter = match[1].str();
+        rest = match.prefix().str() + ")";
+    }
+    if (!regex_search(rest, match, include))
+        return rest;
+    string columns = match[1].str();
+    for (sregex_iterator it(columns.begin(), columns.end(), column), end; it != end; ++it)
+        options.include_columns.push_back(it->str());
+    return match.prefix().str() + match.suffix().str();
+}
+// The value of a literal in a WHERE clause
+static Value where_literal(const Expr *expr) {
+    switch (expr->type) {
+        case hsql::kExprLiteralString:
+            return Value(expr->name);
+        case hsql::kExprLiteralInt:
+            return Value(int32_t(expr->ival));
+        default:
+            throw DbRelationError("Not valid data type.");
+    }
+}
+
+ValueDict* SQLExec::get_where_conjunction(const Expr *expr, ValueLists *in_lists, ValueRanges *ranges){
     ValueDict* where = new ValueDict();
 
     if (expr->type == hsql::kExprOperator)
     {
         if (expr->opType == hsql::Expr::AND) {
-            ValueDict* left_where= get_where_conjunction(expr->expr);
-            ValueDict* right_where= get_where_conjunction(expr->expr2);
+            ValueDict* left_where= get_where_conjunction(expr->expr, in_lists, ranges);
+            ValueDict* right_where= get_where_conjunction(expr->expr2, in_lists, ranges);
 
             where->insert(left_where->begin(), left_where->end());
             where->insert(right_where->begin(), right_where->end());
@@ -124,6 +198,53 @@ ValueDict* SQLExec::get_where_conjunction(const Expr *expr){
 
         //FIX AND
         }
+        else if (expr->opType == hsql::Expr::IN && in_lists != nullptr && expr->exprList != nullptr)
+        {
+            Identifier identifier = expr->expr->name;
+            std::vector<Value> values;
+            for (auto const item: *expr->exprList) {
+                switch (item->type) {
+                    case hsql::kExprLiteralString:
+                        values.push_back(Value(item->name));
+                        break;
+                    case hsql::kExprLiteralInt:
+                        values.push_back(Value(int32_t(item->ival)));
+                        break;
+                    default:
+                        throw DbRelationError("Not valid data type.");
+                }
+            }
+            sort(values.begin(), values.end());
+            values.erase(unique(values.begin(), values.end()), values.end());
+            // the same column IN two lists can only have the values in both
+            if (in_lists->find(identifier) != in_lists->end()) {
+                std::vector<Value> both;
+                const std::vector<Value> &other = in_lists->at(identifier);
+                set_intersection(values.begin(), values.end(), other.begin(), other.end(), back_inserter(both));
+                values = both;
+            }
+            (*in_lists)[identifier] = values;
+        }
+        else if (ranges != nullptr && ((expr->opType == hsql::Expr::SIMPLE_OP && (expr->opChar == '<' || expr->opChar == '>'))
+                                       || expr->opType == hsql::Expr::LESS_EQ || expr->opType == hsql::Expr::GREATER_EQ))
+        {
+            // column < literal, or literal < column read the other way round
+            bool less = expr->opType == hsql::Expr::LESS_EQ || (expr->opType == hsql::Expr::SIMPLE_OP && expr->opChar == '<');
+            bool inclusive = expr->opType != hsql::Expr::SIMPLE_OP;
+            const Expr *column = expr->expr, *literal = expr->expr2;
+            if (column->type != hsql::kExprColumnRef) {
+                std::swap(column, literal);
+                less = !less;
+            }
+            if (column->type != hsql::kExprColumnRef)
+                throw DbRelationError("Invalid where statement");
+            Value bound = where_literal(literal);
+            ValueRange& range = (*ranges)[column->name];
+            if (less)
+                range.below(bound, inclusive);
+            else
+                range.above(bound, inclusive);
+        }
         else {
             throw  DbRelationError("Invalid where statement");
         }
@@ -207,11 +328,11 @@ QueryResult *SQLExec::del(const DeleteStatement *statement)
     // get table and where clauses
     DbRelation &tb = SQLExec::tables->get_table(table);
 
-    // make the evaluation plan
-    EvalPlan *plan = new EvalPlan(tb);
-
+    // make the evaluation plan, letting the optimizer know the table's indexes and statistics
+    std::vector<const Expr *> conjuncts;
     if (statement->expr != NULL)
-        plan = new EvalPlan(get_where_conjunction(statement->expr), plan);
+        conjuncts.push_back(statement->expr);
+    EvalPlan *plan = table_plan(table, conjuncts);
 
     // and execute it to get a list of handles
 
@@ -244,20 +365,195 @@ QueryResult *SQLExec::del(const DeleteStatement *statement)
 
 
 
+// Whether a select groups its rows: it has a GROUP BY clause or aggregates in its select list
+static bool grouped(const SelectStatement *statement) {
+    if (statement->groupBy != nullptr)
+        return true;
+    if (statement->selectList != nullptr)
+        for (auto const& expr: *statement->selectList)
+            if (expr->type == kExprFunctionRef)
+                return true;
+    return false;
+}
+
+// A function call's argument (newer parsers put the arguments in exprList), or nullptr if it hasn't one
+static const Expr *function_argument(const Expr *expr) {
+    if (expr->expr == nullptr && expr->exprList != nullptr && expr->exprList->size() == 1)
+        return expr->exprList->front();
+    return expr->expr;
+}
+
+// Group plan's rows by the GROUP BY columns (into one group if there are none) and compute the select
+// list's aggregates over each group, the select list's columns going into column_names and their
+// attributes into column_attributes. Only the columns the grouping needs are kept from plan's rows.
+// column_of gives the name a column reference has in plan's rows, and its attribute.
+static EvalPlan *group_plan(const SelectStatement *statement, EvalPlan *plan,
+                            std::function<Identifier(const Expr *, ColumnAttribute &)> column_of,
+                            ColumnNames &column_names, ColumnAttributes &column_attributes) {
+    ColumnNames group_by;
+    if (statement->groupBy != nullptr) {
+        if (statement->groupBy->having != nullptr)
+            throw SQLExecError("HAVING is not implemented");
+        for (auto const& expr: *statement->groupBy->columns) {
+            if (expr->type != kExprColumnRef)
+                throw SQLExecError("only columns can be grouped by");
+            ColumnAttribute attribute;
+            Identifier column = column_of(expr, attribute);
+            if (find(group_by.begin(), group_by.end(), column) == group_by.end())
+                group_by.push_back(column);
+        }
+    }
+
+    ColumnNames needed = group_by;
+    Aggregates aggregates;
+    for (auto const& expr: *statement->selectList) {
+        ColumnAttribute attribute;
+        if (expr->type == kExprColumnRef) {
+            Identifier column = column_of(expr, attribute);
+            if (find(group_by.begin(), group_by.end(), column) == group_by.end())
+                throw SQLExecError("column " + column + " must be grouped by or aggregated");
+            column_names.push_back(column);
+            column_attributes.push_back(attribute);
+            continue;
+        }
+        if (expr->type != kExprFunctionRef)
+            throw SQLExecError("only grouped columns and aggregates can be selected from groups");
+        Aggregate::Function function;
+        if (!Aggregate::function_named(expr->name, function))
+            throw SQLExecError(string("unknown function ") + expr->name);
+        if (expr->distinct)
+            throw SQLExecError("DISTINCT aggregates are not implemented");
+        Identifier column, name = Aggregate::function_name(function);
+        const Expr *argument = function_argument(expr);
+        if (argument != nullptr && argument->type == kExprStar && function == Aggregate::COUNT) {
+            name += "(*)";
+            attribute = ColumnAttribute(ColumnAttribute::INT);
+        } else if (argument != nullptr && argument->type == kExprColumnRef) {
+            column = column_of(argument, attribute);
+            if ((function == Aggregate::SUM || function == Aggregate::AVG)
+                && attribute.get_data_type() != ColumnAttribute::INT)
+                throw SQLExecError(name + " of a column that isn't INT");
+            if (function == Aggregate::COUNT || function == Aggregate::SUM || function == Aggregate::AVG)
+                attribute = ColumnAttribute(ColumnAttribute::INT);
+            name += "(" + column + ")";
+            if (find(needed.begin(), needed.end(), column) == needed.end())
+                needed.push_back(column);
+        } else {
+            throw SQLExecError("only a column (or * for COUNT) can be aggregated");
+        }
+        if (expr->alias != nullptr)
+            name = expr->alias;
+        aggregates.push_back(Aggregate(function, column, name));
+        column_names.push_back(name);
+        column_attributes.push_back(attribute);
+    }
+    return new EvalPlan(group_by, aggregates, new EvalPlan(new ColumnNames(needed), plan));
+}
+
+// The rows of plan in the order of the statement's ORDER BY, if it has one. A column can be named as
+// column_of resolves it or, in a grouped query, by the alias it is selected as; an aggregate has to be
+// selected too, and in a grouped query only what the groups have (the grouped columns and the selected
+// aggregates, column_names) can be sorted on.
+static EvalPlan *order_plan(const SelectStatement *statement, EvalPlan *plan,
+                            std::function<Identifier(const Expr *, ColumnAttribute &)> column_of,
+                            const ColumnNames &column_names) {
+    if (statement->order == nullptr || statement->order->empty())
+        return plan;
+    bool groups = grouped(statement);
+    ColumnNames sortable = column_names;
+    if (groups && statement->groupBy != nullptr) {
+        for (auto const& expr: *statement->groupBy->columns) {
+            ColumnAttribute attribute;
+            sortable.push_back(column_of(expr, attribute));
+        }
+    }
+    // the selected aggregate (by its position in the select list) that expr is, if any
+    auto selected_aggregate = [&](const Expr *expr) {
+        Aggregate::Function function, other;
+        if (!Aggregate::function_named(expr->name, function))
+            throw SQLExecError(string("unknown function ") + expr->name);
+        const Expr *argument = function_argument(expr);
+        for (size_t i = 0; groups && i < statement->selectList->size(); i++) {
+            const Expr *selected = statement->selectList->at(i);
+            if (selected->type != kExprFunctionRef || !Aggregate::function_named(selected->name, other)
+                || other != function)
+                continue;
+            const Expr *selected_argument = function_argument(selected);
+            if (argument == nullptr || selected_argument == nullptr || argument->type != selected_argument->type)
+                continue;
+            ColumnAttribute attribute;
+            if (argument->type == kExprStar
+                || (argument->type == kExprColumnRef
+                    && column_of(argument, attribute) == column_of(selected_argument, attribute)))
+                return column_names[i];
+        }
+        throw SQLExecError("only an aggregate that is selected can be ordered by");
+    };
+
+    SortKeys keys;
+    for (auto const order: *statement->order) {
+        const Expr *expr = order->expr;
+        Identifier column;
+        if (expr->type == kExprFunctionRef) {
+            column = selected_aggregate(expr);
+        } else if (expr->type != kExprColumnRef) {
+            throw SQLExecError("only columns and aggregates can be ordered by");
+        } else if (groups && expr->table == nullptr
+                   && find(column_names.begin(), column_names.end(), expr->name) != column_names.end()) {
+            column = expr->name;
+        } else {
+            ColumnAttribute attribute;
+            column = column_of(expr, attribute);
+            if (groups && find(sortable.begin(), sortable.end(), column) == sortable.end())
+                throw SQLExecError("column " + column + " must be grouped by to be ordered by");
+        }
+        keys.push_back(SortKey(column, order->type == kOrderDesc));
+    }
+    // under a LIMIT, only the rows it takes (and those it skips first) need to be sorted out
+    size_t top = 0;
+    if (statement->limit != nullptr && statement->limit->limit >= 0)
+        top = (size_t) (statement->limit->limit + max(statement->limit->offset, (int64_t) 0));
+    return new EvalPlan(keys, plan, top);
+}
+
+// The first rows of plan the statement's LIMIT takes, after any its OFFSET skips, if it has a LIMIT
+static EvalPlan *limit_plan(const SelectStatement *statement, EvalPlan *plan) {
+    if (statement->limit == nullptr || (statement->limit->limit < 0 && statement->limit->offset <= 0))
+        return plan;
+    if (statement->limit->limit < 0)
+        throw SQLExecError("OFFSET without LIMIT is not implemented");
+    return new EvalPlan((size_t) statement->limit->limit, (size_t) max(statement->limit->offset, (int64_t) 0), plan);
+}
+
+
 QueryResult *SQLExec::select(const SelectStatement *statement) {
+    if (statement->fromTable->type == kTableJoin || statement->fromTable->type == kTableCrossProduct)
+        return select_join(statement);
 
     Identifier table_name = statement->fromTable->getName();
     DbRelation& table = SQLExec::tables->get_table(table_name);
     ColumnNames *column_names = new ColumnNames;
     ColumnAttributes *column_attributes = table.get_column_attributes(*column_names);
-    //stat base of plan at tablescan
-    EvalPlan *plan = new EvalPlan(table);
-    //
-    //ValueDict where;
-    if(statement->whereClause != nullptr){
-        plan = new EvalPlan(get_where_conjunction(statement->whereClause), plan);
-    }
-    if (statement->selectList != nullptr){
+    //stat base of plan at tablescan, with the where clause's selections on top
+    std::vector<const Expr *> conjuncts;
+    if (statement->whereClause != nullptr)
+        conjuncts.push_back(statement->whereClause);
+    EvalPlan *plan = table_plan(table_name, conjuncts);
+    auto column_of = [&table](const Expr *expr, ColumnAttribute &attribute) {
+        ColumnNames table_columns = table.get_column_names();
+        if (find(table_columns.begin(), table_columns.end(), expr->name) == table_columns.end())
+            throw SQLExecError(string("unknown column ") + expr->name);
+        ColumnAttributes *attributes = table.get_column_attributes(ColumnNames(1, expr->name));
+        attribute = attributes->front();
+        delete attributes;
+        return Identifier(expr->name);
+    };
+    if (grouped(statement)) {
+        delete column_attributes;
+        column_attributes = new ColumnAttributes;
+        plan = group_plan(statement, plan, column_of, *column_names, *column_attributes);
+        plan = new EvalPlan(new ColumnNames(*column_names), order_plan(statement, plan, column_of, *column_names));
+    } else if (statement->selectList != nullptr){
         for (auto const& expr : *statement->selectList)
         {
             if (expr->type == kExprStar){
@@ -273,15 +569,233 @@ QueryResult *SQLExec::select(const SelectStatement *statement) {
 
             }
         }
-        plan = new EvalPlan(column_names, plan);
+        plan = new EvalPlan(new ColumnNames(*column_names), order_plan(statement, plan, column_of, *column_names));
 
     }
+    plan = limit_plan(statement, plan);
 
+    // the rows are produced, a batch at a time, as the result is printed
     EvalPlan *optimized = plan->optimize();
-    ValueDicts *rows = optimized->evaluate();
+    EvalOperator *stream = optimized->stream(true);
+    delete optimized;
+    delete plan;
 
-    return new QueryResult(column_names, column_attributes, rows,
-                           "successfully returned " + to_string(rows->size()) + " rows");
+    return new QueryResult(column_names, column_attributes, stream);
+}
+
+// One table of a join: the name its columns are qualified by (its alias, if it has one), and the
+// conjuncts of the ON and WHERE clauses that are on it alone
+class JoinTable {
+public:
+    JoinTable(Identifier table_name, Identifier qualifier)
+            : table_name(table_name), qualifier(qualifier), column_names(), conjuncts() {}
+
+    Identifier table_name;
+    Identifier qualifier;
+    ColumnNames column_names;
+    std::vector<const Expr *> conjuncts;
+};
+
+// Two columns of different tables (by their index in the join) that a join condition makes equal
+class JoinEquality {
+public:
+    JoinEquality(size_t left, Identifier left_column, size_t right, Identifier right_column)
+            : left(left), left_column(left_column), right(right), right_column(right_column) {}
+
+    size_t left;
+    Identifier left_column;
+    size_t right;
+    Identifier right_column;
+};
+
+// Each table of a FROM clause of joins and cross products, in order, and the joins' ON conditions
+static void join_tables(const TableRef *ref, std::vector<JoinTable> &tables, std::vector<const Expr *> &conditions) {
+    switch (ref->type) {
+        case kTableName:
+            tables.push_back(JoinTable(ref->name, ref->alias != nullptr ? ref->alias : ref->name));
+            break;
+        case kTableCrossProduct:
+            for (auto const table: *ref->list)
+                join_tables(table, tables, conditions);
+            break;
+        case kTableJoin:
+            if (ref->join->type != kJoinInner && ref->join->type != kJoinCross)
+                throw SQLExecError("only inner joins are implemented");
+            join_tables(ref->join->left, tables, conditions);
+            join_tables(ref->join->right, tables, conditions);
+            if (ref->join->condition != nullptr)
+                conditions.push_back(ref->join->condition);
+            break;
+        default:
+            throw SQLExecError("only joins of tables are implemented");
+    }
+}
+
+// The terms of an AND expression
+static void join_conjuncts(const Expr *expr, std::vector<const Expr *> &conjuncts) {
+    if (expr->type == kExprOperator && expr->opType == Expr::AND) {
+        join_conjuncts(expr->expr, conjuncts);
+        join_conjuncts(expr->expr2, conjuncts);
+    } else {
+        conjuncts.push_back(expr);
+    }
+}
+
+// Which of the tables a column reference is to: the one it is qualified with, or else the only one
+// with a column of that name
+static size_t join_column(const Expr *column, const std::vector<JoinTable> &tables) {
+    size_t found = tables.size();
+    for (size_t i = 0; i < tables.size(); i++) {
+        if (column->table != nullptr && tables[i].qualifier != column->table)
+            continue;
+        const ColumnNames &column_names = tables[i].column_names;
+        if (find(column_names.begin(), column_names.end(), column->name) == column_names.end())
+            continue;
+        if (found < tables.size())
+            throw SQLExecError(string("column ") + column->name + " is ambiguous");
+        found = i;
+    }
+    if (found == tables.size())
+        throw SQLExecError(string("unknown column ")
+                           + (column->table != nullptr ? string(column->table) + "." : "") + column->name);
+    return found;
+}
+
+// A table's scan, letting the optimizer know the table's indexes and statistics, under the selections
+// the conjuncts make
+EvalPlan *SQLExec::table_plan(const Identifier &table_name, const std::vector<const Expr *> &conjuncts) {
+    DbRelation& table = SQLExec::tables->get_table(table_name);
+    DbIndexes indexes;
+    for (auto const& index_name: SQLExec::indices->get_index_names(table_name))
+        indexes.push_back(&SQLExec::indices->get_index(table_name, index_name));
+    EvalPlan *plan = new EvalPlan(table, indexes, SQLExec::statistics->get_stats(table_name));
+    if (conjuncts.empty())
+        return plan;
+
+    ValueLists *in_lists = new ValueLists();
+    ValueRanges *ranges = new ValueRanges();
+    ValueDict *where = new ValueDict();
+    for (auto const conjunct: conjuncts) {
+        ValueDict *equalities = get_where_conjunction(conjunct, in_lists, ranges);
+        where->insert(equalities->begin(), equalities->end());
+        delete equalities;
+    }
+    bool has_in = !in_lists->empty(), has_range = !ranges->empty();
+    if (has_in)
+        plan = new EvalPlan(in_lists, plan);
+    else
+        delete in_lists;
+    if (where->empty() && (has_in || has_range))
+        delete where;
+    else
+        plan = new EvalPlan(where, plan);
+    if (has_range)
+        plan = new EvalPlan(ranges, plan);
+    else
+        delete ranges;
+    return plan;
+}
+
+// SELECT ... FROM a JOIN b ON ... (or FROM a, b WHERE ...): the tables are joined left to right, each
+// on the column equalities between it and the tables before it, and the rest of the conditions select
+// from the table they are on before it is joined. Every column comes out qualified, as a.column.
+QueryResult *SQLExec::select_join(const SelectStatement *statement) {
+    std::vector<JoinTable> tables;
+    std::vector<const Expr *> conditions;
+    join_tables(statement->fromTable, tables, conditions);
+    for (size_t i = 0; i < tables.size(); i++) {
+        for (size_t j = 0; j < i; j++)
+            if (tables[j].qualifier == tables[i].qualifier)
+                throw SQLExecError("table " + tables[i].qualifier + " appears twice without an alias");
+        tables[i].column_names = SQLExec::tables->get_table(tables[i].table_name).get_column_names();
+    }
+    if (statement->whereClause != nullptr)
+        conditions.push_back(statement->whereClause);
+
+    std::vector<const Expr *> conjuncts;
+    for (auto const condition: conditions)
+        join_conjuncts(condition, conjuncts);
+    std::vector<JoinEquality> equalities;
+    for (auto const conjunct: conjuncts) {
+        if (conjunct->type != kExprOperator)
+            throw SQLExecError("Invalid where statement");
+        const Expr *column = conjunct->expr, *other = conjunct->expr2;
+        if (column == nullptr || column->type != kExprColumnRef)
+            std::swap(column, other);
+        if (column == nullptr || column->type != kExprColumnRef)
+            throw SQLExecError("Invalid where statement");
+        size_t table = join_column(column, tables);
+        if (other == nullptr || other->type != kExprColumnRef) {
+            tables[table].conjuncts.push_back(conjunct);
+            continue;
+        }
+        size_t other_table = join_column(other, tables);
+        if (conjunct->opType != Expr::SIMPLE_OP || conjunct->opChar != '=' || table == other_table)
+            throw SQLExecError("only equalities between columns of different tables are implemented");
+        if (table > other_table) {
+            std::swap(table, other_table);
+            std::swap(column, other);
+        }
+        equalities.push_back(JoinEquality(table, column->name, other_table, other->name));
+    }
+
+    EvalPlan *plan = table_plan(tables[0].table_name, tables[0].conjuncts);
+    for (size_t i = 1; i < tables.size(); i++) {
+        // past the first join, the left input's columns are already qualified
+        ColumnNames left_keys, right_keys;
+        for (auto const& equality: equalities) {
+            if (equality.right != i)
+                continue;
+            left_keys.push_back(i == 1 ? equality.left_column
+                                       : tables[equality.left].qualifier + "." + equality.left_column);
+            right_keys.push_back(equality.right_column);
+        }
+        plan = new EvalPlan(plan, table_plan(tables[i].table_name, tables[i].conjuncts), left_keys, right_keys,
+                            i == 1 ? tables[0].qualifier : "", tables[i].qualifier);
+    }
+
+    ColumnNames *column_names = new ColumnNames;
+    ColumnAttributes *column_attributes = new ColumnAttributes;
+    auto add_column = [&](const JoinTable &table, const Identifier &column_name) {
+        column_names->push_back(table.qualifier + "." + column_name);
+        ColumnAttributes *attributes = SQLExec::tables->get_table(table.table_name)
+                .get_column_attributes(ColumnNames(1, column_name));
+        column_attributes->push_back(attributes->front());
+        delete attributes;
+    };
+    auto column_of = [&](const Expr *expr, ColumnAttribute &attribute) {
+        const JoinTable &table = tables[join_column(expr, tables)];
+        ColumnAttributes *attributes = SQLExec::tables->get_table(table.table_name)
+                .get_column_attributes(ColumnNames(1, expr->name));
+        attribute = attributes->front();
+        delete attributes;
+        return table.qualifier + "." + expr->name;
+    };
+    if (grouped(statement)) {
+        plan = group_plan(statement, plan, column_of, *column_names, *column_attributes);
+    } else if (statement->selectList != nullptr) {
+        for (auto const& expr: *statement->selectList) {
+            if (expr->type == kExprStar) {
+                for (auto const& table: tables)
+                    for (auto const& column_name: table.column_names)
+                        add_column(table, column_name);
+            } else if (expr->type == kExprColumnRef) {
+                add_column(tables[join_column(expr, tables)], expr->name);
+            } else {
+                throw SQLExecError("only columns can be selected from a join");
+            }
+        }
+    }
+    plan = new EvalPlan(new ColumnNames(*column_names), order_plan(statement, plan, column_of, *column_names));
+    plan = limit_plan(statement, plan);
+
+    // the rows are produced, a batch at a time, as the result is printed
+    EvalPlan *optimized = plan->optimize();
+    EvalOperator *stream = optimized->stream(true);
+    delete optimized;
+    delete plan;
+
+    return new QueryResult(column_names, column_attributes, stream);
 }
 
 // Defines data type of column, stores data identifier and attribute
@@ -302,12 +816,12 @@ void SQLExec::column_definition(const ColumnDefinition *col, Identifier& column_
 }
 
 // Executes create statement for tables and indexes
-QueryResult *SQLExec::create(const CreateStatement *statement) {
+QueryResult *SQLExec::create(const CreateStatement *statement, const IndexOptions &index_options) {
     switch(statement->type) {
         case CreateStatement::kTable:
             return create_table(statement);
         case CreateStatement::kIndex:
-            return create_index(statement);
+            return create_index(statement, index_options);
         default:
             return new QueryResult("Only CREATE TABLE and CREATE INDEX are implemented");
     }
@@ -375,7 +889,7 @@ QueryResult *SQLExec::create_table(const CreateStatement *statement) {
 }
 
 // Creates index for specified table
-QueryResult *SQLExec::create_index(const CreateStatement *statement) {
+QueryResult *SQLExec::create_index(const CreateStatement *statement, const IndexOptions &index_options) {
 
 	Identifier index_name = statement->indexName;
 	Identifier table_name = statement->tableName;
@@ -390,12 +904,54 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
 		}
 	}
 
+	// USING a type the parser doesn't know overrides the parser's (BTREE, the default)
+	string index_type = index_options.index_type.empty() ? statement->indexType : index_options.index_type;
+
+	// a LEARNED index models the positions of one column's INT values
+	if (index_type == "LEARNED") {
+		bool is_int = statement->indexColumns->size() == 1;
+		if (is_int) {
+			ColumnAttributes *attributes = table.get_column_attributes(ColumnNames(1, statement->indexColumns->at(0)));
+			is_int = (*attributes)[0].get_data_type() == ColumnAttribute::INT;
+			delete attributes;
+		}
+		if (!is_int)
+			throw SQLExecError("a LEARNED index must be on a single INT column");
+	}
+
+	// INCLUDE columns must be real, non-key columns, and only a BTREE keeps them
+	if (!index_options.include_columns.empty() && index_type != "BTREE")
+		throw SQLExecError("INCLUDE is only supported for BTREE indices");
+	for (auto const& col_name: index_options.include_columns) {
+		if (find(table_columns.begin(), table_columns.end(), col_name) == table_columns.end())
+			throw SQLExecError(string("column '" + col_name + "' does not exist"));
+		for (auto const& key_column: *statement->indexColumns)
+			if (col_name == key_column)
+				throw SQLExecError(string("column '" + col_name + "' is already in the index key"));
+	}
+
+	// a partial index's predicate can only be on real columns, compared to values of their type
+	ValueDict filter = Indices::parse_filter(index_options.filter);
+	if (!filter.empty() && index_type != "BTREE")
+		throw SQLExecError("WHERE is only supported for BTREE indices");
+	for (auto const& column: filter) {
+		auto found = find(table_columns.begin(), table_columns.end(), column.first);
+		if (found == table_columns.end())
+			throw SQLExecError(string("column '" + column.first + "' does not exist"));
+		ColumnAttributes *attributes = table.get_column_attributes(ColumnNames(1, column.first));
+		bool is_text = (*attributes)[0].get_data_type() == ColumnAttribute::TEXT;
+		delete attributes;
+		if (is_text != (column.second.data_type == ColumnAttribute::TEXT))
+			throw SQLExecError(string("wrong type of value for column '" + column.first + "' in WHERE"));
+	}
+
 	ValueDict row;
 
 	row["table_name"] = Value(table_name);
 	row["index_name"] = Value(index_name);
-	row["index_type"] = Value(statement->indexType);
-    row["is_unique"] = Value(string(statement->indexType) == "BTREE");
+	row["index_type"] = Value(index_type);
+    row["is_unique"] = Value(index_type == "BTREE");
+	row["filter"] = Value(Indices::filter_text(filter));
 	
 	int seq = 0;
 
@@ -407,6 +963,12 @@ QueryResult *SQLExec::create_index(const CreateStatement *statement) {
 			row["column_name"] = Value(col_name);
 			inHandles.push_back(SQLExec::indices->insert(&row));
 		}
+		seq = 0;
+		for (auto const &col_name: index_options.include_columns) {
+			row["seq_in_index"] = Value(--seq);
+			row["column_name"] = Value(col_name);
+			inHandles.push_back(SQLExec::indices->insert(&row));
+		}
 
 		DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
 		
@@ -443,7 +1005,8 @@ QueryResult *SQLExec::drop_table(const DropStatement *statement) {
     Identifier table_name = statement->name;
  
     if (table_name == Tables::TABLE_NAME || table_name == Columns::TABLE_NAME || 
-         table_name==Indices::TABLE_NAME) {
+         table_name==Indices::TABLE_NAME || table_name == Statistics::TABLE_NAME ||
+         table_name == Histograms::TABLE_NAME) {
         throw SQLExecError("cannot drop a schema table");
 	}
  
@@ -457,23 +1020,18 @@ QueryResult *SQLExec::drop_table(const DropStatement *statement) {
     //remove any indexes on table
     IndexNames theseIndices = SQLExec::indices->get_index_names(table_name);
 
-    if (!theseIndices.empty()) {
-       for (auto const& index_name: theseIndices) { 
-       	// This is what causes the warning when making, and is becuase the index.drop()
-    	// function has been commented below.
+    for (auto const& index_name: theseIndices) {
+        // drop the index's files before its _indices rows go, since deleting them deletes the index too
         DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
-     
-         // remove from _indices schema
-        Handles* handles = SQLExec::indices->select(&where);
-  
+        index.drop();
+
+        // remove from _indices schema (and so from the index cache)
+        ValueDict index_where = where;
+        index_where["index_name"] = Value(index_name);
+        Handles* handles = SQLExec::indices->select(&index_where);
         for (auto const& handle: *handles)
             SQLExec::indices->del(handle);
-    
-        // index.drop() causes segfault due to dummy function
-        //index.drop();
-        
         delete handles;
-      }
     }
  
     // remove from _columns schema
@@ -486,6 +1044,9 @@ QueryResult *SQLExec::drop_table(const DropStatement *statement) {
  
     delete handles;
 
+    // remove from _statistics and _histograms
+    SQLExec::statistics->drop_stats(table_name);
+
     // remove table
     table.drop();
 
@@ -500,7 +1061,8 @@ QueryResult *SQLExec::drop_index(const DropStatement *statement) {
     Identifier table_name = statement->name;
     Identifier index_name = statement->indexName;
  
-    if(SQLExec::indices->get_index_names(table_name).empty())
+    IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+    if (find(index_names.begin(), index_names.end(), index_name) == index_names.end())
 		throw SQLExecError("index does not exist"); 
  
     ValueDict where;
@@ -508,19 +1070,15 @@ QueryResult *SQLExec::drop_index(const DropStatement *statement) {
     where["table_name"] = Value(table_name);
     where["index_name"] = Value(index_name);
    
-    // get the table
-    // This is what causes the warning when making, and is becuase the index.drop()
-    // function has been commented below.
+    // drop the index's files before its _indices rows go, since deleting them deletes the index too
     DbIndex& index = SQLExec::indices->get_index(table_name, index_name);
+    index.drop();
  
-    // remove from _indices schema
+    // remove from _indices schema (and so from the index cache)
     Handles* handles = SQLExec::indices->select(&where);
  
     for (auto const& handle: *handles)
         SQLExec::indices->del(handle);
- 
-    // index.drop() causes a segfault, likely due to it refering to a dummy function
-    //index.drop();
 
     delete handles;
 
@@ -542,7 +1100,8 @@ QueryResult *SQLExec::show(const ShowStatement *statement) {
     }
 }
 
-// Returns index information for specified table
+// Returns index information for specified table, with each index's statistics
+// (distinct is for the index's columns up to and including the row's column)
 QueryResult *SQLExec::show_index(const ShowStatement *statement) {
 
     ColumnNames* column_names = new ColumnNames;
@@ -552,6 +1111,15 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) {
     column_names->push_back("seq_in_index");
     column_names->push_back("index_type");
     column_names->push_back("is_unique");
+    column_names->push_back("filter");
+    ColumnNames index_columns = *column_names;
+    column_names->push_back("entries");
+    column_names->push_back("leaf_pages");
+    column_names->push_back("interior_pages");
+    column_names->push_back("fill_percent");
+    column_names->push_back("distinct");
+    column_names->push_back("leaf_splits");
+    column_names->push_back("interior_splits");
 
     ColumnAttributes* column_attributes = new ColumnAttributes;
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
@@ -565,7 +1133,23 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) {
     ValueDicts* rows = new ValueDicts;
   
     for (auto const& handle: *handles) {
-        ValueDict* row = SQLExec::indices->project(handle, column_names); 
+        ValueDict* row = SQLExec::indices->project(handle, &index_columns);
+        DbIndex& index = SQLExec::indices->get_index(statement->tableName, (*row)["index_name"].s);
+        IndexStats stats = index.get_stats();
+        uint seq = (uint) (*row)["seq_in_index"].n;
+        if (stats.known) {
+            (*row)["entries"] = Value((int) stats.entries);
+            (*row)["leaf_pages"] = Value((int) stats.leaf_pages);
+            (*row)["interior_pages"] = Value((int) stats.interior_pages);
+            (*row)["fill_percent"] = Value((int) (stats.fill * 100 + 0.5));
+            (*row)["distinct"] = seq <= stats.distinct.size() ? Value((int) stats.distinct[seq - 1]) : Value("");
+            (*row)["leaf_splits"] = Value((int) stats.leaf_splits);
+            (*row)["interior_splits"] = Value((int) stats.interior_splits);
+        } else {
+            for (auto const& column_name: *column_names)
+                if (row->find(column_name) == row->end())
+                    (*row)[column_name] = Value("");
+        }
         rows->push_back(row);
     }
   
@@ -575,6 +1159,40 @@ QueryResult *SQLExec::show_index(const ShowStatement *statement) {
                            "successfully returned " + to_string(n) + " rows");
 }
 
+// Gather the table's statistics and recount each index's
+QueryResult *SQLExec::analyze(const Identifier &table_name) {
+    if (SQLExec::tables == nullptr)
+        SQLExec::tables = new Tables();
+    if (SQLExec::indices == nullptr)
+        SQLExec::indices = new Indices();
+    if (SQLExec::statistics == nullptr)
+        SQLExec::statistics = new Statistics();
+
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles* handles = SQLExec::tables->select(&where);
+    bool exists = !handles->empty();
+    delete handles;
+    if (!exists)
+        throw SQLExecError("table " + table_name + " does not exist");
+
+    IndexNames index_names = SQLExec::indices->get_index_names(table_name);
+    TableStats stats;
+    try {
+        HeapTable *table = dynamic_cast<HeapTable *>(&SQLExec::tables->get_table(table_name));
+        if (table == nullptr)
+            throw SQLExecError("cannot analyze " + table_name);
+        stats = TableStats::gather(*table);
+        SQLExec::statistics->set_stats(table_name, stats);
+        for (auto const& index_name: index_names)
+            SQLExec::indices->get_index(table_name, index_name).analyze();
+    } catch (DbRelationError& e) {
+        throw SQLExecError(string("DbRelationError: ") + e.what());
+    }
+    return new QueryResult("analyzed " + table_name + ": " + to_string(stats.rows) + " rows in "
+                           + to_string(stats.pages) + " pages and " + to_string(index_names.size()) + " indices");
+}
+
 // Returns tables in database
 QueryResult *SQLExec::show_tables() {
     ColumnNames* column_names = new ColumnNames;
@@ -584,7 +1202,7 @@ QueryResult *SQLExec::show_tables() {
     column_attributes->push_back(ColumnAttribute(ColumnAttribute::TEXT));
 
     Handles* handles = SQLExec::tables->select();
-    u_long n = handles->size() - 3;
+    u_long n = handles->size() - 5;
 
     ValueDicts* rows = new ValueDicts;
  
@@ -593,9 +1211,12 @@ QueryResult *SQLExec::show_tables() {
         Identifier table_name = row->at("table_name").s;
      
         if (table_name != Tables::TABLE_NAME && table_name != Columns::TABLE_NAME &&
-            table_name != Indices::TABLE_NAME) {
+            table_name != Indices::TABLE_NAME && table_name != Statistics::TABLE_NAME &&
+            table_name != Histograms::TABLE_NAME) {
             rows->push_back(row);
-    	}
+    	} else {
+            delete row;
+        }
 
     }
 
@@ -636,3 +1257,63 @@ QueryResult *SQLExec::show_columns(const ShowStatement *statement) {
                            "successfully returned " + to_string(n) + " rows");
 }
 
+
+// Run a query the way the shell does (lower-cased, the clauses the parser doesn't know taken out
+// first) and return what the shell would print.
+static string run_query(string query) {
+    transform(query.begin(), query.end(), query.begin(), ::tolower);
+    IndexOptions index_options;
+    query = SQLExec::parse_index_options(query, index_options);
+    SQLParserResult *parse = SQLParser::parseSQLString(query);
+    if (!parse->isValid()) {
+        delete parse;
+        return "Invalid SQL: " + query;
+    }
+    stringstream out;
+    try {
+        QueryResult *result = SQLExec::execute(parse->getStatement(0), &index_options);
+        out << *result;
+        delete result;
+    } catch (SQLExecError &e) {
+        out << "Error: " << e.what();
+    }
+    delete parse;
+    return out.str();
+}
+
+// test function -- returns true if all tests pass
+bool test_index_types() {
+    auto ends_with = [](const string &text, const string &end) {
+        return text.size() >= end.size() && text.compare(text.size() - end.size(), end.size(), end) == 0;
+    };
+    bool result = ends_with(run_query("CREATE TABLE _test_index_types (id INT, grp INT, name TEXT)"),
+                            "created _test_index_types");
+    for (int i = 0; i < 200; i++)
+        result = result && run_query("INSERT INTO _test_index_types VALUES (" + to_string(i) + ", "
+                                     + to_string(i % 4) + ", 'n" + to_string(i) + "')").find("Successfully") == 0;
+
+    //t1 each type the parser doesn't know: created, stored as its own type, and used to answer a query
+    vector<vector<string>> types = {{"BITMAP", "grp", "2", "50"}, {"ART", "name", "'n17'", "1"},
+                                    {"LSM", "grp", "3", "50"}, {"LEARNED", "id", "123", "1"}};
+    for (auto const &type: types) {
+        string index_name = "_test_index_types_" + type[1];
+        result = result && ends_with(run_query("CREATE INDEX " + index_name + " ON _test_index_types USING "
+                                               + type[0] + " (" + type[1] + ")"), "created index " + index_name);
+        result = result && run_query("SHOW INDEX FROM _test_index_types").find("\"" + type[0] + "\"") != string::npos;
+        result = result && ends_with(run_query("SELECT id FROM _test_index_types WHERE " + type[1] + " = "
+                                               + type[2]), "successfully returned " + type[3] + " rows");
+        result = result && ends_with(run_query("DROP INDEX " + index_name + " FROM _test_index_types"),
+                                     "dropped index " + index_name);
+    }
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 a LEARNED index is only on a single INT column
+    string bad = "CREATE INDEX _test_index_types_bad ON _test_index_types USING LEARNED ";
+    result = result && run_query(bad + "(name)").find("Error: ") == 0
+             && run_query(bad + "(id, grp)").find("Error: ") == 0
+             && run_query("SHOW INDEX FROM _test_index_types").find("_test_index_types_bad") == string::npos;
+    cout << (result ? "passed t2" : "failed t2") << endl;
+
+    result = ends_with(run_query("DROP TABLE _test_index_types"), "dropped _test_index_types") && result;
+    return result;
+}
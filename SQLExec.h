@@ -9,6 +9,7 @@
 #include <string>
 #include "SQLParser.h"
 #include "schema_tables.h"
+#include "EvalPlan.h"
 
 /**
  * @class SQLExecError - exception for SQLExec methods
@@ -21,22 +22,31 @@ public:
 
 /**
  * @class QueryResult - data structure to hold all the returned data for a query execution
+ *
+ * A SELECT's rows are not in the result: it holds the operators that produce them, and printing the
+ * result runs them, writing each row as it comes (and the row count after).
  */
 class QueryResult {
 public:
-    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), message("") {}
+    QueryResult() : column_names(nullptr), column_attributes(nullptr), rows(nullptr), stream(nullptr), message("") {}
 
     QueryResult(std::string message) : column_names(nullptr), column_attributes(nullptr), rows(nullptr),
-                                       message(message) {}
+                                       stream(nullptr), message(message) {}
 
     QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, ValueDicts *rows, std::string message)
-            : column_names(column_names), column_attributes(column_attributes), rows(rows), message(message) {}
+            : column_names(column_names), column_attributes(column_attributes), rows(rows), stream(nullptr),
+              message(message) {}
+
+    QueryResult(ColumnNames *column_names, ColumnAttributes *column_attributes, EvalOperator *stream)
+            : column_names(column_names), column_attributes(column_attributes), rows(nullptr), stream(stream),
+              message("") {}
 
     virtual ~QueryResult();
 
     ColumnNames *get_column_names() const { return column_names; }
     ColumnAttributes *get_column_attributes() const { return column_attributes; }
     ValueDicts *get_rows() const { return rows; }
+    EvalOperator *get_stream() const { return stream; }
     const std::string &get_message() const { return message; }
     friend std::ostream &operator<<(std::ostream &stream, const QueryResult &qres);
 
@@ -44,10 +54,27 @@ protected:
     ColumnNames *column_names;
     ColumnAttributes *column_attributes;
     ValueDicts *rows;
+    EvalOperator *stream;  // instead of rows: the query, ready to run
     std::string message;
 };
 
 
+/**
+ * @class IndexOptions - CREATE INDEX clauses our SQL parser doesn't understand
+ *
+ * The shell takes these out of the query text (see SQLExec::parse_index_options) before parsing
+ * the rest, and hands them to SQLExec::execute along with the parsed CREATE INDEX statement.
+ */
+class IndexOptions {
+public:
+    IndexOptions() : index_type(), include_columns(), filter() {}
+
+    std::string index_type;  // USING BITMAP, ART, LSM or LEARNED (upper-cased), or empty for the parser's own
+    ColumnNames include_columns;  // INCLUDE (...): non-key columns stored with each entry
+    std::string filter;  // WHERE ...: the predicate a row must meet to be indexed (see Indices::parse_filter)
+};
+
+
 /**
  * @class SQLExec - execution engine
  */
@@ -55,20 +82,40 @@ class SQLExec {
 public:
 	/**
 	 * Execute the given SQL statement.
-	 * @param statement   the Hyrise AST of the SQL statement to execute
+	 * @param statement      the Hyrise AST of the SQL statement to execute
+	 * @param index_options  extra clauses of a CREATE INDEX statement, if any
+	 * @returns              the query result (freed by caller)
+	 */
+    static QueryResult *execute(const hsql::SQLStatement *statement,
+                                const IndexOptions *index_options=nullptr) throw(SQLExecError);
+
+	/**
+	 * Take the clauses the parser doesn't know out of a CREATE INDEX query.
+	 * @param query    the (lower-cased) SQL text
+	 * @param options  returned by reference: the clauses found
+	 * @returns        the query without them, ready for the parser
+	 */
+    static std::string parse_index_options(const std::string &query, IndexOptions &options);
+
+	/**
+	 * ANALYZE table: gather the table's statistics into _statistics and _histograms for the optimizer,
+	 * and recount the statistics of each of its indices (the parser has no ANALYZE, so the shell calls
+	 * this directly).
+	 * @param table_name  the table whose indices to analyze
 	 * @returns           the query result (freed by caller)
 	 */
-    static QueryResult *execute(const hsql::SQLStatement *statement) throw(SQLExecError);
+    static QueryResult *analyze(const Identifier &table_name);
 
 protected:
-	// the one place in the system that holds the _tables table and _indices table
+	// the one place in the system that holds the _tables table, _indices table and _statistics table
     static Tables *tables;
 	static Indices *indices;
+	static Statistics *statistics;
 
 	// recursive decent into the AST
-    static QueryResult *create(const hsql::CreateStatement *statement);
+    static QueryResult *create(const hsql::CreateStatement *statement, const IndexOptions &index_options);
     static QueryResult *create_table(const hsql::CreateStatement *statement);
-    static QueryResult *create_index(const hsql::CreateStatement *statement);
+    static QueryResult *create_index(const hsql::CreateStatement *statement, const IndexOptions &index_options);
 
     static QueryResult *drop(const hsql::DropStatement *statement);
     static QueryResult *drop_table(const hsql::DropStatement *statement);
@@ -82,7 +129,28 @@ protected:
 	static QueryResult *insert(const hsql::InsertStatement *statement);
 	static QueryResult *del(const hsql::DeleteStatement *statement);
 	static QueryResult *select(const hsql::SelectStatement *statement);
+	static QueryResult *select_join(const hsql::SelectStatement *statement);
+
+	/**
+	 * The plan for scanning a table, under the selections a WHERE clause's conjuncts make
+	 * @param table_name  the table to scan
+	 * @param conjuncts   AST conditions the rows must meet, each an equality, IN or comparison with a literal
+	 *                    (or an AND of them)
+	 * @returns           the plan (freed by caller)
+	 */
+	static EvalPlan *table_plan(const Identifier &table_name, const std::vector<const hsql::Expr *> &conjuncts);
+
 
+	/**
+	 * Pull the equalities (and, given in_lists and ranges, the IN lists and comparisons) out of a WHERE
+	 * clause's conjunction
+	 * @param expr      AST WHERE clause
+	 * @param in_lists  returned by reference: each column IN (...) with its values, sorted
+	 * @param ranges    returned by reference: each column compared with <, <=, > or >=, with its bounds
+	 * @returns         column = value for each equality
+	 */
+	static ValueDict* get_where_conjunction(const hsql::Expr *expr, ValueLists *in_lists=nullptr,
+	                                        ValueRanges *ranges=nullptr);
 
 	/**
 	 * Pull out column name and attributes from AST's column definition clause
@@ -90,7 +158,7 @@ protected:
 	 * @param column_name        returned by reference
 	 * @param column_attributes  returned by reference
 	 */
-	static ValueDict* get_where_conjunction(const hsql::Expr *expr);
     static void column_definition(const hsql::ColumnDefinition *col, Identifier &column_name, ColumnAttribute &column_attribute);
 };
 
+bool test_index_types();
@@ -0,0 +1,387 @@
+#include <algorithm>
+#include <iostream>
+#include "Sort.h"
+using namespace std;
+
+bool SortKey::operator==(const SortKey &other) const {
+    return this->column == other.column && this->descending == other.descending;
+}
+
+int compare_rows(const ValueDict &a, const ValueDict &b, const SortKeys &keys) {
+    for (auto const& key: keys) {
+        const Value &x = a.at(key.column), &y = b.at(key.column);
+        if (x < y)
+            return key.descending ? 1 : -1;
+        if (y < x)
+            return key.descending ? -1 : 1;
+    }
+    return 0;
+}
+
+// The first key's value as an integer that orders as the value does (by Value's operator<) as far as
+// it goes: the data type in the top byte, then an INT's (or BOOLEAN's) number with the sign bit flipped
+// or a TEXT's first seven bytes.
+uint64_t key_prefix(const ValueDict &row, const SortKeys &keys) {
+    if (keys.empty())
+        return 0;
+    const SortKey &key = keys.front();
+    const Value &value = row.at(key.column);
+    uint64_t prefix;
+    if (value.data_type == ColumnAttribute::TEXT) {
+        prefix = (uint64_t) 2 << 56;
+        for (size_t i = 0; i < 7 && i < value.s.size(); i++)
+            prefix |= (uint64_t) (unsigned char) value.s[i] << (48 - 8 * i);
+    } else {
+        prefix = (uint64_t) (value.data_type == ColumnAttribute::INT ? 1 : 0) << 56
+                 | (uint64_t) ((uint32_t) value.n ^ 0x80000000U) << 24;
+    }
+    return key.descending ? ~prefix : prefix;
+}
+
+/*****************
+ * SortOperator
+ *****************/
+
+static uint temp_sequence = 0;  // to name each run apart
+
+SortOperator::SortOperator(EvalOperator *input, const SortKeys &keys, size_t memory_budget)
+        : input(input), keys(keys), memory_budget(memory_budget), entries(), bytes(0), position(0), spilled(),
+          runs(), heap() {
+}
+
+SortOperator::~SortOperator() {
+    clear();
+    delete this->input;
+}
+
+// Read the input, writing out a sorted run whenever the rows in memory outgrow the budget, then merge
+// the runs down until the last merge can take them all (along with the rows left in memory).
+void SortOperator::open() {
+    clear();
+    this->input->open();
+    ValueDict *row;
+    while ((row = this->input->next()) != nullptr) {
+        this->entries.push_back(Entry{key_prefix(*row, this->keys), row});
+        this->bytes += JoinHashTable::row_bytes(*row) + sizeof(Entry);
+        if (this->bytes > this->memory_budget)
+            spill();
+    }
+    this->input->close();
+    sort_entries();
+    if (!is_external())
+        return;
+    while (this->spilled.size() + (this->entries.empty() ? 0 : 1) > MAX_FAN_IN) {
+        JoinPartitions merged;  // each MAX_FAN_IN runs as one
+        for (size_t first = 0; first < this->spilled.size(); first += MAX_FAN_IN) {
+            JoinPartition *run = new JoinPartition("_sort" + to_string(temp_sequence++));
+            merged.push_back(run);
+            merge(first, min((size_t) MAX_FAN_IN, this->spilled.size() - first), false);
+            while ((row = merge_next()) != nullptr) {
+                run->add(*row);
+                delete row;
+            }
+            end_merge();
+        }
+        for (auto const run: this->spilled)
+            delete run;
+        this->spilled.swap(merged);
+    }
+    merge(0, this->spilled.size(), !this->entries.empty());
+}
+
+ValueDict *SortOperator::next() {
+    if (is_external())
+        return merge_next();
+    if (this->position >= this->entries.size())
+        return nullptr;
+    return this->entries[this->position++].row;
+}
+
+void SortOperator::close() {
+    clear();
+}
+
+void SortOperator::sort_entries() {
+    const SortKeys &keys = this->keys;
+    stable_sort(this->entries.begin(), this->entries.end(), [&keys](const Entry &a, const Entry &b) {
+        if (a.prefix != b.prefix)
+            return a.prefix < b.prefix;
+        return compare_rows(*a.row, *b.row, keys) < 0;
+    });
+}
+
+// Write the rows in memory out as a sorted run.
+void SortOperator::spill() {
+    sort_entries();
+    JoinPartition *run = new JoinPartition("_sort" + to_string(temp_sequence++));
+    this->spilled.push_back(run);
+    for (auto const& entry: this->entries) {
+        run->add(*entry.row);
+        delete entry.row;
+    }
+    this->entries.clear();
+    this->bytes = 0;
+}
+
+// Start merging count runs on disk from first on and, if with_entries, the rows in memory as the last run.
+void SortOperator::merge(size_t first, size_t count, bool with_entries) {
+    for (size_t i = first; i < first + count; i++)
+        this->runs.push_back(Run{this->spilled[i], nullptr, 0, 0});
+    if (with_entries) {
+        ValueDicts *rows = new ValueDicts();
+        for (auto const& entry: this->entries)
+            rows->push_back(entry.row);
+        this->entries.clear();
+        this->bytes = 0;
+        this->runs.push_back(Run{nullptr, rows, 0, 0});
+    }
+    for (size_t i = 0; i < this->runs.size(); i++) {
+        if (!advance(this->runs[i]))
+            continue;
+        this->heap.push_back(i);
+        push_heap(this->heap.begin(), this->heap.end(), [this](size_t a, size_t b) { return after(a, b); });
+    }
+}
+
+// The first row of the runs being merged, or nullptr once they are all handed over.
+ValueDict *SortOperator::merge_next() {
+    if (this->heap.empty())
+        return nullptr;
+    auto comes_after = [this](size_t a, size_t b) { return after(a, b); };
+    pop_heap(this->heap.begin(), this->heap.end(), comes_after);
+    size_t i = this->heap.back();
+    this->heap.pop_back();
+    Run &run = this->runs[i];
+    ValueDict *row = (*run.rows)[run.position++];
+    if (advance(run)) {
+        this->heap.push_back(i);
+        push_heap(this->heap.begin(), this->heap.end(), comes_after);
+    }
+    return row;
+}
+
+// Make sure the run has a row to hand over, reading its next block when it is through the last one.
+// Returns false if there are no more.
+bool SortOperator::advance(Run &run) {
+    while (run.rows == nullptr || run.position >= run.rows->size()) {
+        delete run.rows;  // its rows are all handed over
+        run.rows = nullptr;
+        if (run.partition == nullptr)
+            return false;
+        run.rows = run.partition->read(++run.block_id);
+        run.position = 0;
+        if (run.rows == nullptr)
+            return false;
+    }
+    return true;
+}
+
+// Whether run a's next row comes after run b's (on equal keys, the later run's does, keeping input order).
+bool SortOperator::after(size_t a, size_t b) const {
+    const Run &x = this->runs[a], &y = this->runs[b];
+    int order = compare_rows(*(*x.rows)[x.position], *(*y.rows)[y.position], this->keys);
+    return order > 0 || (order == 0 && a > b);
+}
+
+// Free the runs' rows not handed over (leaving the runs on disk).
+void SortOperator::end_merge() {
+    for (auto& run: this->runs) {
+        if (run.rows == nullptr)
+            continue;
+        for (size_t i = run.position; i < run.rows->size(); i++)
+            delete (*run.rows)[i];
+        delete run.rows;
+    }
+    this->runs.clear();
+    this->heap.clear();
+}
+
+// Free the rows not handed over, and drop the runs.
+void SortOperator::clear() {
+    end_merge();
+    for (size_t i = this->position; i < this->entries.size(); i++)
+        delete this->entries[i].row;
+    this->entries.clear();
+    this->bytes = 0;
+    this->position = 0;
+    for (auto const run: this->spilled)
+        delete run;
+    this->spilled.clear();
+}
+
+/*****************
+ * TopNOperator
+ *****************/
+
+TopNOperator::TopNOperator(EvalOperator *input, const SortKeys &keys, size_t limit)
+        : input(input), keys(keys), limit(limit), entries(), position(0) {
+}
+
+TopNOperator::~TopNOperator() {
+    clear();
+    delete this->input;
+}
+
+// Keep the first limit rows in a heap with the last of them on top, then put them in order.
+void TopNOperator::open() {
+    clear();
+    if (this->limit == 0)
+        return;
+    auto comes_before = [this](const Entry &a, const Entry &b) { return before(a, b); };
+    this->input->open();
+    ValueDict *row;
+    for (size_t sequence = 0; (row = this->input->next()) != nullptr; sequence++) {
+        Entry entry{key_prefix(*row, this->keys), sequence, row};
+        if (this->entries.size() < this->limit) {
+            this->entries.push_back(entry);
+            push_heap(this->entries.begin(), this->entries.end(), comes_before);
+        } else if (before(entry, this->entries.front())) {
+            pop_heap(this->entries.begin(), this->entries.end(), comes_before);
+            delete this->entries.back().row;
+            this->entries.back() = entry;
+            push_heap(this->entries.begin(), this->entries.end(), comes_before);
+        } else {
+            delete row;
+        }
+    }
+    this->input->close();
+    sort_heap(this->entries.begin(), this->entries.end(), comes_before);
+}
+
+ValueDict *TopNOperator::next() {
+    if (this->position >= this->entries.size())
+        return nullptr;
+    return this->entries[this->position++].row;
+}
+
+void TopNOperator::close() {
+    clear();
+}
+
+// Whether a comes before b: by the prefixes, then the keys, then input order.
+bool TopNOperator::before(const Entry &a, const Entry &b) const {
+    if (a.prefix != b.prefix)
+        return a.prefix < b.prefix;
+    int order = compare_rows(*a.row, *b.row, this->keys);
+    return order < 0 || (order == 0 && a.sequence < b.sequence);
+}
+
+// Free the rows not handed over.
+void TopNOperator::clear() {
+    for (size_t i = this->position; i < this->entries.size(); i++)
+        delete this->entries[i].row;
+    this->entries.clear();
+    this->position = 0;
+}
+
+// test function -- returns true if all tests pass
+bool test_sort() {
+    ColumnNames column_names = {"id", "name", "amount"};
+    ColumnAttributes column_attributes = {ColumnAttribute(ColumnAttribute::INT), ColumnAttribute(ColumnAttribute::TEXT),
+                                          ColumnAttribute(ColumnAttribute::INT)};
+    HeapTable table("test_sort", column_names, column_attributes);
+    table.create();
+
+    // names sharing long prefixes (so the normalized prefixes tie), negative and duplicate amounts
+    ValueDict row;
+    for (int i = 0; i < 2000; i++) {
+        row["id"] = Value(i);
+        row["name"] = Value("customer" + to_string((i * 7919) % 300));
+        row["amount"] = Value(i % 2 == 0 ? (i * 37) % 101 : -((i * 53) % 97));
+        table.insert(&row);
+    }
+    // every row once, in order of the keys, and rows with equal keys in order of id (their input order)
+    auto check = [](SortOperator &op, const SortKeys &keys) {
+        bool ok = true;
+        size_t count = 0;
+        int64_t ids = 0;
+        ValueDict *last = nullptr, *sorted;
+        op.open();
+        while ((sorted = op.next()) != nullptr) {
+            if (last != nullptr) {
+                int order = compare_rows(*last, *sorted, keys);
+                ok = ok && (order < 0 || (order == 0 && last->at("id").n < sorted->at("id").n));
+                delete last;
+            }
+            last = sorted;
+            count++;
+            ids += sorted->at("id").n;
+        }
+        delete last;
+        op.close();
+        return ok && count == 2000 && ids == 1999 * 1000;
+    };
+
+    //t1 in memory, on a text key and then a descending key
+    SortKeys keys = {SortKey("name"), SortKey("amount", true)};
+    SortOperator in_memory(new TableScanOperator(table), keys);
+    bool result = check(in_memory, keys) && !in_memory.is_external();
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 past a small memory budget: more runs than are merged at once, and reopening
+    SortOperator external(new TableScanOperator(table), keys, 2000);
+    for (int pass = 0; pass < 2; pass++)
+        result = result && check(external, keys);
+    external.open();
+    result = result && external.is_external();
+    external.close();
+    cout << (result ? "passed t2" : "failed t2") << endl;
+
+    //t3 a descending key with negative values, equal keys keeping their order across runs
+    SortKeys amounts(1, SortKey("amount", true));
+    SortOperator descending(new TableScanOperator(table), amounts, 20000);
+    result = result && check(descending, amounts);
+    SortOperator ascending(new TableScanOperator(table), SortKeys(1, SortKey("amount")), 20000);
+    result = result && check(ascending, SortKeys(1, SortKey("amount")));
+    cout << (result ? "passed t3" : "failed t3") << endl;
+
+    //t4 the first rows only, as the full sort has them (past an offset, too), and none or all of them
+    SortOperator full(new TableScanOperator(table), keys);
+    ValueDicts expected;
+    ValueDict *sorted;
+    full.open();
+    while ((sorted = full.next()) != nullptr)
+        expected.push_back(sorted);
+    full.close();
+    for (size_t limit: {0, 1, 25, 2000, 3000}) {
+        LimitOperator top(new TopNOperator(new TableScanOperator(table), keys, limit + 5), limit, 5);
+        size_t count = 0;
+        top.open();
+        while ((sorted = top.next()) != nullptr) {
+            result = result && count + 5 < expected.size() && *sorted == *expected[count + 5];
+            count++;
+            delete sorted;
+        }
+        top.close();
+        result = result && count == min(limit, expected.size() - 5);
+    }
+    cout << (result ? "passed t4" : "failed t4") << endl;
+
+    //t5 too many rows for a Top-N to hold: a limit over the external sort takes the same ones, and a limit
+    // of 0 takes none without reading its input
+    LimitOperator past_budget(new SortOperator(new TableScanOperator(table), keys, 20000), 1500, 5);
+    size_t count = 0;
+    past_budget.open();
+    while ((sorted = past_budget.next()) != nullptr) {
+        result = result && count + 5 < expected.size() && *sorted == *expected[count + 5];
+        count++;
+        delete sorted;
+    }
+    past_budget.close();
+    result = result && count == 1500;
+    bool fetched = false;
+    auto fetch = [&fetched]() { fetched = true; return new ValueDicts(); };
+    LimitOperator none(new SortOperator(new RowsOperator(fetch), keys), 0);
+    VectorLimitOperator vector_none(new SortOperator(new RowsOperator(fetch), keys), 0, 5);
+    none.open();
+    vector_none.open();
+    result = result && none.next() == nullptr && vector_none.next() == nullptr && !fetched;
+    none.close();
+    vector_none.close();
+    for (auto const row: expected)
+        delete row;
+    cout << (result ? "passed t5" : "failed t5") << endl;
+
+    table.drop();
+    return result;
+}
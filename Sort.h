@@ -0,0 +1,134 @@
+/**
+ * @file Sort.h - putting rows in order:
+ * SortKey: a column to order by, ascending or descending
+ * SortOperator: its input's rows in order of some columns, sorted in memory or, past a memory budget, by
+ * merging sorted runs on disk
+ * TopNOperator: the first rows of its input in order of some columns, without sorting the rest
+ */
+#pragma once
+
+#include "heap_storage.h"
+#include "EvalOperator.h"
+#include "HashJoin.h"
+
+/**
+ * @class SortKey - a column to order rows by
+ */
+class SortKey {
+public:
+    SortKey(Identifier column, bool descending=false) : column(column), descending(descending) {}
+
+    Identifier column;
+    bool descending;
+
+    bool operator==(const SortKey &other) const;
+};
+
+typedef std::vector<SortKey> SortKeys;
+
+/**
+ * Compare two rows by the sort keys, the first key that differs deciding. Values are ordered as
+ * Value's operator< orders them.
+ * @returns  negative if a comes first, positive if b does, zero if the keys are equal
+ */
+int compare_rows(const ValueDict &a, const ValueDict &b, const SortKeys &keys);
+
+/**
+ * The normalized prefix of a row's first sort key: a 64-bit integer that orders as the key does as far
+ * as it goes (0 if there are no keys). Rows whose prefixes are equal have to be compared in full.
+ */
+uint64_t key_prefix(const ValueDict &row, const SortKeys &keys);
+
+/**
+ * @class SortOperator - every row of its input, in order of the sort keys (rows with equal keys keep
+ * their input order)
+ *
+ * open() reads the input into memory and sorts it. Each row is sorted along with a normalized prefix of
+ * its first key, a 64-bit integer that orders as the key does as far as it goes, so that most
+ * comparisons are of two integers rather than of the rows' values. If the rows grow past memory_budget
+ * bytes, they are sorted and written out as a run on disk, and reading goes on into an empty memory.
+ * The runs (and what is left in memory) are then merged, at most MAX_FAN_IN at a time, reading each a
+ * block at a time: while there are too many, each MAX_FAN_IN of them in turn are merged into one longer
+ * run, and next() hands over the rows of the last merge as it goes.
+ */
+class SortOperator : public EvalOperator {
+public:
+    SortOperator(EvalOperator *input, const SortKeys &keys, size_t memory_budget=DEFAULT_MEMORY_BUDGET);
+    virtual ~SortOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+    bool is_external() const { return !this->spilled.empty(); }
+
+    static const size_t DEFAULT_MEMORY_BUDGET = 64 * 1024 * 1024;
+    static const uint MAX_FAN_IN = 64;  // most runs merged at once
+
+protected:
+    struct Entry {  // a row in memory
+        uint64_t prefix;  // of its first key
+        ValueDict *row;
+    };
+    struct Run {  // a sorted run being merged
+        JoinPartition *partition;  // nullptr for the rows still in memory
+        ValueDicts *rows;  // the block being read (or all the rows in memory)
+        size_t position;  // next one to hand over
+        BlockID block_id;
+    };
+
+    EvalOperator *input;
+    SortKeys keys;
+    size_t memory_budget;
+    std::vector<Entry> entries;
+    size_t bytes;  // about how much memory the entries take
+    size_t position;  // next entry to hand over, if nothing was spilled
+    JoinPartitions spilled;  // the sorted runs on disk, in input order
+    std::vector<Run> runs;  // the runs being merged
+    std::vector<size_t> heap;  // the runs with rows left, the one with the first row on top
+
+    void sort_entries();
+    void spill();
+    void merge(size_t first, size_t count, bool with_entries);
+    ValueDict *merge_next();
+    bool advance(Run &run);
+    bool after(size_t a, size_t b) const;
+    void end_merge();
+    void clear();
+};
+
+/**
+ * @class TopNOperator - the first limit rows of its input in order of the sort keys, as SortOperator
+ * would hand them over
+ *
+ * open() reads the whole input, but only ever holds limit rows: a heap of the best so far with the
+ * worst of them on top, which each row either replaces or is dropped as coming after. Each row's key
+ * prefix (as SortOperator's) is compared with the top's before the rows are.
+ */
+class TopNOperator : public EvalOperator {
+public:
+    TopNOperator(EvalOperator *input, const SortKeys &keys, size_t limit);
+    virtual ~TopNOperator();
+
+    virtual void open();
+    virtual ValueDict *next();
+    virtual void close();
+
+protected:
+    struct Entry {
+        uint64_t prefix;  // of its first key
+        size_t sequence;  // its place in the input, so equal keys keep input order
+        ValueDict *row;
+    };
+
+    EvalOperator *input;
+    SortKeys keys;
+    size_t limit;
+    std::vector<Entry> entries;  // a heap until the input is read, then in order
+    size_t position;  // next one to hand over
+
+    bool before(const Entry &a, const Entry &b) const;
+    void clear();
+};
+
+bool test_sort();
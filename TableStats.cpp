@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include "TableStats.h"
+using namespace std;
+
+constexpr double TableStats::DEFAULT_EQUAL_FRACTION;
+constexpr double TableStats::DEFAULT_RANGE_FRACTION;
+
+/*****************
+ * ColumnStats
+ *****************/
+
+double ColumnStats::equal_fraction(const Value &value, uint64_t rows) const {
+    if (rows == 0)
+        return 0.0;
+    for (auto const& bucket: this->buckets) {
+        if (bucket.high < value)
+            continue;
+        if (value < bucket.low)
+            break;
+        return (double) bucket.rows / bucket.distinct / rows;
+    }
+    return 0.0;
+}
+
+// A bucket the range only cuts into counts in proportion for INT and BOOLEAN values and by half for
+// TEXT values. A bound of another type than the column's doesn't cut: it is above or below them all.
+double ColumnStats::range_fraction(const ValueRange &range, uint64_t rows) const {
+    if (rows == 0)
+        return 0.0;
+    double kept = 0.0;
+    for (auto const& bucket: this->buckets) {
+        bool keeps_low = range.holds(bucket.low), keeps_high = range.holds(bucket.high);
+        if (keeps_low && keeps_high) {
+            kept += bucket.rows;
+        } else if (bucket.low.data_type != ColumnAttribute::TEXT) {
+            int64_t low = bucket.low.n, high = bucket.high.n;
+            if (range.has_min) {
+                if (range.min.data_type == bucket.low.data_type)
+                    low = max(low, (int64_t) range.min.n + (range.min_inclusive ? 0 : 1));
+                else if (!(range.min < bucket.low))
+                    continue;
+            }
+            if (range.has_max) {
+                if (range.max.data_type == bucket.high.data_type)
+                    high = min(high, (int64_t) range.max.n - (range.max_inclusive ? 0 : 1));
+                else if (!(bucket.high < range.max))
+                    continue;
+            }
+            if (low <= high)
+                kept += (double) bucket.rows * (high - low + 1) / ((int64_t) bucket.high.n - bucket.low.n + 1);
+        } else if (keeps_low || keeps_high
+                   || (range.has_min && bucket.low < range.min && range.min < bucket.high)) {
+            kept += bucket.rows / 2.0;
+        }
+    }
+    return min(1.0, kept / rows);
+}
+
+/*****************
+ * TableStats
+ *****************/
+
+// The histograms are cut from a reservoir sample of at most sample_size rows, so ANALYZE needs no
+// more memory however big the table is (the row and page counts are still exact). The sample is
+// drawn with a fixed seed so analyzing an unchanged table gives the same statistics again. A sampled
+// bucket's rows are scaled up to the table's, and its distinct values are estimated from how many of
+// them the sample saw just once (GEE): those stand for about sqrt(rows / sample) values each, the
+// ones seen more than once for themselves.
+TableStats TableStats::gather(HeapTable &table, uint buckets, uint sample_size) {
+    TableStats stats;
+    stats.known = true;
+    const ColumnNames &column_names = table.get_column_names();
+    vector<vector<Value>> sample(column_names.size());
+    sample_size = max(sample_size, 1U);
+    mt19937_64 random(SAMPLE_SEED);
+    BlockID last = table.get_block_count();
+    for (BlockID block_id = 1; block_id <= last; block_id++) {
+        Handles handles;
+        ValueDicts *rows = table.scan(block_id, block_id, &column_names, handles);
+        for (auto const row: *rows) {
+            // row number stats.rows replaces a random earlier pick with chance sample_size / (stats.rows + 1)
+            uint64_t slot = stats.rows < sample_size ? stats.rows : random() % (stats.rows + 1);
+            if (slot < sample_size) {
+                for (size_t i = 0; i < column_names.size(); i++)
+                    if (slot < sample[i].size())
+                        sample[i][slot] = row->at(column_names[i]);
+                    else
+                        sample[i].push_back(row->at(column_names[i]));
+            }
+            stats.rows++;
+            delete row;
+        }
+        delete rows;
+    }
+    stats.pages = last;
+
+    bool whole = stats.rows <= sample_size;
+    for (size_t i = 0; i < column_names.size(); i++) {
+        vector<Value> &column = sample[i];
+        sort(column.begin(), column.end());
+        double scale = column.empty() ? 1.0 : (double) stats.rows / column.size();
+        uint64_t depth = max((uint64_t) 1, (column.size() + buckets - 1) / max(buckets, 1U));
+        ColumnStats &column_stats = stats.columns[column_names[i]];
+        size_t first = 0;
+        while (first < column.size()) {
+            // a full bucket's worth, then on to the end of the last value's run
+            size_t end = min(column.size(), (size_t) (first + depth));
+            while (end < column.size() && column[end] == column[end - 1])
+                end++;
+            uint64_t seen = 0, seen_once = 0;
+            for (size_t run = first; run < end; ) {
+                size_t next = run + 1;
+                while (next < end && column[next] == column[run])
+                    next++;
+                seen++;
+                if (next - run == 1)
+                    seen_once++;
+                run = next;
+            }
+            uint64_t rows = whole ? end - first : (uint64_t) llround((end - first) * scale);
+            uint64_t distinct = whole ? seen : (uint64_t) llround(sqrt(scale) * seen_once) + seen - seen_once;
+            distinct = max((uint64_t) 1, min(distinct, rows));
+            column_stats.buckets.push_back(HistogramBucket(column[first], column[end - 1], rows, distinct));
+            column_stats.distinct += distinct;
+            first = end;
+        }
+    }
+    return stats;
+}
+
+double TableStats::selectivity(const ValueDict &conjunction) const {
+    double fraction = 1.0;
+    for (auto const& column: conjunction) {
+        auto column_stats = this->columns.find(column.first);
+        if (column_stats == this->columns.end())
+            fraction *= DEFAULT_EQUAL_FRACTION;
+        else
+            fraction *= column_stats->second.equal_fraction(column.second, this->rows);
+    }
+    return fraction;
+}
+
+double TableStats::selectivity(const ValueLists &value_lists) const {
+    double fraction = 1.0;
+    for (auto const& list: value_lists) {
+        auto column_stats = this->columns.find(list.first);
+        double listed = 0.0;
+        for (auto const& value: list.second)
+            if (column_stats == this->columns.end())
+                listed += DEFAULT_EQUAL_FRACTION;
+            else
+                listed += column_stats->second.equal_fraction(value, this->rows);
+        fraction *= min(1.0, listed);
+    }
+    return fraction;
+}
+
+double TableStats::selectivity(const ValueRanges &value_ranges) const {
+    double fraction = 1.0;
+    for (auto const& range: value_ranges) {
+        auto column_stats = this->columns.find(range.first);
+        if (column_stats == this->columns.end())
+            fraction *= DEFAULT_RANGE_FRACTION;
+        else
+            fraction *= column_stats->second.range_fraction(range.second, this->rows);
+    }
+    return fraction;
+}
+
+// test function -- returns true if all tests pass
+bool test_table_stats() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("status");
+    column_names.push_back("region");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("test_table_stats", column_names, column_attributes);
+    table.create();
+
+    // status is skewed: nine rows in ten are 'done'; region is 0 through 99 evenly
+    ValueDict row;
+    for (int i = 0; i < 4000; i++) {
+        row["id"] = Value(i);
+        row["status"] = Value(i % 10 == 0 ? (i % 20 == 0 ? "open" : "held") : "done");
+        row["region"] = Value(i % 100);
+        table.insert(&row);
+    }
+    TableStats stats = TableStats::gather(table, 16);
+    auto near = [](double estimate, double actual) { return estimate >= actual * 0.8 && estimate <= actual * 1.25; };
+
+    //t1 counts and histogram shape
+    const ColumnStats &ids = stats.columns.at("id");
+    bool result = stats.known && stats.rows == 4000 && stats.pages == table.get_block_count()
+                  && ids.distinct == 4000 && ids.buckets.size() == 16
+                  && stats.columns.at("status").distinct == 3 && stats.columns.at("region").distinct == 100;
+    for (auto const& bucket: ids.buckets)
+        result = result && bucket.rows == 250 && bucket.distinct == 250;
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 equality: exact for the heavy value, close for the rest, none for values outside every bucket
+    ValueDict where;
+    where["status"] = Value("done");
+    result = result && near(stats.selectivity(where), 0.9);
+    where["status"] = Value("open");
+    result = result && near(stats.selectivity(where), 0.05);
+    where["status"] = Value("closed");
+    result = result && stats.selectivity(where) == 0.0;
+    where.clear();
+    where["region"] = Value(42);
+    result = result && near(stats.selectivity(where), 0.01);
+    where["id"] = Value(4000);
+    result = result && stats.selectivity(where) == 0.0;
+    ValueLists lists;
+    lists["region"] = {Value(1), Value(2), Value(3)};
+    result = result && near(stats.selectivity(lists), 0.03);
+    cout << (result ? "passed t2" : "failed t2") << endl;
+
+    //t3 ranges, including bounds of the wrong type
+    ValueRanges ranges;
+    ranges["id"].above(Value(1000), true);
+    ranges["id"].below(Value(1999), false);
+    result = result && near(stats.selectivity(ranges), 0.25);
+    ranges["id"] = ValueRange();
+    ranges["id"].below(Value("z"), true);
+    result = result && stats.selectivity(ranges) == 1.0;
+    ranges["id"].above(Value("a"), true);
+    result = result && stats.selectivity(ranges) == 0.0;
+    ranges.clear();
+    ranges["region"].above(Value(89), false);
+    result = result && near(stats.selectivity(ranges), 0.1);
+    cout << (result ? "passed t3" : "failed t3") << endl;
+
+    //t4 from a sample of a quarter of the rows: same counts, close estimates, and the same again next time
+    TableStats sampled = TableStats::gather(table, 16, 1000);
+    result = result && sampled.rows == 4000 && sampled.pages == stats.pages
+             && sampled.columns.at("status").distinct == 3
+             && near(sampled.columns.at("region").distinct, 100);
+    uint64_t bucketed = 0;
+    for (auto const& bucket: sampled.columns.at("id").buckets)
+        bucketed += bucket.rows;
+    result = result && near(bucketed, 4000);
+    where.clear();
+    where["status"] = Value("done");
+    result = result && near(sampled.selectivity(where), 0.9);
+    where.clear();
+    where["region"] = Value(42);
+    result = result && near(sampled.selectivity(where), 0.01);
+    ranges.clear();
+    ranges["id"].above(Value(1000), true);
+    ranges["id"].below(Value(1999), false);
+    result = result && near(sampled.selectivity(ranges), 0.25);
+    TableStats again = TableStats::gather(table, 16, 1000);
+    result = result && again.columns.at("id").distinct == sampled.columns.at("id").distinct
+             && again.columns.at("id").buckets.size() == sampled.columns.at("id").buckets.size()
+             && again.columns.at("id").buckets[3].low == sampled.columns.at("id").buckets[3].low;
+    cout << (result ? "passed t4" : "failed t4") << endl;
+
+    table.drop();
+    return result;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file TableStats.h - what ANALYZE learns about a table, for the optimizer to estimate costs with:
+ * HistogramBucket: one bucket of an equi-depth histogram
+ * ColumnStats: a column's distinct values and histogram, and the fraction of rows a predicate on it keeps
+ * TableStats: the table's row and page counts and its columns' statistics
+ */
+#pragma once
+
+#include "heap_storage.h"
+#include "EvalOperator.h"
+
+/**
+ * @class HistogramBucket - rows values low through high (inclusive), distinct of them different
+ */
+class HistogramBucket {
+public:
+    HistogramBucket() : low(), high(), rows(0), distinct(0) {}
+    HistogramBucket(Value low, Value high, uint64_t rows, uint64_t distinct)
+            : low(low), high(high), rows(rows), distinct(distinct) {}
+
+    Value low;
+    Value high;
+    uint64_t rows;
+    uint64_t distinct;
+};
+
+typedef std::vector<HistogramBucket> HistogramBuckets;
+
+/**
+ * @class ColumnStats - an equi-depth histogram of a column
+ *
+ * Each bucket has about the same number of rows, but a value never spans two buckets: a value that
+ * is in many rows fills a bucket (or more) of its own, so its count is exact (or as good as the
+ * sample) while the rest share the other buckets. Within a bucket the values are taken to be spread evenly, each in rows / distinct
+ * rows.
+ */
+class ColumnStats {
+public:
+    ColumnStats() : distinct(0), buckets() {}
+
+    uint64_t distinct;
+    HistogramBuckets buckets;  // in order, not overlapping
+
+    double equal_fraction(const Value &value, uint64_t rows) const;  // of rows where column = value
+    double range_fraction(const ValueRange &range, uint64_t rows) const;  // of rows with column in range
+};
+
+typedef std::map<Identifier, ColumnStats> ColumnStatsMap;
+
+/**
+ * @class TableStats - the size of a table and the histograms of its columns, as of the last ANALYZE
+ *
+ * Nothing is kept up to date in between, so the numbers drift as rows are inserted and deleted (the
+ * optimizer just goes on trusting them). Predicates on different columns are taken to be independent.
+ */
+class TableStats {
+public:
+    TableStats() : known(false), rows(0), pages(0), columns() {}
+
+    bool known;  // false if the table has never been analyzed (the rest are then all zero)
+    uint64_t rows;
+    uint64_t pages;
+    ColumnStatsMap columns;
+
+    /**
+     * Read every row of the table and build its statistics.
+     * @param table        the table to analyze
+     * @param buckets      most buckets in each column's histogram
+     * @param sample_size  most rows kept in memory to build the histograms from
+     * @returns            the table's statistics
+     */
+    static TableStats gather(HeapTable &table, uint buckets=DEFAULT_BUCKETS, uint sample_size=DEFAULT_SAMPLE_SIZE);
+
+    // fraction of the rows each kind of selection keeps
+    double selectivity(const ValueDict &conjunction) const;
+    double selectivity(const ValueLists &value_lists) const;
+    double selectivity(const ValueRanges &value_ranges) const;
+
+    static const uint DEFAULT_BUCKETS = 32;
+    static const uint DEFAULT_SAMPLE_SIZE = 30000;
+    static const uint64_t SAMPLE_SEED = 5300;
+    static constexpr double DEFAULT_EQUAL_FRACTION = 0.1;  // for a column without a histogram
+    static constexpr double DEFAULT_RANGE_FRACTION = 0.33;
+};
+
+bool test_table_stats();
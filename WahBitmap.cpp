@@ -0,0 +1,227 @@
+#include <algorithm>
+#include "WahBitmap.h"
+using namespace std;
+
+const uint WahBitmap::GROUP_BITS;
+const uint64_t WahBitmap::FILL_FLAG;
+const uint64_t WahBitmap::FILL_BIT;
+const uint64_t WahBitmap::GROUP_MASK;
+const uint64_t WahBitmap::MAX_FILL;
+
+// Walks the complete groups of a bitmap as runs, padded out to total groups: the words, then (if the
+// bitmap is shorter than total) its active word as one more literal group, then zero groups.
+class WahRuns {
+public:
+    WahRuns(const WahBitmap& bitmap, uint64_t total)
+            : fill(false), value(0), run(0), bitmap(bitmap), total(total), word(0), done(0) {}
+
+    bool fill;  // current run is a fill (of value) rather than one literal group
+    uint64_t value;  // 63 bits of every group in the run
+    uint64_t run;  // groups left in the current run
+
+    void load() {
+        const vector<uint64_t>& words = this->bitmap.get_words();
+        if (this->word < words.size()) {
+            uint64_t w = words[this->word++];
+            this->fill = (w & WahBitmap::FILL_FLAG) != 0;
+            this->value = this->fill ? ((w & WahBitmap::FILL_BIT) ? WahBitmap::GROUP_MASK : 0) : w;
+            this->run = this->fill ? (w & WahBitmap::MAX_FILL) : 1;
+        } else if (this->done == this->bitmap.get_groups()) {
+            this->fill = false;
+            this->value = this->bitmap.get_active();
+            this->run = 1;
+        } else {
+            this->fill = true;
+            this->value = 0;
+            this->run = this->total - this->done;
+        }
+    }
+
+    void consume(uint64_t count) {
+        this->run -= count;
+        this->done += count;
+    }
+
+protected:
+    const WahBitmap& bitmap;
+    uint64_t total;
+    size_t word;
+    uint64_t done;
+};
+
+template<typename Op>
+WahBitmap WahBitmap::combine(const WahBitmap& a, const WahBitmap& b, Op op) {
+    uint64_t total = max(a.groups, b.groups);
+    WahBitmap result;
+    WahRuns x(a, total), y(b, total);
+    uint64_t done = 0;
+    while (done < total) {
+        if (x.run == 0)
+            x.load();
+        if (y.run == 0)
+            y.load();
+        uint64_t count = (x.fill && y.fill) ? min(x.run, y.run) : 1;
+        uint64_t value = op(x.value, y.value) & GROUP_MASK;
+        if (count > 1)
+            result.append_fill(value != 0, count);
+        else
+            result.append_group(value);
+        x.consume(count);
+        y.consume(count);
+        done += count;
+    }
+    result.active = op(a.groups == total ? a.active : 0, b.groups == total ? b.active : 0) & GROUP_MASK;
+    return result;
+}
+
+WahBitmap WahBitmap::operator&(const WahBitmap& other) const {
+    return combine(*this, other, [](uint64_t x, uint64_t y) { return x & y; });
+}
+
+WahBitmap WahBitmap::operator|(const WahBitmap& other) const {
+    return combine(*this, other, [](uint64_t x, uint64_t y) { return x | y; });
+}
+
+WahBitmap WahBitmap::and_not(const WahBitmap& other) const {
+    return combine(*this, other, [](uint64_t x, uint64_t y) { return x & ~y; });
+}
+
+// Setting a position at or past the active word only appends; anything earlier is an OR.
+void WahBitmap::set(BitPosition position) {
+    uint64_t group = position / GROUP_BITS;
+    uint64_t bit = 1ULL << (position % GROUP_BITS);
+    if (group < this->groups) {
+        if (test(position))
+            return;
+        WahBitmap single;
+        single.set(position);
+        *this = *this | single;
+        this->dirty_from = 0;
+        return;
+    }
+    if (group > this->groups) {
+        append_group(this->active);
+        this->active = 0;
+        append_fill(false, group - this->groups);
+    }
+    this->active |= bit;
+}
+
+void WahBitmap::clear(BitPosition position) {
+    uint64_t group = position / GROUP_BITS;
+    if (group == this->groups) {
+        this->active &= ~(1ULL << (position % GROUP_BITS));
+    } else if (group < this->groups && test(position)) {
+        WahBitmap single;
+        single.set(position);
+        *this = and_not(single);
+        this->dirty_from = 0;
+    }
+}
+
+bool WahBitmap::test(BitPosition position) const {
+    uint64_t group = position / GROUP_BITS;
+    uint64_t bit = 1ULL << (position % GROUP_BITS);
+    if (group == this->groups)
+        return (this->active & bit) != 0;
+    if (group > this->groups)
+        return false;
+    uint64_t start = 0;
+    for (auto const w: this->words) {
+        uint64_t length = (w & FILL_FLAG) ? (w & MAX_FILL) : 1;
+        if (group < start + length)
+            return (w & FILL_FLAG) ? (w & FILL_BIT) != 0 : (w & bit) != 0;
+        start += length;
+    }
+    return false;
+}
+
+// Literal words always have a bit set, so only fills of zeros can hide in a non-empty words vector.
+bool WahBitmap::empty() const {
+    if (this->active != 0)
+        return false;
+    for (auto const w: this->words)
+        if (!(w & FILL_FLAG) || (w & FILL_BIT))
+            return false;
+    return true;
+}
+
+uint64_t WahBitmap::count() const {
+    uint64_t n = __builtin_popcountll(this->active);
+    for (auto const w: this->words) {
+        if (!(w & FILL_FLAG))
+            n += __builtin_popcountll(w);
+        else if (w & FILL_BIT)
+            n += (w & MAX_FILL) * GROUP_BITS;
+    }
+    return n;
+}
+
+BitPositions WahBitmap::positions() const {
+    BitPositions ret;
+    BitPosition base = 0;
+    auto add_literal = [&ret](BitPosition base, uint64_t literal) {
+        while (literal != 0) {
+            ret.push_back(base + __builtin_ctzll(literal));
+            literal &= literal - 1;
+        }
+    };
+    for (auto const w: this->words) {
+        if (!(w & FILL_FLAG)) {
+            add_literal(base, w);
+            base += GROUP_BITS;
+        } else {
+            uint64_t length = (w & MAX_FILL) * GROUP_BITS;
+            if (w & FILL_BIT)
+                for (BitPosition i = 0; i < length; i++)
+                    ret.push_back(base + i);
+            base += length;
+        }
+    }
+    add_literal(base, this->active);
+    return ret;
+}
+
+WahBitmap WahBitmap::from_words(const vector<uint64_t>& words, uint64_t groups, uint64_t active) {
+    WahBitmap bitmap;
+    bitmap.words = words;
+    bitmap.groups = groups;
+    bitmap.active = active;
+    bitmap.dirty_from = words.size();
+    return bitmap;
+}
+
+void WahBitmap::append_group(uint64_t literal) {
+    if (literal == 0 || literal == GROUP_MASK) {
+        append_fill(literal != 0, 1);
+        return;
+    }
+    this->words.push_back(literal);
+    touched(this->words.size() - 1);
+    this->groups++;
+}
+
+// Extend the last word if it is a fill of the same bit with room left in its count.
+void WahBitmap::append_fill(bool bit, uint64_t count) {
+    uint64_t fill = FILL_FLAG | (bit ? FILL_BIT : 0);
+    while (count > 0) {
+        if (!this->words.empty() && (this->words.back() & (FILL_FLAG | FILL_BIT)) == fill &&
+            (this->words.back() & MAX_FILL) < MAX_FILL) {
+            uint64_t add = min(count, MAX_FILL - (this->words.back() & MAX_FILL));
+            this->words.back() += add;
+            touched(this->words.size() - 1);
+            this->groups += add;
+            count -= add;
+        } else {
+            uint64_t add = min(count, MAX_FILL);
+            this->words.push_back(fill | add);
+            touched(this->words.size() - 1);
+            this->groups += add;
+            count -= add;
+        }
+    }
+}
+
+void WahBitmap::touched(size_t word) {
+    this->dirty_from = min(this->dirty_from, word);
+}
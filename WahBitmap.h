@@ -0,0 +1,67 @@
+/**
+ * @file WahBitmap.h - compressed bitmap of row positions, as kept by a BitmapIndex
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+typedef uint64_t BitPosition;
+typedef std::vector<BitPosition> BitPositions;
+
+/**
+ * @class WahBitmap - word-aligned hybrid (WAH) compressed bitmap
+ *
+ * Bits are taken 63 at a time. A group with some bits set is stored as a literal word (top bit 0, the
+ * group in the low 63 bits); a run of all-zero or all-one groups is stored as one fill word (top bit 1,
+ * then the fill bit, then the number of groups). The last, partly filled group is kept apart as the
+ * active word so setting ever larger positions only ever touches the end of the bitmap.
+ *
+ * AND, OR and AND NOT work directly on the compressed words: two fills combine into a fill covering
+ * both runs at once, and everything else combines a 64-bit word at a time.
+ */
+class WahBitmap {
+public:
+    static const uint GROUP_BITS = 63;
+    static const uint64_t FILL_FLAG = 1ULL << 63;
+    static const uint64_t FILL_BIT = 1ULL << 62;
+    static const uint64_t GROUP_MASK = FILL_FLAG - 1;  // all 63 bits of a group set
+    static const uint64_t MAX_FILL = FILL_BIT - 1;  // most groups one fill word can count
+
+    WahBitmap() : words(), groups(0), active(0), dirty_from(0) {}
+
+    void set(BitPosition position);
+    void clear(BitPosition position);
+    bool test(BitPosition position) const;
+    bool empty() const;
+    uint64_t count() const;
+    BitPositions positions() const;  // the set positions, in order
+
+    WahBitmap operator&(const WahBitmap& other) const;
+    WahBitmap operator|(const WahBitmap& other) const;
+    WahBitmap and_not(const WahBitmap& other) const;
+
+    // storage: the compressed words, plus the complete group count and active word kept alongside them
+    const std::vector<uint64_t>& get_words() const { return this->words; }
+    uint64_t get_groups() const { return this->groups; }
+    uint64_t get_active() const { return this->active; }
+    static WahBitmap from_words(const std::vector<uint64_t>& words, uint64_t groups, uint64_t active);
+
+    // lowest word changed since mark_clean (get_words().size() if none), so only the tail need be rewritten
+    size_t get_dirty_from() const { return this->dirty_from; }
+    void mark_clean() { this->dirty_from = this->words.size(); }
+
+protected:
+    std::vector<uint64_t> words;
+    uint64_t groups;  // complete groups in words
+    uint64_t active;  // bits of group number groups
+    size_t dirty_from;
+
+    void append_group(uint64_t literal);
+    void append_fill(bool bit, uint64_t count);
+    void touched(size_t word);
+
+    template<typename Op>
+    static WahBitmap combine(const WahBitmap& a, const WahBitmap& b, Op op);
+};
@@ -0,0 +1,393 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "art_index.h"
+
+using namespace std;
+
+ArtIndex::ArtIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique),
+          closed(true),
+          clean(false),
+          file(relation.get_table_name() + "-" + name),
+          key_profile(),
+          tree(unique),
+          mutex() {
+    ColumnAttributes* column_attributes = this->relation.get_column_attributes(this->key_columns);
+    for (ColumnAttribute col: *column_attributes)
+        this->key_profile.push_back(col.get_data_type());
+    delete column_attributes;
+}
+
+// Create the index: build the tree from the relation and snapshot it straight away.
+void ArtIndex::create() {
+    lock_guard<std::mutex> guard(this->mutex);
+    this->file.create();
+    this->closed = false;
+    this->tree.clear();
+    rebuild();
+    save();
+}
+
+// Drop the index.
+void ArtIndex::drop() {
+    lock_guard<std::mutex> guard(this->mutex);
+    this->file.drop();
+    this->tree.clear();
+    this->clean = false;
+    this->closed = true;
+}
+
+// Open existing index. Enables: lookup, range, prefix, insert, delete.
+void ArtIndex::open() {
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+}
+
+// Closes the index, leaving a clean snapshot behind. Disables: lookup, range, prefix, insert, delete.
+void ArtIndex::close() {
+    lock_guard<std::mutex> guard(this->mutex);
+    if (this->closed)
+        return;
+    if (!this->clean)
+        save();
+    this->file.close();
+    this->tree.clear();
+    this->closed = true;
+}
+
+void ArtIndex::snapshot() {
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    if (!this->clean)
+        save();
+}
+
+// Index operations open the index themselves, since an index found in _indices is never created here.
+void ArtIndex::open_if_closed() const {
+    if (!this->closed)
+        return;
+    this->file.open();
+    this->tree.clear();
+    load();
+    if (!this->clean) {
+        this->tree.clear();
+        rebuild();
+    }
+    this->closed = false;
+}
+
+// Read the snapshot into the tree if the header says it is clean; otherwise leave clean false.
+void ArtIndex::load() const {
+    this->clean = false;
+    SlottedPage* header = this->file.get(HEADER);
+    RecordIDs* record_ids = header->ids();
+    uint32_t fields[3] = {0, 0, 0};  // clean, entries, data blocks
+    if (!record_ids->empty()) {
+        Dbt* dbt = header->get(record_ids->front());
+        memcpy(fields, dbt->get_data(), sizeof(fields));
+        delete dbt;
+    }
+    delete record_ids;
+    delete header;
+    if (fields[0] == 0)
+        return;
+
+    for (BlockID block_id = HEADER + 1; block_id <= HEADER + fields[2]; block_id++) {
+        SlottedPage* page = this->file.get(block_id);
+        record_ids = page->ids();
+        for (auto const& record_id: *record_ids) {
+            Dbt* dbt = page->get(record_id);
+            const char* data = (const char*) dbt->get_data();
+            Handle handle;
+            memcpy(&handle.first, data, sizeof(BlockID));
+            memcpy(&handle.second, data + sizeof(BlockID), sizeof(RecordID));
+            this->tree.insert(NormalizedKey(data + HANDLE_SZ, dbt->get_size() - HANDLE_SZ), handle);
+            delete dbt;
+        }
+        delete record_ids;
+        delete page;
+    }
+    this->clean = this->tree.get_size() == fields[1];
+}
+
+// Fill the (empty) tree from every row of the relation.
+void ArtIndex::rebuild() const {
+    Handles* handles = this->relation.select();
+    for (auto const& handle: *handles)
+        this->tree.insert(row_key(handle), handle);
+    delete handles;
+}
+
+// Write every entry, in key order, over the data blocks (adding more as needed), then a clean header.
+void ArtIndex::save() {
+    ArtEntries entries;
+    this->tree.range(nullptr, nullptr, entries);
+    BlockID block_id = HEADER;
+    SlottedPage* page = nullptr;
+    uint used = CAPACITY;
+    for (auto const& entry: entries) {
+        uint size = HANDLE_SZ + (uint) entry.first.size();
+        if (used + size + SLOT_SZ > CAPACITY) {
+            if (page != nullptr) {
+                this->file.put(page);
+                delete page;
+            }
+            block_id++;
+            page = block_id <= this->file.get_last_block_id() ? this->file.get(block_id) : this->file.get_new();
+            page->clear();
+            used = 0;
+        }
+        string record((const char*) &entry.second.first, sizeof(BlockID));
+        record.append((const char*) &entry.second.second, sizeof(RecordID));
+        record.append(entry.first);
+        Dbt dbt((void*) record.data(), (u_int32_t) record.size());
+        page->add(&dbt);
+        used += size + SLOT_SZ;
+    }
+    if (page != nullptr) {
+        this->file.put(page);
+        delete page;
+    }
+    this->clean = true;
+    write_header((uint32_t) entries.size(), block_id - HEADER);
+}
+
+void ArtIndex::write_header(uint32_t entries, uint32_t data_blocks) const {
+    uint32_t fields[3] = {this->clean ? 1U : 0U, entries, data_blocks};
+    SlottedPage* header = this->file.get(HEADER);
+    header->clear();
+    Dbt dbt(fields, sizeof(fields));
+    header->add(&dbt);
+    this->file.put(header);
+    delete header;
+}
+
+// The first change after a snapshot means the next open must rebuild unless another snapshot is taken.
+void ArtIndex::make_dirty() {
+    if (!this->clean)
+        return;
+    this->clean = false;
+    write_header(0, 0);
+}
+
+/*
+ * LOOKUP
+ * */
+Handles* ArtIndex::lookup(ValueDict* key) const {
+    NormalizedKey normalized = normalized_key(key);
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    const Handles* found = this->tree.find(normalized);
+    return found == nullptr ? new Handles() : new Handles(*found);
+}
+
+// Rows with keys from min_key to max_key inclusive (either may be nullptr for no bound), in key order.
+Handles* ArtIndex::range(ValueDict* min_key, ValueDict* max_key) const {
+    NormalizedKey min_normalized, max_normalized;
+    if (min_key != nullptr)
+        min_normalized = normalized_key(min_key);
+    if (max_key != nullptr)
+        max_normalized = normalized_key(max_key);
+    ArtEntries entries;
+    {
+        lock_guard<std::mutex> guard(this->mutex);
+        open_if_closed();
+        this->tree.range(min_key == nullptr ? nullptr : &min_normalized,
+                         max_key == nullptr ? nullptr : &max_normalized, entries);
+    }
+    return handles(entries);
+}
+
+// Rows whose leading key columns match key, in key order. Only the first columns given count; if the
+// last of them is TEXT, its terminator is left off so it matches any value starting with it.
+Handles* ArtIndex::prefix(ValueDict* key) const {
+    NormalizedKey normalized;
+    ColumnAttribute::DataType last = ColumnAttribute::DataType::INT;
+    for (uint i = 0; i < this->key_columns.size() && key->find(this->key_columns[i]) != key->end(); i++) {
+        last = this->key_profile[i];
+        KeyEncoding::encode_value(key->at(this->key_columns[i]), last, normalized);
+    }
+    if (!normalized.empty() && last == ColumnAttribute::DataType::TEXT)
+        normalized.resize(normalized.size() - 2);
+    ArtEntries entries;
+    {
+        lock_guard<std::mutex> guard(this->mutex);
+        open_if_closed();
+        this->tree.prefixed(normalized, entries);
+    }
+    return handles(entries);
+}
+
+/*
+ * INSERTION AND DELETION
+ * */
+// Insert a row with the given handle. Row must exist in relation already.
+void ArtIndex::insert(Handle handle) {
+    NormalizedKey key = row_key(handle);
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    this->tree.insert(key, handle);
+    make_dirty();
+}
+
+// Remove the row with the given handle. Row must still be in the relation.
+void ArtIndex::del(Handle handle) {
+    NormalizedKey key = row_key(handle);
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    if (!this->tree.remove(key, handle))
+        throw DbRelationError("row is not in index " + this->name);
+    make_dirty();
+}
+
+Handles* ArtIndex::handles(const ArtEntries& entries) {
+    Handles* ret = new Handles();
+    for (auto const& entry: entries)
+        ret->push_back(entry.second);
+    return ret;
+}
+
+NormalizedKey ArtIndex::normalized_key(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const& col: this->key_columns)
+        key_value.push_back(key->at(col));
+    return KeyEncoding::encode(key_value, this->key_profile);
+}
+
+NormalizedKey ArtIndex::row_key(Handle handle) const {
+    ValueDict* row = this->relation.project(handle, &this->key_columns);
+    NormalizedKey key = this->normalized_key(row);
+    delete row;
+    if (key.size() > MAX_KEY_SIZE)
+        throw DbRelationError("key is too long for index " + this->name);
+    return key;
+}
+
+
+//ART INDEX TESTING
+bool test_art_index() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("name");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("test_art", column_names, column_attributes);
+    table.create();
+
+    // build from the first 1500 rows, then insert the rest; names share a lot of leading bytes
+    ColumnNames id_key, name_key;
+    id_key.push_back("id");
+    name_key.push_back("name");
+    ArtIndex* ids = new ArtIndex(table, "test_art_id", id_key, true);
+    ArtIndex* names = new ArtIndex(table, "test_art_name", name_key, false);
+    Handles handles;
+    vector<string> row_names;
+    ValueDict row;
+    for (int i = 0; i < 2000; i++) {
+        if (i == 1500) {
+            ids->create();
+            names->create();
+        }
+        row_names.push_back(string(1, (char) ('a' + i % 26)) + to_string(i % 60));
+        row["id"] = Value(i);
+        row["name"] = Value(row_names.back());
+        handles.push_back(table.insert(&row));
+        if (i >= 1500) {
+            ids->insert(handles.back());
+            names->insert(handles.back());
+        }
+    }
+
+    // expected answers, the slow way, against the rows still in the indices
+    vector<bool> present(2000, true);
+    auto expect = [&](bool (*wanted)(int, const string&)) {
+        Handles ret;
+        for (int i = 0; i < (int) handles.size(); i++)
+            if (present[i] && wanted(i, row_names[i]))
+                ret.push_back(handles[i]);
+        sort(ret.begin(), ret.end());
+        return ret;
+    };
+    auto same = [](Handles* found, const Handles& expected) {
+        sort(found->begin(), found->end());
+        bool ret = *found == expected;
+        delete found;
+        return ret;
+    };
+    auto check = [&]() {
+        ValueDict key, min, max;
+        bool ok = true;
+        for (int i = 0; i < 2000 && ok; i += 37) {
+            key["id"] = Value(i);
+            Handles* found = ids->lookup(&key);
+            ok = found->size() == (present[i] ? 1U : 0U) && (!present[i] || found->front() == handles[i]);
+            delete found;
+        }
+        key.clear();
+        key["name"] = Value("c12");
+        ok = ok && same(names->lookup(&key), expect([](int i, const string& s) { return s == "c12"; }));
+        min["id"] = Value(-5);
+        max["id"] = Value(777);
+        ok = ok && same(ids->range(&min, &max), expect([](int i, const string& s) { return i <= 777; }));
+        key["name"] = Value("c1");
+        ok = ok && same(names->prefix(&key), expect([](int i, const string& s) { return s.compare(0, 2, "c1") == 0; }));
+        key["name"] = Value("");
+        ok = ok && same(names->prefix(&key), expect([](int i, const string& s) { return true; }));
+        return ok;
+    };
+
+    //t1 lookup, range and prefix after a build and inserts; a unique key is enforced
+    bool result = check();
+    try {
+        ids->insert(handles[0]);
+        result = false;
+    } catch (DbRelationError& e) {
+    }
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 delete most rows, collapsing and shrinking nodes on the way down
+    for (int i = 0; i < 2000; i++) {
+        if (i % 50 == 7)
+            continue;
+        ids->del(handles[i]);
+        names->del(handles[i]);
+        present[i] = false;
+    }
+    result = result && check();
+    try {
+        ids->del(handles[0]);
+        result = false;
+    } catch (DbRelationError& e) {
+    }
+    cout << (result ? "passed t2" : "failed t2") << endl;
+
+    //t3 a clean snapshot is loaded (so the deleted rows stay gone); a dirty one is rebuilt from the relation
+    ids->snapshot();
+    names->snapshot();
+    delete ids;
+    delete names;
+    ids = new ArtIndex(table, "test_art_id", id_key, true);
+    names = new ArtIndex(table, "test_art_name", name_key, false);
+    result = result && check();
+    row["id"] = Value(2000);
+    row["name"] = Value("zz");
+    handles.push_back(table.insert(&row));
+    row_names.push_back("zz");
+    names->insert(handles.back());
+    delete names;
+    names = new ArtIndex(table, "test_art_name", name_key, false);
+    present.assign(2001, true);
+    ValueDict key;
+    key["name"] = Value("c");
+    result = result && same(names->prefix(&key), expect([](int i, const string& s) { return s[0] == 'c'; }));
+    cout << (result ? "passed t3" : "failed t3") << endl;
+
+    ids->drop();
+    names->drop();
+    delete ids;
+    delete names;
+    table.drop();
+    return result;
+}
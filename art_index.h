@@ -0,0 +1,66 @@
+#pragma once
+
+#include <mutex>
+#include "heap_storage.h"
+#include "ArtTree.h"
+
+/**
+ * @class ArtIndex - in-memory index on an adaptive radix tree of normalized keys
+ *
+ * The whole index lives in an ArtTree while it is open, so probes never touch the disk. The index file
+ * holds a snapshot of the entries: block 1 is a header (clean flag, entry count, data block count), then
+ * data blocks of handle + key records in key order. Opening loads the snapshot if it is clean and
+ * otherwise rebuilds the tree from the relation; the first change after a snapshot marks it dirty, and
+ * close() (or snapshot()) writes a fresh one.
+ *
+ * Besides lookup and range, prefix() finds the rows matching the leading key columns, where the last of
+ * them given may be matched as the start of a TEXT value.
+ */
+class ArtIndex : public DbIndex {
+public:
+    ArtIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+    virtual ~ArtIndex() {}
+
+    virtual void create();
+    virtual void drop();
+
+    virtual void open();
+    virtual void close();
+
+    virtual Handles* lookup(ValueDict* key) const;
+    virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+    virtual bool has_range() const { return true; }
+    virtual bool range_in_order() const { return true; }
+    Handles* prefix(ValueDict* key) const;  // key holds just the leading key columns wanted
+
+    virtual void insert(Handle handle);
+    virtual void del(Handle handle);
+
+    void snapshot();  // write the entries out so the next open need not rebuild
+
+protected:
+    static const BlockID HEADER = 1;
+    static const uint SLOT_SZ = 4;
+    static const uint CAPACITY = DbBlock::BLOCK_SZ - 5;
+    static const uint HANDLE_SZ = sizeof(BlockID) + sizeof(RecordID);
+    static const uint MAX_KEY_SIZE = DbBlock::BLOCK_SZ / 4;
+
+    mutable bool closed;
+    mutable bool clean;  // the snapshot on disk matches the tree
+    mutable HeapFile file;
+    KeyProfile key_profile;
+    mutable ArtTree tree;
+    mutable std::mutex mutex;  // one operation at a time
+
+    void open_if_closed() const;
+    void load() const;
+    void rebuild() const;
+    void save();
+    void write_header(uint32_t entries, uint32_t data_blocks) const;
+    void make_dirty();
+    NormalizedKey normalized_key(const ValueDict *key) const;
+    NormalizedKey row_key(Handle handle) const;
+    static Handles* handles(const ArtEntries& entries);
+};
+
+bool test_art_index();
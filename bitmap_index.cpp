@@ -0,0 +1,404 @@
+#include <algorithm>
+#include <iostream>
+#include "bitmap_index.h"
+
+using namespace std;
+
+BitmapIndex::BitmapIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique),
+          closed(true),
+          file(relation.get_table_name() + "-" + name),
+          key_profile(),
+          bitmaps(),
+          directory_pages(),
+          mutex() {
+    if (unique)
+        throw DbRelationError("Bitmap index cannot have a unique key");
+    ColumnAttributes* column_attributes = this->relation.get_column_attributes(this->key_columns);
+    for (ColumnAttribute col: *column_attributes)
+        this->key_profile.push_back(col.get_data_type());
+    delete column_attributes;
+}
+
+// Create the index: one pass over the relation sets every row's bit, then each bitmap is written once.
+void BitmapIndex::create() {
+    lock_guard<std::mutex> guard(this->mutex);
+    this->file.create();
+    this->closed = false;
+    this->bitmaps.clear();
+    this->directory_pages.clear();
+    this->directory_pages.push_back(BlockID(DIRECTORY));
+
+    Handles* handles = this->relation.select();
+    for (auto const& handle: *handles)
+        this->bitmaps[row_key(handle)].first.set(position(handle));
+    delete handles;
+    for (auto& item: this->bitmaps)
+        save_bitmap(item.second);
+    save_directory();
+}
+
+// Drop the index.
+void BitmapIndex::drop() {
+    lock_guard<std::mutex> guard(this->mutex);
+    this->file.drop();
+    this->bitmaps.clear();
+    this->directory_pages.clear();
+    this->closed = true;
+}
+
+// Open existing index. Enables: lookup, range, insert, delete.
+void BitmapIndex::open() {
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+}
+
+// Closes the index. Disables: lookup, range, insert, delete (until opened again).
+void BitmapIndex::close() {
+    lock_guard<std::mutex> guard(this->mutex);
+    if (this->closed)
+        return;
+    this->file.close();
+    this->bitmaps.clear();
+    this->directory_pages.clear();
+    this->closed = true;
+}
+
+// Read the directory and every bitmap into memory. Index operations call this themselves.
+void BitmapIndex::open_if_closed() const {
+    if (!this->closed)
+        return;
+    this->file.open();
+    BlockID directory_id = DIRECTORY;
+    while (directory_id != 0) {
+        this->directory_pages.push_back(directory_id);
+        SlottedPage* page = this->file.get(directory_id);
+        RecordIDs* record_ids = page->ids();
+        directory_id = 0;
+        for (auto const& record_id: *record_ids) {
+            Dbt* dbt = page->get(record_id);
+            if (record_id == 1)
+                directory_id = *(BlockID *) dbt->get_data();
+            else
+                load_bitmap((const char *) dbt->get_data(), dbt->get_size());
+            delete dbt;
+        }
+        delete record_ids;
+        delete page;
+    }
+    this->closed = false;
+}
+
+// Load the bitmap described by a directory entry: first page, word count, group count, active word, key.
+void BitmapIndex::load_bitmap(const char *entry, uint size) const {
+    BlockID page_id = *(uint32_t *) entry;
+    uint32_t word_count = *(uint32_t *) (entry + sizeof(uint32_t));
+    uint64_t groups = *(uint64_t *) (entry + 2 * sizeof(uint32_t));
+    uint64_t active = *(uint64_t *) (entry + 2 * sizeof(uint32_t) + sizeof(uint64_t));
+    NormalizedKey key(entry + DIRECTORY_ENTRY_SZ, size - DIRECTORY_ENTRY_SZ);
+
+    vector<uint64_t> words;
+    BlockIDs pages;
+    while (page_id != 0) {
+        pages.push_back(page_id);
+        SlottedPage* page = this->file.get(page_id);
+        Dbt* dbt = page->get(1);
+        page_id = *(BlockID *) dbt->get_data();
+        delete dbt;
+        RecordIDs* record_ids = page->ids();
+        if (record_ids->size() > 1 && words.size() < word_count) {
+            dbt = page->get(2);
+            const uint64_t* page_words = (const uint64_t *) dbt->get_data();
+            words.insert(words.end(), page_words, page_words + dbt->get_size() / sizeof(uint64_t));
+            delete dbt;
+        }
+        delete record_ids;
+        delete page;
+    }
+    words.resize(word_count);
+    this->bitmaps[key] = StoredBitmap(WahBitmap::from_words(words, groups, active), pages);
+}
+
+// Rewrite a bitmap's pages from the one holding its first changed word on, adding pages as it grows.
+void BitmapIndex::save_bitmap(StoredBitmap& stored) {
+    WahBitmap& bitmap = stored.first;
+    BlockIDs& pages = stored.second;
+    const vector<uint64_t>& words = bitmap.get_words();
+    size_t needed = max((size_t) 1, (words.size() + WORDS_PER_PAGE - 1) / WORDS_PER_PAGE);
+    size_t start = bitmap.get_dirty_from() / WORDS_PER_PAGE;
+    size_t old_count = pages.size();
+    while (pages.size() < needed) {
+        SlottedPage* page = this->file.get_new();
+        pages.push_back(page->get_block_id());
+        delete page;
+    }
+    if (pages.size() > old_count)
+        start = min(start, old_count == 0 ? 0 : old_count - 1);  // the old last page needs its next pointer
+
+    for (size_t i = start; i < pages.size(); i++) {
+        SlottedPage* page = this->file.get(pages[i]);
+        page->clear();
+        BlockID next = i + 1 < pages.size() ? pages[i + 1] : 0;
+        Dbt next_dbt(&next, sizeof(BlockID));
+        page->add(&next_dbt);
+        size_t begin = i * WORDS_PER_PAGE;
+        size_t end = min(words.size(), begin + WORDS_PER_PAGE);
+        if (begin < end) {
+            Dbt words_dbt((void *) &words[begin], (u_int32_t) ((end - begin) * sizeof(uint64_t)));
+            page->add(&words_dbt);
+        }
+        this->file.put(page);
+        delete page;
+    }
+    bitmap.mark_clean();
+}
+
+// Rewrite the directory, chaining on more blocks if it has outgrown the ones it has.
+void BitmapIndex::save_directory() {
+    vector<vector<string>> contents(1);
+    uint used = sizeof(BlockID) + SLOT_SZ;
+    for (auto const& item: this->bitmaps) {
+        const WahBitmap& bitmap = item.second.first;
+        uint32_t fields[2] = {item.second.second.front(), (uint32_t) bitmap.get_words().size()};
+        uint64_t state[2] = {bitmap.get_groups(), bitmap.get_active()};
+        string record((const char *) fields, sizeof(fields));
+        record.append((const char *) state, sizeof(state));
+        record.append(item.first);
+        if (used + record.size() + SLOT_SZ > CAPACITY) {
+            contents.push_back(vector<string>());
+            used = sizeof(BlockID) + SLOT_SZ;
+        }
+        used += record.size() + SLOT_SZ;
+        contents.back().push_back(record);
+    }
+    while (this->directory_pages.size() < contents.size()) {
+        SlottedPage* page = this->file.get_new();
+        this->directory_pages.push_back(page->get_block_id());
+        delete page;
+    }
+    contents.resize(this->directory_pages.size());
+
+    for (size_t i = 0; i < this->directory_pages.size(); i++) {
+        SlottedPage* page = this->file.get(this->directory_pages[i]);
+        page->clear();
+        BlockID next = i + 1 < this->directory_pages.size() ? this->directory_pages[i + 1] : 0;
+        Dbt next_dbt(&next, sizeof(BlockID));
+        page->add(&next_dbt);
+        for (auto const& record: contents[i]) {
+            Dbt dbt((void *) record.data(), (u_int32_t) record.size());
+            page->add(&dbt);
+        }
+        this->file.put(page);
+        delete page;
+    }
+}
+
+/*
+ * LOOKUP
+ * */
+Handles* BitmapIndex::lookup(ValueDict* key) const {
+    return handles(bitmap(key));
+}
+
+// Rows with keys from min_key to max_key inclusive (either may be nullptr for no bound): since the
+// bitmaps are kept in normalized key order this is an OR of a run of them.
+Handles* BitmapIndex::range(ValueDict* min_key, ValueDict* max_key) const {
+    NormalizedKey min_normalized, max_normalized;
+    if (min_key != nullptr)
+        min_normalized = normalized_key(min_key);
+    if (max_key != nullptr)
+        max_normalized = normalized_key(max_key);
+    WahBitmap result;
+    {
+        lock_guard<std::mutex> guard(this->mutex);
+        open_if_closed();
+        auto it = min_key == nullptr ? this->bitmaps.begin() : this->bitmaps.lower_bound(min_normalized);
+        auto end = max_key == nullptr ? this->bitmaps.end() : this->bitmaps.upper_bound(max_normalized);
+        for (; it != end; it++)
+            result = result | it->second.first;
+    }
+    return handles(result);
+}
+
+WahBitmap BitmapIndex::bitmap(const ValueDict* key) const {
+    NormalizedKey normalized = normalized_key(key);
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    auto it = this->bitmaps.find(normalized);
+    if (it == this->bitmaps.end())
+        return WahBitmap();
+    return it->second.first;
+}
+
+Handles* BitmapIndex::lookup_and(const BitmapProbes& probes) {
+    if (probes.empty())
+        throw DbRelationError("no bitmaps to combine");
+    WahBitmap result = probes[0].first->bitmap(probes[0].second);
+    for (size_t i = 1; i < probes.size() && !result.empty(); i++)
+        result = result & probes[i].first->bitmap(probes[i].second);
+    return handles(result);
+}
+
+Handles* BitmapIndex::lookup_or(const BitmapProbes& probes) {
+    WahBitmap result;
+    for (auto const& probe: probes)
+        result = result | probe.first->bitmap(probe.second);
+    return handles(result);
+}
+
+/*
+ * INSERTION AND DELETION
+ * */
+// Insert a row with the given handle. Row must exist in relation already.
+void BitmapIndex::insert(Handle handle) {
+    NormalizedKey key = row_key(handle);
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    StoredBitmap& stored = this->bitmaps[key];
+    stored.first.set(position(handle));
+    save_bitmap(stored);
+    save_directory();
+}
+
+// Remove the row with the given handle. Row must still be in the relation.
+void BitmapIndex::del(Handle handle) {
+    NormalizedKey key = row_key(handle);
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    auto it = this->bitmaps.find(key);
+    if (it == this->bitmaps.end() || !it->second.first.test(position(handle)))
+        throw DbRelationError("row is not in index " + this->name);
+    it->second.first.clear(position(handle));
+    save_bitmap(it->second);
+    save_directory();
+}
+
+/*
+ * POSITIONS
+ * */
+BitPosition BitmapIndex::position(Handle handle) {
+    if (handle.second > (1U << RECORD_BITS))
+        throw DbRelationError("record id is too large for a bitmap index");
+    return ((BitPosition) (handle.first - 1) << RECORD_BITS) | (handle.second - 1);
+}
+
+Handle BitmapIndex::handle(BitPosition position) {
+    return Handle((BlockID) (position >> RECORD_BITS) + 1,
+                  (RecordID) (position & ((1U << RECORD_BITS) - 1)) + 1);
+}
+
+Handles* BitmapIndex::handles(const WahBitmap& bitmap) {
+    Handles* ret = new Handles();
+    for (auto const position: bitmap.positions())
+        ret->push_back(handle(position));
+    return ret;
+}
+
+NormalizedKey BitmapIndex::normalized_key(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const& col: this->key_columns)
+        key_value.push_back(key->at(col));
+    return KeyEncoding::encode(key_value, this->key_profile);
+}
+
+NormalizedKey BitmapIndex::row_key(Handle handle) const {
+    ValueDict* row = this->relation.project(handle, &this->key_columns);
+    NormalizedKey key = this->normalized_key(row);
+    delete row;
+    if (key.size() > MAX_KEY_SIZE)
+        throw DbRelationError("key is too long for index " + this->name);
+    return key;
+}
+
+
+//BITMAP INDEX TESTING
+bool test_bitmap_index() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("flag");
+    column_names.push_back("color");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::TEXT));
+    HeapTable table("test_bitmap", column_names, column_attributes);
+    table.create();
+
+    // build from the first 3000 rows, then insert the rest
+    const char* colors[] = {"red", "green", "blue"};
+    Handles handles;
+    ValueDict row;
+    ColumnNames flag_key, color_key;
+    flag_key.push_back("flag");
+    color_key.push_back("color");
+    BitmapIndex* flags = new BitmapIndex(table, "test_bitmap_flag", flag_key, false);
+    BitmapIndex* color = new BitmapIndex(table, "test_bitmap_color", color_key, false);
+    for (int i = 0; i < 4000; i++) {
+        if (i == 3000) {
+            flags->create();
+            color->create();
+        }
+        row["id"] = Value(i);
+        row["flag"] = Value(i % 7 == 0 ? 1 : 0);
+        row["color"] = Value(colors[i % 3]);
+        handles.push_back(table.insert(&row));
+        if (i >= 3000) {
+            flags->insert(handles.back());
+            color->insert(handles.back());
+        }
+    }
+
+    // expected answers, the slow way
+    auto expect = [&handles](bool (*wanted)(int)) {
+        Handles ret;
+        for (int i = 0; i < 4000; i++)
+            if (wanted(i))
+                ret.push_back(handles[i]);
+        return ret;
+    };
+
+    //t1 single bitmap lookups, after a build and after inserts
+    ValueDict flag_on, red, green;
+    flag_on["flag"] = Value(1);
+    red["color"] = Value("red");
+    green["color"] = Value("green");
+    Handles* found = flags->lookup(&flag_on);
+    bool result = *found == expect([](int i) { return i % 7 == 0; });
+    delete found;
+    found = color->lookup(&green);
+    result = result && *found == expect([](int i) { return i % 3 == 1; });
+    delete found;
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 AND and OR of bitmaps from both indices
+    BitmapProbes probes;
+    probes.push_back(BitmapProbes::value_type(flags, &flag_on));
+    probes.push_back(BitmapProbes::value_type(color, &red));
+    found = BitmapIndex::lookup_and(probes);
+    result = result && *found == expect([](int i) { return i % 7 == 0 && i % 3 == 0; });
+    delete found;
+    found = BitmapIndex::lookup_or(probes);
+    result = result && *found == expect([](int i) { return i % 7 == 0 || i % 3 == 0; });
+    delete found;
+    found = color->range(&green, &red);  // "green" through "red" takes in all but "blue"
+    result = result && *found == expect([](int i) { return i % 3 != 2; });
+    delete found;
+    cout << (result ? "passed t2" : "failed t2") << endl;
+
+    //t3 deletes, then reopen
+    for (uint i = 0; i < 4000; i += 14)
+        flags->del(handles[i]);
+    delete flags;
+    flags = new BitmapIndex(table, "test_bitmap_flag", flag_key, false);
+    found = flags->lookup(&flag_on);
+    result = result && *found == expect([](int i) { return i % 7 == 0 && i % 14 != 0; });
+    delete found;
+    cout << (result ? "passed t3" : "failed t3") << endl;
+
+    flags->drop();
+    color->drop();
+    delete flags;
+    delete color;
+    table.drop();
+    return result;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include "heap_storage.h"
+#include "KeyEncoding.h"
+#include "WahBitmap.h"
+
+class BitmapIndex;
+
+// a bitmap index and the key value wanted from it, for combining several indices' bitmaps
+typedef std::vector<std::pair<const BitmapIndex*, ValueDict*>> BitmapProbes;
+
+/**
+ * @class BitmapIndex - one compressed bitmap of row positions per distinct key value
+ *
+ * Meant for low-cardinality keys (flags, status codes and the like). A row's position is its block id
+ * and record id packed together, so rows appended to the relation only ever append to the bitmaps.
+ * Bitmaps from several bitmap indices are combined with AND/OR a word at a time (see WahBitmap) before
+ * any row is read.
+ *
+ * Every bitmap is held in memory while the index is open and written through to the index file on each
+ * change. Block 1 starts the directory: the next directory block, then per value its first bitmap page,
+ * word count, group count, active word and key. Bitmap pages hold the next page and a run of words; only
+ * the pages from the first changed word on are rewritten.
+ */
+class BitmapIndex : public DbIndex {
+public:
+    BitmapIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+    virtual ~BitmapIndex() {}
+
+    virtual void create();
+    virtual void drop();
+
+    virtual void open();
+    virtual void close();
+
+    virtual Handles* lookup(ValueDict* key) const;
+    virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;  // OR of the values in between
+    virtual bool has_range() const { return true; }
+
+    virtual void insert(Handle handle);
+    virtual void del(Handle handle);
+
+    WahBitmap bitmap(const ValueDict* key) const;  // (a copy of) the bitmap for key, empty if none
+
+    // rows matching every probe or any probe, found by combining bitmaps before touching the relation
+    static Handles* lookup_and(const BitmapProbes& probes);
+    static Handles* lookup_or(const BitmapProbes& probes);
+
+    static const uint RECORD_BITS = 10;  // record ids per block in a position
+    static BitPosition position(Handle handle);
+    static Handle handle(BitPosition position);
+    static Handles* handles(const WahBitmap& bitmap);
+
+protected:
+    static const BlockID DIRECTORY = 1;
+    // bytes of records plus their 4-byte slot headers that fit in a SlottedPage
+    static const uint SLOT_SZ = 4;
+    static const uint CAPACITY = DbBlock::BLOCK_SZ - 5;
+    static const uint WORDS_PER_PAGE = 500;
+    static const uint DIRECTORY_ENTRY_SZ = 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+    static const uint MAX_KEY_SIZE = DbBlock::BLOCK_SZ / 4;
+
+    // a value's bitmap and the pages it is stored on, in order
+    typedef std::pair<WahBitmap, BlockIDs> StoredBitmap;
+
+    mutable bool closed;
+    mutable HeapFile file;
+    KeyProfile key_profile;
+    mutable std::map<NormalizedKey, StoredBitmap> bitmaps;
+    mutable BlockIDs directory_pages;
+    mutable std::mutex mutex;  // one operation at a time
+
+    void open_if_closed() const;
+    NormalizedKey normalized_key(const ValueDict *key) const;
+    NormalizedKey row_key(Handle handle) const;
+    void load_bitmap(const char *entry, uint size) const;
+    void save_bitmap(StoredBitmap& stored);  // just the changed pages; the directory is saved separately
+    void save_directory();
+};
+
+bool test_bitmap_index();
@@ -1,10 +1,15 @@
 #pragma once
 
 #include "BTreeNode.h"
+#include "BTreeLatch.h"
+
+class BTreeSorter;
+class BTreeProbeLevel;
 
 class BTreeIndex : public DbIndex {
 public:
-    BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+    BTreeIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique,
+               ColumnNames include_columns=ColumnNames(), ValueDict filter=ValueDict());
     virtual ~BTreeIndex();
 
     virtual void create();
@@ -15,24 +20,64 @@ public:
 
     virtual Handles* lookup(ValueDict* key) const;
     virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+    virtual bool has_range() const { return true; }
+    virtual bool range_in_order() const { return true; }
+    virtual HandlesList* lookup_many(const ValueDicts& keys) const;  // in key order, sharing descents
+
+    // covering index support: key and INCLUDE columns can be read straight from the leaves
+    virtual bool covers(const ColumnNames& column_names) const;
+    virtual ValueDicts* lookup_values(ValueDict* key, const ColumnNames* column_names) const;
+
+    // partial index support: only rows meeting the filter (column = value for each) get entries
+    virtual bool implied_by(const ValueDict& conjunction) const;
+
+    // statistics: counted by inserts as they go (distinct counts estimated), recounted exactly by analyze
+    virtual IndexStats get_stats() const;
+    virtual void analyze();
 
     virtual void insert(Handle handle);
     //virtual void split_root(Insertion split_root, BTreeNode* node, uint height );
     virtual void del(Handle handle);
 
     virtual KeyValue *tkey(const ValueDict *key) const; // pull out the key values from the ValueDict in order
+    NormalizedKey normalized_key(const ValueDict *key) const; // tkey, encoded for bytewise comparison
+    Payload payload(const ValueDict *row) const; // the row's INCLUDE column values, encoded for a leaf entry
+
+    // bulk-load tuning for create(): leaf/interior fill percentage and how many entries to sort in memory
+    static const uint DEFAULT_FILL_PERCENT = 90;
+    static const uint DEFAULT_SORT_RUN_SIZE = 1000000;
+    void set_fill_percent(uint fill_percent) { this->fill_percent = fill_percent; }
+    void set_sort_run_size(uint sort_run_size) { this->sort_run_size = sort_run_size; }
+    void set_build_threads(uint build_threads) { this->build_threads = build_threads; }
 
 protected:
     static const BlockID STAT = 1;
     bool closed;
     BTreeStat *stat;
-    BTreeNode *root;
-    HeapFile file;
+    mutable HeapFile file;
     KeyProfile key_profile;
+    ColumnNames include_columns;
+    KeyProfile include_profile;
+    ValueDict filter;
+    uint fill_percent;
+    uint sort_run_size;
+    uint build_threads;
+    mutable BTreeLatches latches;  // the stat block's latch guards the root id and height
 
     void build_key_profile();
-    Handles* _lookup(BTreeNode *node, uint height, const KeyValue* key) const;
-    Insertion _insert(BTreeNode *node, uint height, const KeyValue* key, Handle handle);
+    void bulk_load();
+    void sort_blocks(BlockID first, BlockID last, BTreeSorter* sorter) const;
+    void sort_rows(BTreeSorter* sorter) const;
+    BTreeLeaf *find_leaf(const NormalizedKey& key, BTreeLatch*& leaf_latch, uint64_t& leaf_version) const;
+    BTreeLeaf *torn(const BTreeLatch* latch, uint64_t version) const;
+    BTreeLeaf *probe_leaf(const NormalizedKey& key, std::vector<BTreeProbeLevel>& path, BTreeLatch*& leaf_latch,
+                          uint64_t& leaf_version, NormalizedKey& high, bool& bounded) const;
+    ColumnNames entry_columns() const;
+    bool in_filter(const ValueDict *row) const;
+    size_t shared_columns(const BTreeLeaf& leaf, const NormalizedKey& key) const;
+    void count_insert(size_t shared, size_t bytes);
+    bool insert_in_leaf(const NormalizedKey& key, Handle handle, const Payload& payload);
+    void insert_splitting(const NormalizedKey& key, Handle handle, const Payload& payload);
 };
 
 bool test_btree();
@@ -0,0 +1,507 @@
+#include <algorithm>
+#include <iostream>
+#include "hash_index.h"
+
+using namespace std;
+
+HashIndex::HashIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique),
+          closed(true),
+          stat(nullptr),
+          file(relation.get_table_name() + "-" + name),
+          overflow(relation.get_table_name() + "-" + name + "-overflow"),
+          key_profile(),
+          split_load(DEFAULT_SPLIT_LOAD),
+          mutex() {
+    ColumnAttributes* column_attributes = this->relation.get_column_attributes(this->key_columns);
+    for (ColumnAttribute col: *column_attributes)
+        this->key_profile.push_back(col.get_data_type());
+    delete column_attributes;
+}
+
+HashIndex::~HashIndex() {
+    delete this->stat;
+}
+
+// Create the index and fill it from the relation.
+void HashIndex::create() {
+    lock_guard<std::mutex> guard(this->mutex);
+    this->file.create();
+    this->overflow.create();
+    this->stat = new HashStat(this->file, STAT, true);
+    this->closed = false;
+    build();
+}
+
+// Hash every row of the relation, then make just enough buckets for them at split_load and write
+// each bucket out once, so a build never splits.
+void HashIndex::build() {
+    HashEntries entries;
+    uint64_t bytes = 0;
+    Handles* handles = this->relation.select();
+    for (auto const& handle: *handles) {
+        entries.push_back(entry(handle));
+        bytes += entries.back().size();
+    }
+    delete handles;
+
+    uint level = 0;
+    while ((uint64_t) (INITIAL_BUCKETS << level) * HashBucket::CAPACITY * this->split_load / 100 < bytes)
+        level++;
+    uint bucket_count = INITIAL_BUCKETS << level;
+    vector<HashEntries> buckets(bucket_count);
+    for (auto const& entry: entries)
+        buckets[entry.hash & (bucket_count - 1)].push_back(entry);
+    entries.clear();
+
+    for (uint bucket = 0; bucket < bucket_count; bucket++) {
+        if (this->unique) {
+            HashEntries& contents = buckets[bucket];
+            sort(contents.begin(), contents.end(),
+                 [](const HashEntry& a, const HashEntry& b) { return a.key < b.key; });
+            for (size_t i = 1; i < contents.size(); i++)
+                if (contents[i].key == contents[i - 1].key)
+                    throw DbRelationError("Duplicate keys are not allowed in unique index");
+        }
+        vector<HashBucket*> pages;
+        pages.push_back(new HashBucket(this->file, 0, true));
+        try {
+            write_chain(pages, buckets[bucket]);
+        } catch (...) {
+            for (auto page: pages)
+                delete page;
+            throw;
+        }
+        for (auto page: pages)
+            delete page;
+        buckets[bucket].clear();
+    }
+    this->stat->set_level(level);
+    this->stat->set_next_split(0);
+    this->stat->set_bytes((uint) bytes);
+    this->stat->save();
+}
+
+// Drop the index.
+void HashIndex::drop() {
+    lock_guard<std::mutex> guard(this->mutex);
+    this->file.drop();
+    this->overflow.drop();
+    delete this->stat;
+    this->stat = nullptr;
+    this->closed = true;
+}
+
+// Open existing index. Enables: lookup, insert, delete.
+void HashIndex::open() {
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+}
+
+// Closes the index. Disables: lookup, insert, delete (until opened again).
+void HashIndex::close() {
+    lock_guard<std::mutex> guard(this->mutex);
+    if (this->closed)
+        return;
+    this->file.close();
+    this->overflow.close();
+    delete this->stat;
+    this->stat = nullptr;
+    this->closed = true;
+}
+
+// Index operations open the index themselves, since an index found in _indices is never created here.
+void HashIndex::open_if_closed() const {
+    if (!this->closed)
+        return;
+    this->file.open();
+    this->overflow.open();
+    this->stat = new HashStat(this->file, STAT, false);
+    this->closed = false;
+}
+
+/*
+ * LOOKUP
+ * */
+// Find all the rows whose columns are equal to key: one primary page read, plus its overflow pages if any.
+Handles* HashIndex::lookup(ValueDict* key_dict) const {
+    NormalizedKey key = this->normalized_key(key_dict);
+    HashCode code = hash(key);
+    Handles* handles = new Handles();
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    HashBucket* page = new HashBucket(this->file, FIRST_BUCKET + bucket_of(code), false);
+    while (true) {
+        for (auto const& entry: page->get_entries())
+            if (entry.hash == code && entry.key == key)
+                handles->push_back(entry.handle);
+        BlockID next = page->get_next();
+        delete page;
+        if (next == 0 || (this->unique && !handles->empty()))
+            break;
+        page = new HashBucket(this->overflow, next, false);
+    }
+    return handles;
+}
+
+// The keys are grouped by bucket, so each bucket's chain is read once however many keys land in it.
+HandlesList* HashIndex::lookup_many(const ValueDicts& keys) const {
+    NormalizedKeys normalized;
+    vector<HashCode> codes;
+    HandlesList* ret = new HandlesList();
+    for (auto const key: keys) {
+        normalized.push_back(this->normalized_key(key));
+        codes.push_back(hash(normalized.back()));
+        ret->push_back(new Handles());
+    }
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    map<uint, vector<size_t>> by_bucket;
+    for (size_t i = 0; i < keys.size(); i++)
+        by_bucket[bucket_of(codes[i])].push_back(i);
+    for (auto const& bucket: by_bucket) {
+        vector<HashBucket*> pages;
+        read_chain(bucket.first, pages);
+        for (auto page: pages) {
+            for (auto const& entry: page->get_entries())
+                for (auto const i: bucket.second)
+                    if (entry.hash == codes[i] && entry.key == normalized[i])
+                        (*ret)[i]->push_back(entry.handle);
+            delete page;
+        }
+    }
+    return ret;
+}
+
+Handles* HashIndex::range(ValueDict* min_key, ValueDict* max_key) const {
+    throw DbRelationError("Hash index has no key order to do a range query on");
+}
+
+/*
+ * INSERTION
+ * */
+// Insert a row with the given handle. Row must exist in relation already.
+void HashIndex::insert(Handle handle) {
+    HashEntry new_entry = entry(handle);
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    vector<HashBucket*> pages;
+    try {
+        read_chain(bucket_of(new_entry.hash), pages);
+        HashBucket* target = nullptr;
+        for (auto page: pages) {
+            if (this->unique)
+                for (auto const& entry: page->get_entries())
+                    if (entry.hash == new_entry.hash && entry.key == new_entry.key)
+                        throw DbRelationError("Duplicate keys are not allowed in unique index");
+            if (target == nullptr && page->has_room_for(new_entry))
+                target = page;
+        }
+        if (target == nullptr) {
+            target = new_overflow();
+            pages.back()->set_next(target->get_id());
+            pages.back()->save();
+            pages.push_back(target);
+        }
+        target->add(new_entry);
+        target->save();
+    } catch (...) {
+        for (auto page: pages)
+            delete page;
+        throw;
+    }
+    for (auto page: pages)
+        delete page;
+
+    this->stat->set_bytes(this->stat->get_bytes() + new_entry.size());
+    if ((uint64_t) this->stat->get_bytes() * 100 > (uint64_t) get_bucket_count() * HashBucket::CAPACITY * this->split_load)
+        split();
+    this->stat->save();
+}
+
+// Split the bucket at the split pointer into itself and a new bucket at the end, telling their entries
+// apart by the next bit of the hash. Once every bucket of this round is split, the next round starts.
+void HashIndex::split() {
+    uint round_size = INITIAL_BUCKETS << this->stat->get_level();
+    uint bucket = this->stat->get_next_split();
+    vector<HashBucket*> old_pages, new_pages;
+    try {
+        read_chain(bucket, old_pages);
+        HashEntries stay, move;
+        for (auto page: old_pages)
+            for (auto const& entry: page->get_entries())
+                ((entry.hash & (2 * round_size - 1)) == bucket ? stay : move).push_back(entry);
+        new_pages.push_back(new HashBucket(this->file, 0, true));
+        if (new_pages[0]->get_id() != FIRST_BUCKET + bucket + round_size)
+            throw DbRelationError("hash index " + this->name + " has lost track of its buckets");
+        write_chain(old_pages, stay);
+        write_chain(new_pages, move);
+    } catch (...) {
+        for (auto page: old_pages)
+            delete page;
+        for (auto page: new_pages)
+            delete page;
+        throw;
+    }
+    for (auto page: old_pages)
+        delete page;
+    for (auto page: new_pages)
+        delete page;
+
+    if (bucket + 1 == round_size) {
+        this->stat->set_level(this->stat->get_level() + 1);
+        this->stat->set_next_split(0);
+    } else {
+        this->stat->set_next_split(bucket + 1);
+    }
+}
+
+/*
+ * DELETION
+ * */
+// Remove the entry for the given handle. Row must still be in the relation.
+void HashIndex::del(Handle handle) {
+    HashEntry old_entry = entry(handle);
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+    vector<HashBucket*> pages;
+    try {
+        read_chain(bucket_of(old_entry.hash), pages);
+        size_t i = 0;
+        while (i < pages.size() && !pages[i]->remove(old_entry.key, handle))
+            i++;
+        if (i == pages.size())
+            throw DbRelationError("row is not in index " + this->name);
+        if (i > 0 && pages[i]->get_entries().empty()) {
+            // unlink the emptied overflow page
+            pages[i - 1]->set_next(pages[i]->get_next());
+            pages[i - 1]->save();
+            free_overflow(pages[i]);
+        } else {
+            pages[i]->save();
+        }
+    } catch (...) {
+        for (auto page: pages)
+            delete page;
+        throw;
+    }
+    for (auto page: pages)
+        delete page;
+    this->stat->set_bytes(this->stat->get_bytes() - old_entry.size());
+    this->stat->save();
+}
+
+/*
+ * BUCKETS
+ * */
+// FNV-1a: cheap, and the same in every build, which matters since bucket numbers are on disk.
+HashCode HashIndex::hash(const NormalizedKey& key) {
+    HashCode code = 2166136261U;
+    for (unsigned char byte: key) {
+        code ^= byte;
+        code *= 16777619U;
+    }
+    return code;
+}
+
+uint HashIndex::get_bucket_count() const {
+    return (INITIAL_BUCKETS << this->stat->get_level()) + this->stat->get_next_split();
+}
+
+// Buckets already split this round are addressed with one more bit of the hash.
+uint HashIndex::bucket_of(HashCode hash) const {
+    uint round_size = INITIAL_BUCKETS << this->stat->get_level();
+    uint bucket = hash & (round_size - 1);
+    if (bucket < this->stat->get_next_split())
+        bucket = hash & (2 * round_size - 1);
+    return bucket;
+}
+
+// Read every page of a bucket, primary page first. The caller deletes them.
+void HashIndex::read_chain(uint bucket, vector<HashBucket*>& pages) const {
+    pages.push_back(new HashBucket(this->file, FIRST_BUCKET + bucket, false));
+    while (pages.back()->get_next() != 0)
+        pages.push_back(new HashBucket(this->overflow, pages.back()->get_next(), false));
+}
+
+// Replace the contents of a bucket's pages with entries, packing them from the primary page on.
+// Adds overflow pages as needed and frees (and drops from pages) any left over.
+void HashIndex::write_chain(vector<HashBucket*>& pages, const HashEntries& entries) {
+    for (auto page: pages)
+        page->clear();
+    size_t last = 0;
+    for (auto const& entry: entries) {
+        if (!pages[last]->has_room_for(entry)) {
+            last++;
+            if (last == pages.size())
+                pages.push_back(new_overflow());
+        }
+        pages[last]->add(entry);
+    }
+    while (pages.size() > last + 1) {
+        free_overflow(pages.back());
+        delete pages.back();
+        pages.pop_back();
+    }
+    for (size_t i = 0; i < pages.size(); i++) {
+        pages[i]->set_next(i + 1 < pages.size() ? pages[i + 1]->get_id() : 0);
+        pages[i]->save();
+    }
+}
+
+// Get an empty overflow page, reusing a freed one if there is one. Caller saves the stat block.
+HashBucket *HashIndex::new_overflow() {
+    BlockID free_id = this->stat->get_free_overflow();
+    if (free_id == 0)
+        return new HashBucket(this->overflow, 0, true);
+    HashBucket *page = new HashBucket(this->overflow, free_id, false);
+    this->stat->set_free_overflow(page->get_next());
+    page->clear();
+    page->set_next(0);
+    return page;
+}
+
+// Put an overflow page (no longer in any chain) on the free list. Caller saves the stat block.
+void HashIndex::free_overflow(HashBucket *page) {
+    page->clear();
+    page->set_next(this->stat->get_free_overflow());
+    page->save();
+    this->stat->set_free_overflow(page->get_id());
+}
+
+NormalizedKey HashIndex::normalized_key(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const& col: this->key_columns)
+        key_value.push_back(key->at(col));
+    return KeyEncoding::encode(key_value, this->key_profile);
+}
+
+// The entry for a row of the relation.
+HashEntry HashIndex::entry(Handle handle) const {
+    ValueDict* row = this->relation.project(handle, &this->key_columns);
+    NormalizedKey key = this->normalized_key(row);
+    delete row;
+    if (key.size() > HashBucket::MAX_KEY_SIZE)
+        throw DbRelationError("key is too long for index " + this->name);
+    return HashEntry(hash(key), handle, key);
+}
+
+
+//HASH INDEX TESTING
+bool test_hash_index() {
+    ColumnNames column_names;
+    column_names.push_back("a");
+    column_names.push_back("b");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("test_hash", column_names, column_attributes);
+    table.create();
+
+    // a repeats every 500 rows, b is unique
+    Handles handles;
+    ValueDict row;
+    for (uint i = 0; i < 1000; i++) {
+        row["a"] = Value(i % 500);
+        row["b"] = Value(i);
+        handles.push_back(table.insert(&row));
+    }
+    ColumnNames key_a, key_b;
+    key_a.push_back("a");
+    key_b.push_back("b");
+    HashIndex* by_a = new HashIndex(table, "test_hash_a", key_a, false);
+    HashIndex* by_b = new HashIndex(table, "test_hash_b", key_b, true);
+    by_a->create();
+    by_b->create();
+    uint built_buckets = by_b->get_bucket_count();
+
+    //t1 inserts after the build: splits a bucket at a time and chains overflow pages
+    for (uint i = 1000; i < 6000; i++) {
+        row["a"] = Value(i % 500);
+        row["b"] = Value(i);
+        handles.push_back(table.insert(&row));
+        by_a->insert(handles.back());
+        by_b->insert(handles.back());
+    }
+    bool result = by_b->get_bucket_count() > built_buckets;
+    ValueDict key;
+    for (uint i = 0; i < 6000 && result; i++) {
+        key["b"] = Value(i);
+        Handles* found = by_b->lookup(&key);
+        result = found->size() == 1 && found->at(0) == handles[i];
+        delete found;
+    }
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 duplicate keys in a non-unique index, and in a unique one
+    key.clear();
+    for (uint i = 0; i < 500 && result; i++) {
+        key["a"] = Value(i);
+        Handles* found = by_a->lookup(&key);
+        result = found->size() == 12;
+        delete found;
+    }
+    try {
+        by_b->insert(handles[7]);
+        result = false;
+    } catch (DbRelationError& e) {
+        // expected
+    }
+    key["a"] = Value(-1);
+    Handles* found = by_a->lookup(&key);
+    result = result && found->empty();
+    delete found;
+    cout << (result ? "passed t2" : "failed t2") << endl;
+
+    //t3 deletes, emptying overflow pages, then reinserts reusing them
+    for (uint i = 0; i < 6000; i += 500)
+        by_a->del(handles[i]);
+    key["a"] = Value(0);
+    found = by_a->lookup(&key);
+    result = result && found->empty();
+    delete found;
+    for (uint i = 0; i < 6000; i += 500)
+        by_a->insert(handles[i]);
+    found = by_a->lookup(&key);
+    result = result && found->size() == 12;
+    delete found;
+    cout << (result ? "passed t3" : "failed t3") << endl;
+
+    //t4 reopen
+    delete by_b;
+    by_b = new HashIndex(table, "test_hash_b", key_b, true);
+    key.clear();
+    for (uint i = 0; i < 6000 && result; i += 7) {
+        key["b"] = Value(i);
+        found = by_b->lookup(&key);
+        result = found->size() == 1 && found->at(0) == handles[i];
+        delete found;
+    }
+    cout << (result ? "passed t4" : "failed t4") << endl;
+
+    //t5 batched lookups, several keys to a bucket, match one-at-a-time lookups
+    ValueDicts keys;
+    for (int i = -1; i < 500; i += 3) {
+        keys.push_back(new ValueDict());
+        (*keys.back())["a"] = Value(i);
+    }
+    HandlesList* found_many = by_a->lookup_many(keys);
+    for (size_t i = 0; i < keys.size() && result; i++) {
+        found = by_a->lookup(keys[i]);
+        result = *found == *found_many->at(i) && found->size() == (i == 0 ? 0U : 12U);
+        delete found;
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        delete keys[i];
+        delete found_many->at(i);
+    }
+    delete found_many;
+    cout << (result ? "passed t5" : "failed t5") << endl;
+
+    by_a->drop();
+    by_b->drop();
+    delete by_a;
+    delete by_b;
+    table.drop();
+    return result;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <mutex>
+#include "HashBucket.h"
+
+/**
+ * @class HashIndex - disk-based hash index using linear hashing
+ *
+ * Bucket b's primary page is block b + FIRST_BUCKET of the index file, so a probe goes straight to
+ * it; pages that overflow are chained off it from a second file. Buckets are split one at a time, in
+ * order, whenever the entries would fill more than split_load percent of the primary pages, so the
+ * index grows a bucket per split instead of rehashing everything at once.
+ */
+class HashIndex : public DbIndex {
+public:
+    HashIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+    virtual ~HashIndex();
+
+    virtual void create();
+    virtual void drop();
+
+    virtual void open();
+    virtual void close();
+
+    virtual Handles* lookup(ValueDict* key) const;
+    virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+    virtual HandlesList* lookup_many(const ValueDicts& keys) const;  // one read of each bucket's chain
+
+    virtual void insert(Handle handle);
+    virtual void del(Handle handle);
+
+    static HashCode hash(const NormalizedKey& key);
+
+    static const uint INITIAL_BUCKETS = 4;  // must be a power of two
+    static const uint DEFAULT_SPLIT_LOAD = 75;
+    void set_split_load(uint split_load) { this->split_load = split_load; }
+    uint get_bucket_count() const;
+
+protected:
+    static const BlockID STAT = 1;
+    static const BlockID FIRST_BUCKET = STAT + 1;
+    mutable bool closed;
+    mutable HashStat *stat;
+    mutable HeapFile file;
+    mutable HeapFile overflow;
+    KeyProfile key_profile;
+    uint split_load;
+    mutable std::mutex mutex;  // one operation at a time
+
+    void open_if_closed() const;
+    NormalizedKey normalized_key(const ValueDict *key) const;
+    HashEntry entry(Handle handle) const;
+    uint bucket_of(HashCode hash) const;
+    void read_chain(uint bucket, std::vector<HashBucket*>& pages) const;
+    void write_chain(std::vector<HashBucket*>& pages, const HashEntries& entries);
+    HashBucket *new_overflow();
+    void free_overflow(HashBucket *page);
+    void split();
+    void build();
+};
+
+bool test_hash_index();
@@ -10,6 +10,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
+#include <algorithm>
+#include <limits>
 #include "heap_storage.h"
 using namespace std;
 
@@ -25,6 +27,12 @@ SlottedPage::SlottedPage(Dbt &block, BlockID block_id, bool is_new) : DbBlock(bl
 	}
 }
 
+// Release the block's memory if it was handed to us by HeapFile::get.
+SlottedPage::~SlottedPage() {
+	if (this->block.get_flags() & DB_DBT_MALLOC)
+		free(this->block.get_data());
+}
+
 // Add a new record to the block. Return its id.
 RecordID SlottedPage::add(const Dbt* data) throw(DbBlockNoRoomError) {
 	if (!has_room((u16)data->get_size()))
@@ -107,6 +115,20 @@ u16 SlottedPage::size() const {
     return count;
 }
 
+// True if the slot headers and every record lie within the block. A copy of a block taken while
+// another thread was writing it may not be; this is what such a reader checks before using the offsets.
+bool SlottedPage::is_sound() const {
+	if (this->end_free >= DbBlock::BLOCK_SZ || 4U * (this->num_records + 1) > this->end_free + 1U)
+		return false;
+	u16 size, loc;
+	for (RecordID record_id = 1; record_id <= this->num_records; record_id++) {
+		get_header(size, loc, record_id);
+		if (loc != 0 && (loc <= this->end_free || (uint) loc + size > DbBlock::BLOCK_SZ))
+			return false;
+	}
+	return true;
+}
+
 // Get the size and offset for given id. For id of zero, it is the block header.
 void SlottedPage::get_header(u16 &size, u16 &loc, RecordID id) const {
 	size = get_n((u16) 4*id);
@@ -126,8 +148,8 @@ void SlottedPage::put_header(RecordID id, u16 size, u16 loc) {
 // Calculate if we have room to store a record with given size. The size should include the 4 bytes
 // for the header, too, if this is an add.
 bool SlottedPage::has_room(u16 size) const {
-	u16 available = this->end_free - (u16)(4*(this->num_records+2));
-	return size <= available;
+	int available = (int)this->end_free - 4*(this->num_records+2);  // signed: a full block must not wrap around
+	return available >= 0 && size <= available;
 }
 
 // If start < end, then remove data from offset start up to but not including offset end by sliding data
@@ -221,21 +243,25 @@ SlottedPage* HeapFile::get_new(void) {
 	memset(block, 0, sizeof(block));
 	Dbt data(block, sizeof(block));
 
+	std::unique_lock<std::mutex> guard(this->new_block_mutex);
 	int block_id = ++this->last;
+	guard.unlock();
 	Dbt key(&block_id, sizeof(block_id));
 
-	// write out an empty block and read it back in so Berkeley DB is managing the memory
-	SlottedPage* page = new SlottedPage(data, this->last, true);
+	// write out an empty block and read it back in so the new block has its own copy of the memory
+	SlottedPage* page = new SlottedPage(data, block_id, true);
 	this->db.put(nullptr, &key, &data, 0); // write it out with initialization done to it
 	delete page;
-	this->db.get(nullptr, &key, &data, 0);
-	return new SlottedPage(data, this->last);
+	return get(block_id);
 }
 
 // Get a block from the database file.
+// The block gets its own copy of the data (freed by ~SlottedPage), so any number of blocks from
+// the same file can be held at once.
 SlottedPage* HeapFile::get(BlockID block_id) {
 	Dbt key(&block_id, sizeof(block_id));
 	Dbt data;
+	data.set_flags(DB_DBT_MALLOC);
 	this->db.get(nullptr, &key, &data, 0);
 	return new SlottedPage(data, block_id, false);
 }
@@ -266,7 +292,8 @@ void HeapFile::db_open(uint flags) {
     if (!this->closed)
         return;
     this->db.set_re_len(DbBlock::BLOCK_SZ); // record length - will be ignored if file already exists
-    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags, 0644);
+    // free-threaded handle, shared by the threads of an index build or merge (see the env flags in sql5300)
+    this->db.open(nullptr, this->dbfilename.c_str(), nullptr, DB_RECNO, flags | DB_THREAD, 0644);
 
 	this->last = flags ? 0 : get_block_count();
     this->closed = false;
@@ -355,13 +382,23 @@ Handles* HeapTable::select() {
 // Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
 // Returns a list of handles for qualifying rows.
 Handles* HeapTable::select(const ValueDict* where) {
+	return select(where, numeric_limits<size_t>::max());
+}
+
+// Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where> LIMIT <limit>
+// The blocks are read in order, and no more of them once limit rows qualify.
+Handles* HeapTable::select(const ValueDict* where, size_t limit) {
 	open();
 	Handles* handles = new Handles();
 	BlockIDs* block_ids = file.block_ids();
     for (auto const& block_id: *block_ids) {
+    	if (handles->size() >= limit)
+    		break;
     	SlottedPage* block = file.get(block_id);
     	RecordIDs* record_ids = block->ids();
     	for (auto const& record_id: *record_ids) {
+			if (handles->size() >= limit)
+				break;
 			Handle handle(block_id, record_id);
 			if (selected(handle, where))
     			handles->push_back(handle);
@@ -408,6 +445,111 @@ ValueDict* HeapTable::project(Handle handle, const ColumnNames* column_names) {
     return result;
 }
 
+// Keep the block in hand as long as the handles stay in it.
+ValueDicts* HeapTable::project(Handles* handles, const ColumnNames* column_names) {
+	open();
+	ValueDicts* rows = new ValueDicts();
+	SlottedPage* block = nullptr;
+	for (auto const& handle: *handles) {
+		if (block == nullptr || block->get_block_id() != handle.first) {
+			delete block;
+			block = file.get(handle.first);
+		}
+		Dbt* data = block->get(handle.second);
+		ValueDict* row = unmarshal(data);
+		delete data;
+		if (!column_names->empty()) {
+			ValueDict* projected = new ValueDict();
+			for (auto const& column_name: *column_names) {
+				if (row->find(column_name) == row->end()) {
+					delete row;
+					delete block;
+					throw DbRelationError("table does not have column named '" + column_name + "'");
+				}
+				(*projected)[column_name] = (*row)[column_name];
+			}
+			delete row;
+			row = projected;
+		}
+		rows->push_back(row);
+	}
+	delete block;
+	return rows;
+}
+
+BlockID HeapTable::get_block_count() {
+	open();
+	return this->file.get_last_block_id();
+}
+
+// Unmarshal each record of the block range directly from its block (no per-row block fetch).
+ValueDicts* HeapTable::scan(BlockID first, BlockID last, const ColumnNames* column_names, Handles& handles) {
+	open();
+	// every row has every column, so one check up front covers them all (and nothing is left to free)
+	for (auto const& column_name: *column_names)
+		if (find(this->column_names.begin(), this->column_names.end(), column_name) == this->column_names.end())
+			throw DbRelationError("table does not have column named '" + column_name + "'");
+	ValueDicts* rows = new ValueDicts();
+	for (BlockID block_id = first; block_id <= last && block_id <= this->file.get_last_block_id(); block_id++) {
+		SlottedPage* block = file.get(block_id);
+		RecordIDs* record_ids = block->ids();
+		for (auto const& record_id: *record_ids) {
+			Dbt* data = block->get(record_id);
+			ValueDict* row = unmarshal(data);
+			delete data;
+			if (!column_names->empty()) {
+				ValueDict* projected = new ValueDict();
+				for (auto const& column_name: *column_names)
+					(*projected)[column_name] = (*row)[column_name];
+				delete row;
+				row = projected;
+			}
+			handles.push_back(Handle(block_id, record_id));
+			rows->push_back(row);
+		}
+		delete record_ids;
+		delete block;
+	}
+	return rows;
+}
+
+int HeapTable::scan_columns(BlockID block_id, size_t room, std::vector<std::vector<int32_t>>& ints,
+                            std::vector<std::vector<std::string>>& texts) {
+	open();
+	SlottedPage* block = file.get(block_id);
+	RecordIDs* record_ids = block->ids();
+	int count = record_ids->size() <= room ? (int) record_ids->size() : -1;
+	for (size_t i = 0; count > 0 && i < record_ids->size(); i++) {
+		Dbt* data = block->get(record_ids->at(i));
+		const char* bytes = (const char*) data->get_data();
+		uint offset = 0;
+		for (size_t col_num = 0; col_num < this->column_attributes.size(); col_num++) {
+			ColumnAttribute::DataType data_type = this->column_attributes[col_num].get_data_type();
+			if (data_type == ColumnAttribute::DataType::INT) {
+				ints[col_num].push_back(*(const int32_t*)(bytes + offset));
+				offset += sizeof(int32_t);
+			} else if (data_type == ColumnAttribute::DataType::TEXT) {
+				u16 size = *(const u16*)(bytes + offset);
+				offset += sizeof(u16);
+				texts[col_num].emplace_back(bytes + offset, size);
+				offset += size;
+			} else if (data_type == ColumnAttribute::DataType::BOOLEAN) {
+				ints[col_num].push_back(*(const uint8_t*)(bytes + offset));
+				offset += sizeof(uint8_t);
+			} else {
+				delete data;
+				delete record_ids;
+				delete block;
+				throw DbRelationError("Only know how to unmarshal INT, TEXT, and BOOLEAN");
+			}
+		}
+		delete data;
+	}
+	delete record_ids;
+	delete block;
+	return count;
+}
+
 // Check if the given row is acceptable to insert. Raise ValueError if not.
 // Otherwise return the full row dictionary.
 ValueDict* HeapTable::validate(const ValueDict* row) const {
@@ -433,6 +575,7 @@ Handle HeapTable::append(const ValueDict* row) {
         record_id = block->add(data);
     } catch (DbBlockNoRoomError& e) {
     	// need a new block
+    	delete block;
     	block = this->file.get_new();
     	record_id = block->add(data);
     }
@@ -521,7 +664,9 @@ bool HeapTable::selected(Handle handle, const ValueDict* where) {
 	if (where == nullptr)
 		return true;
 	ValueDict* row = this->project(handle, where);
-	return *row == *where;
+	bool is_selected = *row == *where;
+	delete row;
+	return is_selected;
 }
 
 void test_set_row(ValueDict &row, int a, string b) {
@@ -607,7 +752,34 @@ bool test_heap_storage() {
         if (!test_compare(table, handle, i++, b))
             return false;
     cout << "del ok" << endl;
- 
+	delete handles;
+
+    ValueDict where;
+    where["b"] = Value(b);
+    handles = table.select(&where, 50);
+    if (handles->size() != 50)
+        return false;
+    i = -1;
+    for (auto const& handle: *handles)
+        if (!test_compare(table, handle, i++, b))
+            return false;
+    delete handles;
+    handles = table.select(&where, 0);
+    if (!handles->empty())
+        return false;
+    cout << "select with limit ok" << endl;
+
+    Handles scanned;
+    ColumnNames missing = {"a", "z"};
+    try {
+        delete table.scan(1, table.get_block_count(), &missing, scanned);
+        return false;
+    } catch (DbRelationError&) {
+    }
+    if (!scanned.empty())
+        return false;
+    cout << "scan of a missing column ok" << endl;
+
     table.drop();
 	delete handles;
     return true;
@@ -9,6 +9,7 @@
  */
 #pragma once
 
+#include <mutex>
 #include "db_cxx.h"
 #include "storage_engine.h"
 
@@ -32,7 +33,7 @@ public:
 	SlottedPage(Dbt &block, BlockID block_id, bool is_new=false);
 	// Big 5 - we only need the destructor, copy-ctor, move-ctor, and op= are unnecessary
 	// but we delete them explicitly just to make sure we don't use them accidentally
-	virtual ~SlottedPage() {}
+	virtual ~SlottedPage();
 	SlottedPage(const SlottedPage& other) = delete;
 	SlottedPage(SlottedPage&& temp) = delete;
 	SlottedPage& operator=(const SlottedPage& other) = delete;
@@ -45,6 +46,7 @@ public:
 	virtual RecordIDs* ids(void) const;
 	virtual void clear();
 	virtual u_int16_t size() const;
+	virtual bool is_sound() const;
 
 protected:
 	uint16_t num_records;
@@ -96,6 +98,7 @@ protected:
 	uint32_t last;
 	bool closed;
 	Db db;
+	std::mutex new_block_mutex;  // serializes get_new so threads sharing the file don't claim the same block
 	virtual void db_open(uint flags=0);
 	virtual uint32_t get_block_count();
 };
@@ -126,11 +129,43 @@ public:
 
 	virtual Handles* select();
 	virtual Handles* select(const ValueDict* where);
+	virtual Handles* select(const ValueDict* where, size_t limit);
 	virtual Handles* select(Handles *current_selection, const ValueDict* where);
 	virtual ValueDict* project(Handle handle);
 	virtual ValueDict* project(Handle handle, const ColumnNames* column_names);
+
+	/**
+	 * Project each of the handles, reading a block once for any run of handles in it (so handles
+	 * sorted by block are fetched a block at a time).
+	 * @returns  the projected rows (freed by caller), in the order of handles
+	 */
+	virtual ValueDicts* project(Handles* handles, const ColumnNames* column_names);
 	using DbRelation::project;
 
+	/**
+	 * Number of blocks in the table's file, so a scan can be split into block ranges.
+	 * @returns  id of the last block (blocks are numbered from 1)
+	 */
+	virtual BlockID get_block_count();
+
+	/**
+	 * Read every row in blocks first through last (inclusive), projecting each onto column_names
+	 * while its block is in hand.
+	 * @param handles  returned by reference: the handle of each row, in the same order as the rows
+	 * @returns        the projected rows (freed by caller)
+	 */
+	virtual ValueDicts* scan(BlockID first, BlockID last, const ColumnNames* column_names, Handles& handles);
+
+	/**
+	 * Decode the rows of a block straight into one array per column (as an EvalBatch holds them), with
+	 * no ValueDict built on the way: the i-th column's values are appended to ints[i] if it is INT or
+	 * BOOLEAN, to texts[i] if it is TEXT.
+	 * @param room  most rows to take: if the block has more, nothing is decoded
+	 * @returns     the number of rows decoded, or -1 if there was no room for them
+	 */
+	virtual int scan_columns(BlockID block_id, size_t room, std::vector<std::vector<int32_t>>& ints,
+	                         std::vector<std::vector<std::string>>& texts);
+
 protected:
 	HeapFile file;
 	virtual ValueDict* validate(const ValueDict* row) const;
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <set>
+#include "heap_storage.h"
+#include "LearnedModel.h"
+
+/**
+ * @class LearnedIndex - index on one INT column that learns where each key is instead of searching for it
+ *
+ * The entries are kept sorted by key in fixed-size pages, so an entry's position says which page it is
+ * on. A LearnedModel fitted to the keys while they are written predicts a key's position to within its
+ * error; a probe reads the page (or two) around the prediction and binary searches just that window.
+ * For ids or timestamps the model is a handful of segments, where a BTreeIndex would read a block per
+ * level of the tree.
+ *
+ * Inserts and deletes go to a delta buffer in memory--the new entries, and the handles of deleted
+ * entries still in the pages--that probes merge in. Once the buffer is past a fraction of the entries,
+ * the entries are rewritten with the buffer applied and the model refitted.
+ *
+ * Block 1 of the index file is a header (clean flag, entry count, data block count, segment count), then
+ * the data blocks, then the segments. The first change after a rewrite marks the header dirty, and
+ * close() rewrites; opening a dirty index rebuilds it from the relation, since the buffer was lost.
+ */
+class LearnedIndex : public DbIndex {
+public:
+    LearnedIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+    virtual ~LearnedIndex() {}
+
+    virtual void create();
+    virtual void drop();
+
+    virtual void open();
+    virtual void close();
+
+    virtual Handles* lookup(ValueDict* key) const;
+    virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+    virtual bool has_range() const { return true; }
+    virtual bool range_in_order() const { return true; }
+
+    virtual void insert(Handle handle);
+    virtual void del(Handle handle);
+
+    size_t segment_count() const;  // how big the model is
+
+    static const uint MIN_DELTA = 1024;  // the buffer is rewritten once past this or entries / DELTA_FRACTION
+    static const uint DELTA_FRACTION = 8;
+    void set_min_delta(uint min_delta) { this->min_delta = min_delta; }
+
+protected:
+    static const BlockID HEADER = 1;
+    static const uint ENTRY_SZ = sizeof(int32_t) + sizeof(BlockID) + sizeof(RecordID);
+    static const uint SEGMENT_SZ = sizeof(int32_t) + sizeof(uint32_t) + sizeof(double);
+    static const uint ENTRIES_PER_PAGE = (DbBlock::BLOCK_SZ - 9) / ENTRY_SZ;  // one record per page
+    static const uint SEGMENTS_PER_PAGE = (DbBlock::BLOCK_SZ - 9) / SEGMENT_SZ;
+
+    typedef std::map<size_t, LearnedEntries> PageCache;  // page index -> its entries, for one probe
+
+    mutable bool closed;
+    mutable bool clean;  // the pages hold every entry
+    mutable HeapFile file;
+    Identifier key_column;
+    uint min_delta;
+    mutable LearnedModel model;
+    mutable uint32_t data_blocks;
+    mutable std::multimap<int32_t, Handle> inserted;  // delta buffer: entries not in the pages
+    mutable std::set<Handle> deleted;  // delta buffer: entries in the pages that are gone
+    mutable std::mutex mutex;  // one operation at a time
+
+    void open_if_closed() const;
+    void load() const;
+    void rebuild() const;
+    void rewrite() const;
+    void write(const LearnedEntries& entries) const;
+    void write_header() const;
+    void make_dirty();
+    const LearnedEntries& page(size_t page_index, PageCache& cache) const;
+    int32_t key_at(size_t position, PageCache& cache) const;
+    size_t lower_bound(int32_t key, PageCache& cache) const;
+    void scan(const int32_t* min, const int32_t* max, LearnedEntries& found) const;
+    int32_t row_key(Handle handle) const;
+};
+
+bool test_learned_index();
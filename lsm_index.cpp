@@ -0,0 +1,607 @@
+#include <algorithm>
+#include <iostream>
+#include "lsm_index.h"
+
+using namespace std;
+
+const uint LsmIndex::MAX_RUNS;
+const uint LsmIndex::MAX_FROZEN;
+
+LsmIndex::LsmIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique)
+        : DbIndex(relation, name, key_columns, unique),
+          closed(true),
+          clean(false),
+          file(relation.get_table_name() + "-" + name),
+          key_profile(),
+          memtable_entries(DEFAULT_MEMTABLE_ENTRIES),
+          memtable(nullptr),
+          frozen(),
+          runs(),
+          free_head(0),
+          mutex(),
+          free_mutex(),
+          work(),
+          done(),
+          merger(),
+          stopping(false),
+          busy(false),
+          concurrent(false),
+          error() {
+    // enforcing a unique key would take a probe of every run on each insert, which is what this index avoids
+    if (unique)
+        throw DbRelationError("LSM index cannot have a unique key");
+    ColumnAttributes* column_attributes = this->relation.get_column_attributes(this->key_columns);
+    for (ColumnAttribute col: *column_attributes)
+        this->key_profile.push_back(col.get_data_type());
+    delete column_attributes;
+}
+
+LsmIndex::~LsmIndex() {
+    stop_merger();
+    delete this->memtable;
+    for (auto table: this->frozen)
+        delete table;
+}
+
+// Create the index: every row of the relation goes straight into one run.
+void LsmIndex::create() {
+    lock_guard<std::mutex> guard(this->mutex);
+    this->file.create();
+    rebuild();
+    this->memtable = new LsmMemtable();
+    this->closed = false;
+    start_merger();
+}
+
+// Drop the index.
+void LsmIndex::drop() {
+    stop_merger();
+    lock_guard<std::mutex> guard(this->mutex);
+    this->file.drop();
+    delete this->memtable;
+    this->memtable = nullptr;
+    for (auto table: this->frozen)
+        delete table;
+    this->frozen.clear();
+    this->runs.clear();
+    this->clean = false;
+    this->closed = true;
+}
+
+// Open existing index. Enables: lookup, range, insert, delete.
+void LsmIndex::open() {
+    lock_guard<std::mutex> guard(this->mutex);
+    open_if_closed();
+}
+
+// Closes the index after writing out everything in memory. Disables: lookup, range, insert, delete.
+void LsmIndex::close() {
+    {
+        unique_lock<std::mutex> lock(this->mutex);
+        if (this->closed)
+            return;
+        flush(lock);
+    }
+    stop_merger();
+    lock_guard<std::mutex> guard(this->mutex);
+    this->file.close();
+    delete this->memtable;
+    this->memtable = nullptr;
+    this->runs.clear();
+    this->closed = true;
+}
+
+void LsmIndex::flush() {
+    unique_lock<std::mutex> lock(this->mutex);
+    open_if_closed();
+    flush(lock);
+}
+
+// Freeze the memtable, then wait until the merger has written out every frozen memtable and merged the
+// runs down to MAX_RUNS, and mark the directory clean.
+void LsmIndex::flush(unique_lock<std::mutex>& lock) {
+    if (!this->memtable->empty()) {
+        this->frozen.push_back(this->memtable);
+        this->memtable = new LsmMemtable();
+        this->work.notify_one();
+    }
+    this->done.wait(lock, [this]() {
+        return this->error || (!this->busy && this->frozen.empty() && this->runs.size() <= MAX_RUNS);
+    });
+    if (this->error)
+        rethrow_exception(this->error);
+    if (!this->clean) {
+        this->clean = true;
+        save_directory();
+    }
+}
+
+// Index operations open the index themselves, since an index found in _indices is never created here.
+void LsmIndex::open_if_closed() const {
+    if (!this->closed)
+        return;
+    this->file.open();
+    load_directory();
+    if (!this->clean)
+        rebuild();
+    this->memtable = new LsmMemtable();
+    this->closed = false;
+    start_merger();
+}
+
+void LsmIndex::load_directory() const {
+    this->clean = false;
+    this->runs.clear();
+    SlottedPage* page = this->file.get(DIRECTORY);
+    RecordIDs* record_ids = page->ids();
+    for (auto const& record_id: *record_ids) {
+        Dbt* dbt = page->get(record_id);
+        const uint32_t* fields = (const uint32_t*) dbt->get_data();
+        if (record_id == 1) {
+            this->clean = fields[0] != 0;
+            this->free_head = fields[1];
+        } else {
+            this->runs.push_back(LsmRun::load(this->file, fields[0], fields[2]));
+        }
+        delete dbt;
+    }
+    delete record_ids;
+    delete page;
+}
+
+// Directory: clean flag, free list head and run count, then per run (oldest first) its first page,
+// page count and entry count.
+void LsmIndex::save_directory() const {
+    SlottedPage* page = this->file.get(DIRECTORY);
+    page->clear();
+    uint32_t header[3] = {this->clean ? 1U : 0U, 0, (uint32_t) this->runs.size()};
+    {
+        lock_guard<std::mutex> guard(this->free_mutex);
+        header[1] = this->free_head;
+    }
+    Dbt header_dbt(header, sizeof(header));
+    page->add(&header_dbt);
+    for (auto const& run: this->runs) {
+        uint32_t fields[3] = {run.pages.front(), (uint32_t) run.pages.size(), run.entries};
+        Dbt dbt(fields, sizeof(fields));
+        page->add(&dbt);
+    }
+    this->file.put(page);
+    delete page;
+}
+
+// Start over from the relation: every page but the directory goes back on the free list (a dirty
+// directory may not account for them all) and the rows are written as a single run.
+void LsmIndex::rebuild() const {
+    this->runs.clear();
+    this->free_head = 0;
+    for (BlockID block_id = this->file.get_last_block_id(); block_id > DIRECTORY; block_id--)
+        free_page(block_id);
+
+    LsmMemtable table;
+    Handles* handles = this->relation.select();
+    for (auto const& handle: *handles)
+        table[LsmEntry::make(row_key(handle), handle)] = true;
+    delete handles;
+    this->runs.push_back(write_run(table));
+    this->clean = true;
+    save_directory();
+}
+
+/*
+ * MERGER
+ * */
+void LsmIndex::start_merger() const {
+    u_int32_t flags = 0;
+    _DB_ENV->get_open_flags(&flags);
+    this->concurrent = (flags & (DB_INIT_CDB | DB_INIT_LOCK)) != 0;
+    this->stopping = false;
+    this->merger = thread(&LsmIndex::merge_loop, const_cast<LsmIndex*>(this));
+}
+
+// Must not be called holding mutex.
+void LsmIndex::stop_merger() const {
+    {
+        lock_guard<std::mutex> guard(this->mutex);
+        this->stopping = true;
+    }
+    this->work.notify_all();
+    if (this->merger.joinable())
+        this->merger.join();
+}
+
+// The background thread: write out the oldest frozen memtable, or if there are none, merge the runs once
+// there are too many. The slow part of each is done without holding mutex, so probes and inserts carry
+// on meanwhile; this is safe since frozen memtables and runs never change once made, and only this
+// thread retires them. It also has the merger writing the file while probes read it, which Berkeley DB
+// only allows in an environment opened with DB_INIT_CDB or DB_INIT_LOCK; otherwise mutex stays held.
+void LsmIndex::merge_loop() {
+    unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->work.wait(lock, [this]() {
+            return this->stopping || !this->frozen.empty() || this->runs.size() > MAX_RUNS;
+        });
+        if (this->stopping)
+            return;
+        this->busy = true;
+        try {
+            if (!this->frozen.empty()) {
+                const LsmMemtable* table = this->frozen.front();
+                if (this->concurrent)
+                    lock.unlock();
+                LsmRun run = write_run(*table);
+                if (!lock.owns_lock())
+                    lock.lock();
+                this->runs.push_back(run);
+                this->frozen.pop_front();
+                delete table;
+            } else {
+                vector<LsmRun> merging(this->runs);
+                if (this->concurrent)
+                    lock.unlock();
+                LsmRun merged = merge_runs(merging);
+                if (!lock.owns_lock())
+                    lock.lock();
+                this->runs.erase(this->runs.begin(), this->runs.begin() + merging.size());
+                this->runs.insert(this->runs.begin(), merged);
+                for (auto const& run: merging)
+                    for (auto const& page_id: run.pages)
+                        free_page(page_id);
+            }
+            save_directory();
+        } catch (...) {
+            if (!lock.owns_lock())
+                lock.lock();
+            this->error = current_exception();
+            this->busy = false;
+            this->done.notify_all();
+            return;
+        }
+        this->busy = false;
+        this->done.notify_all();
+    }
+}
+
+LsmRun LsmIndex::write_run(const LsmMemtable& table) const {
+    LsmRunWriter writer(this->file, [this]() { return this->allocate(); });
+    for (auto const& entry: table)
+        writer.add(entry.first, entry.second);
+    return writer.finish();
+}
+
+// K-way merge of the runs, where the newest run (last) wins when several have an entry. Since the
+// merge takes in every run back to the oldest, deleted entries have nothing left to hide and are dropped.
+LsmRun LsmIndex::merge_runs(const vector<LsmRun>& merging) const {
+    vector<LsmRunReader*> readers;
+    vector<LsmEntryKey> heads(merging.size());
+    vector<bool> lives(merging.size()), more(merging.size());
+    for (size_t i = 0; i < merging.size(); i++) {
+        readers.push_back(new LsmRunReader(this->file, merging[i]));
+        bool live;
+        more[i] = readers[i]->next(heads[i], live);
+        lives[i] = live;
+    }
+    LsmRunWriter writer(this->file, [this]() { return this->allocate(); });
+    try {
+        while (true) {
+            int newest = -1;
+            for (size_t i = 0; i < merging.size(); i++)
+                if (more[i] && (newest < 0 || heads[i] <= heads[newest]))
+                    newest = (int) i;
+            if (newest < 0)
+                break;
+            LsmEntryKey entry = heads[newest];
+            if (lives[newest])
+                writer.add(entry, true);
+            for (size_t i = 0; i < merging.size(); i++) {
+                if (more[i] && heads[i] == entry) {
+                    bool live;
+                    more[i] = readers[i]->next(heads[i], live);
+                    lives[i] = live;
+                }
+            }
+        }
+    } catch (...) {
+        for (auto reader: readers)
+            delete reader;
+        throw;
+    }
+    for (auto reader: readers)
+        delete reader;
+    return writer.finish();
+}
+
+// Take a page off the free list if there is one.
+SlottedPage* LsmIndex::allocate() const {
+    lock_guard<std::mutex> guard(this->free_mutex);
+    if (this->free_head == 0)
+        return this->file.get_new();
+    SlottedPage* page = this->file.get(this->free_head);
+    Dbt* dbt = page->get(1);
+    this->free_head = *(BlockID*) dbt->get_data();
+    delete dbt;
+    page->clear();
+    return page;
+}
+
+void LsmIndex::free_page(BlockID block_id) const {
+    lock_guard<std::mutex> guard(this->free_mutex);
+    SlottedPage* page = this->file.get(block_id);
+    page->clear();
+    Dbt dbt(&this->free_head, sizeof(BlockID));
+    page->add(&dbt);
+    this->file.put(page);
+    delete page;
+    this->free_head = block_id;
+}
+
+/*
+ * LOOKUP
+ * */
+Handles* LsmIndex::lookup(ValueDict* key) const {
+    NormalizedKey normalized = normalized_key(key);
+    return scan(&normalized, &normalized);
+}
+
+Handles* LsmIndex::range(ValueDict* min_key, ValueDict* max_key) const {
+    NormalizedKey min_normalized, max_normalized;
+    if (min_key != nullptr)
+        min_normalized = normalized_key(min_key);
+    if (max_key != nullptr)
+        max_normalized = normalized_key(max_key);
+    return scan(min_key == nullptr ? nullptr : &min_normalized, max_key == nullptr ? nullptr : &max_normalized);
+}
+
+// Rows with keys from min to max inclusive (either may be nullptr for no bound), in key order. The
+// memtable, frozen memtables and runs are visited newest first, and the first version of an entry seen
+// is the one that counts.
+Handles* LsmIndex::scan(const NormalizedKey* min, const NormalizedKey* max) const {
+    LsmMemtable newest;
+    auto in_memory = [&newest, min, max](const LsmMemtable& table) {
+        auto it = min == nullptr ? table.begin() : table.lower_bound(*min);
+        for (; it != table.end(); it++) {
+            if (max != nullptr && LsmEntry::key(it->first) > *max)
+                break;
+            newest.insert(*it);
+        }
+    };
+    {
+        lock_guard<std::mutex> guard(this->mutex);
+        open_if_closed();
+        in_memory(*this->memtable);
+        for (auto it = this->frozen.rbegin(); it != this->frozen.rend(); it++)
+            in_memory(**it);
+        for (auto run = this->runs.rbegin(); run != this->runs.rend(); run++) {
+            LsmRunReader reader(this->file, *run, min == nullptr ? 0 : run->first_page(*min));
+            LsmEntryKey entry;
+            bool live;
+            while (reader.next(entry, live)) {
+                NormalizedKey key = LsmEntry::key(entry);
+                if (min != nullptr && key < *min)
+                    continue;
+                if (max != nullptr && key > *max)
+                    break;
+                newest.insert(make_pair(entry, live));
+            }
+        }
+    }
+    Handles* ret = new Handles();
+    for (auto const& entry: newest)
+        if (entry.second)
+            ret->push_back(LsmEntry::handle(entry.first));
+    return ret;
+}
+
+// The keys are taken in order, so each run is read in one forward pass that jumps ahead (by its fences)
+// only to pages that can hold a wanted key. As in scan, the newest version of an entry counts.
+HandlesList* LsmIndex::lookup_many(const ValueDicts& keys) const {
+    map<NormalizedKey, vector<size_t>> wanted;  // key -> where it is in keys
+    for (size_t i = 0; i < keys.size(); i++)
+        wanted[normalized_key(keys[i])].push_back(i);
+    LsmMemtable newest;
+    {
+        lock_guard<std::mutex> guard(this->mutex);
+        open_if_closed();
+        vector<const LsmMemtable*> tables(1, this->memtable);
+        tables.insert(tables.end(), this->frozen.rbegin(), this->frozen.rend());
+        for (auto const table: tables)
+            for (auto const& key: wanted)
+                for (auto it = table->lower_bound(key.first); it != table->end() && LsmEntry::key(it->first) == key.first; it++)
+                    newest.insert(*it);
+        for (auto run = this->runs.rbegin(); run != this->runs.rend(); run++) {
+            LsmRunReader reader(this->file, *run);
+            LsmEntryKey entry;
+            bool live = false, more = false;
+            for (auto const& key: wanted) {
+                if (reader.skip_to(run->first_page(key.first)))
+                    more = reader.next(entry, live);
+                while (more && LsmEntry::key(entry) < key.first)
+                    more = reader.next(entry, live);
+                while (more && LsmEntry::key(entry) == key.first) {
+                    newest.insert(make_pair(entry, live));
+                    more = reader.next(entry, live);
+                }
+            }
+        }
+    }
+    HandlesList* ret = new HandlesList();
+    for (size_t i = 0; i < keys.size(); i++)
+        ret->push_back(new Handles());
+    for (auto const& entry: newest)
+        if (entry.second)
+            for (auto const i: wanted[LsmEntry::key(entry.first)])
+                (*ret)[i]->push_back(LsmEntry::handle(entry.first));
+    return ret;
+}
+
+/*
+ * INSERTION AND DELETION
+ * */
+// Insert a row with the given handle. Row must exist in relation already.
+void LsmIndex::insert(Handle handle) {
+    LsmEntryKey entry = LsmEntry::make(row_key(handle), handle);
+    unique_lock<std::mutex> lock(this->mutex);
+    open_if_closed();
+    add(entry, true, lock);
+}
+
+// Remove the row with the given handle. Row must still be in the relation. Since the entry may be in
+// any run, this only records a tombstone; the entry is dropped when the runs are next merged.
+void LsmIndex::del(Handle handle) {
+    LsmEntryKey entry = LsmEntry::make(row_key(handle), handle);
+    unique_lock<std::mutex> lock(this->mutex);
+    open_if_closed();
+    add(entry, false, lock);
+}
+
+// Put an entry in the memtable, marking the directory dirty if this is the first change since a flush,
+// and hand the memtable to the merger if it is full (waiting if the merger is too far behind).
+void LsmIndex::add(const LsmEntryKey& entry, bool live, unique_lock<std::mutex>& lock) {
+    if (this->error)
+        rethrow_exception(this->error);
+    if (this->clean) {
+        this->clean = false;
+        save_directory();
+    }
+    (*this->memtable)[entry] = live;
+    if (this->memtable->size() < this->memtable_entries)
+        return;
+    this->done.wait(lock, [this]() { return this->error || this->frozen.size() < MAX_FROZEN; });
+    if (this->error)
+        rethrow_exception(this->error);
+    this->frozen.push_back(this->memtable);
+    this->memtable = new LsmMemtable();
+    this->work.notify_one();
+}
+
+NormalizedKey LsmIndex::normalized_key(const ValueDict *key) const {
+    KeyValue key_value;
+    for (auto const& col: this->key_columns)
+        key_value.push_back(key->at(col));
+    return KeyEncoding::encode(key_value, this->key_profile);
+}
+
+NormalizedKey LsmIndex::row_key(Handle handle) const {
+    ValueDict* row = this->relation.project(handle, &this->key_columns);
+    NormalizedKey key = this->normalized_key(row);
+    delete row;
+    if (key.size() > MAX_KEY_SIZE)
+        throw DbRelationError("key is too long for index " + this->name);
+    return key;
+}
+
+
+//LSM INDEX TESTING
+bool test_lsm_index() {
+    ColumnNames column_names;
+    column_names.push_back("id");
+    column_names.push_back("grp");
+    ColumnAttributes column_attributes;
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    column_attributes.push_back(ColumnAttribute(ColumnAttribute::INT));
+    HeapTable table("test_lsm", column_names, column_attributes);
+    table.create();
+
+    // build from the first 1000 rows, then insert the rest through small memtables so there are
+    // plenty of runs to merge
+    ColumnNames id_key, grp_key;
+    id_key.push_back("id");
+    grp_key.push_back("grp");
+    LsmIndex* ids = new LsmIndex(table, "test_lsm_id", id_key, false);
+    LsmIndex* grps = new LsmIndex(table, "test_lsm_grp", grp_key, false);
+    ids->set_memtable_entries(100);
+    grps->set_memtable_entries(100);
+    Handles handles;
+    ValueDict row;
+    for (int i = 0; i < 4000; i++) {
+        if (i == 1000) {
+            ids->create();
+            grps->create();
+        }
+        row["id"] = Value(i);
+        row["grp"] = Value(i % 37);
+        handles.push_back(table.insert(&row));
+        if (i >= 1000) {
+            ids->insert(handles.back());
+            grps->insert(handles.back());
+        }
+    }
+
+    // expected answers, the slow way, against the rows still in the indices
+    vector<bool> present(4000, true);
+    auto expect = [&](bool (*wanted)(int)) {
+        Handles ret;
+        for (int i = 0; i < (int) handles.size(); i++)
+            if (present[i] && wanted(i))
+                ret.push_back(handles[i]);
+        return ret;
+    };
+    auto same = [](Handles* found, Handles expected) {
+        sort(found->begin(), found->end());
+        sort(expected.begin(), expected.end());
+        bool ret = *found == expected;
+        delete found;
+        return ret;
+    };
+    auto check = [&]() {
+        ValueDict key, min, max;
+        key["grp"] = Value(5);
+        bool ok = same(grps->lookup(&key), expect([](int i) { return i % 37 == 5; }));
+        key["id"] = Value(2999);
+        ok = ok && same(ids->lookup(&key), expect([](int i) { return i == 2999; }));
+        min["id"] = Value(950);
+        max["id"] = Value(3100);
+        ok = ok && same(ids->range(&min, &max), expect([](int i) { return i >= 950 && i <= 3100; }));
+        ok = ok && same(grps->range(nullptr, nullptr), expect([](int i) { return true; }));
+        return ok;
+    };
+
+    //t1 probes see the build, the runs and whatever is still buffered
+    bool result = check();
+    cout << (result ? "passed t1" : "failed t1") << endl;
+
+    //t2 deletes shadow entries in older runs, before and after a flush
+    for (int i = 0; i < 4000; i += 3) {
+        ids->del(handles[i]);
+        grps->del(handles[i]);
+        present[i] = false;
+    }
+    result = result && check();
+    ids->flush();
+    grps->flush();
+    result = result && check();
+    ValueDicts keys;
+    for (int i = 36; i >= -1; i -= 4) {
+        keys.push_back(new ValueDict());
+        (*keys.back())["grp"] = Value(i);
+    }
+    HandlesList* found = grps->lookup_many(keys);
+    for (size_t i = 0; i < keys.size(); i++) {
+        result = result && same(grps->lookup(keys[i]), *found->at(i));
+        delete found->at(i);
+        delete keys[i];
+    }
+    delete found;
+    cout << (result ? "passed t2" : "failed t2") << endl;
+
+    //t3 a flushed index is reopened from its runs (so the deleted rows stay gone); one changed since
+    // its last flush is rebuilt from the relation
+    delete ids;
+    ids = new LsmIndex(table, "test_lsm_id", id_key, false);
+    result = result && check();
+    grps->insert(handles[0]);
+    delete grps;
+    grps = new LsmIndex(table, "test_lsm_grp", grp_key, false);
+    ValueDict key;
+    key["grp"] = Value(0);
+    present.assign(4000, true);
+    result = result && same(grps->lookup(&key), expect([](int i) { return i % 37 == 0; }));
+    cout << (result ? "passed t3" : "failed t3") << endl;
+
+    ids->drop();
+    grps->drop();
+    delete ids;
+    delete grps;
+    table.drop();
+    return result;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include "LsmRun.h"
+
+/**
+ * @class LsmIndex - write-optimized index: inserts and deletes go to memory, and are written out in batches
+ *
+ * Changes land in a sorted in-memory memtable, so an insert costs a key projection and a map insert
+ * rather than a root-to-leaf descent and a page rewrite. A full memtable is frozen and handed to a
+ * background merger thread, which writes it out as a sorted run, and once there are more than MAX_RUNS
+ * runs merges them all into one (dropping deleted entries). A probe merges the memtable, the frozen
+ * memtables and the runs, newest first, so the newest insert or delete of an entry wins. The merger
+ * only writes runs alongside probes when the environment was opened with DB_INIT_CDB or DB_INIT_LOCK;
+ * in any other environment probes and inserts wait for it instead.
+ *
+ * Block 1 of the index file is the directory: a clean flag, the head of the list of free pages, and each
+ * run's first page, page count and entry count. The directory is marked dirty by the first change after
+ * flush(); opening a dirty index rebuilds it from the relation, since anything still in memory was lost.
+ */
+class LsmIndex : public DbIndex {
+public:
+    LsmIndex(DbRelation& relation, Identifier name, ColumnNames key_columns, bool unique);
+    virtual ~LsmIndex();  // stops the merger but does not flush
+
+    virtual void create();
+    virtual void drop();
+
+    virtual void open();
+    virtual void close();
+
+    virtual Handles* lookup(ValueDict* key) const;
+    virtual Handles* range(ValueDict* min_key, ValueDict* max_key) const;
+    virtual bool has_range() const { return true; }
+    virtual bool range_in_order() const { return true; }
+    virtual HandlesList* lookup_many(const ValueDicts& keys) const;  // one forward pass over each run
+
+    virtual void insert(Handle handle);
+    virtual void del(Handle handle);
+
+    void flush();  // write out everything in memory and wait for the merger to catch up
+
+    static const uint DEFAULT_MEMTABLE_ENTRIES = 4096;
+    static const uint MAX_RUNS = 4;
+    static const uint MAX_FROZEN = 2;  // inserts wait for the merger beyond this
+    void set_memtable_entries(uint memtable_entries) { this->memtable_entries = memtable_entries; }
+
+protected:
+    static const BlockID DIRECTORY = 1;
+    static const uint MAX_KEY_SIZE = DbBlock::BLOCK_SZ / 4;
+
+    mutable bool closed;
+    mutable bool clean;  // the directory's runs hold every entry
+    mutable HeapFile file;
+    KeyProfile key_profile;
+    uint memtable_entries;
+    mutable LsmMemtable* memtable;
+    mutable std::deque<LsmMemtable*> frozen;  // oldest first
+    mutable std::vector<LsmRun> runs;  // oldest first
+    mutable BlockID free_head;
+    mutable std::mutex mutex;  // guards everything above but free_head
+    mutable std::mutex free_mutex;  // guards free_head, so the merger can allocate pages without mutex
+    mutable std::condition_variable work;  // wakes the merger
+    mutable std::condition_variable done;  // wakes threads waiting on the merger
+    mutable std::thread merger;
+    mutable bool stopping;
+    mutable bool busy;
+    mutable bool concurrent;  // the environment lets the merger write the file while probes read it
+    mutable std::exception_ptr error;  // what stopped the merger, if anything
+
+    void open_if_closed() const;
+    void load_directory() const;
+    void save_directory() const;
+    void rebuild() const;
+    void start_merger() const;
+    void stop_merger() const;
+    void merge_loop();
+    void flush(std::unique_lock<std::mutex>& lock);
+    void add(const LsmEntryKey& entry, bool live, std::unique_lock<std::mutex>& lock);
+    Handles* scan(const NormalizedKey* min, const NormalizedKey* max) const;
+    LsmRun write_run(const LsmMemtable& table) const;
+    LsmRun merge_runs(const std::vector<LsmRun>& merging) const;
+    SlottedPage* allocate() const;
+    void free_page(BlockID block_id) const;
+    NormalizedKey normalized_key(const ValueDict* key) const;
+    NormalizedKey row_key(Handle handle) const;
+};
+
+bool test_lsm_index();
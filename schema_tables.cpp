@@ -3,9 +3,15 @@
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
  */
+#include <regex>
 #include "schema_tables.h"
 #include "ParseTreeToString.h"
 #include "btree.h"
+#include "hash_index.h"
+#include "bitmap_index.h"
+#include "art_index.h"
+#include "lsm_index.h"
+#include "learned_index.h"
 
 
 void initialize_schema_tables() {
@@ -18,6 +24,12 @@ void initialize_schema_tables() {
 	Indices indices;
 	indices.create_if_not_exists();
 	indices.close();
+	Statistics statistics;
+	statistics.create_if_not_exists();
+	statistics.close();
+	Histograms histograms;
+	histograms.create_if_not_exists();
+	histograms.close();
 }
 
 // Not terribly useful since the parser weeds most of these out
@@ -86,6 +98,10 @@ void Tables::create() {
     insert(&row);
 	row["table_name"] = Value("_indices");
 	insert(&row);
+	row["table_name"] = Value("_statistics");
+	insert(&row);
+	row["table_name"] = Value("_histograms");
+	insert(&row);
 }
 
 // Manually check that table_name is unique.
@@ -226,6 +242,40 @@ void Columns::create() {
     row["column_name"] = Value("is_unique");
     row["data_type"] = Value("BOOLEAN");
     insert(&row); 
+    row["column_name"] = Value("filter");
+    row["data_type"] = Value("TEXT");
+    insert(&row);
+
+    row["table_name"] = Value("_statistics");
+    row["column_name"] = Value("table_name");
+    insert(&row);
+    row["column_name"] = Value("row_count");
+    row["data_type"] = Value("INT");
+    insert(&row);
+    row["column_name"] = Value("page_count");
+    insert(&row);
+
+    row["table_name"] = Value("_histograms");
+    row["column_name"] = Value("table_name");
+    row["data_type"] = Value("TEXT");
+    insert(&row);
+    row["column_name"] = Value("column_name");
+    insert(&row);
+    row["column_name"] = Value("data_type");
+    insert(&row);
+    row["column_name"] = Value("bucket");
+    row["data_type"] = Value("INT");
+    insert(&row);
+    row["column_name"] = Value("low");
+    row["data_type"] = Value("TEXT");
+    insert(&row);
+    row["column_name"] = Value("high");
+    insert(&row);
+    row["column_name"] = Value("row_count");
+    row["data_type"] = Value("INT");
+    insert(&row);
+    row["column_name"] = Value("distinct_count");
+    insert(&row);
 }
 
 // Manually check that (table_name, column_name) is unique.
@@ -271,6 +321,7 @@ ColumnNames& Indices::COLUMN_NAMES() {
         cn.push_back("column_name");
         cn.push_back("index_type");
         cn.push_back("is_unique");
+        cn.push_back("filter");
     }
     return cn;
 }
@@ -289,6 +340,8 @@ ColumnAttributes& Indices::COLUMN_ATTRIBUTES() {
         cas.push_back(ca);  // index_type
         ca.set_data_type(ColumnAttribute::BOOLEAN);
         cas.push_back(ca);  // is_unique
+        ca.set_data_type(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // filter
     }
     return cas;
 }
@@ -309,7 +362,7 @@ Handle Indices::insert(const ValueDict* row) {
     ValueDict where;
     where["table_name"] = row->at("table_name");
     where["index_name"] = row->at("index_name");
-    if (row->at("seq_in_index").n > 1)
+    if (row->at("seq_in_index").n != 1)
         where["column_name"] = row->at("column_name");  // check for duplicate columns on the same index
     Handles* handles = select(&where);
     bool unique = handles->empty();
@@ -337,7 +390,8 @@ void Indices::del(Handle handle) {
 
 // Return a list of column names and column attributes for given table.
 void Indices::get_columns(Identifier table_name, Identifier index_name,
-                          ColumnNames &column_names, bool &is_hash, bool &is_unique) {
+                          ColumnNames &column_names, bool &is_hash, bool &is_unique,
+                          ColumnNames *include_columns, Identifier *index_type, ValueDict *filter) {
     // SELECT * FROM _indices WHERE table_name = <table_name> AND index_name = <index_name>
     ValueDict where;
     where["table_name"] = table_name;
@@ -345,38 +399,42 @@ void Indices::get_columns(Identifier table_name, Identifier index_name,
     Handles* handles = select(&where);
 
     Identifier colnames[DbIndex::MAX_COMPOSITE];
-    uint size = 0;
+    Identifier include_colnames[DbIndex::MAX_COMPOSITE];
+    uint size = 0, include_size = 0;
     for (auto const& handle: *handles) {
         ValueDict *row = project(handle);
 
         Identifier column_name = (*row)["column_name"].s;
-        uint which = (uint) (*row)["seq_in_index"].n;
+        int seq = (*row)["seq_in_index"].n;
+        if (seq < 0) {
+            // INCLUDE column
+            uint which = (uint) -seq;
+            include_colnames[which - 1] = column_name;
+            if (which > include_size)
+                include_size = which;
+            delete row;
+            continue;
+        }
+        uint which = (uint) seq;
         colnames[which - 1] = column_name;  // seq_in_index is 1-based
         if (which > size)
             size = which;
         is_unique = (*row)["is_unique"].n != 0;
         is_hash = (*row)["index_type"].s == "HASH";
+        if (index_type != nullptr)
+            *index_type = (*row)["index_type"].s;
+        if (filter != nullptr)
+            *filter = parse_filter((*row)["filter"].s);
         delete row;
     }
     for (uint i = 0; i < size; i++)
         column_names.push_back(colnames[i]);
+    if (include_columns != nullptr)
+        for (uint i = 0; i < include_size; i++)
+            include_columns->push_back(include_colnames[i]);
     delete handles;
 }
 
-// FIXME - use this for now until we have BTreeIndex and HashIndex
-class DummyIndex : public DbIndex {
-public:
-    DummyIndex(DbRelation& rel, Identifier idx, ColumnNames key, bool unq) : DbIndex(rel, idx, key, unq) {}
-    void create() {}
-    void drop() {}
-    void open() {}
-    void close() {}
-    Handles* lookup(ValueDict* key_values) const {return nullptr;}
-    void insert(Handle handle) {}
-    void del(Handle handle) {}
-};
-
-
 // Return a table for given table_name.
 DbIndex& Indices::get_index(Identifier table_name, Identifier index_name) {
     // if they are asking about an index we've once constructed, then just return that one
@@ -384,16 +442,26 @@ DbIndex& Indices::get_index(Identifier table_name, Identifier index_name) {
     if (Indices::index_cache.find(cache_key) != Indices::index_cache.end())
         return  *Indices::index_cache[cache_key];
 
-    // otherwise assume it is a DummyIndex (for now)
-    ColumnNames column_names;
+    // otherwise construct it from its rows in _indices
+    ColumnNames column_names, include_columns;
+    Identifier index_type;
+    ValueDict filter;
     bool is_hash, is_unique;
-    get_columns(table_name, index_name, column_names, is_hash, is_unique);
+    get_columns(table_name, index_name, column_names, is_hash, is_unique, &include_columns, &index_type, &filter);
     DbRelation& table = Tables::get_table(table_name);
     DbIndex* index;
     if (is_hash) {
-        index = new DummyIndex(table, index_name, column_names, is_unique);  // FIXME - change to HashIndex
+        index = new HashIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "BITMAP") {
+        index = new BitmapIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "ART") {
+        index = new ArtIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "LSM") {
+        index = new LsmIndex(table, index_name, column_names, is_unique);
+    } else if (index_type == "LEARNED") {
+        index = new LearnedIndex(table, index_name, column_names, is_unique);
     } else {
-        index = new BTreeIndex(table, index_name, column_names, is_unique);
+        index = new BTreeIndex(table, index_name, column_names, is_unique, include_columns, filter);
     }
     Indices::index_cache[cache_key] = index;
     return *index;
@@ -414,3 +482,225 @@ IndexNames Indices::get_index_names(Identifier table_name) {
     return ret;
 }
 
+// Split the predicate at each AND and read each piece as column = literal.
+ValueDict Indices::parse_filter(const std::string &text) {
+    static const std::regex conjunct("\\band\\b");
+    static const std::regex equality("^\\s*([a-z_][a-z0-9_]*)\\s*=\\s*(?:(-?[0-9]+)|'([^']*)')\\s*$");
+    ValueDict filter;
+    if (std::regex_match(text, std::regex("\\s*")))
+        return filter;
+    for (std::sregex_token_iterator it(text.begin(), text.end(), conjunct, -1), end; it != end; ++it) {
+        std::string term = it->str();
+        std::smatch match;
+        if (!std::regex_match(term, match, equality))
+            throw DbRelationError("index predicate must be column = literal [AND ...], not '" + term + "'");
+        if (filter.find(match[1].str()) != filter.end())
+            throw DbRelationError("column '" + match[1].str() + "' is in the index predicate twice");
+        if (match[2].matched)
+            filter[match[1].str()] = Value((int32_t) std::stol(match[2].str()));
+        else
+            filter[match[1].str()] = Value(match[3].str());
+    }
+    return filter;
+}
+
+std::string Indices::filter_text(const ValueDict &filter) {
+    std::string text;
+    for (auto const& column: filter) {
+        if (!text.empty())
+            text += " and ";
+        text += column.first + " = ";
+        if (column.second.data_type == ColumnAttribute::TEXT)
+            text += "'" + column.second.s + "'";
+        else
+            text += std::to_string(column.second.n);
+    }
+    return text;
+}
+
+
+
+/*
+ * *******************************
+ * Histograms class implementation
+ * *******************************
+ */
+const Identifier Histograms::TABLE_NAME = "_histograms";
+
+// get the column name for _histograms column
+ColumnNames& Histograms::COLUMN_NAMES() {
+    static ColumnNames cn;
+    if (cn.empty()) {
+        cn.push_back("table_name");
+        cn.push_back("column_name");
+        cn.push_back("data_type");
+        cn.push_back("bucket");
+        cn.push_back("low");
+        cn.push_back("high");
+        cn.push_back("row_count");
+        cn.push_back("distinct_count");
+    }
+    return cn;
+}
+
+// get the column attribute for _histograms column
+ColumnAttributes& Histograms::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes cas;
+    if (cas.empty()) {
+        ColumnAttribute ca(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // table_name
+        cas.push_back(ca);  // column_name
+        cas.push_back(ca);  // data_type
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // bucket
+        ca.set_data_type(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // low
+        cas.push_back(ca);  // high
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // row_count
+        cas.push_back(ca);  // distinct_count
+    }
+    return cas;
+}
+
+// ctor - we have a fixed table structure
+Histograms::Histograms() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+}
+
+
+/*
+ * *******************************
+ * Statistics class implementation
+ * *******************************
+ */
+const Identifier Statistics::TABLE_NAME = "_statistics";
+Histograms* Statistics::histograms_table = nullptr;
+std::map<Identifier,TableStats> Statistics::stats_cache;
+
+// get the column name for _statistics column
+ColumnNames& Statistics::COLUMN_NAMES() {
+    static ColumnNames cn;
+    if (cn.empty()) {
+        cn.push_back("table_name");
+        cn.push_back("row_count");
+        cn.push_back("page_count");
+    }
+    return cn;
+}
+
+// get the column attribute for _statistics column
+ColumnAttributes& Statistics::COLUMN_ATTRIBUTES() {
+    static ColumnAttributes cas;
+    if (cas.empty()) {
+        ColumnAttribute ca(ColumnAttribute::TEXT);
+        cas.push_back(ca);  // table_name
+        ca.set_data_type(ColumnAttribute::INT);
+        cas.push_back(ca);  // row_count
+        cas.push_back(ca);  // page_count
+    }
+    return cas;
+}
+
+// ctor - we have a fixed table structure
+Statistics::Statistics() : HeapTable(TABLE_NAME, COLUMN_NAMES(), COLUMN_ATTRIBUTES()) {
+    if (Statistics::histograms_table == nullptr)
+        histograms_table = new Histograms();
+}
+
+// Read the table's row from _statistics and its buckets from _histograms (just once; set_stats and
+// drop_stats keep the cache right after that).
+TableStats Statistics::get_stats(Identifier table_name) {
+    if (Statistics::stats_cache.find(table_name) != Statistics::stats_cache.end())
+        return Statistics::stats_cache.at(table_name);
+
+    TableStats stats;
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles* handles = select(&where);
+    for (auto const& handle: *handles) {
+        ValueDict* row = project(handle);
+        stats.known = true;
+        stats.rows = (uint64_t) (*row)["row_count"].n;
+        stats.pages = (uint64_t) (*row)["page_count"].n;
+        delete row;
+    }
+    delete handles;
+
+    if (stats.known) {
+        handles = Statistics::histograms_table->select(&where);
+        std::map<Identifier, std::map<int, HistogramBucket>> buckets;
+        for (auto const& handle: *handles) {
+            ValueDict* row = Statistics::histograms_table->project(handle);
+            const std::string& data_type = (*row)["data_type"].s;
+            Value low, high;
+            if (data_type == "TEXT") {
+                low = Value((*row)["low"].s);
+                high = Value((*row)["high"].s);
+            } else {
+                low = Value((int32_t) std::stol((*row)["low"].s));
+                high = Value((int32_t) std::stol((*row)["high"].s));
+                if (data_type == "BOOLEAN")
+                    low.data_type = high.data_type = ColumnAttribute::BOOLEAN;
+            }
+            buckets[(*row)["column_name"].s][(*row)["bucket"].n] = HistogramBucket(low, high,
+                    (uint64_t) (*row)["row_count"].n, (uint64_t) (*row)["distinct_count"].n);
+            delete row;
+        }
+        delete handles;
+        for (auto const& column: buckets) {
+            ColumnStats& column_stats = stats.columns[column.first];
+            for (auto const& bucket: column.second) {
+                column_stats.buckets.push_back(bucket.second);
+                column_stats.distinct += bucket.second.distinct;
+            }
+        }
+    }
+    Statistics::stats_cache[table_name] = stats;
+    return stats;
+}
+
+void Statistics::set_stats(Identifier table_name, const TableStats &stats) {
+    drop_stats(table_name);
+    ValueDict row;
+    row["table_name"] = Value(table_name);
+    row["row_count"] = Value((int32_t) stats.rows);
+    row["page_count"] = Value((int32_t) stats.pages);
+    insert(&row);
+
+    for (auto const& column: stats.columns) {
+        int bucket_number = 1;
+        for (auto const& bucket: column.second.buckets) {
+            ValueDict bucket_row;
+            bucket_row["table_name"] = Value(table_name);
+            bucket_row["column_name"] = Value(column.first);
+            if (bucket.low.data_type == ColumnAttribute::TEXT) {
+                bucket_row["data_type"] = Value("TEXT");
+                bucket_row["low"] = Value(bucket.low.s);
+                bucket_row["high"] = Value(bucket.high.s);
+            } else {
+                bucket_row["data_type"] = Value(bucket.low.data_type == ColumnAttribute::BOOLEAN ? "BOOLEAN" : "INT");
+                bucket_row["low"] = Value(std::to_string(bucket.low.n));
+                bucket_row["high"] = Value(std::to_string(bucket.high.n));
+            }
+            bucket_row["bucket"] = Value(bucket_number++);
+            bucket_row["row_count"] = Value((int32_t) bucket.rows);
+            bucket_row["distinct_count"] = Value((int32_t) bucket.distinct);
+            Statistics::histograms_table->insert(&bucket_row);
+        }
+    }
+    Statistics::stats_cache[table_name] = stats;
+}
+
+void Statistics::drop_stats(Identifier table_name) {
+    ValueDict where;
+    where["table_name"] = Value(table_name);
+    Handles* handles = select(&where);
+    for (auto const& handle: *handles)
+        del(handle);
+    delete handles;
+    handles = Statistics::histograms_table->select(&where);
+    for (auto const& handle: *handles)
+        Statistics::histograms_table->del(handle);
+    delete handles;
+    Statistics::stats_cache.erase(table_name);
+}
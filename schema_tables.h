@@ -2,12 +2,16 @@
  * @file schema_tables.h - schema table classes:
  * 		Columns
  * 		Tables
+ * 		Indices
+ * 		Statistics
+ * 		Histograms
  * @author Kevin Lundeen
  * @see "Seattle University, CPSC5300, Summer 2018"
  */
 #pragma once
 
 #include "heap_storage.h"
+#include "TableStats.h"
 
 /**
  * Initialize access to the schema tables.
@@ -97,6 +101,12 @@ protected:
 
 typedef ColumnNames IndexNames;
 
+/**
+ * @class Indices - The singleton table that stores the metadata for all indices.
+ * One row per key column, numbered from 1 by seq_in_index. A covering index's INCLUDE
+ * columns get rows too, numbered -1, -2, ... A partial index has its WHERE predicate in
+ * the filter column of each row (empty for an index of every row).
+ */
 class Indices : public HeapTable {
 public:
 	/**
@@ -117,9 +127,16 @@ public:
 	 * @param is_hash         returned by reference: set to False if the
 	 *                        requested index is a btree index
 	 * @param is_unique       search key for this index is a key for the relation
+	 * @param include_columns if not null, returned by reference: list of INCLUDE
+	 *                        column names in order
+	 * @param index_type      if not null, returned by reference: BTREE, HASH or BITMAP
+	 * @param filter          if not null, returned by reference: the partial index's
+	 *                        WHERE predicate (empty if it indexes every row)
 	 */ 
 	virtual void get_columns(Identifier table_name, Identifier index_name,
-                             ColumnNames &column_names, bool &is_hash, bool &is_unique);
+                             ColumnNames &column_names, bool &is_hash, bool &is_unique,
+                             ColumnNames *include_columns=nullptr, Identifier *index_type=nullptr,
+                             ValueDict *filter=nullptr);
 
 	/**
 	 * Get the instantiated DbIndex for the given index.
@@ -136,6 +153,21 @@ public:
 	 */
 	virtual IndexNames get_index_names(Identifier table_name);
 
+	/**
+	 * Read a partial index's WHERE predicate: equalities of columns to literals joined by AND,
+	 * e.g., "status = 'open' and region = 3".
+	 * @param text  the predicate, lower-cased (empty for none)
+	 * @returns     column = value for each equality
+	 */
+	static ValueDict parse_filter(const std::string &text);
+
+	/**
+	 * The inverse of parse_filter, as stored in _indices.
+	 * @param filter  column = value for each equality
+	 * @returns       the predicate text
+	 */
+	static std::string filter_text(const ValueDict &filter);
+
 	// overrides
 	virtual Handle insert(const ValueDict* row);
 	virtual void del(Handle handle);
@@ -148,3 +180,73 @@ private:
 	static std::map<std::pair<Identifier,Identifier>,DbIndex*> index_cache;
 };
 
+
+
+/**
+ * @class Histograms - The singleton table that stores the histogram buckets ANALYZE builds.
+ * One row per bucket, numbered from 1 by bucket in each column. The bounds are stored as text,
+ * along with the column's data type to read them back as.
+ */
+class Histograms : public HeapTable {
+public:
+	/**
+	 * Name of the histograms table ("_histograms")
+	 */
+	static const Identifier TABLE_NAME;
+
+	// ctor/dtor
+	Histograms();
+	virtual ~Histograms() {}
+
+protected:
+	static ColumnNames& COLUMN_NAMES();
+	static ColumnAttributes& COLUMN_ATTRIBUTES();
+
+};
+
+/**
+ * @class Statistics - The singleton table that stores each analyzed table's row and page counts
+ * (its columns' histograms are in _histograms). A table that was never analyzed has no row.
+ */
+class Statistics : public HeapTable {
+public:
+	/**
+	 * Name of the statistics table ("_statistics")
+	 */
+	static const Identifier TABLE_NAME;
+
+	// ctor/dtor
+	Statistics();
+	virtual ~Statistics() {}
+
+	/**
+	 * Get the statistics of a table, as of its last ANALYZE.
+	 * @param table_name  table to get statistics for
+	 * @returns           its statistics (not known if it was never analyzed)
+	 */
+	virtual TableStats get_stats(Identifier table_name);
+
+	/**
+	 * Replace the statistics of a table.
+	 * @param table_name  table the statistics are for
+	 * @param stats       the new statistics
+	 */
+	virtual void set_stats(Identifier table_name, const TableStats &stats);
+
+	/**
+	 * Forget the statistics of a table (when it is dropped).
+	 * @param table_name  table to forget
+	 */
+	virtual void drop_stats(Identifier table_name);
+
+protected:
+	static ColumnNames& COLUMN_NAMES();
+	static ColumnAttributes& COLUMN_ATTRIBUTES();
+
+	// keep a reference to the histograms table
+	static Histograms* histograms_table;
+
+private:
+	// keep a cache of the statistics we've read so far
+	static std::map<Identifier,TableStats> stats_cache;
+};
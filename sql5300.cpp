@@ -4,10 +4,16 @@
  */
 #include <iostream>
 #include <algorithm>
+#include <regex>
 #include "db_cxx.h"
 #include "ParseTreeToString.h"
 #include "SQLExec.h"
 #include "btree.h"
+#include "hash_index.h"
+#include "bitmap_index.h"
+#include "art_index.h"
+#include "lsm_index.h"
+#include "learned_index.h"
 using namespace std;
 using namespace hsql;
 
@@ -40,7 +46,9 @@ int main(int argc, char *argv[])
 	env->set_message_stream(&std::cout);
 	env->set_error_stream(&std::cerr);
    try {
-	   env->open(real_path, DB_CREATE | DB_INIT_MPOOL, 0);
+	   // Concurrent Data Store, free-threaded: index builds and background merges write while other
+	   // threads read (a plain Data Store allows no writer alongside a reader)
+	   env->open(real_path, DB_CREATE | DB_INIT_CDB | DB_INIT_MPOOL | DB_THREAD, 0);
    } catch (DbException &exe) {
       cerr << "(sql5300: " << exe.what() << ")" << endl;
       return 1;
@@ -96,10 +104,37 @@ int main(int argc, char *argv[])
 			cout << "test_heap_storage: " << (test_heap_storage() ? "ok" : "failed") << endl;
 			cout<<"TEST BTREE LINE_____"<< endl;
 			cout << "test_btree: "<<(test_btree() ? "ok" : "failed") << endl;
+			cout << "test_hash_index: " << (test_hash_index() ? "ok" : "failed") << endl;
+			cout << "test_bitmap_index: " << (test_bitmap_index() ? "ok" : "failed") << endl;
+			cout << "test_art_index: " << (test_art_index() ? "ok" : "failed") << endl;
+			cout << "test_lsm_index: " << (test_lsm_index() ? "ok" : "failed") << endl;
+			cout << "test_learned_index: " << (test_learned_index() ? "ok" : "failed") << endl;
+			cout << "test_table_stats: " << (test_table_stats() ? "ok" : "failed") << endl;
+			cout << "test_eval: " << (test_eval() ? "ok" : "failed") << endl;
+			cout << "test_hash_join: " << (test_hash_join() ? "ok" : "failed") << endl;
+			cout << "test_index_join: " << (test_index_join() ? "ok" : "failed") << endl;
+			cout << "test_sort: " << (test_sort() ? "ok" : "failed") << endl;
+			cout << "test_merge_join: " << (test_merge_join() ? "ok" : "failed") << endl;
+			cout << "test_hash_aggregate: " << (test_hash_aggregate() ? "ok" : "failed") << endl;
+			cout << "test_index_types: " << (test_index_types() ? "ok" : "failed") << endl;
+			continue;
+		}
+		std::smatch analyze_match;
+		if (std::regex_match(query, analyze_match, std::regex("\\s*analyze\\s+([a-z_][a-z0-9_]*)\\s*;?\\s*"))) {
+			// not a statement the parser knows
+			try {
+				QueryResult *result = SQLExec::analyze(analyze_match[1]);
+				cout << *result << endl;
+				delete result;
+			} catch (SQLExecError& e) {
+				cout << "Error: " << e.what() << endl;
+			}
 			continue;
 		}
 		else
 		{
+			IndexOptions index_options;
+			query = SQLExec::parse_index_options(query, index_options);
 			hsql::SQLParserResult* parseResult = hsql::SQLParser::parseSQLString(query);
 	      std::string message;
 	      if (parseResult->isValid())
@@ -107,7 +142,7 @@ int main(int argc, char *argv[])
             for (uint i = 0; i < parseResult->size(); i++) {
                try {
                   cout << ParseTreeToString::statement(parseResult->getStatement(i)) << endl;
-                  QueryResult *result = SQLExec::execute(parseResult->getStatement(i));
+                  QueryResult *result = SQLExec::execute(parseResult->getStatement(i), &index_options);
                   cout << *result << endl;
                   delete result;
                } catch (SQLExecError& e) {
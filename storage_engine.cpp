@@ -4,9 +4,9 @@
 bool Value::operator==(const Value &other) const {
     if (this->data_type != other.data_type)
         return false;
-    if (this->data_type == ColumnAttribute::INT)
-        return this->n == other.n;
-    return this->s == other.s;
+    if (this->data_type == ColumnAttribute::TEXT)
+        return this->s == other.s;
+    return this->n == other.n;
 }
 
 bool Value::operator!=(const Value &other) const {
@@ -31,6 +31,13 @@ bool Value::operator<(const Value &other) const {
     return this->n < other.n;
 }
 
+Handles* DbRelation::select(const ValueDict* where, size_t limit) {
+    Handles* handles = select(where);
+    if (handles->size() > limit)
+        handles->resize(limit);
+    return handles;
+}
+
 // Get only selected column attributes
 ColumnAttributes* DbRelation::get_column_attributes(const ColumnNames &select_column_names) const {
     ColumnAttributes *ret = new ColumnAttributes();
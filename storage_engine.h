@@ -245,6 +245,7 @@ typedef std::pair<BlockID, RecordID> Handle;
 typedef std::vector<Handle> Handles;  // FIXME: will need to turn this into an iterator at some point
 typedef std::map<Identifier, Value> ValueDict;
 typedef std::vector<ValueDict*> ValueDicts;
+typedef std::vector<Handles*> HandlesList;
 
 
 /**
@@ -348,6 +349,16 @@ public:
 	 */
 	virtual Handles* select(const ValueDict* where) = 0;
 
+	/**
+	 * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where> LIMIT <limit>
+	 * A relation that can stop its scan once it has found limit rows should; by default this is
+	 * select(where) cut short.
+	 * @param where  where-clause predicates (nullptr for all rows)
+	 * @param limit  most handles wanted
+	 * @returns      a pointer to a list of the first handles of qualifying rows (freed by caller)
+	 */
+	virtual Handles* select(const ValueDict* where, size_t limit);
+
 	/**
 	 * Conceptually, execute: SELECT <handle> FROM <table_name> WHERE <where>
 	 * This version does a restricted selection based on current_selection.
@@ -426,6 +437,24 @@ protected:
 	ColumnAttributes column_attributes;
 };
 
+/**
+ * @class IndexStats - the size and shape of an index, for SHOW INDEX and the optimizer
+ */
+class IndexStats {
+public:
+    IndexStats() : known(false), entries(0), leaf_pages(0), interior_pages(0), fill(0.0), distinct(),
+                   leaf_splits(0), interior_splits(0) {}
+
+    bool known;  // false if the index keeps no statistics (the rest are then all zero)
+    uint64_t entries;
+    uint64_t leaf_pages;  // pages holding entries
+    uint64_t interior_pages;  // pages only there to find the entries
+    double fill;  // average fraction of a leaf page in use
+    std::vector<uint64_t> distinct;  // distinct values of the first 1, 2, ... key columns
+    uint64_t leaf_splits;
+    uint64_t interior_splits;
+};
+
 class DbIndex {
 public:
 	/**
@@ -475,6 +504,66 @@ public:
         throw DbRelationError("range index query not supported");
     }
 
+	/**
+	 * Does range() work on this index? (Indices that keep no key order can't do it.)
+	 * @returns  true if range queries are supported
+	 */
+    virtual bool has_range() const {
+        return false;
+    }
+
+	/**
+	 * Does range() hand back the handles in key order (rather than, say, in handle order)? If so, a
+	 * range scan is a way to read the relation sorted on the key.
+	 * @returns  true if range results come in key order
+	 */
+    virtual bool range_in_order() const {
+        return false;
+    }
+
+	/**
+	 * Lookup several search keys at once. Indices that can share work between the keys (say, by
+	 * probing them in key order) override this; by default each key is looked up in turn.
+	 * @param keys  dictionaries of values for the search keys
+	 * @returns     one list of DbFile handles per key, in the order of keys (each freed by caller)
+	 */
+    virtual HandlesList* lookup_many(const ValueDicts& keys) const {
+        HandlesList* ret = new HandlesList();
+        for (auto const key: keys)
+            ret->push_back(lookup(key));
+        return ret;
+    }
+
+	/**
+	 * Does the selection imply the index's predicate, so that the index holds every row the selection
+	 * can match? Only a partial index can say no.
+	 * @param conjunction  column = value for each equality the selection requires
+	 * @returns            true if the index can be used to answer the selection
+	 */
+    virtual bool implied_by(const ValueDict& conjunction) const {
+        return true;
+    }
+
+	/**
+	 * Does the index hold all of the given columns (as key or included columns)? If so,
+	 * lookup_values can answer for them without going to the relation.
+	 * @param column_names  columns a query needs
+	 * @returns             true if they can all be read from the index
+	 */
+    virtual bool covers(const ColumnNames& column_names) const {
+        return false;
+    }
+
+	/**
+	 * Lookup a specific search key, reading the values from the index itself (index-only).
+	 * @param key_values    dictionary of values for the search key
+	 * @param column_names  columns to get (the index must cover them)
+	 * @returns             values of column_names for each record with key_values
+	 */
+    virtual ValueDicts* lookup_values(ValueDict* key_values, const ColumnNames* column_names) const {
+        throw DbRelationError("index-only lookup not supported");
+    }
+
 	/**
 	 * Insert the index entry for the given record.
 	 * @param record  handle (into relation) to the record to insert
@@ -489,6 +578,27 @@ public:
 	 */
     virtual void del(Handle record) = 0;
 
+	/**
+	 * The index's statistics, as kept up to date by its inserts.
+	 * @returns  the statistics (known is false if the index keeps none)
+	 */
+    virtual IndexStats get_stats() const {
+        return IndexStats();
+    }
+
+	/**
+	 * Recount the index's statistics from its contents.
+	 */
+    virtual void analyze() {}
+
+	/**
+	 * Accessor for key_columns.
+	 * @returns  the columns of the search key, in order
+	 */
+    virtual const ColumnNames& get_key_columns() const {
+        return key_columns;
+    }
+
 protected:
     DbRelation& relation;
     Identifier name;